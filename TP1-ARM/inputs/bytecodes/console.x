@@ -0,0 +1,9 @@
+d2840001
+d370bc21
+d2800902
+f8000022
+d2800d22
+38000022
+d2800142
+f8000022
+d4400000
\ No newline at end of file
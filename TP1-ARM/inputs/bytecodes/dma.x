@@ -0,0 +1,25 @@
+d2840001
+d370bc21
+d2820009
+ab090021
+d2820002
+d370bc42
+d2824683
+f8000043
+d2820024
+d370bc84
+f8000022
+f8008024
+d2800105
+f8010025
+d2800065
+f801c025
+f8014025
+f8400086
+f8418027
+b1000000
+b1000000
+b1000000
+f8400088
+f8418029
+d4400000
\ No newline at end of file
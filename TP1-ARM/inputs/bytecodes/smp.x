@@ -0,0 +1,19 @@
+d2820001
+d370bc21
+d2800022
+d2807d03
+f8220024
+f1000463
+54ffffc1
+91002025
+c85f7ca6
+910004c6
+c8077ca6
+b4000047
+17fffffc
+d5033bbf
+d28000a8
+91004029
+c8a87d22
+f822812a
+d4400000
\ No newline at end of file
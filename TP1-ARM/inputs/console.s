@@ -0,0 +1,10 @@
+.text
+    movz X1, 0x2000
+    lsl X1, X1, 16
+    movz X2, 72
+    stur X2, [X1, 0]
+    movz X2, 105
+    sturb W2, [X1, 0]
+    movz X2, 10
+    stur X2, [X1, 0]
+    HLT 0
@@ -0,0 +1,26 @@
+.text
+    movz X1, 0x2000
+    lsl X1, X1, 16
+    movz X9, 0x1000
+    adds X1, X1, X9
+    movz X2, 0x1000
+    lsl X2, X2, 16
+    movz X3, 0x1234
+    stur X3, [X2, 0]
+    movz X4, 0x1001
+    lsl X4, X4, 16
+    stur X2, [X1, 0]
+    stur X4, [X1, 8]
+    movz X5, 8
+    stur X5, [X1, 16]
+    movz X5, 3
+    stur X5, [X1, 28]
+    stur X5, [X1, 20]
+    ldur X6, [X4, 0]
+    ldur X7, [X1, 24]
+    adds X0, X0, 0
+    adds X0, X0, 0
+    adds X0, X0, 0
+    ldur X8, [X4, 0]
+    ldur X9, [X1, 24]
+    HLT 0
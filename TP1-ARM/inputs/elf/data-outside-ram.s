@@ -0,0 +1,8 @@
+.text
+mov X1, 0x3000
+lsl X1, X1, 16
+ldur X2, [X1, 0x0]
+HLT 0
+
+.data
+.quad 0x1234
@@ -0,0 +1,23 @@
+.text
+    movz X1, 0x1000
+    lsl X1, X1, 16
+    movz X2, 1
+    movz X3, 1000
+loop:
+    .inst 0xF8220024        // ldadd X2, X4, [X1]
+    subs X3, X3, 1
+    b.ne loop
+    add X5, X1, 8
+retry:
+    ldxr X6, [X5]
+    add X6, X6, 1
+    stxr W7, X6, [X5]
+    cbz X7, done
+    b retry
+done:
+    dmb ish
+    movz X8, 5
+    add X9, X1, 16
+    .inst 0xC8A87D22        // cas X8, X2, [X9]
+    .inst 0xF822812A        // swp X2, X10, [X9]
+    hlt 0
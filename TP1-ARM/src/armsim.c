@@ -0,0 +1,404 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: simulator lifecycle, execution loop and the    */
+/*   public API declared in armsim.h                           */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "engine.h"
+#include "sim.h"
+#include "device.h"
+#include "armsim.h"
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sim_ctx_create                                  */
+/*                                                             */
+/* Purpose   : Allocate a simulator with zeroed memory and     */
+/*             its devices mapped in                           */
+/*                                                             */
+/***************************************************************/
+sim_ctx_t *sim_ctx_create() {
+  sim_ctx_t *ctx = sim_ctx_create_shared(mem_map_create());
+
+  ctx->OWNS_MEM = TRUE;
+  return ctx;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sim_ctx_create_shared                           */
+/*                                                             */
+/* Purpose   : Allocate a simulator (an SMP core) on top of an */
+/*             existing memory map it does not own             */
+/*                                                             */
+/***************************************************************/
+sim_ctx_t *sim_ctx_create_shared(mem_map_t *mem) {
+  sim_ctx_t *ctx = calloc(1, sizeof(sim_ctx_t));
+
+  ctx->MEM = mem;
+  ctx->DEVICE_NEXT_EVENT = DEVICE_NO_EVENT;
+  return ctx;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sim_ctx_destroy                                 */
+/*                                                             */
+/* Purpose   : Free a simulator and, if it owns it, its memory */
+/*                                                             */
+/***************************************************************/
+void sim_ctx_destroy(sim_ctx_t *ctx) {
+  armsim_record_stop(ctx);
+  armsim_trace_detach(ctx);
+  if (ctx->OWNS_MEM)
+    mem_map_destroy(ctx->MEM);
+  if (ctx->IMAGE != NULL)
+    armsim_image_destroy(ctx->IMAGE);
+  symtab_release(ctx->SYMBOLS);
+  free(ctx);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : cycle                                           */
+/*                                                             */
+/* Purpose   : Execute a cycle                                 */
+/*                                                             */
+/***************************************************************/
+void cycle(sim_ctx_t *ctx) {
+
+  if (ctx->UNDO != NULL || ctx->TRACE != NULL) {
+    if (ctx->UNDO != NULL)
+      undo_begin(ctx);
+    if (ctx->TRACE != NULL)
+      trace_begin(ctx);
+    process_instruction(ctx);
+    if (ctx->TRACE != NULL)
+      trace_end(ctx);
+    if (ctx->UNDO != NULL)
+      undo_end(ctx);
+  } else
+    process_instruction(ctx);
+  ctx->CURRENT_STATE = ctx->NEXT_STATE;
+  ctx->INSTRUCTION_COUNT++;
+  if (ctx->INSTRUCTION_COUNT >= ctx->DEVICE_NEXT_EVENT)
+    device_tick_all(ctx);
+}
+
+armsim_t *armsim_create(void) {
+  return sim_ctx_create();
+}
+
+void armsim_destroy(armsim_t *sim) {
+  sim_ctx_destroy(sim);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : load_finish                                     */
+/*                                                             */
+/* Purpose   : Common tail of the loaders: predecode the text, */
+/*             point the PC at the entry, install the symbols  */
+/*             and forget the reset point of the old program   */
+/*                                                             */
+/***************************************************************/
+void load_finish(sim_ctx_t *ctx, uint64_t text, uint32_t nwords, uint64_t entry,
+                 symtab_t *symbols) {
+  predecode(ctx, text, nwords);
+  symtab_release(ctx->SYMBOLS);
+  ctx->SYMBOLS = symbols;
+
+  ctx->CURRENT_STATE.PC = entry;
+  ctx->NEXT_STATE = ctx->CURRENT_STATE;
+  ctx->RUN_BIT = TRUE;
+  if (ctx->INITIAL != NULL)
+    mem_snapshot_drop(ctx, ctx->INITIAL);
+  ctx->INITIAL = NULL;
+  if (ctx->UNDO != NULL)
+    undo_reset(ctx);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_load_buffer                              */
+/*                                                             */
+/* Purpose   : Copy machine words into the text segment and    */
+/*             reset the PC to its start                       */
+/*                                                             */
+/***************************************************************/
+int armsim_load_buffer(armsim_t *sim, const uint32_t *words, size_t nwords) {
+  size_t ii;
+
+  if (nwords > MEM_TEXT_SIZE / 4)
+    return ARMSIM_ERR_RANGE;
+  for (ii = 0; ii < nwords; ii++)
+    mem_write_32(sim, MEM_TEXT_START + 4 * ii, words[ii]);
+  load_finish(sim, MEM_TEXT_START, nwords, MEM_TEXT_START, NULL);
+  return ARMSIM_OK;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_load_file                                */
+/*                                                             */
+/* Purpose   : Load a program, choosing the loader by the     */
+/*             file's magic number or extension                */
+/*                                                             */
+/***************************************************************/
+int armsim_load_file(armsim_t *sim, const char *path, int *nwords) {
+  FILE * prog;
+  char magic[4];
+  size_t len = strlen(path);
+  int elf;
+
+  if (nwords)
+    *nwords = 0;
+
+  /* Open program file. */
+  prog = fopen(path, "r");
+  if (prog == NULL)
+    return ARMSIM_ERR_OPEN;
+  elf = fread(magic, 1, 4, prog) == 4 && memcmp(magic, "\x7f" "ELF", 4) == 0;
+  fclose(prog);
+
+  if (elf)
+    return armsim_load_elf(sim, path, nwords);
+  if (len > 4 && strcmp(path + len - 4, ".bin") == 0)
+    return armsim_load_binary(sim, path, nwords);
+  if (len > 2 && strcmp(path + len - 2, ".s") == 0)
+    return armsim_load_asm(sim, path, nwords);
+  return armsim_load_hex(sim, path, nwords);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_reset_point                              */
+/*                                                             */
+/* Purpose   : Remember the current state as the one           */
+/*             armsim_reset returns to. Nothing is copied now: */
+/*             the snapshot saves each page the first time it  */
+/*             is written afterwards.                          */
+/*                                                             */
+/***************************************************************/
+void armsim_reset_point(armsim_t *sim) {
+  if (sim->INITIAL != NULL)
+    mem_snapshot_drop(sim, sim->INITIAL);
+  sim->INITIAL = mem_snapshot_take(sim);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_reset                                    */
+/*                                                             */
+/* Purpose   : Go back to the reset point. Only the pages      */
+/*             written since are copied back, and the          */
+/*             predecoded program is kept.                     */
+/*                                                             */
+/***************************************************************/
+int armsim_reset(armsim_t *sim) {
+  if (sim->INITIAL == NULL || !mem_snapshot_live(sim->INITIAL))
+    return ARMSIM_ERR_STALE;
+  device_reset_all(sim);
+  mem_snapshot_restore(sim, sim->INITIAL);
+  sim->WATCH_HIT = FALSE;
+  if (sim->UNDO != NULL)
+    undo_reset(sim);
+  return ARMSIM_OK;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_run                                      */
+/*                                                             */
+/* Purpose   : Simulate until HALTed, a watchpoint fires or    */
+/*             budget instructions retire (0 = no limit)       */
+/*                                                             */
+/***************************************************************/
+int armsim_run(armsim_t *sim, uint64_t budget) {
+  uint64_t executed = 0;
+  int reason = ARMSIM_HALTED;
+
+  sim->WATCH_HIT = FALSE;
+  sim->WATCH_ARMED = TRUE;
+  while (sim->RUN_BIT) {
+    if (budget && executed == budget) {
+      reason = ARMSIM_BUDGET;
+      break;
+    }
+    cycle(sim);
+    executed++;
+    if (sim->WATCH_HIT) {
+      if (sim->STOP != NULL)
+        __atomic_store_n(sim->STOP, TRUE, __ATOMIC_RELAXED);
+      reason = ARMSIM_WATCHPOINT;
+      break;
+    }
+    /* another core of the machine stopped on one */
+    if (sim->STOP != NULL && __atomic_load_n(sim->STOP, __ATOMIC_RELAXED)) {
+      reason = ARMSIM_WATCHPOINT;
+      break;
+    }
+  }
+  sim->WATCH_ARMED = FALSE;
+  device_flush_all(sim);
+  return reason;
+}
+
+int armsim_step(armsim_t *sim) {
+  return armsim_run(sim, 1);
+}
+
+int64_t armsim_get_reg(armsim_t *sim, int n) {
+  if (n < 0 || n >= ARM_REGS)
+    return 0;
+  return sim->CURRENT_STATE.REGS[n];
+}
+
+int armsim_set_reg(armsim_t *sim, int n, int64_t value) {
+  if (n < 0 || n >= ARM_REGS)
+    return ARMSIM_ERR_RANGE;
+  sim->CURRENT_STATE.REGS[n] = value;
+  sim->NEXT_STATE.REGS[n] = value;
+  if (sim->UNDO != NULL)
+    undo_reset(sim);
+  return ARMSIM_OK;
+}
+
+uint64_t armsim_get_pc(armsim_t *sim) {
+  return sim->CURRENT_STATE.PC;
+}
+
+void armsim_set_pc(armsim_t *sim, uint64_t pc) {
+  sim->CURRENT_STATE.PC = pc;
+  sim->NEXT_STATE.PC = pc;
+  if (sim->UNDO != NULL)
+    undo_reset(sim);
+}
+
+void armsim_get_flags(armsim_t *sim, int *n, int *z) {
+  *n = sim->CURRENT_STATE.FLAG_N;
+  *z = sim->CURRENT_STATE.FLAG_Z;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : mapped                                          */
+/*                                                             */
+/* Purpose   : TRUE if every byte of [address, address+len)    */
+/*             is RAM or a device register.                    */
+/*                                                             */
+/***************************************************************/
+static int mapped(armsim_t *sim, uint64_t address, size_t len) {
+  mem_region_t *region;
+  uint64_t end = address + len;
+  int i;
+
+  if (end < address)
+    return FALSE;
+  while (address < end) {
+    for (i = 0; i < MEM_NREGIONS; i++) {
+      region = &sim->MEM->REGIONS[i];
+      if (address >= region->start && address - region->start < region->size)
+        break;
+    }
+    if (i < MEM_NREGIONS)
+      address = region->start + region->size;
+    else if (device_find(sim->MEM, address) != NULL)
+      address++;
+    else
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_read_mem / armsim_write_mem              */
+/*                                                             */
+/* Purpose   : Copy bytes out of / into guest memory. RAM      */
+/*             ranges go through the host backing in one       */
+/*             memcpy; anything else goes word by word.        */
+/*             ARMSIM_ERR_RANGE, touching nothing, if a byte   */
+/*             is neither RAM nor a device register.           */
+/*                                                             */
+/***************************************************************/
+int armsim_read_mem(armsim_t *sim, uint64_t address, void *buf, size_t len) {
+  uint8_t *host = mem_host_ptr(sim, address, len, FALSE);
+  uint8_t *out = buf;
+  size_t k;
+
+  if (host != NULL) {
+    memcpy(buf, host, len);
+    return ARMSIM_OK;
+  }
+  if (!mapped(sim, address, len))
+    return ARMSIM_ERR_RANGE;
+  for (k = 0; k < len; k++)
+    out[k] = mem_read_32(sim, (address + k) & ~3ULL) >> (((address + k) & 3) * 8);
+  return ARMSIM_OK;
+}
+
+int armsim_write_mem(armsim_t *sim, uint64_t address, const void *buf, size_t len) {
+  const uint8_t *in = buf;
+  uint8_t *host;
+  uint64_t aligned;
+  uint32_t word, shift;
+  size_t k;
+
+  if (!mapped(sim, address, len))
+    return ARMSIM_ERR_RANGE;
+  host = mem_host_ptr(sim, address, len, TRUE);
+  /* recorded history can't be undone past a host edit */
+  if (sim->UNDO != NULL)
+    undo_reset(sim);
+  if (host != NULL) {
+    memcpy(host, buf, len);
+    return ARMSIM_OK;
+  }
+  for (k = 0; k < len; k++) {
+    aligned = (address + k) & ~3ULL;
+    shift = ((address + k) & 3) * 8;
+    word = mem_read_32(sim, aligned);
+    word = (word & ~(0xFFu << shift)) | ((uint32_t)in[k] << shift);
+    mem_write_32(sim, aligned, word);
+  }
+  return ARMSIM_OK;
+}
+
+void armsim_get_stats(armsim_t *sim, armsim_stats_t *stats) {
+  int i;
+
+  stats->instructions = sim->INSTRUCTION_COUNT;
+  stats->halted = !sim->RUN_BIT;
+  stats->dirty_pages = 0;
+  for (i = 0; i < MEM_NREGIONS; i++)
+    stats->dirty_pages += sim->MEM->REGIONS[i].ndirty;
+}
+
+void armsim_set_verbose(armsim_t *sim, int verbose) {
+  sim->VERBOSE = verbose;
+}
+
+armsim_snapshot_t *armsim_snapshot_save(armsim_t *sim) {
+  return mem_snapshot_take(sim);
+}
+
+int armsim_snapshot_load(armsim_t *sim, armsim_snapshot_t *snap) {
+  if (!mem_snapshot_live(snap))
+    return ARMSIM_ERR_STALE;
+  device_flush_all(sim);
+  mem_snapshot_restore(sim, snap);
+  if (sim->UNDO != NULL)
+    undo_reset(sim);
+  return ARMSIM_OK;
+}
+
+void armsim_snapshot_free(armsim_t *sim, armsim_snapshot_t *snap) {
+  mem_snapshot_drop(sim, snap);
+}
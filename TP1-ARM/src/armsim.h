@@ -0,0 +1,286 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   libarmsim: embeddable simulator API                       */
+/*                                                             */
+/***************************************************************/
+
+#ifndef _ARMSIM_H_
+#define _ARMSIM_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+/* One simulated machine. Instances share nothing, so different
+   instances may be driven from different threads. */
+typedef struct sim_ctx_t armsim_t;
+
+/* Return codes */
+#define ARMSIM_OK          0
+#define ARMSIM_ERR_OPEN   -1    /* program file can't be opened */
+#define ARMSIM_ERR_FORMAT -2    /* malformed program */
+#define ARMSIM_ERR_RANGE  -3    /* address or register out of range */
+#define ARMSIM_ERR_STALE  -4    /* snapshot made stale by loading an older one */
+#define ARMSIM_ERR_SYMBOL -5    /* no symbol by that name */
+
+/* Why armsim_run/armsim_step returned */
+#define ARMSIM_HALTED      0    /* HLT retired, or already halted */
+#define ARMSIM_BUDGET      1    /* instruction budget used up */
+#define ARMSIM_WATCHPOINT  2    /* a watchpoint was hit */
+
+typedef struct {
+  uint64_t instructions;    /* retired since load */
+  uint64_t dirty_pages;     /* pages stored to since load or clear */
+  int      halted;
+} armsim_stats_t;
+
+armsim_t *armsim_create(void);
+void      armsim_destroy(armsim_t *sim);
+
+/* Programs load at MEM_TEXT_START; loading sets the PC there and
+   un-halts the machine. Words loaded so far go to *nwords if not NULL.
+   armsim_load_file takes hex text, and also ELF files (by their magic),
+   raw images (by a .bin suffix) and assembly (by a .s suffix). */
+int       armsim_load_file(armsim_t *sim, const char *path, int *nwords);
+int       armsim_load_buffer(armsim_t *sim, const uint32_t *words, size_t nwords);
+
+/* AArch64 ELF64: executables get their PT_LOAD segments at their
+   addresses and the PC at the entry point; relocatable objects get
+   their text at MEM_TEXT_START and data at MEM_DATA_START, without
+   applying relocations. ARMSIM_ERR_FORMAT for other ELF files,
+   ARMSIM_ERR_RANGE, before copying it, if a segment or section is
+   not wholly inside one RAM region. */
+int       armsim_load_elf(armsim_t *sim, const char *path, int *nwords);
+/* Raw little-endian words at MEM_TEXT_START */
+int       armsim_load_binary(armsim_t *sim, const char *path, int *nwords);
+/* Hex text, one word per line. ARMSIM_ERR_RANGE if it doesn't fit in
+   the text segment; after ARMSIM_ERR_FORMAT armsim_load_error_line
+   gives the line of the malformed word. */
+int       armsim_load_hex(armsim_t *sim, const char *path, int *nwords);
+/* Assembly source, see armsim_assemble; on ARMSIM_ERR_FORMAT the
+   line and armsim_load_error_message say what is wrong */
+int       armsim_load_asm(armsim_t *sim, const char *path, int *nwords);
+int       armsim_load_error_line(armsim_t *sim);
+const char *armsim_load_error_message(armsim_t *sim);
+
+/* Built-in assembler for the instructions the simulator implements
+   (ADD/ADDS/SUB/SUBS/CMP, AND/ANDS/ORR/EOR, MOV/MOVZ, LSL/LSR, the
+   LDUR and STUR family, B, B.cond, BR, CBZ/CBNZ, MUL, HLT, the
+   atomics and barriers) in GNU as syntax, with labels. On success
+   *words is a malloc'd array the caller frees. On ARMSIM_ERR_FORMAT
+   *line and msg (if not NULL) say where and what. */
+int       armsim_assemble(const char *src, size_t len, uint32_t **words, size_t *nwords,
+                          int *line, char *msg, size_t msgsize);
+
+/* Disassembler. armsim_disasm_word renders one word as fetched at pc;
+   armsim_disasm lists count words from address, one per line with
+   address and hex, marking the PC with "=>". Both write at most size
+   bytes, always terminated, and return the length the whole text
+   needs, like snprintf, so a first call with size 0 sizes the buffer. */
+int       armsim_disasm_word(uint32_t word, uint64_t pc, char *buf, size_t size);
+size_t    armsim_disasm(armsim_t *sim, uint64_t address, uint64_t count, char *buf, size_t size);
+
+/* Symbols: the labels of a .s program or the symbols of an ELF file,
+   kept by the loader (other formats have none). armsim_symbol_at
+   gives the nearest symbol at or below an address in the same memory
+   region, and the offset from it; both lookups are O(log n). */
+int         armsim_symbol_lookup(armsim_t *sim, const char *name, uint64_t *address);
+const char *armsim_symbol_at(armsim_t *sim, uint64_t address, uint64_t *offset);
+int         armsim_symbol_count(armsim_t *sim);
+const char *armsim_symbol_get(armsim_t *sim, int i, uint64_t *address);
+/* "name", "name+0x10" or "" for an address, snprintf-style */
+int         armsim_symbolize(armsim_t *sim, uint64_t address, char *buf, size_t size);
+/* A number, a symbol or symbol+/-number. ARMSIM_ERR_SYMBOL for an
+   unknown name, ARMSIM_ERR_FORMAT for anything else unreadable. */
+int         armsim_parse_address(armsim_t *sim, const char *text, uint64_t *address);
+
+/* armsim_reset_point remembers the current state, typically right
+   after a load; armsim_reset returns to it: registers, flags, PC,
+   instruction count, memory and devices. Only pages written since are
+   restored and the predecoded program is kept, so this is much cheaper
+   than a new instance. Until the next reset each page is copied the
+   first time it is written, so only set a point on machines that will
+   be reset (the pool does it for its instances). A load forgets the
+   point. Snapshots saved after it go stale; ARMSIM_ERR_STALE if there
+   is no point or a checkpoint load replaced the memory since. */
+void      armsim_reset_point(armsim_t *sim);
+int       armsim_reset(armsim_t *sim);
+
+/* Run until halt, watchpoint or budget instructions (0 = no limit) */
+int       armsim_run(armsim_t *sim, uint64_t budget);
+int       armsim_step(armsim_t *sim);
+
+int64_t   armsim_get_reg(armsim_t *sim, int n);
+int       armsim_set_reg(armsim_t *sim, int n, int64_t value);
+uint64_t  armsim_get_pc(armsim_t *sim);
+void      armsim_set_pc(armsim_t *sim, uint64_t pc);
+void      armsim_get_flags(armsim_t *sim, int *n, int *z);
+
+/* Byte-granular guest memory access, through devices as well as RAM.
+   ARMSIM_ERR_RANGE if any byte is neither. */
+int       armsim_read_mem(armsim_t *sim, uint64_t address, void *buf, size_t len);
+int       armsim_write_mem(armsim_t *sim, uint64_t address, const void *buf, size_t len);
+
+/* Dumps, formatted once into a buffer and written to each of the nout
+   streams (e.g. stdout and the dumpsim file). Text is what mdump and
+   rdump print; binary is the raw little-endian words; JSON is one
+   object per call. ARMSIM_ERR_OPEN if a stream fails to take it. */
+#define ARMSIM_DUMP_TEXT   0
+#define ARMSIM_DUMP_BINARY 1
+#define ARMSIM_DUMP_JSON   2
+
+int       armsim_dump_memory(armsim_t *sim, uint64_t start, uint64_t stop, int format,
+                             FILE *const *out, int nout);
+int       armsim_dump_registers(armsim_t *sim, int format, FILE *const *out, int nout);
+int       armsim_dump_format(const char *name);
+
+/* Final-state record for comparing runs, ARMSIM_DUMP_JSON (one line)
+   or ARMSIM_DUMP_BINARY. The binary record is little-endian uint64:
+   magic, record size in bytes, digest, instruction count, PC, X0..X31,
+   flags (N, Z, halted in bits 0-2), number of ranges, then start, size
+   and hash of each run of dirty data/stack pages in address order. The
+   digest hashes every word after it, so equal digests mean equal
+   records. name, if not NULL, goes in the JSON as "program". */
+#define ARMSIM_STATE_MAGIC 0x31544154534d5241ULL     /* "ARMSTAT1" */
+
+int       armsim_dump_state(armsim_t *sim, const char *name, int format,
+                            FILE *const *out, int nout);
+
+void      armsim_get_stats(armsim_t *sim, armsim_stats_t *stats);
+
+/* Per-instruction debug output from the handlers (off by default) */
+void      armsim_set_verbose(armsim_t *sim, int verbose);
+
+/* Full-state snapshots: CPU state, instruction count, run bit and all
+   guest memory (device state is not included). Memory is shared
+   copy-on-write with the running machine, so saving is O(1) and loading
+   copies back only the pages written since. Loading a snapshot makes
+   every snapshot saved after it stale. Snapshots still held when the
+   machine is destroyed are freed with it. */
+typedef struct mem_snapshot_t armsim_snapshot_t;
+
+armsim_snapshot_t *armsim_snapshot_save(armsim_t *sim);
+int                armsim_snapshot_load(armsim_t *sim, armsim_snapshot_t *snap);
+void               armsim_snapshot_free(armsim_t *sim, armsim_snapshot_t *snap);
+
+/* On-disk checkpoints: CPU state plus every non-zero guest page, page
+   aligned in a versioned file. Loading maps the pages from the file
+   copy-on-write instead of reading them, and makes snapshots stale.
+   A file whose index names anything but whole RAM pages, in ascending
+   order, is ARMSIM_ERR_FORMAT and leaves the machine as it was. */
+int       armsim_checkpoint_save(armsim_t *sim, const char *path);
+int       armsim_checkpoint_load(armsim_t *sim, const char *path);
+
+/* Reverse execution. While recording, each retired instruction logs
+   only what it overwrote (registers, flags, PC of taken branches, the
+   words it stored over) delta-encoded in a ring of limit bytes,
+   rounded down to a power of two (ARMSIM_ERR_RANGE under 512); the
+   oldest records are evicted when it fills. Every interval
+   instructions (0 = never) a snapshot is also kept, so going back
+   past the ring restores the nearest one and replays forward; when
+   there are too many, every other one is dropped and the interval
+   doubles. Such a restore makes later snapshots stale. Device
+   side effects are not undone and are repeated by a replay. Editing
+   the machine from the host (set_reg, write_mem, loads) restarts the
+   history. */
+typedef struct {
+  int      recording;
+  uint64_t records;       /* instructions that can be undone from the ring */
+  uint64_t bytes, limit;
+  int      checkpoints;
+} armsim_record_stats_t;
+
+int       armsim_record_start(armsim_t *sim, uint64_t limit, uint64_t interval);
+void      armsim_record_stop(armsim_t *sim);
+void      armsim_get_record_stats(armsim_t *sim, armsim_record_stats_t *stats);
+
+/* Undo n instructions; returns how many were undone, fewer if the
+   history runs out */
+uint64_t  armsim_reverse_step(armsim_t *sim, uint64_t n);
+
+/* Undo until an instruction that stored under a write watchpoint has
+   been undone (ARMSIM_WATCHPOINT) or the ring is empty (ARMSIM_HALTED) */
+int       armsim_reverse_continue(armsim_t *sim);
+
+/* Execution traces: every retired instruction of each attached core
+   (PC, encoding, registers written, flags, memory words read and
+   written) delta-encoded into a per-core ring, which a background
+   thread drains to the file. Rings are lock-free, one writer and one
+   reader each; a core whose ring is full waits rather than lose
+   records. Built with -DARMSIM_TRACE_ZSTD or -DARMSIM_TRACE_LZ4 (and
+   the library), chunks are compressed. Attaching again restarts the
+   core's stream from its current state. close detaches every core
+   and returns once the file is complete. armsim_trace_decode prints a
+   trace as text; ARMSIM_ERR_FORMAT if it is malformed or compressed
+   with a codec this build lacks. */
+typedef struct armsim_trace_t armsim_trace_t;
+
+armsim_trace_t *armsim_trace_open(const char *path, int *err);
+int             armsim_trace_close(armsim_trace_t *trace);
+int             armsim_trace_attach(armsim_trace_t *trace, armsim_t *sim);
+void            armsim_trace_detach(armsim_t *sim);
+int             armsim_trace_decode(FILE *in, FILE *out);
+
+/* Program images: a loaded program's non-zero pages, CPU state and
+   predecoded text, captured once and shared read-only. Instances made
+   from an image map its pages copy-on-write (a memfd), so each costs
+   only the pages it writes, and all of them share the decoded text.
+   An image is freed once it and every instance made from it have been
+   destroyed. Safe to share between threads. */
+typedef struct armsim_image_t armsim_image_t;
+
+armsim_image_t *armsim_image_create(armsim_t *sim);
+armsim_image_t *armsim_image_load(const char *path, int *err);
+void            armsim_image_destroy(armsim_image_t *img);
+armsim_t       *armsim_image_instance(armsim_image_t *img);
+
+/* Instance pool: loaded instances of one program, parsed once. get
+   hands out a free instance (or loads a new one), put resets it and
+   keeps it for the next get. Safe to share between threads. */
+typedef struct armsim_pool_t armsim_pool_t;
+
+armsim_pool_t *armsim_pool_create(const char *path, int *err);
+void           armsim_pool_destroy(armsim_pool_t *pool);
+armsim_t      *armsim_pool_get(armsim_pool_t *pool);
+void           armsim_pool_put(armsim_pool_t *pool, armsim_t *sim);
+
+/* SMP: ncores cores sharing one memory map and its devices. Every
+   core starts at MEM_TEXT_START with X0 holding its core number. */
+typedef struct armsim_smp_t armsim_smp_t;
+
+armsim_smp_t *armsim_smp_create(int ncores);
+void          armsim_smp_destroy(armsim_smp_t *smp);
+int           armsim_smp_ncores(armsim_smp_t *smp);
+armsim_t     *armsim_smp_core(armsim_smp_t *smp, int n);
+int           armsim_smp_load_file(armsim_smp_t *smp, const char *path, int *nwords);
+
+/* Run every core until all halt, one hits a watchpoint, or each has
+   retired budget instructions (0 = no limit). quantum > 0 interleaves
+   the cores round-robin, quantum instructions at a time, on the
+   calling thread, which is deterministic; quantum 0 runs each core
+   on its own thread. */
+int           armsim_smp_run(armsim_smp_t *smp, uint64_t budget, uint64_t quantum);
+
+/* SIMT: nlanes independent copies of one program run in lockstep for
+   parameter sweeps. Set each lane's inputs through armsim_simt_lane()
+   and the usual register calls; lanes that branch away from the rest
+   finish on their own. A lane hitting a watchpoint, in lockstep or
+   not, stops the run. */
+typedef struct armsim_simt_t armsim_simt_t;
+
+typedef struct {
+  uint64_t lockstep_instructions;  /* group steps, each one per lane */
+  uint64_t diverged;               /* lanes split off by a branch */
+} armsim_simt_stats_t;
+
+armsim_simt_t *armsim_simt_create(int nlanes);
+void           armsim_simt_destroy(armsim_simt_t *simt);
+int            armsim_simt_nlanes(armsim_simt_t *simt);
+armsim_t      *armsim_simt_lane(armsim_simt_t *simt, int n);
+int            armsim_simt_load_file(armsim_simt_t *simt, const char *path, int *nwords);
+int            armsim_simt_run(armsim_simt_t *simt, uint64_t budget);
+void           armsim_simt_get_stats(armsim_simt_t *simt, armsim_simt_stats_t *stats);
+
+#endif
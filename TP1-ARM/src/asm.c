@@ -0,0 +1,974 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Built-in assembler for the instructions the simulator     */
+/*   runs, so .s programs load without the external toolchain  */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include "engine.h"
+#include "armsim.h"
+
+/***************************************************************/
+/* Syntax follows GNU as for AArch64: one statement per line   */
+/* (or several split by ';'), "label:" prefixes, // comments,  */
+/* optional '#' before immediates. Branch targets are labels,  */
+/* resolved once the whole source is read. Encodings are the   */
+/* ones GNU as picks, so the output matches asm2hex.           */
+/***************************************************************/
+
+typedef struct {
+  char *name;
+  uint32_t index;          /* word the label points at */
+} asm_label_t;
+
+typedef struct {
+  uint32_t index;          /* word to patch */
+  char *label;
+  int kind;                /* ASM_FIX_* */
+  int line;
+} asm_fixup_t;
+
+#define ASM_FIX_B26 0      /* B: imm26 at bit 0 */
+#define ASM_FIX_B19 1      /* B.cond, CBZ, CBNZ: imm19 at bit 5 */
+
+typedef struct {
+  uint32_t *words;
+  size_t nwords, cap;
+  asm_label_t *labels;
+  size_t nlabels, labels_cap;
+  asm_fixup_t *fixups;
+  size_t nfixups, fixups_cap;
+  int line;
+  char *msg;
+  size_t msgsize;
+} asm_t;
+
+/* a parsed register: number 0-31, 64-bit or not, and whether 31 is SP */
+typedef struct {
+  int num;
+  int is64;
+  int is_sp;
+} asm_reg_t;
+
+static int asm_error(asm_t *as, const char *fmt, ...) {
+  va_list ap;
+
+  if (as->msg != NULL && as->msgsize > 0) {
+    va_start(ap, fmt);
+    vsnprintf(as->msg, as->msgsize, fmt, ap);
+    va_end(ap);
+  }
+  return ARMSIM_ERR_FORMAT;
+}
+
+static void asm_emit(asm_t *as, uint32_t word) {
+  if (as->nwords == as->cap) {
+    as->cap = as->cap ? 2 * as->cap : 256;
+    as->words = realloc(as->words, as->cap * sizeof(uint32_t));
+  }
+  as->words[as->nwords++] = word;
+}
+
+/***************************************************************/
+/* Operand scanning. p always points into the current          */
+/* statement; each helper skips the blanks before its token.   */
+/***************************************************************/
+
+static void asm_skip(const char **p) {
+  while (**p == ' ' || **p == '\t')
+    (*p)++;
+}
+
+static int asm_ident_char(int c) {
+  return isalnum(c) || c == '_' || c == '.' || c == '$';
+}
+
+/* Copy an identifier into buf; 0 if there is none */
+static int asm_ident(const char **p, char *buf, size_t size) {
+  size_t n = 0;
+
+  asm_skip(p);
+  while (asm_ident_char((unsigned char)**p)) {
+    if (n + 1 < size)
+      buf[n++] = **p;
+    (*p)++;
+  }
+  buf[n] = '\0';
+  return n > 0;
+}
+
+static int asm_accept(const char **p, char c) {
+  asm_skip(p);
+  if (**p != c)
+    return FALSE;
+  (*p)++;
+  return TRUE;
+}
+
+static int asm_expect(asm_t *as, const char **p, char c) {
+  if (!asm_accept(p, c))
+    return asm_error(as, "expected '%c'", c);
+  return ARMSIM_OK;
+}
+
+static int asm_end(asm_t *as, const char **p) {
+  asm_skip(p);
+  if (**p != '\0')
+    return asm_error(as, "unexpected '%s'", *p);
+  return ARMSIM_OK;
+}
+
+static int asm_reg(asm_t *as, const char **p, asm_reg_t *reg) {
+  const char *start;
+  char name[16], *end;
+  long n;
+
+  asm_skip(p);
+  start = *p;
+  if (!asm_ident(p, name, sizeof(name)))
+    return asm_error(as, "expected a register");
+
+  reg->is_sp = FALSE;
+  if (strcasecmp(name, "sp") == 0 || strcasecmp(name, "wsp") == 0) {
+    reg->num = 31;
+    reg->is64 = tolower((unsigned char)name[0]) == 's';
+    reg->is_sp = TRUE;
+    return ARMSIM_OK;
+  }
+  if (strcasecmp(name, "xzr") == 0 || strcasecmp(name, "wzr") == 0) {
+    reg->num = 31;
+    reg->is64 = tolower((unsigned char)name[0]) == 'x';
+    return ARMSIM_OK;
+  }
+  if ((name[0] == 'x' || name[0] == 'X' || name[0] == 'w' || name[0] == 'W') &&
+      isdigit((unsigned char)name[1])) {
+    n = strtol(name + 1, &end, 10);
+    if (*end == '\0' && n <= 30) {
+      reg->num = n;
+      reg->is64 = name[0] == 'x' || name[0] == 'X';
+      return ARMSIM_OK;
+    }
+  }
+  *p = start;
+  return asm_error(as, "expected a register, got '%s'", name);
+}
+
+/* A general register that is not SP */
+static int asm_greg(asm_t *as, const char **p, asm_reg_t *reg) {
+  int err = asm_reg(as, p, reg);
+
+  if (err == ARMSIM_OK && reg->is_sp)
+    return asm_error(as, "sp is not allowed here");
+  return err;
+}
+
+/* Is the next operand an immediate rather than a register? */
+static int asm_at_imm(const char **p) {
+  asm_skip(p);
+  return **p == '#' || **p == '-' || **p == '+' || isdigit((unsigned char)**p);
+}
+
+static int asm_imm(asm_t *as, const char **p, int64_t *value) {
+  const char *start;
+  char *end;
+  int neg = FALSE;
+  uint64_t v;
+
+  asm_skip(p);
+  if (**p == '#')
+    (*p)++;
+  if (**p == '-' || **p == '+') {
+    neg = **p == '-';
+    (*p)++;
+  }
+  start = *p;
+  if (start[0] == '0' && (start[1] == 'b' || start[1] == 'B'))
+    v = strtoull(start + 2, &end, 2);
+  else
+    v = strtoull(start, &end, 0);
+  if (end == start || asm_ident_char((unsigned char)*end))
+    return asm_error(as, "expected an immediate");
+  *p = end;
+  *value = neg ? -(int64_t)v : (int64_t)v;
+  return ARMSIM_OK;
+}
+
+static int asm_imm_range(asm_t *as, const char **p, int64_t *value, int64_t lo, int64_t hi) {
+  int err = asm_imm(as, p, value);
+
+  if (err == ARMSIM_OK && (*value < lo || *value > hi))
+    return asm_error(as, "immediate %" PRId64 " out of range [%" PRId64 ", %" PRId64 "]",
+                     *value, lo, hi);
+  return err;
+}
+
+/* Optional ", lsl|lsr|asr|ror #n"; *type is the 2-bit shift field */
+static int asm_shift(asm_t *as, const char **p, int allow_ror, int max,
+                     uint32_t *type, int64_t *amount) {
+  static const char *names[] = {"lsl", "lsr", "asr", "ror"};
+  const char *save = *p;
+  char name[8];
+  int k;
+
+  *type = 0;
+  *amount = 0;
+  if (!asm_accept(p, ','))
+    return ARMSIM_OK;
+  if (!asm_ident(p, name, sizeof(name))) {
+    *p = save;
+    return ARMSIM_OK;
+  }
+  for (k = 0; k < (allow_ror ? 4 : 3); k++)
+    if (strcasecmp(name, names[k]) == 0) {
+      *type = k;
+      return asm_imm_range(as, p, amount, 0, max);
+    }
+  return asm_error(as, "unknown shift '%s'", name);
+}
+
+/* Optional ", uxtb|uxth|uxtw|uxtx|sxtb|sxth|sxtw|sxtx [#n]"; *option is
+   the 3-bit extend field, or -1 with the operands left for asm_shift */
+static int asm_extend(asm_t *as, const char **p, int32_t *option, int64_t *amount) {
+  static const char *names[] = {"uxtb", "uxth", "uxtw", "uxtx", "sxtb", "sxth", "sxtw", "sxtx"};
+  const char *save = *p;
+  char name[8];
+  int k;
+
+  *option = -1;
+  *amount = 0;
+  if (!asm_accept(p, ',') || !asm_ident(p, name, sizeof(name))) {
+    *p = save;
+    return ARMSIM_OK;
+  }
+  for (k = 0; k < 8; k++)
+    if (strcasecmp(name, names[k]) == 0) {
+      *option = k;
+      return asm_at_imm(p) ? asm_imm_range(as, p, amount, 0, 4) : ARMSIM_OK;
+    }
+  *p = save;
+  return ARMSIM_OK;
+}
+
+static int asm_same_size(asm_t *as, const asm_reg_t *a, const asm_reg_t *b) {
+  if (a->is64 != b->is64)
+    return asm_error(as, "mixed X and W registers");
+  return ARMSIM_OK;
+}
+
+/* "[Xn]" or "[Xn, #imm]" */
+static int asm_mem(asm_t *as, const char **p, asm_reg_t *base, int64_t *offset) {
+  int err;
+
+  *offset = 0;
+  if ((err = asm_expect(as, p, '[')) != ARMSIM_OK)
+    return err;
+  if ((err = asm_reg(as, p, base)) != ARMSIM_OK)
+    return err;
+  if (!base->is64)
+    return asm_error(as, "base register must be an X register");
+  if (asm_accept(p, ',') && (err = asm_imm(as, p, offset)) != ARMSIM_OK)
+    return err;
+  return asm_expect(as, p, ']');
+}
+
+static void asm_fixup(asm_t *as, const char *label, int kind) {
+  asm_fixup_t *f;
+
+  if (as->nfixups == as->fixups_cap) {
+    as->fixups_cap = as->fixups_cap ? 2 * as->fixups_cap : 64;
+    as->fixups = realloc(as->fixups, as->fixups_cap * sizeof(asm_fixup_t));
+  }
+  f = &as->fixups[as->nfixups++];
+  f->index = as->nwords;
+  f->label = strdup(label);
+  f->kind = kind;
+  f->line = as->line;
+}
+
+static int asm_target(asm_t *as, const char **p, int kind) {
+  char label[128];
+
+  if (!asm_ident(p, label, sizeof(label)))
+    return asm_error(as, "expected a label");
+  asm_fixup(as, label, kind);
+  return ARMSIM_OK;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : asm_bitmask                                     */
+/*                                                             */
+/* Purpose   : Encode a logical immediate as N:immr:imms, the  */
+/*             rotated run of ones repeated over 2..64 bits.   */
+/*             Returns -1 if the value has no such encoding.   */
+/*                                                             */
+/***************************************************************/
+static int32_t asm_bitmask(uint64_t value, int is64) {
+  uint64_t mask, elem, ones_mask;
+  int size, half, ones, r;
+
+  if (!is64)
+    value = (value & 0xffffffffULL) | (value << 32);
+  if (value == 0 || value == ~0ULL)
+    return -1;
+
+  for (size = 64; size > 2; size = half) {
+    half = size / 2;
+    mask = (1ULL << half) - 1;
+    if ((value & mask) != ((value >> half) & mask))
+      break;
+  }
+  if (!is64 && size == 64)
+    return -1;
+
+  mask = size == 64 ? ~0ULL : (1ULL << size) - 1;
+  elem = value & mask;
+  ones = __builtin_popcountll(elem);
+  ones_mask = (1ULL << ones) - 1;
+  for (r = 0; r < size; r++) {
+    uint64_t rot = r == 0 ? elem : ((elem >> r) | (elem << (size - r))) & mask;
+
+    if (rot == ones_mask)
+      return ((size == 64) << 12) | (((size - r) % size) << 6) |
+             (((-size * 2) | (ones - 1)) & 0x3f);
+  }
+  return -1;
+}
+
+/* MOVZ/MOVN with a 16-bit chunk at a multiple of 16, or -1 */
+static int64_t asm_wide(uint64_t value, int is64) {
+  int hw;
+
+  for (hw = 0; hw < (is64 ? 4 : 2); hw++)
+    if ((value & ~(0xffffULL << (16 * hw))) == 0)
+      return ((uint64_t)hw << 21) | (((value >> (16 * hw)) & 0xffff) << 5);
+  return -1;
+}
+
+/***************************************************************/
+/* Instruction encoders, one per operand shape. Each parses    */
+/* the operands after the mnemonic and emits one word.         */
+/***************************************************************/
+
+/* ADD, ADDS, SUB, SUBS and CMP/CMN (no_rd: no destination) */
+static int asm_addsub(asm_t *as, const char **p, int sub, int flags, int no_rd) {
+  asm_reg_t rd, rn, rm;
+  uint32_t type, base;
+  int32_t option;
+  int64_t imm, amount;
+  int err;
+
+  rd.num = 31;
+  rd.is_sp = FALSE;
+  if (!no_rd) {
+    if ((err = asm_reg(as, p, &rd)) != ARMSIM_OK || (err = asm_expect(as, p, ',')) != ARMSIM_OK)
+      return err;
+    if (flags && rd.is_sp)
+      return asm_error(as, "sp is not allowed here");
+  }
+  if ((err = asm_reg(as, p, &rn)) != ARMSIM_OK || (err = asm_expect(as, p, ',')) != ARMSIM_OK)
+    return err;
+  if (no_rd)
+    rd.is64 = rn.is64;
+  if ((err = asm_same_size(as, &rd, &rn)) != ARMSIM_OK)
+    return err;
+
+  if (asm_at_imm(p)) {
+    if ((err = asm_imm(as, p, &imm)) != ARMSIM_OK)
+      return err;
+    if ((err = asm_shift(as, p, FALSE, 12, &type, &amount)) != ARMSIM_OK)
+      return err;
+    if (type != 0 || (amount != 0 && amount != 12))
+      return asm_error(as, "shift must be lsl #0 or lsl #12");
+    if (imm < 0) {
+      imm = -imm;
+      sub = !sub;
+    }
+    if (amount == 0 && imm > 0xfff && (imm & 0xfff) == 0) {
+      imm >>= 12;
+      amount = 12;
+    }
+    if (imm > 0xfff)
+      return asm_error(as, "immediate out of range");
+    base = 0x11000000 | (sub << 30) | (flags << 29) | ((uint32_t)rd.is64 << 31);
+    asm_emit(as, base | ((amount == 12) << 22) | ((uint32_t)imm << 10) | (rn.num << 5) | rd.num);
+    return asm_end(as, p);
+  }
+
+  if ((err = asm_greg(as, p, &rm)) != ARMSIM_OK || (err = asm_extend(as, p, &option, &amount)) != ARMSIM_OK)
+    return err;
+  base = 0x0b000000 | (sub << 30) | (flags << 29) | ((uint32_t)rd.is64 << 31);
+  if (option >= 0) {
+    /* extended register: Rm is an X register only for uxtx/sxtx on X */
+    if (rm.is64 != (rd.is64 && (option & 3) == 3))
+      return asm_error(as, rm.is64 ? "extend needs a W register" : "uxtx/sxtx need an X register");
+    asm_emit(as, base | 0x00200000 | (rm.num << 16) | ((uint32_t)option << 13) |
+                 ((uint32_t)amount << 10) | (rn.num << 5) | rd.num);
+    return asm_end(as, p);
+  }
+  if ((err = asm_same_size(as, &rd, &rm)) != ARMSIM_OK)
+    return err;
+  if (rd.is_sp || rn.is_sp) {
+    /* extended register form, UXTX/UXTW with no shift */
+    if ((err = asm_shift(as, p, FALSE, 4, &type, &amount)) != ARMSIM_OK)
+      return err;
+    if (type != 0)
+      return asm_error(as, "only lsl can follow sp");
+    asm_emit(as, base | 0x00200000 | (rm.num << 16) | ((rd.is64 ? 3 : 2) << 13) |
+                 ((uint32_t)amount << 10) | (rn.num << 5) | rd.num);
+    return asm_end(as, p);
+  }
+  if ((err = asm_shift(as, p, FALSE, rd.is64 ? 63 : 31, &type, &amount)) != ARMSIM_OK)
+    return err;
+  asm_emit(as, base | (type << 22) | (rm.num << 16) | ((uint32_t)amount << 10) |
+               (rn.num << 5) | rd.num);
+  return asm_end(as, p);
+}
+
+/* AND, ANDS, ORR, EOR and TST (opc: 0 and, 1 orr, 2 eor, 3 ands) */
+static int asm_logical(asm_t *as, const char **p, uint32_t opc, int no_rd) {
+  asm_reg_t rd, rn, rm;
+  uint32_t type;
+  int64_t imm, amount;
+  int32_t bits;
+  int err;
+
+  rd.num = 31;
+  rd.is_sp = FALSE;
+  if (!no_rd) {
+    if ((err = asm_reg(as, p, &rd)) != ARMSIM_OK || (err = asm_expect(as, p, ',')) != ARMSIM_OK)
+      return err;
+  }
+  if ((err = asm_greg(as, p, &rn)) != ARMSIM_OK || (err = asm_expect(as, p, ',')) != ARMSIM_OK)
+    return err;
+  if (no_rd)
+    rd.is64 = rn.is64;
+  if ((err = asm_same_size(as, &rd, &rn)) != ARMSIM_OK)
+    return err;
+
+  if (asm_at_imm(p)) {
+    if ((err = asm_imm(as, p, &imm)) != ARMSIM_OK)
+      return err;
+    if ((bits = asm_bitmask(imm, rd.is64)) < 0)
+      return asm_error(as, "immediate 0x%" PRIx64 " is not a valid bitmask", (uint64_t)imm);
+    asm_emit(as, ((uint32_t)rd.is64 << 31) | (opc << 29) | 0x12000000 | ((uint32_t)bits << 10) |
+                 (rn.num << 5) | rd.num);
+    return asm_end(as, p);
+  }
+
+  if (rd.is_sp)
+    return asm_error(as, "sp is not allowed here");
+  if ((err = asm_greg(as, p, &rm)) != ARMSIM_OK || (err = asm_same_size(as, &rd, &rm)) != ARMSIM_OK)
+    return err;
+  if ((err = asm_shift(as, p, TRUE, rd.is64 ? 63 : 31, &type, &amount)) != ARMSIM_OK)
+    return err;
+  asm_emit(as, ((uint32_t)rd.is64 << 31) | (opc << 29) | 0x0a000000 | (type << 22) |
+               (rm.num << 16) | ((uint32_t)amount << 10) | (rn.num << 5) | rd.num);
+  return asm_end(as, p);
+}
+
+/* MOVZ, MOVN, MOVK (opc 0 movn, 2 movz, 3 movk) */
+static int asm_movewide(asm_t *as, const char **p, uint32_t opc) {
+  asm_reg_t rd;
+  uint32_t type;
+  int64_t imm, amount, wide;
+  int err;
+
+  if ((err = asm_greg(as, p, &rd)) != ARMSIM_OK || (err = asm_expect(as, p, ',')) != ARMSIM_OK)
+    return err;
+  if ((err = asm_imm(as, p, &imm)) != ARMSIM_OK)
+    return err;
+  if ((err = asm_shift(as, p, FALSE, rd.is64 ? 48 : 16, &type, &amount)) != ARMSIM_OK)
+    return err;
+  if (type != 0 || amount % 16 != 0)
+    return asm_error(as, "shift must be lsl by a multiple of 16");
+  if (imm < 0 || imm > 0xffff) {
+    /* "movz x0, 0x10000" means the shifted chunk */
+    if (amount != 0 || (wide = asm_wide(imm, rd.is64)) < 0)
+      return asm_error(as, "immediate out of range");
+  } else {
+    wide = ((uint64_t)(amount / 16) << 21) | ((uint64_t)imm << 5);
+  }
+  asm_emit(as, ((uint32_t)rd.is64 << 31) | (opc << 29) | 0x12800000 | (uint32_t)wide | rd.num);
+  return asm_end(as, p);
+}
+
+/* MOV: register, or an immediate as MOVZ, MOVN or ORR */
+static int asm_mov(asm_t *as, const char **p) {
+  asm_reg_t rd, rm;
+  int64_t imm, wide;
+  uint64_t value;
+  int32_t bits;
+  int err;
+
+  if ((err = asm_reg(as, p, &rd)) != ARMSIM_OK || (err = asm_expect(as, p, ',')) != ARMSIM_OK)
+    return err;
+
+  if (asm_at_imm(p)) {
+    if ((err = asm_imm(as, p, &imm)) != ARMSIM_OK)
+      return err;
+    value = rd.is64 ? (uint64_t)imm : (uint64_t)imm & 0xffffffffULL;
+    if (!rd.is_sp && (wide = asm_wide(value, rd.is64)) >= 0)
+      asm_emit(as, ((uint32_t)rd.is64 << 31) | 0x52800000 | (uint32_t)wide | rd.num);
+    else if (!rd.is_sp && (wide = asm_wide(rd.is64 ? ~value : ~value & 0xffffffffULL, rd.is64)) >= 0)
+      asm_emit(as, ((uint32_t)rd.is64 << 31) | 0x12800000 | (uint32_t)wide | rd.num);
+    else if ((bits = asm_bitmask(value, rd.is64)) >= 0)
+      asm_emit(as, ((uint32_t)rd.is64 << 31) | 0x32000000 | ((uint32_t)bits << 10) | (31 << 5) | rd.num);
+    else
+      return asm_error(as, "immediate 0x%" PRIx64 " can't be moved in one instruction", value);
+    return asm_end(as, p);
+  }
+
+  if ((err = asm_reg(as, p, &rm)) != ARMSIM_OK || (err = asm_same_size(as, &rd, &rm)) != ARMSIM_OK)
+    return err;
+  if (rd.is_sp || rm.is_sp)   /* ADD rd, rm, #0 */
+    asm_emit(as, ((uint32_t)rd.is64 << 31) | 0x11000000 | (rm.num << 5) | rd.num);
+  else                        /* ORR rd, zr, rm */
+    asm_emit(as, ((uint32_t)rd.is64 << 31) | 0x2a000000 | (rm.num << 16) | (31 << 5) | rd.num);
+  return asm_end(as, p);
+}
+
+/* LSL, LSR, ASR: by an immediate (bitfield moves) or a register */
+static int asm_shiftop(asm_t *as, const char **p, int type) {
+  asm_reg_t rd, rn, rm;
+  int64_t s;
+  uint32_t width, immr, imms;
+  int err;
+
+  if ((err = asm_greg(as, p, &rd)) != ARMSIM_OK || (err = asm_expect(as, p, ',')) != ARMSIM_OK)
+    return err;
+  if ((err = asm_greg(as, p, &rn)) != ARMSIM_OK || (err = asm_expect(as, p, ',')) != ARMSIM_OK)
+    return err;
+  if ((err = asm_same_size(as, &rd, &rn)) != ARMSIM_OK)
+    return err;
+  width = rd.is64 ? 64 : 32;
+
+  if (!asm_at_imm(p)) {
+    if ((err = asm_greg(as, p, &rm)) != ARMSIM_OK || (err = asm_same_size(as, &rd, &rm)) != ARMSIM_OK)
+      return err;
+    asm_emit(as, ((uint32_t)rd.is64 << 31) | 0x1ac02000 | ((uint32_t)type << 10) |
+                 (rm.num << 16) | (rn.num << 5) | rd.num);
+    return asm_end(as, p);
+  }
+
+  if ((err = asm_imm_range(as, p, &s, 0, width - 1)) != ARMSIM_OK)
+    return err;
+  if (type == 0) {
+    immr = (width - s) % width;
+    imms = width - 1 - s;
+  } else {
+    immr = s;
+    imms = width - 1;
+  }
+  /* UBFM for lsl/lsr, SBFM for asr; N = sf */
+  asm_emit(as, ((uint32_t)rd.is64 << 31) | (type == 2 ? 0x13000000 : 0x53000000) |
+               ((uint32_t)rd.is64 << 22) | (immr << 16) | (imms << 10) | (rn.num << 5) | rd.num);
+  return asm_end(as, p);
+}
+
+/* STUR, LDUR and the byte/halfword forms (size 0 b, 1 h, 2-3 by Rt) */
+static int asm_unscaled(asm_t *as, const char **p, int size, int load) {
+  asm_reg_t rt, rn;
+  int64_t offset;
+  int err;
+
+  if ((err = asm_greg(as, p, &rt)) != ARMSIM_OK || (err = asm_expect(as, p, ',')) != ARMSIM_OK)
+    return err;
+  if ((err = asm_mem(as, p, &rn, &offset)) != ARMSIM_OK)
+    return err;
+  if (offset < -256 || offset > 255)
+    return asm_error(as, "offset %" PRId64 " out of range [-256, 255]", offset);
+  if (size < 0)
+    size = rt.is64 ? 3 : 2;
+  else if (rt.is64)
+    return asm_error(as, "byte and halfword transfers take a W register");
+  asm_emit(as, ((uint32_t)size << 30) | 0x38000000 | ((uint32_t)load << 22) |
+               (((uint32_t)offset & 0x1ff) << 12) | (rn.num << 5) | rt.num);
+  return asm_end(as, p);
+}
+
+/* LDXR Rt, [Xn] and STXR Ws, Rt, [Xn] */
+static int asm_exclusive(asm_t *as, const char **p, int load) {
+  asm_reg_t rs, rt, rn;
+  int64_t offset;
+  int err;
+
+  rs.num = 31;
+  if (!load) {
+    if ((err = asm_greg(as, p, &rs)) != ARMSIM_OK || (err = asm_expect(as, p, ',')) != ARMSIM_OK)
+      return err;
+    if (rs.is64)
+      return asm_error(as, "the status register must be a W register");
+  }
+  if ((err = asm_greg(as, p, &rt)) != ARMSIM_OK || (err = asm_expect(as, p, ',')) != ARMSIM_OK)
+    return err;
+  if ((err = asm_mem(as, p, &rn, &offset)) != ARMSIM_OK)
+    return err;
+  if (offset != 0)
+    return asm_error(as, "exclusive accesses take no offset");
+  asm_emit(as, ((uint32_t)(rt.is64 ? 3 : 2) << 30) | 0x08007c00 | ((uint32_t)load << 22) |
+               (rs.num << 16) | (rn.num << 5) | rt.num);
+  return asm_end(as, p);
+}
+
+/* LDADD, SWP (base) and CAS: Rs, Rt, [Xn] */
+static int asm_atomic(asm_t *as, const char **p, uint32_t base) {
+  asm_reg_t rs, rt, rn;
+  int64_t offset;
+  int err;
+
+  if ((err = asm_greg(as, p, &rs)) != ARMSIM_OK || (err = asm_expect(as, p, ',')) != ARMSIM_OK)
+    return err;
+  if ((err = asm_greg(as, p, &rt)) != ARMSIM_OK || (err = asm_expect(as, p, ',')) != ARMSIM_OK)
+    return err;
+  if ((err = asm_same_size(as, &rs, &rt)) != ARMSIM_OK)
+    return err;
+  if ((err = asm_mem(as, p, &rn, &offset)) != ARMSIM_OK)
+    return err;
+  if (offset != 0)
+    return asm_error(as, "atomics take no offset");
+  asm_emit(as, base | ((uint32_t)rt.is64 << 30) | (rs.num << 16) | (rn.num << 5) | rt.num);
+  return asm_end(as, p);
+}
+
+/* CBZ, CBNZ */
+static int asm_cb(asm_t *as, const char **p, int nonzero) {
+  asm_reg_t rt;
+  int err;
+
+  if ((err = asm_greg(as, p, &rt)) != ARMSIM_OK || (err = asm_expect(as, p, ',')) != ARMSIM_OK)
+    return err;
+  if ((err = asm_target(as, p, ASM_FIX_B19)) != ARMSIM_OK)
+    return err;
+  asm_emit(as, ((uint32_t)rt.is64 << 31) | 0x34000000 | ((uint32_t)nonzero << 24) | rt.num);
+  return asm_end(as, p);
+}
+
+/* DMB, DSB with their option names */
+static int asm_barrier(asm_t *as, const char **p, uint32_t base) {
+  static const struct { const char *name; uint32_t crm; } options[] = {
+    {"sy", 15}, {"st", 14}, {"ld", 13}, {"ish", 11}, {"ishst", 10}, {"ishld", 9},
+    {"nsh", 7}, {"nshst", 6}, {"nshld", 5}, {"osh", 3}, {"oshst", 2}, {"oshld", 1},
+  };
+  char name[8];
+  int64_t crm;
+  size_t k;
+  int err;
+
+  if (asm_at_imm(p)) {
+    if ((err = asm_imm_range(as, p, &crm, 0, 15)) != ARMSIM_OK)
+      return err;
+    asm_emit(as, base | ((uint32_t)crm << 8));
+    return asm_end(as, p);
+  }
+  if (!asm_ident(p, name, sizeof(name)))
+    return asm_error(as, "expected a barrier option");
+  for (k = 0; k < sizeof(options) / sizeof(options[0]); k++)
+    if (strcasecmp(name, options[k].name) == 0) {
+      asm_emit(as, base | (options[k].crm << 8));
+      return asm_end(as, p);
+    }
+  return asm_error(as, "unknown barrier option '%s'", name);
+}
+
+static const char *asm_conds[16] = {
+  "eq", "ne", "cs", "cc", "mi", "pl", "vs", "vc",
+  "hi", "ls", "ge", "lt", "gt", "le", "al", "nv",
+};
+
+static int asm_cond(const char *name) {
+  int k;
+
+  if (strcasecmp(name, "hs") == 0)
+    return 2;
+  if (strcasecmp(name, "lo") == 0)
+    return 3;
+  for (k = 0; k < 16; k++)
+    if (strcasecmp(name, asm_conds[k]) == 0)
+      return k;
+  return -1;
+}
+
+/* .inst / .word: comma-separated 32-bit values */
+static int asm_data(asm_t *as, const char **p) {
+  int64_t value;
+  int err;
+
+  do {
+    if ((err = asm_imm(as, p, &value)) != ARMSIM_OK)
+      return err;
+    if (value < INT32_MIN || value > (int64_t)UINT32_MAX)
+      return asm_error(as, "value doesn't fit in 32 bits");
+    asm_emit(as, (uint32_t)value);
+  } while (asm_accept(p, ','));
+  return asm_end(as, p);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : asm_statement                                   */
+/*                                                             */
+/* Purpose   : Assemble one statement, labels already taken    */
+/*                                                             */
+/***************************************************************/
+static int asm_statement(asm_t *as, const char *p) {
+  char op[16];
+  int64_t imm;
+  asm_reg_t rd, rn, rm;
+  int k, cond, err;
+
+  if (!asm_ident(&p, op, sizeof(op)))
+    return asm_error(as, "expected an instruction");
+  for (k = 0; op[k]; k++)
+    op[k] = tolower((unsigned char)op[k]);
+
+  /* directives */
+  if (op[0] == '.') {
+    if (strcmp(op, ".inst") == 0 || strcmp(op, ".word") == 0 || strcmp(op, ".long") == 0 ||
+        strcmp(op, ".4byte") == 0)
+      return asm_data(as, &p);
+    if (strcmp(op, ".text") == 0 || strcmp(op, ".global") == 0 || strcmp(op, ".globl") == 0 ||
+        strcmp(op, ".type") == 0 || strcmp(op, ".size") == 0 || strcmp(op, ".section") == 0)
+      return ARMSIM_OK;
+    return asm_error(as, "unsupported directive '%s'", op);
+  }
+
+  if (strcmp(op, "add") == 0)  return asm_addsub(as, &p, 0, 0, FALSE);
+  if (strcmp(op, "adds") == 0) return asm_addsub(as, &p, 0, 1, FALSE);
+  if (strcmp(op, "sub") == 0)  return asm_addsub(as, &p, 1, 0, FALSE);
+  if (strcmp(op, "subs") == 0) return asm_addsub(as, &p, 1, 1, FALSE);
+  if (strcmp(op, "cmp") == 0)  return asm_addsub(as, &p, 1, 1, TRUE);
+  if (strcmp(op, "cmn") == 0)  return asm_addsub(as, &p, 0, 1, TRUE);
+  if (strcmp(op, "and") == 0)  return asm_logical(as, &p, 0, FALSE);
+  if (strcmp(op, "orr") == 0)  return asm_logical(as, &p, 1, FALSE);
+  if (strcmp(op, "eor") == 0)  return asm_logical(as, &p, 2, FALSE);
+  if (strcmp(op, "ands") == 0) return asm_logical(as, &p, 3, FALSE);
+  if (strcmp(op, "tst") == 0)  return asm_logical(as, &p, 3, TRUE);
+  if (strcmp(op, "movn") == 0) return asm_movewide(as, &p, 0);
+  if (strcmp(op, "movz") == 0) return asm_movewide(as, &p, 2);
+  if (strcmp(op, "movk") == 0) return asm_movewide(as, &p, 3);
+  if (strcmp(op, "mov") == 0)  return asm_mov(as, &p);
+  if (strcmp(op, "lsl") == 0)  return asm_shiftop(as, &p, 0);
+  if (strcmp(op, "lsr") == 0)  return asm_shiftop(as, &p, 1);
+  if (strcmp(op, "asr") == 0)  return asm_shiftop(as, &p, 2);
+  if (strcmp(op, "stur") == 0) return asm_unscaled(as, &p, -1, 0);
+  if (strcmp(op, "ldur") == 0) return asm_unscaled(as, &p, -1, 1);
+  if (strcmp(op, "sturb") == 0) return asm_unscaled(as, &p, 0, 0);
+  if (strcmp(op, "ldurb") == 0) return asm_unscaled(as, &p, 0, 1);
+  if (strcmp(op, "sturh") == 0) return asm_unscaled(as, &p, 1, 0);
+  if (strcmp(op, "ldurh") == 0) return asm_unscaled(as, &p, 1, 1);
+  if (strcmp(op, "ldxr") == 0) return asm_exclusive(as, &p, 1);
+  if (strcmp(op, "stxr") == 0) return asm_exclusive(as, &p, 0);
+  if (strcmp(op, "ldadd") == 0) return asm_atomic(as, &p, 0xb8200000);
+  if (strcmp(op, "swp") == 0)  return asm_atomic(as, &p, 0xb8208000);
+  if (strcmp(op, "cas") == 0)  return asm_atomic(as, &p, 0x88a07c00);
+  if (strcmp(op, "cbz") == 0)  return asm_cb(as, &p, 0);
+  if (strcmp(op, "cbnz") == 0) return asm_cb(as, &p, 1);
+  if (strcmp(op, "dmb") == 0)  return asm_barrier(as, &p, 0xd50330bf);
+  if (strcmp(op, "dsb") == 0)  return asm_barrier(as, &p, 0xd503309f);
+
+  if (strcmp(op, "mul") == 0) {
+    if ((err = asm_greg(as, &p, &rd)) != ARMSIM_OK || (err = asm_expect(as, &p, ',')) != ARMSIM_OK ||
+        (err = asm_greg(as, &p, &rn)) != ARMSIM_OK || (err = asm_expect(as, &p, ',')) != ARMSIM_OK ||
+        (err = asm_greg(as, &p, &rm)) != ARMSIM_OK)
+      return err;
+    if ((err = asm_same_size(as, &rd, &rn)) != ARMSIM_OK || (err = asm_same_size(as, &rd, &rm)) != ARMSIM_OK)
+      return err;
+    asm_emit(as, ((uint32_t)rd.is64 << 31) | 0x1b007c00 | (rm.num << 16) | (rn.num << 5) | rd.num);
+    return asm_end(as, &p);
+  }
+  if (strcmp(op, "hlt") == 0) {
+    if ((err = asm_imm_range(as, &p, &imm, 0, 0xffff)) != ARMSIM_OK)
+      return err;
+    asm_emit(as, 0xd4400000 | ((uint32_t)imm << 5));
+    return asm_end(as, &p);
+  }
+  if (strcmp(op, "br") == 0) {
+    if ((err = asm_greg(as, &p, &rn)) != ARMSIM_OK)
+      return err;
+    if (!rn.is64)
+      return asm_error(as, "br takes an X register");
+    asm_emit(as, 0xd61f0000 | (rn.num << 5));
+    return asm_end(as, &p);
+  }
+  if (strcmp(op, "isb") == 0) {
+    asm_emit(as, 0xd5033fdf);
+    return asm_end(as, &p);
+  }
+  if (strcmp(op, "nop") == 0) {
+    asm_emit(as, 0xd503201f);
+    return asm_end(as, &p);
+  }
+  if (strcmp(op, "b") == 0) {
+    if ((err = asm_target(as, &p, ASM_FIX_B26)) != ARMSIM_OK)
+      return err;
+    asm_emit(as, 0x14000000);
+    return asm_end(as, &p);
+  }
+
+  /* b.cond and the bcond spelling */
+  if (op[0] == 'b' && (cond = asm_cond(op + (op[1] == '.' ? 2 : 1))) >= 0) {
+    if ((err = asm_target(as, &p, ASM_FIX_B19)) != ARMSIM_OK)
+      return err;
+    asm_emit(as, 0x54000000 | cond);
+    return asm_end(as, &p);
+  }
+  return asm_error(as, "unknown instruction '%s'", op);
+}
+
+static int asm_define(asm_t *as, const char *name) {
+  size_t k;
+
+  for (k = 0; k < as->nlabels; k++)
+    if (strcmp(as->labels[k].name, name) == 0)
+      return asm_error(as, "label '%s' defined twice", name);
+  if (as->nlabels == as->labels_cap) {
+    as->labels_cap = as->labels_cap ? 2 * as->labels_cap : 64;
+    as->labels = realloc(as->labels, as->labels_cap * sizeof(asm_label_t));
+  }
+  as->labels[as->nlabels].name = strdup(name);
+  as->labels[as->nlabels].index = as->nwords;
+  as->nlabels++;
+  return ARMSIM_OK;
+}
+
+/* Patch the branches now that every label is known */
+static int asm_resolve(asm_t *as) {
+  asm_fixup_t *f;
+  int64_t delta;
+  size_t k, j;
+
+  for (k = 0; k < as->nfixups; k++) {
+    f = &as->fixups[k];
+    for (j = 0; j < as->nlabels && strcmp(as->labels[j].name, f->label) != 0; j++)
+      ;
+    as->line = f->line;
+    if (j == as->nlabels)
+      return asm_error(as, "undefined label '%s'", f->label);
+    delta = (int64_t)as->labels[j].index - f->index;
+    if (f->kind == ASM_FIX_B26) {
+      if (delta < -(1 << 25) || delta >= (1 << 25))
+        return asm_error(as, "branch to '%s' out of range", f->label);
+      as->words[f->index] |= (uint32_t)delta & 0x3ffffff;
+    } else {
+      if (delta < -(1 << 18) || delta >= (1 << 18))
+        return asm_error(as, "branch to '%s' out of range", f->label);
+      as->words[f->index] |= ((uint32_t)delta & 0x7ffff) << 5;
+    }
+  }
+  return ARMSIM_OK;
+}
+
+static void asm_free(asm_t *as) {
+  size_t k;
+
+  for (k = 0; k < as->nlabels; k++)
+    free(as->labels[k].name);
+  for (k = 0; k < as->nfixups; k++)
+    free(as->fixups[k].label);
+  free(as->labels);
+  free(as->fixups);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : asm_assemble                                    */
+/*                                                             */
+/* Purpose   : Assemble len bytes of source into machine words */
+/*             and hand the labels to the loader's symbols     */
+/*                                                             */
+/***************************************************************/
+int asm_assemble(const char *src, size_t len, uint32_t **words, size_t *nwords,
+                 int *line, char *msg, size_t msgsize, symtab_t *symbols, uint64_t origin) {
+  asm_t as;
+  const char *end = src + len, *eol, *q;
+  char buf[512], label[128];
+  size_t n, k;
+  int err = ARMSIM_OK, in_comment = FALSE;
+
+  memset(&as, 0, sizeof(as));
+  as.msg = msg;
+  as.msgsize = msgsize;
+  if (msg != NULL && msgsize > 0)
+    msg[0] = '\0';
+
+  while (src < end && err == ARMSIM_OK) {
+    as.line++;
+    eol = memchr(src, '\n', end - src);
+    if (eol == NULL)
+      eol = end;
+    n = eol - src;
+    if (n >= sizeof(buf)) {
+      err = asm_error(&as, "line too long");
+      break;
+    }
+
+    /* strip comments, splitting statements at ';' */
+    for (k = 0, q = src; q < eol; q++) {
+      if (in_comment) {
+        if (q + 1 < eol && q[0] == '*' && q[1] == '/') {
+          in_comment = FALSE;
+          q++;
+        }
+      } else if (q + 1 < eol && q[0] == '/' && q[1] == '*') {
+        in_comment = TRUE;
+        q++;
+      } else if (q + 1 < eol && q[0] == '/' && q[1] == '/') {
+        break;
+      } else {
+        buf[k++] = (q[0] == ';' || q[0] == '\r') ? '\0' : q[0];
+      }
+    }
+    buf[k] = '\0';
+    src = eol + 1;
+
+    /* each statement: labels first, then at most one instruction */
+    for (q = buf; q <= buf + k && err == ARMSIM_OK; q += strlen(q) + 1) {
+      const char *p = q, *save;
+
+      for (;;) {
+        save = p;
+        if (asm_ident(&p, label, sizeof(label)) && asm_accept(&p, ':')) {
+          if ((err = asm_define(&as, label)) != ARMSIM_OK)
+            break;
+          continue;
+        }
+        p = save;
+        break;
+      }
+      asm_skip(&p);
+      if (err == ARMSIM_OK && *p != '\0')
+        err = asm_statement(&as, p);
+    }
+  }
+  if (err == ARMSIM_OK)
+    err = asm_resolve(&as);
+
+  if (line)
+    *line = err == ARMSIM_OK ? 0 : as.line;
+  for (k = 0; err == ARMSIM_OK && symbols != NULL && k < as.nlabels; k++)
+    symtab_add(symbols, as.labels[k].name, strlen(as.labels[k].name),
+               origin + 4 * (uint64_t)as.labels[k].index);
+  asm_free(&as);
+  if (err != ARMSIM_OK) {
+    free(as.words);
+    return err;
+  }
+  *words = as.words;
+  *nwords = as.nwords;
+  return ARMSIM_OK;
+}
+
+int armsim_assemble(const char *src, size_t len, uint32_t **words, size_t *nwords,
+                    int *line, char *msg, size_t msgsize) {
+  return asm_assemble(src, len, words, nwords, line, msg, msgsize, NULL, 0);
+}
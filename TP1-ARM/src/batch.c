@@ -0,0 +1,480 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Batch runner: a thread pool over independent simulator    */
+/*   instances. Each worker owns a contiguous slice of the     */
+/*   job list and, once it runs dry, steals single jobs from   */
+/*   the tail of the other workers' slices.                    */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "engine.h"
+#include "sim.h"
+#include "armsim.h"
+#include "batch.h"
+
+#define BATCH_DEFAULT_BUDGET 100000000ULL
+
+/* A distinct program file. Its image is built by the first job
+   that needs it and shared by every job running the same file. */
+typedef struct {
+  char *path;
+  pthread_mutex_t lock;
+  int built;
+  int load_error;
+  armsim_image_t *image;
+} batch_program_t;
+
+typedef struct {
+  char *path;
+  batch_program_t *prog;
+  int lane;             /* index into the -s sweep */
+  int status;           /* ARMSIM_HALTED, ARMSIM_BUDGET, or a load error */
+  int load_error;
+  uint64_t instructions;
+  uint64_t pc;
+  char where[64];       /* symbol+offset of pc, "" without symbols */
+  char name[256];       /* dump file name, less outdir and extension */
+  int unknown;          /* halted by an undecodable word, at pc - 4 */
+  uint32_t word;
+  char *state;          /* --emit-state record, malloc'd */
+  size_t state_len;
+} batch_job_t;
+
+/* A worker's slice of the job list, packed as (hi << 32) | lo so the
+   owner (taking lo) and thieves (taking hi - 1) race on one CAS. */
+typedef struct {
+  _Atomic uint64_t range;
+} batch_queue_t;
+
+typedef struct {
+  batch_job_t *jobs;
+  batch_queue_t *queues;
+  int nworkers;
+  uint64_t budget;
+  const char *outdir;
+  int sweep_reg;        /* -1 without -s */
+  int64_t sweep_start, sweep_step;
+  int lanes;
+  int emit_state;       /* ARMSIM_DUMP_* with --emit-state, else -1 */
+} batch_t;
+
+typedef struct {
+  batch_t *batch;
+  int id;
+} batch_worker_t;
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : batch_take / batch_steal                        */
+/*                                                             */
+/* Purpose   : Pop a job index from the front of one's own     */
+/*             slice, or from the back of someone else's.      */
+/*             Return -1 when the slice is empty.              */
+/*                                                             */
+/***************************************************************/
+static int batch_take(batch_queue_t *q) {
+  uint64_t r = atomic_load(&q->range), next;
+  uint32_t lo, hi;
+
+  do {
+    lo = r & 0xFFFFFFFF;
+    hi = r >> 32;
+    if (lo >= hi)
+      return -1;
+    next = ((uint64_t)hi << 32) | (lo + 1);
+  } while (!atomic_compare_exchange_weak(&q->range, &r, next));
+  return lo;
+}
+
+static int batch_steal(batch_queue_t *q) {
+  uint64_t r = atomic_load(&q->range), next;
+  uint32_t lo, hi;
+
+  do {
+    lo = r & 0xFFFFFFFF;
+    hi = r >> 32;
+    if (lo >= hi)
+      return -1;
+    next = ((uint64_t)(hi - 1) << 32) | lo;
+  } while (!atomic_compare_exchange_weak(&q->range, &r, next));
+  return hi - 1;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : batch_write_dump                                */
+/*                                                             */
+/* Purpose   : Write the rdump text and every dirty data/stack */
+/*             page, in mdump format, to the job's dump file   */
+/*                                                             */
+/***************************************************************/
+typedef struct {
+  armsim_t *sim;
+  FILE *f;
+} batch_dump_arg_t;
+
+static void batch_dump_page(uint64_t page_address, void *arg) {
+  batch_dump_arg_t *d = arg;
+
+  if (page_address >= MEM_TEXT_START && page_address < MEM_TEXT_START + MEM_TEXT_SIZE)
+    return;
+  armsim_dump_memory(d->sim, page_address, page_address + MEM_PAGE_SIZE - 4,
+                     ARMSIM_DUMP_TEXT, &d->f, 1);
+}
+
+static void batch_write_dump(batch_t *batch, batch_job_t *job, armsim_t *sim) {
+  char path[4096];
+  batch_dump_arg_t d;
+  FILE *f;
+
+  if (batch->lanes > 1)
+    snprintf(path, sizeof(path), "%s/%s.%d.dump", batch->outdir, job->name, job->lane);
+  else
+    snprintf(path, sizeof(path), "%s/%s.dump", batch->outdir, job->name);
+  if ((f = fopen(path, "w")) == NULL) {
+    fprintf(stderr, "Error: Can't open dump file %s\n", path);
+    return;
+  }
+
+  armsim_dump_registers(sim, ARMSIM_DUMP_TEXT, &f, 1);
+
+  d.sim = sim;
+  d.f = f;
+  mem_for_each_dirty(sim, batch_dump_page, &d);
+  fclose(f);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : batch_write_state                               */
+/*                                                             */
+/* Purpose   : Keep the job's state record in memory; they are */
+/*             all written, in job order, at the end           */
+/*                                                             */
+/***************************************************************/
+static void batch_write_state(batch_t *batch, batch_job_t *job, armsim_t *sim) {
+  char name[4096];
+  FILE *f;
+
+  if (batch->lanes > 1)
+    snprintf(name, sizeof(name), "%s[%d]", job->path, job->lane);
+  else
+    snprintf(name, sizeof(name), "%s", job->path);
+  if ((f = open_memstream(&job->state, &job->state_len)) == NULL)
+    return;
+  armsim_dump_state(sim, name, batch->emit_state, &f, 1);
+  fclose(f);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : batch_run_job                                   */
+/*                                                             */
+/* Purpose   : Run and dump one program in a fresh instance    */
+/*             made from the program's shared image            */
+/*                                                             */
+/***************************************************************/
+static void batch_run_job(batch_t *batch, batch_job_t *job) {
+  batch_program_t *prog = job->prog;
+  armsim_stats_t stats;
+  armsim_t *sim;
+
+  pthread_mutex_lock(&prog->lock);
+  if (!prog->built) {
+    prog->image = armsim_image_load(prog->path, &prog->load_error);
+    prog->built = TRUE;
+  }
+  pthread_mutex_unlock(&prog->lock);
+  job->load_error = prog->load_error;
+  if (prog->image == NULL)
+    return;
+
+  sim = armsim_image_instance(prog->image);
+  if (batch->sweep_reg >= 0)
+    armsim_set_reg(sim, batch->sweep_reg, batch->sweep_start + job->lane * batch->sweep_step);
+  job->status = armsim_run(sim, batch->budget);
+  armsim_get_stats(sim, &stats);
+  job->instructions = stats.instructions;
+  job->pc = armsim_get_pc(sim);
+  /* HLT and an undecodable word both stop the machine past themselves */
+  if (job->status == ARMSIM_HALTED && job->instructions > 0 &&
+      armsim_read_mem(sim, job->pc - 4, &job->word, 4) == ARMSIM_OK)
+    job->unknown = strcmp(decode_instruction(NULL, job->word).name, "UNKNOWN") == 0;
+  armsim_symbolize(sim, job->pc, job->where, sizeof(job->where));
+  if (batch->emit_state >= 0)
+    batch_write_state(batch, job, sim);
+  else
+    batch_write_dump(batch, job, sim);
+  armsim_destroy(sim);
+}
+
+static void *batch_worker(void *arg) {
+  batch_worker_t *w = arg;
+  batch_t *batch = w->batch;
+  int job, k;
+
+  for (;;) {
+    job = batch_take(&batch->queues[w->id]);
+    for (k = 1; job < 0 && k < batch->nworkers; k++)
+      job = batch_steal(&batch->queues[(w->id + k) % batch->nworkers]);
+    if (job < 0)
+      return NULL;
+    batch_run_job(batch, &batch->jobs[job]);
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : batch_collect                                   */
+/*                                                             */
+/* Purpose   : Append a program file, or every .x file of a    */
+/*             directory in name order, to the job list        */
+/*                                                             */
+/***************************************************************/
+static int batch_name_cmp(const void *a, const void *b) {
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void batch_add(batch_job_t **jobs, int *njobs, int *cap, char *path) {
+  if (*njobs == *cap) {
+    *cap = *cap ? 2 * *cap : 64;
+    *jobs = realloc(*jobs, *cap * sizeof(batch_job_t));
+  }
+  memset(&(*jobs)[*njobs], 0, sizeof(batch_job_t));
+  (*jobs)[(*njobs)++].path = path;
+}
+
+static void batch_collect(const char *arg, batch_job_t **jobs, int *njobs, int *cap) {
+  DIR *dir = opendir(arg);
+  struct dirent *ent;
+  char **names = NULL;
+  int n = 0, ncap = 0, k;
+  size_t len;
+
+  if (dir == NULL) {
+    batch_add(jobs, njobs, cap, strdup(arg));
+    return;
+  }
+  while ((ent = readdir(dir)) != NULL) {
+    len = strlen(ent->d_name);
+    if (len < 3 || strcmp(ent->d_name + len - 2, ".x") != 0)
+      continue;
+    if (n == ncap) {
+      ncap = ncap ? 2 * ncap : 64;
+      names = realloc(names, ncap * sizeof(char *));
+    }
+    names[n] = malloc(strlen(arg) + len + 2);
+    sprintf(names[n++], "%s/%s", arg, ent->d_name);
+  }
+  closedir(dir);
+  qsort(names, n, sizeof(char *), batch_name_cmp);
+  for (k = 0; k < n; k++)
+    batch_add(jobs, njobs, cap, names[k]);
+  free(names);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : batch_expand                                    */
+/*                                                             */
+/* Purpose   : Point every job at its distinct program and     */
+/*             repeat each one once per sweep lane. Dumps are  */
+/*             named after the file; a name already taken by   */
+/*             an earlier file gets the file's index appended. */
+/*                                                             */
+/***************************************************************/
+static batch_job_t *batch_expand(batch_job_t *files, int nfiles, int lanes,
+                                 batch_program_t **progs, int *nprogs) {
+  batch_job_t *jobs = calloc((size_t)nfiles * lanes, sizeof(batch_job_t));
+  char name[256];
+  const char *base;
+  int i, j, p, lane, len;
+
+  *progs = calloc(nfiles, sizeof(batch_program_t));
+  *nprogs = 0;
+  for (i = 0; i < nfiles; i++) {
+    base = strrchr(files[i].path, '/');
+    base = base ? base + 1 : files[i].path;
+    len = strrchr(base, '.') ? strrchr(base, '.') - base : (int)strlen(base);
+    snprintf(name, sizeof(name), "%.*s", len, base);
+    for (j = 0; j < i; j++)
+      if (strcmp(jobs[j * lanes].name, name) == 0)
+        break;
+    if (j < i)
+      snprintf(name, sizeof(name), "%.*s-%d", len, base, i);
+
+    for (p = 0; p < *nprogs; p++)
+      if (strcmp((*progs)[p].path, files[i].path) == 0)
+        break;
+    if (p == *nprogs) {
+      (*progs)[p].path = files[i].path;
+      pthread_mutex_init(&(*progs)[p].lock, NULL);
+      (*nprogs)++;
+    } else {
+      free(files[i].path);
+    }
+    for (lane = 0; lane < lanes; lane++) {
+      jobs[i * lanes + lane].path = (*progs)[p].path;
+      jobs[i * lanes + lane].prog = &(*progs)[p];
+      jobs[i * lanes + lane].lane = lane;
+      strcpy(jobs[i * lanes + lane].name, name);
+    }
+  }
+  return jobs;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : batch_write_states                              */
+/*                                                             */
+/* Purpose   : Write every job's state record, in job order,   */
+/*             to <outdir>/state.json or state.bin             */
+/*                                                             */
+/***************************************************************/
+static int batch_write_states(batch_t *batch, batch_job_t *jobs, int njobs) {
+  char path[4096];
+  FILE *f;
+  int i, ok = TRUE;
+
+  snprintf(path, sizeof(path), "%s/state.%s", batch->outdir,
+           batch->emit_state == ARMSIM_DUMP_JSON ? "json" : "bin");
+  if ((f = fopen(path, "wb")) == NULL) {
+    fprintf(stderr, "Error: Can't open state file %s\n", path);
+    return FALSE;
+  }
+  for (i = 0; i < njobs; i++)
+    if (jobs[i].state != NULL && fwrite(jobs[i].state, 1, jobs[i].state_len, f) != jobs[i].state_len)
+      ok = FALSE;
+  if (fclose(f) != 0 || !ok) {
+    fprintf(stderr, "Error: Can't write state file %s\n", path);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : batch_main                                      */
+/*                                                             */
+/***************************************************************/
+int batch_main(int argc, char *argv[]) {
+  batch_t batch;
+  batch_job_t *files = NULL, *jobs;
+  batch_program_t *progs;
+  batch_worker_t *workers;
+  pthread_t *threads;
+  int nfiles = 0, cap = 0, njobs, nprogs, nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  int i, failed = 0, bad = FALSE;
+  uint32_t lo, hi;
+
+  batch.budget = BATCH_DEFAULT_BUDGET;
+  batch.outdir = ".";
+  batch.sweep_reg = -1;
+  batch.lanes = 1;
+  batch.emit_state = -1;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+      nthreads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      batch.budget = strtoull(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      batch.outdir = argv[++i];
+    else if (strcmp(argv[i], "-s") == 0 && i + 4 < argc) {
+      batch.sweep_reg = atoi(argv[++i]);
+      batch.sweep_start = strtoll(argv[++i], NULL, 0);
+      batch.sweep_step = strtoll(argv[++i], NULL, 0);
+      batch.lanes = atoi(argv[++i]);
+    } else if (strncmp(argv[i], "--emit-state=", 13) == 0) {
+      batch.emit_state = armsim_dump_format(argv[i] + 13);
+      if (batch.emit_state != ARMSIM_DUMP_JSON && batch.emit_state != ARMSIM_DUMP_BINARY)
+        bad = TRUE;
+    } else
+      batch_collect(argv[i], &files, &nfiles, &cap);
+  }
+  if (bad || nfiles == 0 || batch.lanes < 1 || batch.sweep_reg >= ARM_REGS) {
+    printf("Error: usage: sim --batch [-j threads] [-n budget] [-o outdir]"
+           " [-s reg start step count] [--emit-state=json|bin] <file.x|dir> ...\n");
+    return 1;
+  }
+  jobs = batch_expand(files, nfiles, batch.lanes, &progs, &nprogs);
+  njobs = nfiles * batch.lanes;
+  free(files);
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > njobs)
+    nthreads = njobs;
+
+  /* hand every worker an equal contiguous slice */
+  batch.jobs = jobs;
+  batch.nworkers = nthreads;
+  batch.queues = calloc(nthreads, sizeof(batch_queue_t));
+  for (i = 0; i < nthreads; i++) {
+    lo = (uint64_t)njobs * i / nthreads;
+    hi = (uint64_t)njobs * (i + 1) / nthreads;
+    atomic_init(&batch.queues[i].range, ((uint64_t)hi << 32) | lo);
+  }
+
+  workers = calloc(nthreads, sizeof(batch_worker_t));
+  threads = calloc(nthreads, sizeof(pthread_t));
+  for (i = 0; i < nthreads; i++) {
+    workers[i].batch = &batch;
+    workers[i].id = i;
+    pthread_create(&threads[i], NULL, batch_worker, &workers[i]);
+  }
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  for (i = 0; i < njobs; i++) {
+    if (jobs[i].load_error == ARMSIM_ERR_OPEN) {
+      printf("%s: can't open program file\n", jobs[i].path);
+      failed = 1;
+    } else if (jobs[i].load_error == ARMSIM_ERR_FORMAT) {
+      printf("%s: malformed program file\n", jobs[i].path);
+      failed = 1;
+    } else if (jobs[i].load_error == ARMSIM_ERR_RANGE) {
+      printf("%s: program doesn't fit in memory\n", jobs[i].path);
+      failed = 1;
+    } else {
+      if (batch.lanes > 1)
+        printf("%s[%d]: ", jobs[i].path, jobs[i].lane);
+      else
+        printf("%s: ", jobs[i].path);
+      if (jobs[i].unknown)
+        printf("unknown instruction 0x%08" PRIx32 " at PC 0x%" PRIx64 " after %" PRIu64
+               " instructions\n", jobs[i].word, jobs[i].pc - 4, jobs[i].instructions);
+      else
+        printf("%s after %" PRIu64 " instructions, PC 0x%" PRIx64 "%s%s%s\n",
+               jobs[i].status == ARMSIM_HALTED ? "halted" : "stopped",
+               jobs[i].instructions, jobs[i].pc,
+               jobs[i].where[0] ? " <" : "", jobs[i].where, jobs[i].where[0] ? ">" : "");
+      if (jobs[i].status != ARMSIM_HALTED || jobs[i].unknown)
+        failed = 1;
+    }
+  }
+  if (batch.emit_state >= 0 && !batch_write_states(&batch, jobs, njobs))
+    failed = 1;
+  for (i = 0; i < njobs; i++)
+    free(jobs[i].state);
+  for (i = 0; i < nprogs; i++) {
+    if (progs[i].image != NULL)
+      armsim_image_destroy(progs[i].image);
+    pthread_mutex_destroy(&progs[i].lock);
+    free(progs[i].path);
+  }
+  free(progs);
+
+  free(threads);
+  free(workers);
+  free(batch.queues);
+  free(jobs);
+  return failed;
+}
@@ -0,0 +1,27 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Batch mode: many programs, one instance each, all cores   */
+/*                                                             */
+/***************************************************************/
+
+#ifndef _SIM_BATCH_H_
+#define _SIM_BATCH_H_
+
+/* sim --batch [-j threads] [-n budget] [-o outdir] [-s reg start step count]
+             [--emit-state=json|bin]
+             file.x|dir ...
+   Runs every program in its own simulator on a thread pool and writes
+   <outdir>/<name>.dump with the final registers and dirty memory;
+   a name already used by an earlier file gets "-<index>" appended,
+   index being the file's position in the list.
+   With -s each program runs count times, run i with reg set to
+   start + i*step, into <name>.<i>.dump. Instances of one program share
+   a read-only image of it. With --emit-state there are no .dump files:
+   one state record per run (see armsim_dump_state) goes, in job order,
+   to <outdir>/state.json or state.bin. Returns the process exit
+   status. */
+int batch_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,197 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   On-disk checkpoints that restore by mmap                  */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "engine.h"
+#include "device.h"
+#include "armsim.h"
+
+/***************************************************************/
+/* File layout, host byte order:                               */
+/*   ckpt_header_t                                             */
+/*   npages guest page addresses (uint64_t), ascending         */
+/*   zero padding up to data_offset (page aligned)             */
+/*   the pages themselves, MEM_PAGE_SIZE bytes each, in index  */
+/*   order                                                     */
+/* Pages that are all zero are left out: a fresh machine       */
+/* already has them.                                           */
+/***************************************************************/
+
+#define CKPT_MAGIC   0x54504b434d495341ULL   /* "ASIMCKPT" */
+#define CKPT_VERSION 1
+
+typedef struct {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t page_size;
+  uint64_t instruction_count;
+  uint64_t pc;
+  int64_t  regs[ARM_REGS];
+  int32_t  flag_n, flag_z, run_bit;
+  uint32_t npages;
+  uint64_t data_offset;
+} ckpt_header_t;
+
+static int ckpt_page_is_zero(const uint8_t *page) {
+  const uint64_t *w = (const uint64_t *)page;
+  int k;
+
+  for (k = 0; k < MEM_PAGE_SIZE / 8; k++)
+    if (w[k] != 0)
+      return FALSE;
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_checkpoint_save                          */
+/*                                                             */
+/* Purpose   : Write the CPU state and every non-zero page     */
+/*                                                             */
+/***************************************************************/
+int armsim_checkpoint_save(armsim_t *sim, const char *path) {
+  static const uint8_t zero[MEM_PAGE_SIZE];
+  ckpt_header_t hdr;
+  uint64_t *index = NULL, pos;
+  uint32_t npages = 0, k, page;
+  FILE *out;
+  int i, err = ARMSIM_OK;
+
+  for (i = 0; i < MEM_NREGIONS; i++) {
+    mem_region_t *region = &sim->MEM->REGIONS[i];
+
+    for (page = 0; page < region->size >> MEM_PAGE_SHIFT; page++) {
+      if (ckpt_page_is_zero(region->mem + ((uint64_t)page << MEM_PAGE_SHIFT)))
+        continue;
+      index = realloc(index, (npages + 1) * sizeof(uint64_t));
+      index[npages++] = region->start + ((uint64_t)page << MEM_PAGE_SHIFT);
+    }
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = CKPT_MAGIC;
+  hdr.version = CKPT_VERSION;
+  hdr.page_size = MEM_PAGE_SIZE;
+  hdr.instruction_count = sim->INSTRUCTION_COUNT;
+  hdr.pc = sim->CURRENT_STATE.PC;
+  for (k = 0; k < ARM_REGS; k++)
+    hdr.regs[k] = sim->CURRENT_STATE.REGS[k];
+  hdr.flag_n = sim->CURRENT_STATE.FLAG_N;
+  hdr.flag_z = sim->CURRENT_STATE.FLAG_Z;
+  hdr.run_bit = sim->RUN_BIT;
+  hdr.npages = npages;
+  pos = sizeof(hdr) + npages * sizeof(uint64_t);
+  hdr.data_offset = (pos + MEM_PAGE_SIZE - 1) & ~(uint64_t)(MEM_PAGE_SIZE - 1);
+
+  out = fopen(path, "wb");
+  if (out == NULL) {
+    free(index);
+    return ARMSIM_ERR_OPEN;
+  }
+  if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+      fwrite(index, sizeof(uint64_t), npages, out) != npages ||
+      fwrite(zero, 1, hdr.data_offset - pos, out) != hdr.data_offset - pos)
+    err = ARMSIM_ERR_OPEN;
+  for (k = 0; k < npages && err == ARMSIM_OK; k++)
+    if (fwrite(mem_host_ptr(sim, index[k], MEM_PAGE_SIZE, FALSE), MEM_PAGE_SIZE, 1, out) != 1)
+      err = ARMSIM_ERR_OPEN;
+  if (fclose(out) != 0)
+    err = ARMSIM_ERR_OPEN;
+  free(index);
+  return err;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_checkpoint_load                          */
+/*                                                             */
+/* Purpose   : Restore a checkpoint. Guest pages are mapped    */
+/*             straight from the file, copy-on-write, so the   */
+/*             cost is a few mmap calls whatever the size.     */
+/*             Hosts whose page size differs from the guest's  */
+/*             fall back to copying.                           */
+/*                                                             */
+/***************************************************************/
+int armsim_checkpoint_load(armsim_t *sim, const char *path) {
+  const ckpt_header_t *hdr;
+  const uint64_t *index;
+  struct stat st;
+  uint8_t *file;
+  uint32_t k, run;
+  int fd, direct;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return ARMSIM_ERR_OPEN;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ckpt_header_t)) {
+    close(fd);
+    return ARMSIM_ERR_FORMAT;
+  }
+  file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (file == MAP_FAILED) {
+    close(fd);
+    return ARMSIM_ERR_OPEN;
+  }
+
+  hdr = (const ckpt_header_t *)file;
+  index = (const uint64_t *)(file + sizeof(ckpt_header_t));
+  if (hdr->magic != CKPT_MAGIC || hdr->version != CKPT_VERSION ||
+      hdr->page_size != MEM_PAGE_SIZE || hdr->data_offset % MEM_PAGE_SIZE != 0 ||
+      hdr->data_offset < sizeof(ckpt_header_t) + (uint64_t)hdr->npages * sizeof(uint64_t) ||
+      (uint64_t)st.st_size < hdr->data_offset + ((uint64_t)hdr->npages << MEM_PAGE_SHIFT)) {
+    munmap(file, st.st_size);
+    close(fd);
+    return ARMSIM_ERR_FORMAT;
+  }
+  /* every entry a whole RAM page, in ascending order, before any
+     of the live machine is wiped */
+  for (k = 0; k < hdr->npages; k++)
+    if (index[k] % MEM_PAGE_SIZE != 0 || (k > 0 && index[k] <= index[k - 1]) ||
+        mem_host_ptr(sim, index[k], MEM_PAGE_SIZE, FALSE) == NULL) {
+      munmap(file, st.st_size);
+      close(fd);
+      return ARMSIM_ERR_FORMAT;
+    }
+
+  device_flush_all(sim);
+  mem_zero(sim);
+  direct = sysconf(_SC_PAGESIZE) == MEM_PAGE_SIZE;
+  for (k = 0; k < hdr->npages; k += run) {
+    uint64_t offset = hdr->data_offset + ((uint64_t)k << MEM_PAGE_SHIFT);
+
+    /* one mapping per run of consecutive guest pages */
+    for (run = 1; k + run < hdr->npages &&
+                  index[k + run] == index[k] + ((uint64_t)run << MEM_PAGE_SHIFT); run++)
+      ;
+    if (!direct || mem_map_file(sim, index[k], run, fd, offset) != 0)
+      armsim_write_mem(sim, index[k], file + offset, (uint64_t)run << MEM_PAGE_SHIFT);
+  }
+
+  sim->CURRENT_STATE.PC = hdr->pc;
+  for (k = 0; k < ARM_REGS; k++)
+    sim->CURRENT_STATE.REGS[k] = hdr->regs[k];
+  sim->CURRENT_STATE.FLAG_N = hdr->flag_n;
+  sim->CURRENT_STATE.FLAG_Z = hdr->flag_z;
+  sim->NEXT_STATE = sim->CURRENT_STATE;
+  sim->INSTRUCTION_COUNT = hdr->instruction_count;
+  sim->RUN_BIT = hdr->run_bit;
+  sim->EXCL_VALID = FALSE;
+  if (sim->UNDO != NULL)
+    undo_reset(sim);
+
+  /* the guest mappings keep the file referenced */
+  munmap(file, st.st_size);
+  close(fd);
+  return ARMSIM_OK;
+}
@@ -0,0 +1,85 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Buffered UART-style console device                        */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "engine.h"
+#include "device.h"
+
+#define CONSOLE_BUFFER_SIZE 65536
+
+typedef struct {
+  char buffer[CONSOLE_BUFFER_SIZE];
+  int used;
+} console_state_t;
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: console_flush                                    */
+/*                                                             */
+/* Purpose: Write the buffered bytes to stdout in one chunk    */
+/*                                                             */
+/***************************************************************/
+static void console_flush(device_t *dev)
+{
+  console_state_t *con = dev->state;
+
+  if (con->used == 0)
+    return;
+  fwrite(con->buffer, 1, con->used, stdout);
+  fflush(stdout);
+  con->used = 0;
+}
+
+static uint32_t console_read_32(sim_ctx_t *ctx, device_t *dev, uint64_t offset)
+{
+  (void)ctx;
+  (void)dev;
+  if (offset == CONSOLE_STATUS)
+    return 1;
+  return 0;
+}
+
+static void console_write_32(sim_ctx_t *ctx, device_t *dev, uint64_t offset, uint32_t value)
+{
+  console_state_t *con = dev->state;
+
+  (void)ctx;
+  switch (offset) {
+  case CONSOLE_TX:
+    if (con->used == CONSOLE_BUFFER_SIZE)
+      console_flush(dev);
+    con->buffer[con->used++] = value & 0xFF;
+    break;
+  case CONSOLE_CTRL:
+    console_flush(dev);
+    break;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: console_init                                     */
+/*                                                             */
+/* Purpose: Map the console into the MMIO window               */
+/*                                                             */
+/***************************************************************/
+void console_init(mem_map_t *mem)
+{
+  device_t *dev = calloc(1, sizeof(device_t));
+
+  dev->name = "console";
+  dev->start = MEM_CONSOLE_START;
+  dev->size = MEM_CONSOLE_SIZE;
+  dev->read_32 = console_read_32;
+  dev->write_32 = console_write_32;
+  dev->flush = console_flush;
+  dev->state = calloc(1, sizeof(console_state_t));
+  if (!device_register(mem, dev))
+    device_destroy(dev);
+}
@@ -0,0 +1,143 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Memory-mapped I/O device table                            */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "engine.h"
+#include "device.h"
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: device_register                                  */
+/*                                                             */
+/* Purpose: Claim [dev->start, dev->start + dev->size) for a   */
+/*          device. Returns FALSE if the table is full or the  */
+/*          range overlaps another device.                     */
+/*                                                             */
+/***************************************************************/
+int device_register(mem_map_t *mem, device_t *dev)
+{
+  int i;
+
+  if (mem->NUM_DEVICES == MAX_DEVICES)
+    return FALSE;
+  for (i = 0; i < mem->NUM_DEVICES; i++)
+    if (dev->start < mem->DEVICES[i]->start + mem->DEVICES[i]->size &&
+        mem->DEVICES[i]->start < dev->start + dev->size)
+      return FALSE;
+
+  mem->DEVICES[mem->NUM_DEVICES++] = dev;
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: device_find                                      */
+/*                                                             */
+/* Purpose: Device claiming address, or NULL. Only reached     */
+/*          after the RAM regions missed.                      */
+/*                                                             */
+/***************************************************************/
+device_t *device_find(mem_map_t *mem, uint64_t address)
+{
+  int i;
+  for (i = 0; i < mem->NUM_DEVICES; i++)
+    if (address >= mem->DEVICES[i]->start &&
+        address < mem->DEVICES[i]->start + mem->DEVICES[i]->size)
+      return mem->DEVICES[i];
+
+  return NULL;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: device_destroy                                   */
+/*                                                             */
+/* Purpose: Flush and free a device and its state              */
+/*                                                             */
+/***************************************************************/
+void device_destroy(device_t *dev)
+{
+  if (dev->flush)
+    dev->flush(dev);
+  free(dev->state);
+  free(dev);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: device_flush_all                                 */
+/*                                                             */
+/* Purpose: Push out buffered device output                    */
+/*                                                             */
+/***************************************************************/
+void device_flush_all(sim_ctx_t *ctx)
+{
+  int i;
+
+  pthread_mutex_lock(&ctx->MEM->DEVICE_LOCK);
+  for (i = 0; i < ctx->MEM->NUM_DEVICES; i++)
+    if (ctx->MEM->DEVICES[i]->flush)
+      ctx->MEM->DEVICES[i]->flush(ctx->MEM->DEVICES[i]);
+  pthread_mutex_unlock(&ctx->MEM->DEVICE_LOCK);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: device_schedule                                  */
+/*                                                             */
+/* Purpose: Ask for device_tick_all once INSTRUCTION_COUNT     */
+/*          reaches when                                       */
+/*                                                             */
+/***************************************************************/
+void device_schedule(sim_ctx_t *ctx, uint64_t when)
+{
+  if (when < ctx->DEVICE_NEXT_EVENT)
+    ctx->DEVICE_NEXT_EVENT = when;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: device_tick_all                                  */
+/*                                                             */
+/* Purpose: Let every device complete due work. Devices with   */
+/*          later work pending call device_schedule again.     */
+/*                                                             */
+/***************************************************************/
+void device_tick_all(sim_ctx_t *ctx)
+{
+  int i;
+
+  ctx->DEVICE_NEXT_EVENT = DEVICE_NO_EVENT;
+  pthread_mutex_lock(&ctx->MEM->DEVICE_LOCK);
+  for (i = 0; i < ctx->MEM->NUM_DEVICES; i++)
+    if (ctx->MEM->DEVICES[i]->tick)
+      ctx->MEM->DEVICES[i]->tick(ctx, ctx->MEM->DEVICES[i]);
+  pthread_mutex_unlock(&ctx->MEM->DEVICE_LOCK);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: device_reset_all                                 */
+/*                                                             */
+/* Purpose: Flush, then return every device to its power-on    */
+/*          state, dropping pending events                     */
+/*                                                             */
+/***************************************************************/
+void device_reset_all(sim_ctx_t *ctx)
+{
+  int i;
+
+  device_flush_all(ctx);
+  ctx->DEVICE_NEXT_EVENT = DEVICE_NO_EVENT;
+  pthread_mutex_lock(&ctx->MEM->DEVICE_LOCK);
+  for (i = 0; i < ctx->MEM->NUM_DEVICES; i++)
+    if (ctx->MEM->DEVICES[i]->reset)
+      ctx->MEM->DEVICES[i]->reset(ctx->MEM->DEVICES[i]);
+  pthread_mutex_unlock(&ctx->MEM->DEVICE_LOCK);
+}
@@ -0,0 +1,81 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Memory-mapped I/O devices                                 */
+/*                                                             */
+/***************************************************************/
+
+#ifndef _SIM_DEVICE_H_
+#define _SIM_DEVICE_H_
+
+#include <inttypes.h>
+#include "engine.h"
+
+/* Devices live in their own window, outside every RAM region, so
+   ordinary loads and stores never look at the device table. */
+#define MEM_MMIO_START    0x20000000
+#define MEM_CONSOLE_START (MEM_MMIO_START + 0x0000)
+#define MEM_CONSOLE_SIZE  0x1000
+#define MEM_DMA_START     (MEM_MMIO_START + 0x1000)
+#define MEM_DMA_SIZE      0x1000
+
+typedef struct device_t {
+  const char *name;
+  uint64_t start, size;
+  uint32_t (*read_32)(sim_ctx_t *ctx, struct device_t *dev, uint64_t offset);
+  void     (*write_32)(sim_ctx_t *ctx, struct device_t *dev, uint64_t offset, uint32_t value);
+  void     (*flush)(struct device_t *dev);                  /* may be NULL */
+  void     (*tick)(sim_ctx_t *ctx, struct device_t *dev);   /* may be NULL */
+  void     (*reset)(struct device_t *dev);                  /* may be NULL */
+  void *state;    /* heap-allocated, freed with the device */
+} device_t;
+
+/* ctx->DEVICE_NEXT_EVENT is the instruction count at which the earliest
+   device event is due. cycle() compares against it once per instruction
+   and calls device_tick_all. */
+#define DEVICE_NO_EVENT UINT64_MAX
+
+int       device_register(mem_map_t *mem, device_t *dev);
+device_t *device_find(mem_map_t *mem, uint64_t address);
+void      device_destroy(device_t *dev);
+void      device_flush_all(sim_ctx_t *ctx);
+void      device_schedule(sim_ctx_t *ctx, uint64_t when);
+void      device_tick_all(sim_ctx_t *ctx);
+void      device_reset_all(sim_ctx_t *ctx);
+
+/* UART-style console:
+     +0x0 TX     write: append the low byte to the output buffer
+     +0x4 STATUS read:  1 (always ready)
+     +0x8 CTRL   write: any value flushes the buffer */
+#define CONSOLE_TX     0x0
+#define CONSOLE_STATUS 0x4
+#define CONSOLE_CTRL   0x8
+
+void console_init(mem_map_t *mem);
+
+/* DMA controller: copies LEN bytes from SRC to DST with host memcpy.
+     +0x00 SRC_LO  +0x04 SRC_HI
+     +0x08 DST_LO  +0x0c DST_HI
+     +0x10 LEN
+     +0x14 START   write: begin the transfer
+     +0x18 STATUS  read: DMA_IDLE, DMA_BUSY, DMA_DONE or DMA_ERROR
+     +0x1c DELAY   instructions between START and completion (0 = at once)
+   Both ranges must lie inside a single RAM region each. */
+#define DMA_SRC_LO  0x00
+#define DMA_SRC_HI  0x04
+#define DMA_DST_LO  0x08
+#define DMA_DST_HI  0x0c
+#define DMA_LEN     0x10
+#define DMA_START   0x14
+#define DMA_STATUS  0x18
+#define DMA_DELAY   0x1c
+
+#define DMA_IDLE  0
+#define DMA_BUSY  1
+#define DMA_DONE  2
+#define DMA_ERROR 3
+
+void dma_init(mem_map_t *mem);
+
+#endif
@@ -0,0 +1,373 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Disassembler: the decoder names the instruction, exactly  */
+/*   as the engine would run it, and a table gives the syntax  */
+/*   of its operands                                           */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "engine.h"
+#include "sim.h"
+#include "armsim.h"
+
+/***************************************************************/
+/* Operand letters in the format strings, fields as in A64:    */
+/*   d n m t   X register at Rd, Rn, Rm, Rt (31 is xzr)        */
+/*   D N       Rd, Rn with 31 as sp                            */
+/*   e f       Rd, Rn, sp only in the extended register form   */
+/*   w s r     Wt, Ws (bits 20:16), Xs (bits 20:16)            */
+/*   I         #imm12, lsl #12 if shifted                      */
+/*   R         Rm with its shift, or extend in the extended    */
+/*             register form (bit 21)                          */
+/*   L         Rm with its logical shift (ror too)             */
+/*   M         bitmask immediate                               */
+/*   W         #imm16 with its lsl by 16 * hw                  */
+/*   H         #imm16                                          */
+/*   K J       lsl / lsr amounts of the bitfield moves         */
+/*   A E       [Xn, #simm9] and [Xn]                           */
+/*   B C       imm26 and imm19 branch targets, absolute        */
+/*   Y         barrier option                                  */
+/* Anything else is copied as is.                              */
+/***************************************************************/
+
+typedef struct {
+  const char *name;          /* as in opcode_table */
+  const char *mnemonic;
+  const char *format;
+  char alias_when;           /* 'd': Rd is 31, 'n': Rn is 31, 0: never */
+  const char *alias;
+  const char *alias_format;
+} disasm_row_t;
+
+static const disasm_row_t disasm_table[] = {
+  {"ADDS(Extended Register)", "adds", "d, f, R", 'd', "cmn", "f, R"},
+  {"ADDS(immediate)", "adds", "d, N, I", 'd', "cmn", "N, I"},
+  {"SUBS(Extended Register)", "subs", "d, f, R", 'd', "cmp", "f, R"},
+  {"SUBS(immediate)", "subs", "d, N, I", 'd', "cmp", "N, I"},
+  {"ADD(Extended Register)", "add", "e, f, R", 0, NULL, NULL},
+  {"ADD(immediate)", "add", "D, N, I", 0, NULL, NULL},
+  {"SUB(immediate)", "sub", "D, N, I", 0, NULL, NULL},
+  {"ANDS(Shifted Register)", "ands", "d, n, L", 'd', "tst", "n, L"},
+  {"EOR(Shifter Register)", "eor", "d, n, L", 0, NULL, NULL},
+  {"ORR(Shifted Register)", "orr", "d, n, L", 'n', "mov", "d, L"},
+  {"AND(immediate)", "and", "D, n, M", 0, NULL, NULL},
+  {"MOVZ", "movz", "d, W", 0, NULL, NULL},
+  {"LSL(Immediate)", "lsl", "d, n, K", 0, NULL, NULL},
+  {"LSR(Immediate)", "lsr", "d, n, J", 0, NULL, NULL},
+  {"MUL", "mul", "d, n, m", 0, NULL, NULL},
+  {"STUR", "stur", "t, A", 0, NULL, NULL},
+  {"LDUR", "ldur", "t, A", 0, NULL, NULL},
+  {"STURB", "sturb", "w, A", 0, NULL, NULL},
+  {"LDURB", "ldurb", "w, A", 0, NULL, NULL},
+  {"STURH", "sturh", "w, A", 0, NULL, NULL},
+  {"LDURH", "ldurh", "w, A", 0, NULL, NULL},
+  {"B", "b", "B", 0, NULL, NULL},
+  {"BR", "br", "n", 0, NULL, NULL},
+  {"BCOND", "b.", "C", 0, NULL, NULL},
+  {"CBZ", "cbz", "t, C", 0, NULL, NULL},
+  {"CBNZ", "cbnz", "t, C", 0, NULL, NULL},
+  {"HLT", "hlt", "H", 0, NULL, NULL},
+  {"LDXR", "ldxr", "t, E", 0, NULL, NULL},
+  {"STXR", "stxr", "s, t, E", 0, NULL, NULL},
+  {"LDADD", "ldadd", "r, t, E", 0, NULL, NULL},
+  {"SWP", "swp", "r, t, E", 0, NULL, NULL},
+  {"CAS", "cas", "r, t, E", 0, NULL, NULL},
+  {"BARRIER", "", "Y", 0, NULL, NULL},
+  {"NOP", "nop", "", 0, NULL, NULL},
+};
+
+#define DISASM_ROWS (sizeof(disasm_table) / sizeof(disasm_table[0]))
+
+static const char *disasm_conds[16] = {
+  "eq", "ne", "cs", "cc", "mi", "pl", "vs", "vc",
+  "hi", "ls", "ge", "lt", "gt", "le", "al", "nv",
+};
+
+/* Row of each opcode_table entry, so a decoded name is found by
+   pointer; names the decoder makes up (SWP, NOP) fall back to strcmp */
+static int disasm_row_of[OPCODE_TABLE_SIZE];
+static pthread_once_t disasm_once = PTHREAD_ONCE_INIT;
+
+static void disasm_init(void) {
+  size_t i, k;
+
+  for (i = 0; i < OPCODE_TABLE_SIZE; i++) {
+    disasm_row_of[i] = -1;
+    for (k = 0; opcode_table[i].name != NULL && k < DISASM_ROWS; k++)
+      if (strcmp(opcode_table[i].name, disasm_table[k].name) == 0)
+        disasm_row_of[i] = k;
+  }
+}
+
+static const disasm_row_t *disasm_row(const char *name) {
+  size_t i;
+
+  for (i = 0; i < OPCODE_TABLE_SIZE; i++)
+    if (opcode_table[i].name == name)
+      return disasm_row_of[i] >= 0 ? &disasm_table[disasm_row_of[i]] : NULL;
+  for (i = 0; name != NULL && i < DISASM_ROWS; i++)
+    if (strcmp(name, disasm_table[i].name) == 0)
+      return &disasm_table[i];
+  return NULL;
+}
+
+/* Appends to a bounded buffer, keeping count of what didn't fit */
+typedef struct {
+  char *buf;
+  size_t size, len;
+} disasm_out_t;
+
+static void disasm_put(disasm_out_t *out, const char *fmt, ...) {
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(out->len < out->size ? out->buf + out->len : NULL,
+                out->len < out->size ? out->size - out->len : 0, fmt, ap);
+  va_end(ap);
+  if (n > 0)
+    out->len += n;
+}
+
+static void disasm_reg(disasm_out_t *out, uint32_t num, char prefix, int sp) {
+  if (num != 31)
+    disasm_put(out, "%c%u", prefix, num);
+  else if (sp)
+    disasm_put(out, prefix == 'x' ? "sp" : "wsp");
+  else
+    disasm_put(out, "%czr", prefix);
+}
+
+static uint64_t disasm_bitmask(uint32_t n, uint32_t immr, uint32_t imms) {
+  uint32_t len = 31 - __builtin_clz((n << 6) | (~imms & 0x3f));
+  uint32_t size = 1u << len, ones = (imms & (size - 1)) + 1, r = immr & (size - 1);
+  uint64_t elem = ones == 64 ? ~0ULL : (1ULL << ones) - 1, mask, value = 0;
+  uint32_t k;
+
+  mask = size == 64 ? ~0ULL : (1ULL << size) - 1;
+  if (r != 0)
+    elem = ((elem >> r) | (elem << (size - r))) & mask;
+  for (k = 0; k < 64; k += size)
+    value |= elem << k;
+  return value;
+}
+
+/* Branch target, with its symbol when there is one */
+static void disasm_target(disasm_out_t *out, armsim_t *sim, uint64_t target) {
+  uint64_t offset;
+  const char *name = sim != NULL ? armsim_symbol_at(sim, target, &offset) : NULL;
+
+  disasm_put(out, "0x%" PRIx64, target);
+  if (name != NULL && offset == 0)
+    disasm_put(out, " <%s>", name);
+  else if (name != NULL)
+    disasm_put(out, " <%s+0x%" PRIx64 ">", name, offset);
+}
+
+static void disasm_operand(disasm_out_t *out, armsim_t *sim, char c, uint32_t word, uint64_t pc) {
+  static const char *shifts[] = {"lsl", "lsr", "asr", "ror"};
+  static const char *extends[] = {"uxtb", "uxth", "uxtw", "uxtx", "sxtb", "sxth", "sxtw", "sxtx"};
+  static const char *barriers[16] = {
+    "#0", "oshld", "oshst", "osh", "#4", "nshld", "nshst", "nsh",
+    "#8", "ishld", "ishst", "ish", "#12", "ld", "st", "sy",
+  };
+  uint32_t rd = word & 0x1f, rn = (word >> 5) & 0x1f, rm = (word >> 16) & 0x1f;
+  uint32_t imm6 = (word >> 10) & 0x3f, extended = (word >> 21) & 1;
+  int64_t offset;
+
+  switch (c) {
+  case 'd': disasm_reg(out, rd, 'x', FALSE); break;
+  case 'D': disasm_reg(out, rd, 'x', TRUE); break;
+  case 'e': disasm_reg(out, rd, 'x', extended); break;
+  case 'n': disasm_reg(out, rn, 'x', FALSE); break;
+  case 'N': disasm_reg(out, rn, 'x', TRUE); break;
+  case 'f': disasm_reg(out, rn, 'x', extended); break;
+  case 'm': disasm_reg(out, rm, 'x', FALSE); break;
+  case 't': disasm_reg(out, rd, 'x', FALSE); break;
+  case 'w': disasm_reg(out, rd, 'w', FALSE); break;
+  case 's': disasm_reg(out, rm, 'w', FALSE); break;
+  case 'r': disasm_reg(out, rm, 'x', FALSE); break;
+  case 'I':
+    disasm_put(out, "#0x%x", (word >> 10) & 0xfff);
+    if (word & (1 << 22))
+      disasm_put(out, ", lsl #12");
+    break;
+  case 'R':
+    if (extended) {
+      uint32_t option = (word >> 13) & 7, amount = (word >> 10) & 7;
+
+      disasm_reg(out, rm, (option & 3) == 3 ? 'x' : 'w', FALSE);
+      if (option == 3 && (rd == 31 || rn == 31))
+        disasm_put(out, amount ? ", lsl #%u" : "", amount);
+      else
+        disasm_put(out, amount ? ", %s #%u" : ", %s", extends[option], amount);
+      break;
+    }
+    /* fall through */
+  case 'L':
+    disasm_reg(out, rm, 'x', FALSE);
+    if (imm6 != 0 || ((word >> 22) & 3) != 0)
+      disasm_put(out, ", %s #%u", shifts[(word >> 22) & 3], imm6);
+    break;
+  case 'M':
+    disasm_put(out, "#0x%" PRIx64, disasm_bitmask((word >> 22) & 1, (word >> 16) & 0x3f, imm6));
+    break;
+  case 'W':
+    disasm_put(out, "#0x%x", (word >> 5) & 0xffff);
+    if ((word >> 21) & 3)
+      disasm_put(out, ", lsl #%u", 16 * ((word >> 21) & 3));
+    break;
+  case 'H':
+    disasm_put(out, "#0x%x", (word >> 5) & 0xffff);
+    break;
+  case 'K':
+    disasm_put(out, "#%u", 63 - imm6);
+    break;
+  case 'J':
+    disasm_put(out, "#%u", (word >> 16) & 0x3f);
+    break;
+  case 'A':
+    offset = (int32_t)(word << 11) >> 23;
+    disasm_put(out, "[");
+    disasm_reg(out, rn, 'x', TRUE);
+    disasm_put(out, offset ? ", #%" PRId64 "]" : "]", offset);
+    break;
+  case 'E':
+    disasm_put(out, "[");
+    disasm_reg(out, rn, 'x', TRUE);
+    disasm_put(out, "]");
+    break;
+  case 'B':
+    offset = (int32_t)(word << 6) >> 6;
+    disasm_target(out, sim, pc + 4 * offset);
+    break;
+  case 'C':
+    offset = (int32_t)(word << 8) >> 13;
+    disasm_target(out, sim, pc + 4 * offset);
+    break;
+  case 'Y':
+    if (((word >> 12) & 0xf) == 3 && ((word >> 5) & 7) == 6)
+      disasm_put(out, "isb");
+    else if (((word >> 12) & 0xf) == 3 && ((word >> 5) & 7) >= 4)
+      disasm_put(out, "%s\t%s", ((word >> 5) & 7) == 4 ? "dsb" : "dmb", barriers[(word >> 8) & 0xf]);
+    else
+      disasm_put(out, "sys\t#0x%x", word & 0x7ffff);
+    break;
+  default:
+    disasm_put(out, "%c", c);
+  }
+}
+
+/* Render instr (as decoded from word) at pc; sim, if not NULL,
+   names the branch targets */
+static void disasm_format(disasm_out_t *out, armsim_t *sim, const instruction *instr,
+                          uint32_t word, uint64_t pc) {
+  const disasm_row_t *row;
+  const char *mnemonic, *format;
+  uint32_t reg = 31;
+
+  pthread_once(&disasm_once, disasm_init);
+  row = disasm_row(instr->name);
+  if (row == NULL) {
+    disasm_put(out, ".inst\t0x%08x", word);
+    return;
+  }
+
+  mnemonic = row->mnemonic;
+  format = row->format;
+  if (row->alias_when == 'd')
+    reg = word & 0x1f;
+  else if (row->alias_when == 'n')
+    reg = (word >> 5) & 0x1f;
+  if (row->alias_when != 0 && reg == 31) {
+    mnemonic = row->alias;
+    format = row->alias_format;
+  }
+
+  if (strcmp(row->name, "BCOND") == 0)
+    disasm_put(out, "b.%s\t", disasm_conds[word & 0xf]);
+  else if (mnemonic[0] != '\0')
+    disasm_put(out, format[0] != '\0' ? "%s\t" : "%s", mnemonic);
+  for (; *format; format++)
+    disasm_operand(out, sim, *format, word, pc);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_disasm_word                              */
+/*                                                             */
+/* Purpose   : Disassemble one word as if fetched at pc        */
+/*                                                             */
+/***************************************************************/
+int armsim_disasm_word(uint32_t word, uint64_t pc, char *buf, size_t size) {
+  disasm_out_t out = {buf, size, 0};
+  instruction instr = decode_instruction(NULL, word);
+
+  if (size > 0)
+    buf[0] = '\0';
+  disasm_format(&out, NULL, &instr, word, pc);
+  return out.len;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_disasm                                   */
+/*                                                             */
+/* Purpose   : List count words from address, one line each,   */
+/*             labelled with the program's symbols. Text words */
+/*             come from the engine's predecoded table, filled */
+/*             first if it is still lazy. Words are read       */
+/*             straight from RAM, so listing never touches a   */
+/*             device, a watchpoint or the trace; anything     */
+/*             else shows as ??.                               */
+/*                                                             */
+/***************************************************************/
+size_t armsim_disasm(armsim_t *sim, uint64_t address, uint64_t count, char *buf, size_t size) {
+  disasm_out_t out = {buf, size, 0};
+  mem_map_t *mem = sim->MEM;
+  const decoded_t *d;
+  instruction instr;
+  const char *name;
+  const uint8_t *host;
+  uint64_t pc, i, offset;
+  uint32_t word;
+
+  if (size > 0)
+    buf[0] = '\0';
+  predecode_fill(sim);
+  for (i = 0, pc = address & ~3ULL; i < count; i++, pc += 4) {
+    name = armsim_symbol_at(sim, pc, &offset);
+    if (name != NULL && offset == 0)
+      disasm_put(&out, "%s:\n", name);
+    host = mem_host_ptr(sim, pc, 4, FALSE);
+    if (host == NULL) {
+      disasm_put(&out, "%s0x%08" PRIx64 ":  ????????  ??\n",
+                 pc == sim->CURRENT_STATE.PC ? "=> " : "   ", pc);
+      continue;
+    }
+    word = host[0] | (host[1] << 8) | (host[2] << 16) | ((uint32_t)host[3] << 24);
+    d = NULL;
+    if (mem->DECODED != NULL && pc >= mem->DECODED_START &&
+        (pc - mem->DECODED_START) / 4 < mem->NDECODED) {
+      d = &mem->DECODED[(pc - mem->DECODED_START) / 4];
+      if (d->bytecode != word || d->instr.name == NULL)
+        d = NULL;
+    }
+    if (d == NULL)
+      instr = decode_instruction(NULL, word);
+
+    disasm_put(&out, "%s0x%08" PRIx64 ":  %08x  ",
+               pc == sim->CURRENT_STATE.PC ? "=> " : "   ", pc, word);
+    disasm_format(&out, sim, d != NULL ? &d->instr : &instr, word, pc);
+    disasm_put(&out, "\n");
+  }
+  return out.len;
+}
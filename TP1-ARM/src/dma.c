@@ -0,0 +1,135 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   DMA controller device                                     */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "engine.h"
+#include "device.h"
+
+typedef struct {
+  uint64_t src, dst;
+  uint32_t len;
+  uint32_t delay;
+  uint32_t status;
+  uint64_t due;         /* INSTRUCTION_COUNT at which a delayed copy lands */
+  int core;             /* CORE_ID whose INSTRUCTION_COUNT that is */
+} dma_state_t;
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: dma_transfer                                     */
+/*                                                             */
+/* Purpose: Copy the programmed block straight between the     */
+/*          host backings of the two ranges                    */
+/*                                                             */
+/***************************************************************/
+static void dma_transfer(sim_ctx_t *ctx, dma_state_t *dma)
+{
+  uint8_t *src = mem_host_ptr(ctx, dma->src, dma->len, FALSE);
+  uint8_t *dst = mem_host_ptr(ctx, dma->dst, dma->len, TRUE);
+
+  if (src == NULL || dst == NULL) {
+    dma->status = DMA_ERROR;
+    return;
+  }
+  memmove(dst, src, dma->len);
+  dma->status = DMA_DONE;
+}
+
+static uint32_t dma_read_32(sim_ctx_t *ctx, device_t *dev, uint64_t offset)
+{
+  dma_state_t *dma = dev->state;
+
+  (void)ctx;
+  switch (offset) {
+  case DMA_SRC_LO: return dma->src & 0xFFFFFFFF;
+  case DMA_SRC_HI: return dma->src >> 32;
+  case DMA_DST_LO: return dma->dst & 0xFFFFFFFF;
+  case DMA_DST_HI: return dma->dst >> 32;
+  case DMA_LEN:    return dma->len;
+  case DMA_STATUS: return dma->status;
+  case DMA_DELAY:  return dma->delay;
+  }
+  return 0;
+}
+
+static void dma_write_32(sim_ctx_t *ctx, device_t *dev, uint64_t offset, uint32_t value)
+{
+  dma_state_t *dma = dev->state;
+
+  switch (offset) {
+  case DMA_SRC_LO: dma->src = (dma->src & ~0xFFFFFFFFULL) | value; break;
+  case DMA_SRC_HI: dma->src = (dma->src & 0xFFFFFFFFULL) | ((uint64_t)value << 32); break;
+  case DMA_DST_LO: dma->dst = (dma->dst & ~0xFFFFFFFFULL) | value; break;
+  case DMA_DST_HI: dma->dst = (dma->dst & 0xFFFFFFFFULL) | ((uint64_t)value << 32); break;
+  case DMA_LEN:    dma->len = value; break;
+  case DMA_DELAY:  dma->delay = value; break;
+  case DMA_START:
+    if (dma->status == DMA_BUSY)
+      break;
+    if (dma->delay == 0) {
+      dma_transfer(ctx, dma);
+    } else {
+      dma->status = DMA_BUSY;
+      dma->due = ctx->INSTRUCTION_COUNT + dma->delay;
+      dma->core = ctx->CORE_ID;
+      device_schedule(ctx, dma->due);
+    }
+    break;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: dma_tick                                         */
+/*                                                             */
+/* Purpose: Land a delayed transfer once it is due. On a      */
+/*          shared map only the core that started it keeps     */
+/*          time; the others' ticks leave it alone.            */
+/*                                                             */
+/***************************************************************/
+static void dma_tick(sim_ctx_t *ctx, device_t *dev)
+{
+  dma_state_t *dma = dev->state;
+
+  if (dma->status != DMA_BUSY || ctx->CORE_ID != dma->core)
+    return;
+  if (ctx->INSTRUCTION_COUNT >= dma->due)
+    dma_transfer(ctx, dma);
+  else
+    device_schedule(ctx, dma->due);
+}
+
+static void dma_reset(device_t *dev)
+{
+  memset(dev->state, 0, sizeof(dma_state_t));
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: dma_init                                         */
+/*                                                             */
+/* Purpose: Map the DMA controller into the MMIO window        */
+/*                                                             */
+/***************************************************************/
+void dma_init(mem_map_t *mem)
+{
+  device_t *dev = calloc(1, sizeof(device_t));
+
+  dev->name = "dma";
+  dev->start = MEM_DMA_START;
+  dev->size = MEM_DMA_SIZE;
+  dev->read_32 = dma_read_32;
+  dev->write_32 = dma_write_32;
+  dev->tick = dma_tick;
+  dev->reset = dma_reset;
+  dev->state = calloc(1, sizeof(dma_state_t));
+  if (!device_register(mem, dev))
+    device_destroy(dev);
+}
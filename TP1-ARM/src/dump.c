@@ -0,0 +1,426 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Dump engine: memory ranges and register files formatted   */
+/*   once into a large buffer and written to every output      */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "engine.h"
+#include "armsim.h"
+
+/***************************************************************/
+/* RAM is read a page at a time through its host pointer, so   */
+/* there is no region scan per word; only words outside RAM    */
+/* (devices, holes) go through mem_read_32. Text is formatted  */
+/* by hand: printf per word costs more than all the rest.      */
+/***************************************************************/
+
+#define DUMP_BUFFER (1 << 20)
+#define DUMP_LINE   96          /* longest line any format emits */
+
+typedef struct {
+  char *buf;
+  size_t len, size;
+  FILE *const *out;
+  int nout;
+  int err;
+} dump_t;
+
+static void dump_flush(dump_t *d) {
+  int i;
+
+  for (i = 0; i < d->nout; i++)
+    if (fwrite(d->buf, 1, d->len, d->out[i]) != d->len)
+      d->err = ARMSIM_ERR_OPEN;
+  d->len = 0;
+}
+
+/* Room for n more bytes */
+static char *dump_room(dump_t *d, size_t n) {
+  if (d->len + n > d->size)
+    dump_flush(d);
+  return d->buf + d->len;
+}
+
+static void dump_str(dump_t *d, const char *s) {
+  size_t n = strlen(s);
+  int i;
+
+  if (n > d->size) {
+    /* longer than the buffer: straight through */
+    dump_flush(d);
+    for (i = 0; i < d->nout; i++)
+      if (fwrite(s, 1, n, d->out[i]) != n)
+        d->err = ARMSIM_ERR_OPEN;
+    return;
+  }
+  memcpy(dump_room(d, n), s, n);
+  d->len += n;
+}
+
+/* value in hex, at least digits digits */
+static char *dump_hex(char *p, uint64_t value, int digits) {
+  static const char hex[] = "0123456789abcdef";
+  char tmp[16];
+  int n = 0;
+
+  do {
+    tmp[n++] = hex[value & 0xf];
+    value >>= 4;
+  } while (value != 0 || n < digits);
+  while (n > 0)
+    *p++ = tmp[--n];
+  return p;
+}
+
+static char *dump_dec(char *p, int64_t value) {
+  char tmp[20];
+  uint64_t v = value < 0 ? -(uint64_t)value : (uint64_t)value;
+  int n = 0;
+
+  if (value < 0)
+    *p++ = '-';
+  do {
+    tmp[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v != 0);
+  while (n > 0)
+    *p++ = tmp[--n];
+  return p;
+}
+
+/* expect: about how many bytes will be written, so that a page
+   dump does not take a whole megabyte */
+static void dump_begin(dump_t *d, size_t expect, FILE *const *out, int nout) {
+  d->size = expect < DUMP_BUFFER ? expect + 2 * DUMP_LINE : DUMP_BUFFER;
+  d->buf = malloc(d->size);
+  d->len = 0;
+  d->out = out;
+  d->nout = nout;
+  d->err = ARMSIM_OK;
+}
+
+static int dump_end(dump_t *d) {
+  dump_flush(d);
+  free(d->buf);
+  return d->err;
+}
+
+/* One word in the chosen format; first says whether it opens a JSON list */
+static void dump_word(dump_t *d, int format, uint64_t address, uint32_t word, int first) {
+  char *p = dump_room(d, DUMP_LINE), *start = p;
+
+  switch (format) {
+  case ARMSIM_DUMP_BINARY:
+    memcpy(p, &word, 4);
+    p += 4;
+    break;
+  case ARMSIM_DUMP_JSON:
+    if (!first)
+      *p++ = ',';
+    p = dump_dec(p, word);
+    break;
+  default:
+    memcpy(p, "  0x", 4);
+    p = dump_hex(p + 4, address, 8);
+    memcpy(p, " (", 2);
+    p = dump_dec(p + 2, (int64_t)address);
+    memcpy(p, ") : 0x", 6);
+    p = dump_hex(p + 6, word, 1);
+    *p++ = '\n';
+  }
+  d->len += p - start;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_dump_memory                              */
+/*                                                             */
+/* Purpose   : Dump the words from start to stop, inclusive,   */
+/*             to each of the nout streams                     */
+/*                                                             */
+/***************************************************************/
+int armsim_dump_memory(armsim_t *sim, uint64_t start, uint64_t stop, int format,
+                       FILE *const *out, int nout) {
+  char header[128];
+  dump_t d;
+  uint64_t address, left, page_end, n, k;
+  uint8_t *host;
+  uint32_t word;
+
+  left = stop >= start ? (stop - start) / 4 + 1 : 0;
+  dump_begin(&d, left < DUMP_BUFFER ? left * DUMP_LINE : DUMP_BUFFER, out, nout);
+  if (format == ARMSIM_DUMP_JSON) {
+    snprintf(header, sizeof(header), "{\"start\": \"0x%08" PRIx64 "\", \"stop\": \"0x%08" PRIx64
+             "\", \"words\": [", start, stop);
+    dump_str(&d, header);
+  } else if (format == ARMSIM_DUMP_TEXT) {
+    snprintf(header, sizeof(header), "\nMemory content [0x%08" PRIx64 "..0x%08" PRIx64 "] :\n"
+             "-------------------------------------\n", start, stop);
+    dump_str(&d, header);
+  }
+
+  for (address = start; left > 0; ) {
+    /* the words that lie wholly in this page */
+    page_end = (address | (MEM_PAGE_SIZE - 1)) + 1;
+    n = page_end > address ? (page_end - address) / 4 : (0 - address) / 4;
+    if (n > left)
+      n = left;
+    host = n > 0 ? mem_host_ptr(sim, address, 4 * n, FALSE) : NULL;
+    if (n == 0)
+      n = 1;
+
+    for (k = 0; k < n; k++, address += 4) {
+      if (host != NULL)
+        memcpy(&word, host + 4 * k, 4);
+      else
+        word = mem_read_32(sim, address);
+      dump_word(&d, format, address, word, address == start);
+    }
+    left -= n;
+  }
+
+  if (format == ARMSIM_DUMP_JSON)
+    dump_str(&d, "]}\n");
+  else if (format == ARMSIM_DUMP_TEXT)
+    dump_str(&d, "\n");
+  return dump_end(&d);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_dump_registers                           */
+/*                                                             */
+/* Purpose   : Dump the instruction count, PC, registers and   */
+/*             flags: rdump's text, a JSON object, or binary   */
+/*             (all little-endian uint64: count, PC, X0..X31,  */
+/*             N, Z)                                           */
+/*                                                             */
+/***************************************************************/
+int armsim_dump_registers(armsim_t *sim, int format, FILE *const *out, int nout) {
+  CPU_State *state = &sim->CURRENT_STATE;
+  uint64_t values[ARM_REGS + 4], offset;
+  const char *name;
+  char *p;
+  dump_t d;
+  int k;
+
+  dump_begin(&d, (ARM_REGS + 8) * DUMP_LINE, out, nout);
+  switch (format) {
+  case ARMSIM_DUMP_BINARY:
+    values[0] = sim->INSTRUCTION_COUNT;
+    values[1] = state->PC;
+    for (k = 0; k < ARM_REGS; k++)
+      values[2 + k] = state->REGS[k];
+    values[ARM_REGS + 2] = state->FLAG_N;
+    values[ARM_REGS + 3] = state->FLAG_Z;
+    memcpy(dump_room(&d, sizeof(values)), values, sizeof(values));
+    d.len += sizeof(values);
+    break;
+
+  case ARMSIM_DUMP_JSON:
+    p = dump_room(&d, DUMP_LINE);
+    p += sprintf(p, "{\"instructions\": %" PRIu64 ", \"pc\": \"0x%" PRIx64 "\", \"regs\": [",
+                 sim->INSTRUCTION_COUNT, state->PC);
+    d.len = p - d.buf;
+    for (k = 0; k < ARM_REGS; k++) {
+      p = dump_room(&d, DUMP_LINE);
+      p += sprintf(p, "%s\"0x%" PRIx64 "\"", k ? ", " : "", state->REGS[k]);
+      d.len = p - d.buf;
+    }
+    p = dump_room(&d, DUMP_LINE);
+    p += sprintf(p, "], \"flag_n\": %d, \"flag_z\": %d}\n", state->FLAG_N, state->FLAG_Z);
+    d.len = p - d.buf;
+    break;
+
+  default:
+    dump_str(&d, "\nCurrent register/bus values :\n"
+                 "-------------------------------------\n");
+    p = dump_room(&d, DUMP_LINE);
+    p += sprintf(p, "Instruction Count : %" PRIu64 "\nPC                : 0x%" PRIx64,
+                 sim->INSTRUCTION_COUNT, state->PC);
+    d.len = p - d.buf;
+    /* " <name+0x8>" after the PC when the program has symbols */
+    if ((name = armsim_symbol_at(sim, state->PC, &offset)) != NULL) {
+      dump_str(&d, " <");
+      dump_str(&d, name);
+      p = dump_room(&d, DUMP_LINE);
+      p += offset ? sprintf(p, "+0x%" PRIx64 ">", offset) : sprintf(p, ">");
+      d.len = p - d.buf;
+    }
+    dump_str(&d, "\nRegisters:\n");
+    for (k = 0; k < ARM_REGS; k++) {
+      p = dump_room(&d, DUMP_LINE);
+      p += sprintf(p, "X%d: 0x%" PRIx64 "\n", k, state->REGS[k]);
+      d.len = p - d.buf;
+    }
+    p = dump_room(&d, DUMP_LINE);
+    p += sprintf(p, "FLAG_N: %d\nFLAG_Z: %d\n\n", state->FLAG_N, state->FLAG_Z);
+    d.len = p - d.buf;
+  }
+  return dump_end(&d);
+}
+
+/* ARMSIM_DUMP_* for "text", "bin" or "json", -1 for anything else */
+int armsim_dump_format(const char *name) {
+  if (strcmp(name, "text") == 0)
+    return ARMSIM_DUMP_TEXT;
+  if (strcmp(name, "bin") == 0 || strcmp(name, "binary") == 0)
+    return ARMSIM_DUMP_BINARY;
+  if (strcmp(name, "json") == 0)
+    return ARMSIM_DUMP_JSON;
+  return -1;
+}
+
+/***************************************************************/
+/* State records. The fields are gathered as 64-bit words      */
+/* first; the binary record is those words as they are, and    */
+/* the digest is a hash of all of them, so a checker compares  */
+/* two runs by one word and only looks further when they       */
+/* differ. Range hashes fold the Merkle leaves, which stores   */
+/* keep up to date, so no page is read again here.             */
+/***************************************************************/
+
+#define STATE_HEADER 39         /* words before the ranges */
+#define STATE_P1 0x9E3779B185EBCA87ULL
+#define STATE_P2 0xC2B2AE3D27D4EB4FULL
+
+static uint64_t state_mix(uint64_t h, uint64_t w) {
+  h ^= w * STATE_P2;
+  h = ((h << 31) | (h >> 33)) * STATE_P1;
+  h ^= h >> 29;
+  return h;
+}
+
+static int state_page_cmp(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Append (start, size, hash) for each run of consecutive dirty
+   pages of region i to words; returns the new word count */
+static uint64_t state_ranges(armsim_t *sim, int i, uint64_t **words, uint64_t n, uint64_t *cap) {
+  mem_region_t *region = &sim->MEM->REGIONS[i];
+  uint32_t npages = region->size >> MEM_PAGE_SHIFT, nnodes, *pages, k, first;
+  const uint64_t *tree;
+  uint64_t h;
+
+  if (region->ndirty == 0)
+    return n;
+  tree = mem_merkle_tree(sim, i, &nnodes);
+  pages = malloc(region->ndirty * sizeof(uint32_t));
+  memcpy(pages, region->dirty_pages, region->ndirty * sizeof(uint32_t));
+  qsort(pages, region->ndirty, sizeof(uint32_t), state_page_cmp);
+
+  for (k = 0; k < region->ndirty; ) {
+    first = k;
+    h = STATE_P1;
+    do
+      h = state_mix(h, tree[npages + pages[k++]]);
+    while (k < region->ndirty && pages[k] == pages[k - 1] + 1);
+    if (n + 3 > *cap) {
+      *cap *= 2;
+      *words = realloc(*words, *cap * sizeof(uint64_t));
+    }
+    (*words)[n++] = region->start + ((uint64_t)pages[first] << MEM_PAGE_SHIFT);
+    (*words)[n++] = (uint64_t)(k - first) << MEM_PAGE_SHIFT;
+    (*words)[n++] = h;
+  }
+  free(pages);
+  return n;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_dump_state                               */
+/*                                                             */
+/* Purpose   : Write the final-state record of a run: PC,      */
+/*             registers, flags, instruction count and the     */
+/*             dirty memory ranges with their hashes, as one   */
+/*             JSON line or one binary record                  */
+/*                                                             */
+/***************************************************************/
+int armsim_dump_state(armsim_t *sim, const char *name, int format, FILE *const *out, int nout) {
+  CPU_State *state = &sim->CURRENT_STATE;
+  uint64_t *words, n, cap = STATE_HEADER + 3 * 64, k;
+  char *p;
+  dump_t d;
+  int i;
+
+  if (format != ARMSIM_DUMP_JSON && format != ARMSIM_DUMP_BINARY)
+    return ARMSIM_ERR_FORMAT;
+
+  words = malloc(cap * sizeof(uint64_t));
+  words[0] = ARMSIM_STATE_MAGIC;
+  words[3] = sim->INSTRUCTION_COUNT;
+  words[4] = state->PC;
+  for (k = 0; k < ARM_REGS; k++)
+    words[5 + k] = state->REGS[k];
+  words[5 + ARM_REGS] = (state->FLAG_N != 0) | (state->FLAG_Z != 0) << 1 | (!sim->RUN_BIT) << 2;
+  n = STATE_HEADER;
+  /* text is dirty from loading the program, as in the batch dumps */
+  for (i = 0; i < MEM_NREGIONS; i++)
+    if (MEM_TEXT_START - sim->MEM->REGIONS[i].start >= sim->MEM->REGIONS[i].size)
+      n = state_ranges(sim, i, &words, n, &cap);
+  words[1] = n * sizeof(uint64_t);
+  words[6 + ARM_REGS] = (n - STATE_HEADER) / 3;
+  words[2] = STATE_P1;
+  for (k = 3; k < n; k++)
+    words[2] = state_mix(words[2], words[k]);
+
+  dump_begin(&d, format == ARMSIM_DUMP_BINARY ? n * 8 : (ARM_REGS + 8 + n) * DUMP_LINE, out, nout);
+  if (format == ARMSIM_DUMP_BINARY) {
+    for (k = 0; k < n; k++) {
+      memcpy(dump_room(&d, 8), &words[k], 8);
+      d.len += 8;
+    }
+    free(words);
+    return dump_end(&d);
+  }
+
+  dump_str(&d, "{");
+  if (name != NULL) {
+    dump_str(&d, "\"program\": \"");
+    for (; *name != '\0'; name++) {
+      p = dump_room(&d, 8);
+      if (*name == '"' || *name == '\\')
+        *p++ = '\\';
+      if ((unsigned char)*name < 0x20)
+        p += sprintf(p, "\\u%04x", *name);
+      else
+        *p++ = *name;
+      d.len = p - d.buf;
+    }
+    dump_str(&d, "\", ");
+  }
+  p = dump_room(&d, 2 * DUMP_LINE);
+  p += sprintf(p, "\"digest\": \"0x%016" PRIx64 "\", \"halted\": %s, \"instructions\": %" PRIu64
+               ", \"pc\": \"0x%" PRIx64 "\", \"regs\": [", words[2],
+               words[5 + ARM_REGS] & 4 ? "true" : "false", words[3], words[4]);
+  d.len = p - d.buf;
+  for (k = 0; k < ARM_REGS; k++) {
+    p = dump_room(&d, DUMP_LINE);
+    p += sprintf(p, "%s\"0x%" PRIx64 "\"", k ? ", " : "", words[5 + k]);
+    d.len = p - d.buf;
+  }
+  p = dump_room(&d, DUMP_LINE);
+  p += sprintf(p, "], \"flag_n\": %d, \"flag_z\": %d, \"memory\": [",
+               (int)(words[5 + ARM_REGS] & 1), (int)(words[5 + ARM_REGS] >> 1 & 1));
+  d.len = p - d.buf;
+  for (k = STATE_HEADER; k < n; k += 3) {
+    p = dump_room(&d, 2 * DUMP_LINE);
+    p += sprintf(p, "%s{\"start\": \"0x%" PRIx64 "\", \"size\": %" PRIu64 ", \"hash\": \"0x%016"
+                 PRIx64 "\"}", k > STATE_HEADER ? ", " : "", words[k], words[k + 1], words[k + 2]);
+    d.len = p - d.buf;
+  }
+  dump_str(&d, "]}\n");
+  free(words);
+  return dump_end(&d);
+}
@@ -0,0 +1,204 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Engine internals shared by the modules of libarmsim: the  */
+/*   memory map, the simulator context and their hooks         */
+/*                                                             */
+/***************************************************************/
+
+#ifndef _SIM_ENGINE_H_
+#define _SIM_ENGINE_H_
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "shell.h"
+
+/***************************************************************/
+/* Main memory.                                                */
+/***************************************************************/
+
+#define MEM_DATA_START  0x10000000
+#define MEM_DATA_SIZE   0x00100000
+#define MEM_TEXT_START  0x00400000
+#define MEM_TEXT_SIZE   0x00100000
+#define MEM_STACK_START 0xfffffffc
+#define MEM_STACK_SIZE  0x00100000
+
+#define MEM_NREGIONS 3
+
+/* Dirty-page tracking: every store marks its guest page dirty */
+#define MEM_PAGE_SHIFT 12
+#define MEM_PAGE_SIZE  (1 << MEM_PAGE_SHIFT)
+
+/* per-page flag bits, see page_flags below */
+#define PAGE_DIRTY      0x01    /* page stored to since last clear */
+#define PAGE_WATCH_R    0x02    /* a read watchpoint covers this page */
+#define PAGE_WATCH_W    0x04    /* a write watchpoint covers this page */
+#define PAGE_HASH_STALE 0x08    /* stored to since its Merkle leaf was hashed */
+
+typedef struct {
+  uint64_t start, size;
+  uint8_t *mem;
+  uint8_t *page_flags;        /* one PAGE_* byte per guest page */
+  uint32_t *dirty_pages;      /* indices of dirty pages, first-write order */
+  uint32_t ndirty;
+  uint32_t *stale_pages;      /* indices of PAGE_HASH_STALE pages */
+  uint32_t nstale;
+  uint64_t *merkle;           /* 2*npages nodes, root at 1, leaves at npages */
+  uint32_t *snap_epoch;       /* EPOCH when each page's preimage was last kept */
+} mem_region_t;
+
+/* Watchpoints: only pages holding a watch leave the fast path */
+#define WATCH_READ  1
+#define WATCH_WRITE 2
+
+#define MAX_WATCHPOINTS 16
+
+typedef struct {
+  uint64_t start, len;
+  int type;                   /* WATCH_READ and/or WATCH_WRITE */
+  int active;
+} watchpoint_t;
+
+#define MAX_DEVICES 8
+
+struct device_t;
+struct mem_snapshot_t;
+struct undo_log_t;
+struct trace_ring_t;
+
+/* Guest memory map: RAM regions, watchpoints and devices */
+typedef struct {
+  mem_region_t REGIONS[MEM_NREGIONS];
+  watchpoint_t WATCHPOINTS[MAX_WATCHPOINTS];
+  struct device_t *DEVICES[MAX_DEVICES];
+  int NUM_DEVICES;
+  pthread_mutex_t DEVICE_LOCK;  /* serialises device callbacks across SMP cores */
+  int SHARED;                   /* used by several SMP cores, see mem_read_32 */
+  struct mem_snapshot_t *SNAPSHOTS;  /* newest first, see mem_snapshot_take */
+  uint32_t EPOCH;
+  pthread_mutex_t SNAP_LOCK;
+  struct decoded_t *DECODED;    /* predecoded text, see predecode in sim.c */
+  uint64_t DECODED_START;
+  uint32_t NDECODED;
+  int DECODED_SHARED;           /* DECODED belongs to a program image */
+  int DECODED_LAZY;             /* entries still fill at first fetch */
+} mem_map_t;
+
+/***************************************************************/
+/* Simulator context: everything one simulated machine owns.   */
+/* Nothing below is process-global, so independent contexts    */
+/* may run on different threads.                               */
+/***************************************************************/
+
+struct sim_ctx_t {
+  CPU_State CURRENT_STATE, NEXT_STATE;  /* Data Structure for Latch */
+  int RUN_BIT;                          /* run bit */
+  uint64_t INSTRUCTION_COUNT;
+  int WATCH_HIT;      /* set by a watched access, checked by run/go */
+  int WATCH_ARMED;    /* watched accesses only count while simulating */
+  int *STOP;          /* threaded SMP run: set once any core hits a watchpoint */
+  uint64_t DEVICE_NEXT_EVENT;           /* see device.h */
+  mem_map_t *MEM;
+  int OWNS_MEM;       /* FALSE for cores sharing another core's map */
+  int CORE_ID;        /* 0 unless part of an SMP machine */
+  int EXCL_VALID;     /* exclusive monitor for LDXR/STXR */
+  uint64_t EXCL_ADDR, EXCL_VALUE;
+  int VERBOSE;        /* per-instruction debug output from sim.c */
+  struct undo_log_t *UNDO;  /* non-NULL while recording, see record.c */
+  struct mem_snapshot_t *INITIAL;  /* reset point, NULL unless one was set */
+  struct armsim_image_t *IMAGE;    /* image this was created from, or NULL */
+  int LOAD_LINE;      /* line of the error after a malformed program load */
+  char LOAD_MESSAGE[96];  /* and what is wrong there, if known */
+  struct symtab_t *SYMBOLS;  /* the program's symbols, see symbols.c */
+  struct trace_ring_t *TRACE;  /* non-NULL while tracing, see trace.c */
+};
+
+/* Debug chatter from the decoder and the instruction handlers; the
+   decoder runs without a context (NULL) for the disassembler */
+#define SIM_DEBUG(ctx, ...) \
+  do { if ((ctx) != NULL && (ctx)->VERBOSE) printf(__VA_ARGS__); } while (0)
+
+sim_ctx_t *sim_ctx_create();
+sim_ctx_t *sim_ctx_create_shared(mem_map_t *mem);
+void       sim_ctx_destroy(sim_ctx_t *ctx);
+void       cycle(sim_ctx_t *ctx);
+
+mem_map_t *mem_map_create();
+void       mem_map_destroy(mem_map_t *mem);
+
+uint32_t mem_read_32_nowatch(sim_ctx_t *ctx, uint64_t address);
+uint8_t *mem_host_ptr(sim_ctx_t *ctx, uint64_t address, uint64_t len, int for_write);
+
+int      mem_page_dirty(sim_ctx_t *ctx, uint64_t address);
+void     mem_for_each_dirty(sim_ctx_t *ctx,
+                            void (*fn)(uint64_t page_address, void *arg), void *arg);
+void     mem_clear_dirty(sim_ctx_t *ctx);
+
+int      mem_watch_add(sim_ctx_t *ctx, uint64_t start, uint64_t len, int type);
+void     mem_watch_remove(sim_ctx_t *ctx, int n);
+
+/* Merkle hashing: per-page leaves rehashed lazily after stores */
+void            mem_merkle_update(sim_ctx_t *ctx);
+uint64_t        mem_merkle_root(sim_ctx_t *ctx, int region);
+const uint64_t *mem_merkle_tree(sim_ctx_t *ctx, int region, uint32_t *nnodes);
+int             mem_merkle_diff(sim_ctx_t *ctx, int region, const uint64_t *other,
+                                void (*fn)(uint64_t page_address, void *arg), void *arg);
+
+/* Copy-on-write snapshots: a page keeps its preimage the first time
+   it is written after the newest snapshot, so taking one is O(1) and
+   restoring one only touches the pages written since */
+typedef struct mem_snapshot_t mem_snapshot_t;
+
+mem_snapshot_t *mem_snapshot_take(sim_ctx_t *ctx);
+void            mem_snapshot_restore(sim_ctx_t *ctx, mem_snapshot_t *snap);
+void            mem_snapshot_drop(sim_ctx_t *ctx, mem_snapshot_t *snap);
+int             mem_snapshot_live(const mem_snapshot_t *snap);
+uint64_t        mem_snapshot_count(const mem_snapshot_t *snap);
+
+/* Bulk RAM setup for checkpoints: zero everything, then map file
+   pages in copy-on-write */
+void mem_zero(sim_ctx_t *ctx);
+int  mem_map_file(sim_ctx_t *ctx, uint64_t address, uint32_t npages, int fd, uint64_t offset);
+
+/* Recording for reverse execution: cycle() brackets each instruction
+   with undo_begin/undo_end and the store paths report the words they
+   overwrite */
+void undo_begin(sim_ctx_t *ctx);
+void undo_end(sim_ctx_t *ctx);
+void undo_note_store(sim_ctx_t *ctx, uint64_t address, const uint8_t *host);
+void undo_reset(sim_ctx_t *ctx);
+
+/* Tracing: cycle() brackets each instruction with trace_begin/trace_end
+   and the memory paths report every word it reads or writes */
+#define TRACE_LOAD        0
+#define TRACE_STORE       1
+#define TRACE_STORE_LATER 2     /* through a host pointer: value read at the end */
+
+void trace_begin(sim_ctx_t *ctx);
+void trace_end(sim_ctx_t *ctx);
+void trace_note_access(sim_ctx_t *ctx, uint64_t address, uint32_t value, int kind);
+
+/* Symbol tables (symbols.c): filled by a loader, sorted once by
+   symtab_finish and read-only after that, shared by reference */
+typedef struct symtab_t symtab_t;
+
+symtab_t *symtab_create(void);
+void      symtab_add(symtab_t *tab, const char *name, size_t len, uint64_t address);
+void      symtab_finish(symtab_t *tab);
+symtab_t *symtab_ref(symtab_t *tab);
+void      symtab_release(symtab_t *tab);
+
+/* armsim_assemble that also adds the labels to symbols (if not NULL)
+   as addresses from origin */
+int asm_assemble(const char *src, size_t len, uint32_t **words, size_t *nwords,
+                 int *line, char *msg, size_t msgsize, symtab_t *symbols, uint64_t origin);
+
+/* Common tail of every program loader (armsim.c, loader.c). The
+   context takes over symbols, which may be NULL. */
+void load_finish(sim_ctx_t *ctx, uint64_t text, uint32_t nwords, uint64_t entry,
+                 symtab_t *symbols);
+
+#endif
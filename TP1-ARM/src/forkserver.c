@@ -0,0 +1,247 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Fork server: the program is loaded and predecoded once;   */
+/*   every request then runs in a fork()ed child that shares   */
+/*   the loaded machine copy-on-write, so an execution costs   */
+/*   a fork instead of a process start and a program load.     */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "engine.h"
+#include "sim.h"
+#include "armsim.h"
+#include "forkserver.h"
+
+#define FS_DEFAULT_BUDGET 100000000ULL
+
+static int fs_read_full(int fd, void *buf, size_t len) {
+  uint8_t *p = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    n = read(fd, p, len);
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int fs_write_full(int fd, const void *buf, size_t len) {
+  const uint8_t *p = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, p, len);
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static void fs_reserve(uint8_t **buf, size_t *cap, size_t want) {
+  if (want <= *cap)
+    return;
+  *cap = want > 2 * *cap ? want : 2 * *cap;
+  *buf = realloc(*buf, *cap);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : fs_read_request                                 */
+/*                                                             */
+/* Purpose   : Read one request's payload (everything after    */
+/*             the header) into *payload. Returns its size, or */
+/*             -1 on EOF or a malformed request.               */
+/*                                                             */
+/***************************************************************/
+static ssize_t fs_read_request(int fd, const fs_request_t *req, uint8_t **payload,
+                               size_t *cap) {
+  size_t used = 0, need, total = 0;
+  fs_range_t range;
+  uint32_t k;
+
+  /* registers, then each write's range and bytes, then the reads */
+  for (k = 0; k <= req->nwrites + 1; k++) {
+    if (k == 0)
+      need = (size_t)req->nregs * sizeof(fs_reg_t);
+    else if (k <= req->nwrites)
+      need = sizeof(fs_range_t);
+    else
+      need = (size_t)req->nreads * sizeof(fs_range_t);
+    if (need > FS_MAX_PAYLOAD)
+      return -1;
+
+    fs_reserve(payload, cap, used + need);
+    if (fs_read_full(fd, *payload + used, need) != 0)
+      return -1;
+    used += need;
+
+    if (k >= 1 && k <= req->nwrites) {
+      memcpy(&range, *payload + used - sizeof(range), sizeof(range));
+      total += range.len;
+      if (range.len > FS_MAX_PAYLOAD || total > FS_MAX_PAYLOAD)
+        return -1;
+      fs_reserve(payload, cap, used + range.len);
+      if (fs_read_full(fd, *payload + used, range.len) != 0)
+        return -1;
+      used += range.len;
+    }
+  }
+
+  /* and what the response carries back */
+  total = 0;
+  for (k = 0; k < req->nreads; k++) {
+    memcpy(&range, *payload + used - (req->nreads - k) * sizeof(range), sizeof(range));
+    if (range.len > FS_MAX_PAYLOAD || (total += range.len) > FS_MAX_PAYLOAD)
+      return -1;
+  }
+  return used;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : fs_child                                        */
+/*                                                             */
+/* Purpose   : In the forked child: apply the inputs, run and  */
+/*             answer. Ranges that can't be read come back as  */
+/*             zeros.                                          */
+/*                                                             */
+/***************************************************************/
+static void fs_child(armsim_t *sim, const fs_request_t *req, const uint8_t *payload,
+                     uint64_t budget, int out) {
+  fs_response_t *resp;
+  armsim_stats_t stats;
+  const fs_range_t *reads;
+  fs_range_t range;
+  fs_reg_t reg;
+  uint64_t nbytes = 0, pos;
+  uint32_t k;
+  int status = ARMSIM_OK, n, z;
+
+  for (k = 0; k < req->nregs; k++, payload += sizeof(reg)) {
+    memcpy(&reg, payload, sizeof(reg));
+    if (armsim_set_reg(sim, reg.reg, reg.value) != ARMSIM_OK)
+      status = ARMSIM_ERR_RANGE;
+  }
+  for (k = 0; k < req->nwrites; k++) {
+    memcpy(&range, payload, sizeof(range));
+    payload += sizeof(range);
+    if (armsim_write_mem(sim, range.address, payload, range.len) != ARMSIM_OK)
+      status = ARMSIM_ERR_RANGE;
+    payload += range.len;
+  }
+  reads = (const fs_range_t *)payload;
+
+  if (status == ARMSIM_OK)
+    status = armsim_run(sim, req->budget ? req->budget : budget);
+  fflush(stdout);
+
+  for (k = 0; k < req->nreads; k++) {
+    memcpy(&range, &reads[k], sizeof(range));
+    nbytes += range.len;
+  }
+  resp = calloc(1, sizeof(fs_response_t) + nbytes);
+  resp->magic = FS_RESPONSE_MAGIC;
+  resp->status = status;
+  armsim_get_stats(sim, &stats);
+  resp->instructions = stats.instructions;
+  resp->pc = armsim_get_pc(sim);
+  for (k = 0; k < ARM_REGS; k++)
+    resp->regs[k] = armsim_get_reg(sim, k);
+  armsim_get_flags(sim, &n, &z);
+  resp->flag_n = n;
+  resp->flag_z = z;
+  resp->nbytes = nbytes;
+  for (k = 0, pos = 0; k < req->nreads; k++) {
+    memcpy(&range, &reads[k], sizeof(range));
+    if (armsim_read_mem(sim, range.address, (uint8_t *)(resp + 1) + pos, range.len) != ARMSIM_OK)
+      memset((uint8_t *)(resp + 1) + pos, 0, range.len);
+    pos += range.len;
+  }
+  _exit(fs_write_full(out, resp, sizeof(fs_response_t) + nbytes) == 0 ? 0 : 1);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : forkserver_main                                 */
+/*                                                             */
+/***************************************************************/
+int forkserver_main(int argc, char *argv[]) {
+  armsim_t *sim;
+  fs_request_t req;
+  fs_response_t crash;
+  uint8_t *payload = NULL;
+  size_t cap = 0;
+  uint64_t budget = FS_DEFAULT_BUDGET;
+  uint32_t hello = FS_HELLO_MAGIC;
+  const char *path = NULL;
+  int i, out, wstatus;
+  pid_t pid;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      budget = strtoull(argv[++i], NULL, 0);
+    else
+      path = argv[i];
+  }
+  if (path == NULL) {
+    fprintf(stderr, "Error: usage: sim --forkserver [-n budget] <program_file>\n");
+    return 1;
+  }
+
+  sim = armsim_create();
+  switch (armsim_load_file(sim, path, NULL)) {
+  case ARMSIM_OK:
+    break;
+  case ARMSIM_ERR_OPEN:
+    fprintf(stderr, "Error: Can't open program file %s\n", path);
+    return 1;
+  default:
+    fprintf(stderr, "Error: malformed program file %s\n", path);
+    return 1;
+  }
+
+  /* decode everything now so the children don't each do it again */
+  predecode_fill(sim);
+
+  /* keep stdout for the protocol; the guest's console gets stderr */
+  fflush(stdout);
+  out = dup(1);
+  dup2(2, 1);
+
+  if (fs_write_full(out, &hello, sizeof(hello)) != 0)
+    return 1;
+  while (fs_read_full(0, &req, sizeof(req)) == 0) {
+    if (req.magic != FS_REQUEST_MAGIC || fs_read_request(0, &req, &payload, &cap) < 0) {
+      fprintf(stderr, "Error: malformed fork server request\n");
+      return 1;
+    }
+
+    pid = fork();
+    if (pid == 0)
+      fs_child(sim, &req, payload, budget, out);
+    if (pid < 0 || waitpid(pid, &wstatus, 0) < 0 ||
+        !WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+      memset(&crash, 0, sizeof(crash));
+      crash.magic = FS_RESPONSE_MAGIC;
+      crash.status = FS_CRASHED;
+      if (fs_write_full(out, &crash, sizeof(crash)) != 0)
+        return 1;
+    }
+  }
+
+  free(payload);
+  armsim_destroy(sim);
+  return 0;
+}
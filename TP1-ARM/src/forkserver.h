@@ -0,0 +1,67 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Fork server: load once, fork a copy-on-write child per    */
+/*   execution                                                 */
+/*                                                             */
+/***************************************************************/
+
+#ifndef _SIM_FORKSERVER_H_
+#define _SIM_FORKSERVER_H_
+
+#include <inttypes.h>
+
+/* sim --forkserver [-n budget] file.x
+   Loads and predecodes the program, writes FS_HELLO_MAGIC (uint32_t)
+   to stdout and then serves requests from stdin until EOF. Everything
+   is in host byte order.
+
+   Request:  fs_request_t
+             nregs   x fs_reg_t         registers to set
+             nwrites x (fs_range_t, len bytes)  memory to write
+             nreads  x fs_range_t       memory to send back
+   Response: fs_response_t
+             the nreads ranges' bytes, concatenated
+
+   Each request runs in a fork()ed child, so it starts from the
+   freshly loaded machine. Guest console output goes to stderr. */
+
+#define FS_HELLO_MAGIC    0x4f4c4548u   /* "HELO" */
+#define FS_REQUEST_MAGIC  0x51455246u   /* "FREQ" */
+#define FS_RESPONSE_MAGIC 0x50455246u   /* "FREP" */
+
+/* fs_response_t.status besides the ARMSIM_* codes */
+#define FS_CRASHED -100   /* the child died before answering */
+
+#define FS_MAX_PAYLOAD (16 << 20)   /* total bytes written or read back */
+
+typedef struct {
+  uint32_t magic;
+  uint32_t nregs, nwrites, nreads;
+  uint64_t budget;        /* 0 = the server's -n */
+} fs_request_t;
+
+typedef struct {
+  uint32_t reg;
+  uint32_t pad;
+  int64_t  value;
+} fs_reg_t;
+
+typedef struct {
+  uint64_t address, len;
+} fs_range_t;
+
+typedef struct {
+  uint32_t magic;
+  int32_t  status;        /* ARMSIM_HALTED, ARMSIM_BUDGET, ... or FS_CRASHED */
+  uint64_t instructions;
+  uint64_t pc;
+  int64_t  regs[32];
+  int32_t  flag_n, flag_z;
+  uint64_t nbytes;        /* read-back bytes that follow */
+} fs_response_t;
+
+int forkserver_main(int argc, char *argv[]);
+
+#endif
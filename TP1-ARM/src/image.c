@@ -0,0 +1,182 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Program images: a loaded program's pages and predecoded   */
+/*   text, built once and shared read-only by any number of    */
+/*   instances                                                 */
+/*                                                             */
+/***************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "engine.h"
+#include "sim.h"
+#include "armsim.h"
+
+/***************************************************************/
+/* The non-zero pages live in a memfd, so every instance maps  */
+/* them MAP_PRIVATE: all of them share the same physical pages */
+/* until one writes, and then only that page is copied. The    */
+/* predecoded text is shared as is; an instance that rewrites  */
+/* its text misses it at fetch and decodes on its own.         */
+/***************************************************************/
+
+struct armsim_image_t {
+  atomic_int refs;
+  int fd;                 /* memfd with the pages, -1 if unavailable */
+  uint8_t *data;          /* the pages, mapped from fd or malloc'd */
+  uint64_t *index;        /* guest address of each page, ascending */
+  uint32_t npages;
+  CPU_State state;
+  decoded_t *decoded;
+  uint64_t decoded_start;
+  uint32_t ndecoded;
+  symtab_t *symbols;
+};
+
+static int image_page_is_zero(const uint8_t *page) {
+  const uint64_t *w = (const uint64_t *)page;
+  int k;
+
+  for (k = 0; k < MEM_PAGE_SIZE / 8; k++)
+    if (w[k] != 0)
+      return FALSE;
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_image_create                             */
+/*                                                             */
+/* Purpose   : Capture a loaded instance's memory, CPU state,  */
+/*             predecoded text and symbols                     */
+/*                                                             */
+/***************************************************************/
+armsim_image_t *armsim_image_create(armsim_t *sim) {
+  armsim_image_t *img = calloc(1, sizeof(armsim_image_t));
+  mem_map_t *mem = sim->MEM;
+  uint64_t bytes;
+  uint32_t page, k;
+  int i;
+
+  for (i = 0; i < MEM_NREGIONS; i++) {
+    mem_region_t *region = &mem->REGIONS[i];
+
+    for (page = 0; page < region->size >> MEM_PAGE_SHIFT; page++) {
+      if (image_page_is_zero(region->mem + ((uint64_t)page << MEM_PAGE_SHIFT)))
+        continue;
+      img->index = realloc(img->index, (img->npages + 1) * sizeof(uint64_t));
+      img->index[img->npages++] = region->start + ((uint64_t)page << MEM_PAGE_SHIFT);
+    }
+  }
+
+  bytes = (uint64_t)img->npages << MEM_PAGE_SHIFT;
+  img->fd = bytes ? memfd_create("armsim-image", 0) : -1;
+  if (img->fd >= 0 && ftruncate(img->fd, bytes) == 0 &&
+      (img->data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, img->fd, 0)) != MAP_FAILED) {
+    /* filled below, then only ever mapped read-only or private */
+  } else {
+    if (img->fd >= 0)
+      close(img->fd);
+    img->fd = -1;
+    img->data = malloc(bytes ? bytes : 1);
+  }
+  for (k = 0; k < img->npages; k++)
+    armsim_read_mem(sim, img->index[k], img->data + ((uint64_t)k << MEM_PAGE_SHIFT), MEM_PAGE_SIZE);
+
+  img->state = sim->CURRENT_STATE;
+  predecode_fill(sim);
+  if (mem->DECODED != NULL) {
+    img->ndecoded = mem->NDECODED;
+    img->decoded_start = mem->DECODED_START;
+    img->decoded = malloc((img->ndecoded ? img->ndecoded : 1) * sizeof(decoded_t));
+    memcpy(img->decoded, mem->DECODED, img->ndecoded * sizeof(decoded_t));
+  }
+  img->symbols = symtab_ref(sim->SYMBOLS);
+  atomic_init(&img->refs, 1);
+  return img;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_image_load                               */
+/*                                                             */
+/* Purpose   : Build an image straight from a program file     */
+/*                                                             */
+/***************************************************************/
+armsim_image_t *armsim_image_load(const char *path, int *err) {
+  armsim_t *sim = armsim_create();
+  armsim_image_t *img = NULL;
+  int e;
+
+  e = armsim_load_file(sim, path, NULL);
+  if (e == ARMSIM_OK)
+    img = armsim_image_create(sim);
+  if (err)
+    *err = e;
+  armsim_destroy(sim);
+  return img;
+}
+
+/* Drop a reference; instances hold one each */
+void armsim_image_destroy(armsim_image_t *img) {
+  if (atomic_fetch_sub(&img->refs, 1) != 1)
+    return;
+  if (img->fd >= 0) {
+    munmap(img->data, (uint64_t)img->npages << MEM_PAGE_SHIFT);
+    close(img->fd);
+  } else {
+    free(img->data);
+  }
+  free(img->index);
+  free(img->decoded);
+  symtab_release(img->symbols);
+  free(img);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_image_instance                           */
+/*                                                             */
+/* Purpose   : A new instance in the image's state. Its pages  */
+/*             are mapped copy-on-write from the image, one    */
+/*             mmap per run of consecutive pages.              */
+/*                                                             */
+/***************************************************************/
+armsim_t *armsim_image_instance(armsim_image_t *img) {
+  armsim_t *sim = armsim_create();
+  mem_map_t *mem = sim->MEM;
+  int direct = img->fd >= 0 && sysconf(_SC_PAGESIZE) == MEM_PAGE_SIZE;
+  uint32_t k, run;
+
+  for (k = 0; k < img->npages; k += run) {
+    uint64_t offset = (uint64_t)k << MEM_PAGE_SHIFT;
+
+    for (run = 1; k + run < img->npages &&
+                  img->index[k + run] == img->index[k] + ((uint64_t)run << MEM_PAGE_SHIFT); run++)
+      ;
+    if (!direct || mem_map_file(sim, img->index[k], run, img->fd, offset) != 0)
+      armsim_write_mem(sim, img->index[k], img->data + offset, (uint64_t)run << MEM_PAGE_SHIFT);
+  }
+
+  if (img->decoded != NULL) {
+    mem->DECODED = img->decoded;
+    mem->DECODED_START = img->decoded_start;
+    mem->NDECODED = img->ndecoded;
+    mem->DECODED_SHARED = TRUE;
+  }
+  sim->SYMBOLS = symtab_ref(img->symbols);
+  sim->CURRENT_STATE = img->state;
+  sim->NEXT_STATE = img->state;
+  sim->RUN_BIT = TRUE;
+
+  atomic_fetch_add(&img->refs, 1);
+  sim->IMAGE = img;
+  return sim;
+}
@@ -0,0 +1,481 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Program loaders: hex text, assembly, AArch64 ELF and raw  */
+/*   images                                                    */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "engine.h"
+#include "armsim.h"
+
+/* A read-only mapping of a whole program file */
+typedef struct {
+  const uint8_t *data;
+  uint64_t size;
+} loader_file_t;
+
+static int loader_map(const char *path, loader_file_t *file) {
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0)
+    return ARMSIM_ERR_OPEN;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return ARMSIM_ERR_OPEN;
+  }
+  file->size = st.st_size;
+  file->data = NULL;
+  if (file->size > 0) {
+    file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file->data == MAP_FAILED) {
+      close(fd);
+      return ARMSIM_ERR_OPEN;
+    }
+  }
+  close(fd);
+  return ARMSIM_OK;
+}
+
+static void loader_unmap(loader_file_t *file) {
+  if (file->data != NULL)
+    munmap((void *)file->data, file->size);
+}
+
+/* Is [offset, offset + len) inside the file? */
+static int loader_in_file(const loader_file_t *file, uint64_t offset, uint64_t len) {
+  return offset <= file->size && len <= file->size - offset;
+}
+
+/* Copy len bytes of the file to address and zero the next zero bytes.
+   The whole range must lie in one RAM region: nothing is written to a
+   device register or dropped. */
+static int loader_place(armsim_t *sim, const loader_file_t *file, uint64_t offset,
+                        uint64_t len, uint64_t address, uint64_t zero) {
+  static const uint8_t zeros[MEM_PAGE_SIZE];
+  uint64_t k, n;
+
+  if (zero > UINT64_MAX - len ||
+      (len + zero > 0 && mem_host_ptr(sim, address, len + zero, FALSE) == NULL))
+    return ARMSIM_ERR_RANGE;
+  if (len > 0 && armsim_write_mem(sim, address, file->data + offset, len) != ARMSIM_OK)
+    return ARMSIM_ERR_RANGE;
+  for (k = 0; k < zero; k += n) {
+    n = zero - k < MEM_PAGE_SIZE ? zero - k : MEM_PAGE_SIZE;
+    if (armsim_write_mem(sim, address + len + k, zeros, n) != ARMSIM_OK)
+      return ARMSIM_ERR_RANGE;
+  }
+  return ARMSIM_OK;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : loader_elf_segments                             */
+/*                                                             */
+/* Purpose   : Executables: place every PT_LOAD segment at its */
+/*             virtual address. The first executable segment   */
+/*             is the text that gets predecoded.               */
+/*                                                             */
+/***************************************************************/
+static int loader_elf_segments(armsim_t *sim, const loader_file_t *file,
+                               uint64_t *text, uint32_t *nwords) {
+  const Elf64_Ehdr *eh = (const Elf64_Ehdr *)file->data;
+  const Elf64_Phdr *ph;
+  int i, err;
+
+  if (eh->e_phentsize != sizeof(Elf64_Phdr) ||
+      !loader_in_file(file, eh->e_phoff, (uint64_t)eh->e_phnum * sizeof(Elf64_Phdr)))
+    return ARMSIM_ERR_FORMAT;
+  ph = (const Elf64_Phdr *)(file->data + eh->e_phoff);
+
+  for (i = 0; i < eh->e_phnum; i++) {
+    if (ph[i].p_type != PT_LOAD)
+      continue;
+    if (ph[i].p_filesz > ph[i].p_memsz || !loader_in_file(file, ph[i].p_offset, ph[i].p_filesz))
+      return ARMSIM_ERR_FORMAT;
+    err = loader_place(sim, file, ph[i].p_offset, ph[i].p_filesz, ph[i].p_vaddr,
+                       ph[i].p_memsz - ph[i].p_filesz);
+    if (err != ARMSIM_OK)
+      return err;
+    if ((ph[i].p_flags & PF_X) && *nwords == 0) {
+      *text = ph[i].p_vaddr;
+      *nwords = ph[i].p_filesz / 4;
+    }
+  }
+  return ARMSIM_OK;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : loader_elf_sections                             */
+/*                                                             */
+/* Purpose   : Relocatable objects straight from the assembler */
+/*             have no addresses yet: executable sections go   */
+/*             one after another from MEM_TEXT_START, other    */
+/*             allocated ones from MEM_DATA_START. Relocations */
+/*             are not applied. placed[i] gets the address of  */
+/*             section i, 0 if it isn't loaded.                */
+/*                                                             */
+/***************************************************************/
+static int loader_elf_sections(armsim_t *sim, const loader_file_t *file,
+                               uint64_t *text, uint32_t *nwords, uint64_t *placed) {
+  const Elf64_Ehdr *eh = (const Elf64_Ehdr *)file->data;
+  const Elf64_Shdr *sh;
+  uint64_t next_text = MEM_TEXT_START, next_data = MEM_DATA_START, *next, align;
+  int i, err;
+
+  if (eh->e_shentsize != sizeof(Elf64_Shdr) ||
+      !loader_in_file(file, eh->e_shoff, (uint64_t)eh->e_shnum * sizeof(Elf64_Shdr)))
+    return ARMSIM_ERR_FORMAT;
+  sh = (const Elf64_Shdr *)(file->data + eh->e_shoff);
+
+  for (i = 0; i < eh->e_shnum; i++) {
+    if (!(sh[i].sh_flags & SHF_ALLOC) || sh[i].sh_size == 0)
+      continue;
+    next = (sh[i].sh_flags & SHF_EXECINSTR) ? &next_text : &next_data;
+    align = sh[i].sh_addralign > 1 ? sh[i].sh_addralign : 1;
+    *next = (*next + align - 1) & ~(align - 1);
+
+    if (sh[i].sh_type == SHT_NOBITS) {
+      err = loader_place(sim, file, 0, 0, *next, sh[i].sh_size);
+    } else {
+      if (!loader_in_file(file, sh[i].sh_offset, sh[i].sh_size))
+        return ARMSIM_ERR_FORMAT;
+      err = loader_place(sim, file, sh[i].sh_offset, sh[i].sh_size, *next, 0);
+    }
+    if (err != ARMSIM_OK)
+      return err;
+    placed[i] = *next;
+    *next += sh[i].sh_size;
+  }
+  *text = MEM_TEXT_START;
+  *nwords = (next_text - MEM_TEXT_START) / 4;
+  return ARMSIM_OK;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : loader_elf_symbols                              */
+/*                                                             */
+/* Purpose   : Read .symtab. Object and function symbols and   */
+/*             plain labels are kept; section, file and        */
+/*             undefined symbols, the $x/$d mapping symbols    */
+/*             and .L temporaries are not. With placed (an     */
+/*             object file) a value is an offset into its      */
+/*             section.                                        */
+/*                                                             */
+/***************************************************************/
+static symtab_t *loader_elf_symbols(const loader_file_t *file, const uint64_t *placed) {
+  const Elf64_Ehdr *eh = (const Elf64_Ehdr *)file->data;
+  const Elf64_Shdr *sh, *strtab;
+  const Elf64_Sym *sym;
+  symtab_t *symbols = symtab_create();
+  const char *name;
+  uint64_t k, n, address;
+  size_t len;
+  int i, type;
+
+  if (eh->e_shentsize != sizeof(Elf64_Shdr) ||
+      !loader_in_file(file, eh->e_shoff, (uint64_t)eh->e_shnum * sizeof(Elf64_Shdr))) {
+    symtab_finish(symbols);
+    return symbols;
+  }
+  sh = (const Elf64_Shdr *)(file->data + eh->e_shoff);
+
+  for (i = 0; i < eh->e_shnum; i++) {
+    if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum ||
+        sh[i].sh_entsize != sizeof(Elf64_Sym) || !loader_in_file(file, sh[i].sh_offset, sh[i].sh_size))
+      continue;
+    strtab = &sh[sh[i].sh_link];
+    if (!loader_in_file(file, strtab->sh_offset, strtab->sh_size))
+      continue;
+    sym = (const Elf64_Sym *)(file->data + sh[i].sh_offset);
+    n = sh[i].sh_size / sizeof(Elf64_Sym);
+
+    for (k = 0; k < n; k++) {
+      type = ELF64_ST_TYPE(sym[k].st_info);
+      if ((type != STT_NOTYPE && type != STT_FUNC && type != STT_OBJECT) ||
+          sym[k].st_shndx == SHN_UNDEF || sym[k].st_shndx >= SHN_LORESERVE ||
+          sym[k].st_name >= strtab->sh_size)
+        continue;
+      name = (const char *)file->data + strtab->sh_offset + sym[k].st_name;
+      len = strnlen(name, strtab->sh_size - sym[k].st_name);
+      if (len == 0 || name[0] == '$' || (len >= 2 && name[0] == '.' && name[1] == 'L'))
+        continue;
+      address = sym[k].st_value;
+      if (placed != NULL) {
+        if (sym[k].st_shndx >= eh->e_shnum || placed[sym[k].st_shndx] == 0)
+          continue;
+        address += placed[sym[k].st_shndx];
+      }
+      symtab_add(symbols, name, len, address);
+    }
+  }
+  symtab_finish(symbols);
+  return symbols;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_load_elf                                 */
+/*                                                             */
+/* Purpose   : Load a little-endian AArch64 ELF64 executable   */
+/*             or relocatable object and its symbols. The PC   */
+/*             starts at the entry point (MEM_TEXT_START for   */
+/*             objects).                                       */
+/*                                                             */
+/***************************************************************/
+int armsim_load_elf(armsim_t *sim, const char *path, int *nwords) {
+  loader_file_t file;
+  const Elf64_Ehdr *eh;
+  symtab_t *symbols;
+  uint64_t *placed = NULL;
+  uint64_t text = MEM_TEXT_START, entry;
+  uint32_t words = 0;
+  int err;
+
+  if (nwords)
+    *nwords = 0;
+  err = loader_map(path, &file);
+  if (err != ARMSIM_OK)
+    return err;
+
+  eh = (const Elf64_Ehdr *)file.data;
+  if (file.size < sizeof(Elf64_Ehdr) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+      eh->e_ident[EI_CLASS] != ELFCLASS64 || eh->e_ident[EI_DATA] != ELFDATA2LSB ||
+      eh->e_machine != EM_AARCH64) {
+    loader_unmap(&file);
+    return ARMSIM_ERR_FORMAT;
+  }
+
+  if (eh->e_type == ET_REL) {
+    placed = calloc(eh->e_shnum ? eh->e_shnum : 1, sizeof(uint64_t));
+    err = loader_elf_sections(sim, &file, &text, &words, placed);
+    entry = MEM_TEXT_START;
+  } else {
+    err = loader_elf_segments(sim, &file, &text, &words);
+    entry = eh->e_entry;
+  }
+  symbols = err == ARMSIM_OK ? loader_elf_symbols(&file, placed) : NULL;
+  free(placed);
+  loader_unmap(&file);
+  if (err != ARMSIM_OK)
+    return err;
+
+  load_finish(sim, text, words, entry, symbols);
+  if (nwords)
+    *nwords = words;
+  return ARMSIM_OK;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_load_binary                              */
+/*                                                             */
+/* Purpose   : Load raw little-endian words at MEM_TEXT_START */
+/*                                                             */
+/***************************************************************/
+int armsim_load_binary(armsim_t *sim, const char *path, int *nwords) {
+  loader_file_t file;
+  int err;
+
+  if (nwords)
+    *nwords = 0;
+  err = loader_map(path, &file);
+  if (err != ARMSIM_OK)
+    return err;
+  if (file.size % 4 != 0 || file.size > MEM_TEXT_SIZE) {
+    loader_unmap(&file);
+    return ARMSIM_ERR_FORMAT;
+  }
+  err = loader_place(sim, &file, 0, file.size, MEM_TEXT_START, 0);
+  loader_unmap(&file);
+  if (err != ARMSIM_OK)
+    return err;
+
+  load_finish(sim, MEM_TEXT_START, file.size / 4, MEM_TEXT_START, NULL);
+  if (nwords)
+    *nwords = file.size / 4;
+  return ARMSIM_OK;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_load_hex                                 */
+/*                                                             */
+/* Purpose   : Load a hex program, one word per line. The file */
+/*             is scanned in place from an mmap and the words  */
+/*             go to the text segment a chunk at a time.       */
+/*             Whitespace between words is free; a word must   */
+/*             be up to 8 hex digits with an optional 0x. On   */
+/*             ARMSIM_ERR_FORMAT the line of the bad word is   */
+/*             left in LOAD_LINE.                              */
+/*                                                             */
+/***************************************************************/
+#define HEX_CHUNK 4096   /* words per bulk write */
+
+/* hex digit value, or 0xff */
+static uint8_t hex_value[256];
+
+static void hex_init(void) {
+  int c;
+
+  for (c = 0; c < 256; c++)
+    hex_value[c] = 0xff;
+  for (c = 0; c < 10; c++)
+    hex_value['0' + c] = c;
+  for (c = 0; c < 6; c++)
+    hex_value['a' + c] = hex_value['A' + c] = 10 + c;
+}
+
+int armsim_load_hex(armsim_t *sim, const char *path, int *nwords) {
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  loader_file_t file;
+  uint32_t chunk[HEX_CHUNK], word;
+  const uint8_t *p, *end, *start;
+  uint64_t count = 0, line = 1;
+  int n = 0, err = ARMSIM_OK;
+  uint8_t v;
+
+  pthread_once(&once, hex_init);
+  if (nwords)
+    *nwords = 0;
+  sim->LOAD_LINE = 0;
+  sim->LOAD_MESSAGE[0] = '\0';
+  err = loader_map(path, &file);
+  if (err != ARMSIM_OK)
+    return err;
+
+  p = file.data;
+  end = p + file.size;
+  while (p < end) {
+    /* the common line: exactly eight digits and a newline */
+    if (end - p >= 9 && p[8] == '\n') {
+      word = 0;
+      for (v = 0; v < 8 && hex_value[p[v]] != 0xff; v++)
+        word = (word << 4) | hex_value[p[v]];
+      if (v == 8) {
+        chunk[n++] = word;
+        p += 9;
+        line++;
+        goto stored;
+      }
+    }
+
+    if (*p == '\n') {
+      line++;
+      p++;
+      continue;
+    }
+    if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\v' || *p == '\f') {
+      p++;
+      continue;
+    }
+
+    if (end - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+      p += 2;
+    word = 0;
+    for (start = p; p < end && (v = hex_value[*p]) != 0xff; p++)
+      word = (word << 4) | v;
+    if (p == start || p - start > 8 ||
+        (p < end && !(*p == ' ' || *p == '\n' || (*p >= '\t' && *p <= '\r')))) {
+      err = ARMSIM_ERR_FORMAT;
+      sim->LOAD_LINE = line;
+      break;
+    }
+    chunk[n++] = word;
+
+  stored:
+    if (n == HEX_CHUNK) {
+      if (count + n > MEM_TEXT_SIZE / 4) {
+        err = ARMSIM_ERR_RANGE;
+        break;
+      }
+      armsim_write_mem(sim, MEM_TEXT_START + 4 * count, chunk, sizeof(chunk));
+      count += n;
+      n = 0;
+    }
+  }
+  loader_unmap(&file);
+
+  if (n > 0 && err != ARMSIM_ERR_RANGE) {
+    if (count + n > MEM_TEXT_SIZE / 4) {
+      err = ARMSIM_ERR_RANGE;
+    } else {
+      armsim_write_mem(sim, MEM_TEXT_START + 4 * count, chunk, 4 * n);
+      count += n;
+    }
+  }
+  if (nwords)
+    *nwords = count;
+  if (err != ARMSIM_OK)
+    return err;
+
+  load_finish(sim, MEM_TEXT_START, count, MEM_TEXT_START, NULL);
+  return ARMSIM_OK;
+}
+
+int armsim_load_error_line(armsim_t *sim) {
+  return sim->LOAD_LINE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_load_asm                                 */
+/*                                                             */
+/* Purpose   : Assemble a .s program with the built-in         */
+/*             assembler and load it at MEM_TEXT_START, with   */
+/*             its labels as symbols                           */
+/*                                                             */
+/***************************************************************/
+int armsim_load_asm(armsim_t *sim, const char *path, int *nwords) {
+  loader_file_t file;
+  symtab_t *symbols;
+  uint32_t *words = NULL;
+  size_t n = 0;
+  int err;
+
+  if (nwords)
+    *nwords = 0;
+  sim->LOAD_LINE = 0;
+  sim->LOAD_MESSAGE[0] = '\0';
+  err = loader_map(path, &file);
+  if (err != ARMSIM_OK)
+    return err;
+  symbols = symtab_create();
+  err = asm_assemble((const char *)file.data, file.size, &words, &n, &sim->LOAD_LINE,
+                     sim->LOAD_MESSAGE, sizeof(sim->LOAD_MESSAGE), symbols, MEM_TEXT_START);
+  loader_unmap(&file);
+  if (err == ARMSIM_OK && n > MEM_TEXT_SIZE / 4) {
+    free(words);
+    err = ARMSIM_ERR_RANGE;
+  }
+  if (err != ARMSIM_OK) {
+    symtab_release(symbols);
+    return err;
+  }
+
+  armsim_write_mem(sim, MEM_TEXT_START, words, 4 * n);
+  free(words);
+  symtab_finish(symbols);
+  load_finish(sim, MEM_TEXT_START, n, MEM_TEXT_START, symbols);
+  if (nwords)
+    *nwords = n;
+  return ARMSIM_OK;
+}
+
+/* What was wrong with the program after ARMSIM_ERR_FORMAT, or "" */
+const char *armsim_load_error_message(armsim_t *sim) {
+  return sim->LOAD_MESSAGE;
+}
@@ -0,0 +1,958 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Guest memory: regions, dirty pages, watchpoints, hashing  */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "engine.h"
+#include "device.h"
+
+static void mem_mark_dirty(mem_region_t *region, uint64_t offset);
+static void mem_before_write(mem_map_t *mem, mem_region_t *region, uint64_t offset);
+static void mem_snapshot_free(mem_map_t *mem, mem_snapshot_t *snap);
+static void mem_merkle_reset(mem_region_t *region);
+static void mem_watch_check(sim_ctx_t *ctx, uint64_t address, int type, uint32_t value);
+static void mem_watch_check_range(sim_ctx_t *ctx, uint64_t address, uint64_t len);
+
+/* Little-endian word at a region offset, without watch checks */
+static uint32_t mem_peek_32(const mem_region_t *region, uint64_t offset)
+{
+    const uint8_t *p = region->mem + offset;
+
+    return (p[3] << 24) | (p[2] << 16) | (p[1] << 8) | (p[0] << 0);
+}
+
+/* Guest word accesses. In a map SMP cores share, an aligned word
+   is one relaxed atomic access, so a core never sees half of
+   another core's store; unaligned ones stay byte-wise */
+static uint32_t mem_load_word(const mem_map_t *mem, const mem_region_t *region, uint64_t offset)
+{
+    if (mem->SHARED && (offset & 3) == 0)
+        return __atomic_load_n((const uint32_t *)(region->mem + offset), __ATOMIC_RELAXED);
+    return mem_peek_32(region, offset);
+}
+
+static void mem_store_word(mem_map_t *mem, mem_region_t *region, uint64_t offset, uint32_t value)
+{
+    uint8_t *p = region->mem + offset;
+
+    if (mem->SHARED && (offset & 3) == 0) {
+        __atomic_store_n((uint32_t *)p, value, __ATOMIC_RELAXED);
+        return;
+    }
+    p[3] = (value >> 24) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[1] = (value >>  8) & 0xFF;
+    p[0] = (value >>  0) & 0xFF;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_read_32 / mem_read_32_nowatch                */
+/*                                                             */
+/* Purpose: Read a 32-bit word from memory. The nowatch read   */
+/*          is for the engine's own reads (instruction fetch,  */
+/*          the read half of a byte store), which the guest    */
+/*          never asked for and read watches must not see.     */
+/*                                                             */
+/***************************************************************/
+static uint32_t mem_read(sim_ctx_t *ctx, uint64_t address, int watch)
+{
+    mem_map_t *mem = ctx->MEM;
+    int i;
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        if (address >= mem->REGIONS[i].start &&
+                address < (mem->REGIONS[i].start + mem->REGIONS[i].size)) {
+            uint32_t offset = address - mem->REGIONS[i].start;
+            uint32_t value = mem_load_word(mem, &mem->REGIONS[i], offset);
+
+            if (watch && (mem->REGIONS[i].page_flags[offset >> MEM_PAGE_SHIFT] & PAGE_WATCH_R))
+                mem_watch_check(ctx, address, WATCH_READ, value);
+            if (ctx->TRACE != NULL)
+                trace_note_access(ctx, address, value, TRACE_LOAD);
+            return value;
+        }
+    }
+
+    /* not RAM: try the memory-mapped devices */
+    device_t *dev = device_find(mem, address);
+    if (dev != NULL) {
+        pthread_mutex_lock(&mem->DEVICE_LOCK);
+        uint32_t value = dev->read_32(ctx, dev, address - dev->start);
+        pthread_mutex_unlock(&mem->DEVICE_LOCK);
+        if (ctx->TRACE != NULL)
+            trace_note_access(ctx, address, value, TRACE_LOAD);
+        return value;
+    }
+
+    if (ctx->TRACE != NULL)
+        trace_note_access(ctx, address, 0, TRACE_LOAD);
+    return 0;
+}
+
+uint32_t mem_read_32(sim_ctx_t *ctx, uint64_t address)
+{
+    return mem_read(ctx, address, TRUE);
+}
+
+uint32_t mem_read_32_nowatch(sim_ctx_t *ctx, uint64_t address)
+{
+    return mem_read(ctx, address, FALSE);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_write_32                                     */
+/*                                                             */
+/* Purpose: Write a 32-bit word to memory                      */
+/*                                                             */
+/***************************************************************/
+void mem_write_32(sim_ctx_t *ctx, uint64_t address, uint32_t value)
+{
+    mem_map_t *mem = ctx->MEM;
+    int i;
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        if (address >= mem->REGIONS[i].start &&
+                address < (mem->REGIONS[i].start + mem->REGIONS[i].size)) {
+            uint32_t offset = address - mem->REGIONS[i].start;
+
+            if (mem->REGIONS[i].page_flags[offset >> MEM_PAGE_SHIFT] & PAGE_WATCH_W)
+                mem_watch_check(ctx, address, WATCH_WRITE, value);
+            if (mem->SNAPSHOTS != NULL) {
+                mem_before_write(mem, &mem->REGIONS[i], offset);
+                mem_before_write(mem, &mem->REGIONS[i], offset + 3);
+            }
+            if (ctx->UNDO != NULL)
+                undo_note_store(ctx, address, mem->REGIONS[i].mem + offset);
+            if (ctx->TRACE != NULL)
+                trace_note_access(ctx, address, value, TRACE_STORE);
+
+            mem_store_word(mem, &mem->REGIONS[i], offset, value);
+
+            mem_mark_dirty(&mem->REGIONS[i], offset);
+            if (((offset + 3) >> MEM_PAGE_SHIFT) != (offset >> MEM_PAGE_SHIFT))
+                mem_mark_dirty(&mem->REGIONS[i], offset + 3);
+            return;
+        }
+    }
+
+    /* not RAM: try the memory-mapped devices */
+    device_t *dev = device_find(mem, address);
+    if (dev != NULL) {
+        pthread_mutex_lock(&mem->DEVICE_LOCK);
+        dev->write_32(ctx, dev, address - dev->start, value);
+        pthread_mutex_unlock(&mem->DEVICE_LOCK);
+        if (ctx->TRACE != NULL)
+            trace_note_access(ctx, address, value, TRACE_STORE);
+    }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_mark_dirty                                   */
+/*                                                             */
+/* Purpose: Flag the page holding a region offset as dirty     */
+/*          and hash-stale, appending it to the region's       */
+/*          dirty and stale lists the first time               */
+/*                                                             */
+/***************************************************************/
+static void mem_mark_dirty(mem_region_t *region, uint64_t offset)
+{
+    uint32_t page = offset >> MEM_PAGE_SHIFT;
+
+    /* the 3 pad bytes past the end belong to the last page */
+    if (page >= (region->size >> MEM_PAGE_SHIFT))
+        page = (region->size >> MEM_PAGE_SHIFT) - 1;
+
+    if ((__atomic_load_n(&region->page_flags[page], __ATOMIC_RELAXED) &
+         (PAGE_DIRTY | PAGE_HASH_STALE)) == (PAGE_DIRTY | PAGE_HASH_STALE))
+        return;
+
+    /* cores sharing the map may race here: only the store that
+       actually sets a bit appends the page to that bit's list */
+    uint8_t old = __atomic_fetch_or(&region->page_flags[page],
+                                    PAGE_DIRTY | PAGE_HASH_STALE, __ATOMIC_RELAXED);
+    if (!(old & PAGE_DIRTY))
+        region->dirty_pages[__atomic_fetch_add(&region->ndirty, 1, __ATOMIC_RELAXED)] = page;
+    if (!(old & PAGE_HASH_STALE))
+        region->stale_pages[__atomic_fetch_add(&region->nstale, 1, __ATOMIC_RELAXED)] = page;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_page_dirty                                   */
+/*                                                             */
+/* Purpose: Tell whether the page holding address is dirty     */
+/*                                                             */
+/***************************************************************/
+int mem_page_dirty(sim_ctx_t *ctx, uint64_t address)
+{
+    mem_map_t *mem = ctx->MEM;
+    int i;
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        if (address >= mem->REGIONS[i].start &&
+                address < (mem->REGIONS[i].start + mem->REGIONS[i].size)) {
+            uint64_t offset = address - mem->REGIONS[i].start;
+            return (mem->REGIONS[i].page_flags[offset >> MEM_PAGE_SHIFT] & PAGE_DIRTY) != 0;
+        }
+    }
+
+    return FALSE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_for_each_dirty                               */
+/*                                                             */
+/* Purpose: Call fn with the guest address of every dirty      */
+/*          page. Cost is proportional to the number of dirty  */
+/*          pages, not to the size of the regions.             */
+/*                                                             */
+/***************************************************************/
+void mem_for_each_dirty(sim_ctx_t *ctx,
+                        void (*fn)(uint64_t page_address, void *arg), void *arg)
+{
+    mem_map_t *mem = ctx->MEM;
+    int i;
+    uint32_t k;
+    for (i = 0; i < MEM_NREGIONS; i++)
+        for (k = 0; k < mem->REGIONS[i].ndirty; k++)
+            fn(mem->REGIONS[i].start +
+               ((uint64_t)mem->REGIONS[i].dirty_pages[k] << MEM_PAGE_SHIFT), arg);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_clear_dirty                                  */
+/*                                                             */
+/* Purpose: Forget all dirty pages                             */
+/*                                                             */
+/***************************************************************/
+void mem_clear_dirty(sim_ctx_t *ctx)
+{
+    mem_map_t *mem = ctx->MEM;
+    int i;
+    uint32_t k;
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        for (k = 0; k < mem->REGIONS[i].ndirty; k++)
+            mem->REGIONS[i].page_flags[mem->REGIONS[i].dirty_pages[k]] &= ~PAGE_DIRTY;
+        mem->REGIONS[i].ndirty = 0;
+    }
+}
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_host_ptr                                     */
+/*                                                             */
+/* Purpose: Host pointer to the backing of [address,           */
+/*          address+len), or NULL unless the whole range lies  */
+/*          in one RAM region. With for_write the pages are    */
+/*          marked as if stored to and write watches checked.  */
+/*                                                             */
+/***************************************************************/
+uint8_t *mem_host_ptr(sim_ctx_t *ctx, uint64_t address, uint64_t len, int for_write)
+{
+    mem_map_t *mem = ctx->MEM;
+    int i, watched = FALSE;
+    uint64_t offset, page;
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        if (address >= mem->REGIONS[i].start &&
+                address < (mem->REGIONS[i].start + mem->REGIONS[i].size)) {
+            offset = address - mem->REGIONS[i].start;
+            if (len > mem->REGIONS[i].size - offset)
+                return NULL;
+            /* atomics store through here; bulk host writes are not undone */
+            if (for_write && ctx->UNDO != NULL && len <= 16)
+                for (page = 0; page < len; page += 4)
+                    undo_note_store(ctx, address + page, mem->REGIONS[i].mem + offset + page);
+            if (for_write && ctx->TRACE != NULL && len <= 16)
+                for (page = 0; page < len; page += 4)
+                    trace_note_access(ctx, address + page, 0, TRACE_STORE_LATER);
+            if (for_write && len > 0)
+                for (page = offset >> MEM_PAGE_SHIFT;
+                     page <= (offset + len - 1) >> MEM_PAGE_SHIFT; page++) {
+                    /* other cores mark the same flags dirty meanwhile */
+                    if (__atomic_load_n(&mem->REGIONS[i].page_flags[page], __ATOMIC_RELAXED) &
+                        PAGE_WATCH_W)
+                        watched = TRUE;
+                    if (mem->SNAPSHOTS != NULL)
+                        mem_before_write(mem, &mem->REGIONS[i], page << MEM_PAGE_SHIFT);
+                    mem_mark_dirty(&mem->REGIONS[i], page << MEM_PAGE_SHIFT);
+                }
+            if (watched)
+                mem_watch_check_range(ctx, address, len);
+            return mem->REGIONS[i].mem + offset;
+        }
+    }
+
+    return NULL;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: merkle_mix                                       */
+/*                                                             */
+/* Purpose: 64-bit hash helpers for Merkle leaves and nodes    */
+/*                                                             */
+/***************************************************************/
+#define MERKLE_P1 0x9E3779B185EBCA87ULL
+#define MERKLE_P2 0xC2B2AE3D27D4EB4FULL
+
+static uint64_t merkle_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= MERKLE_P2;
+    h ^= h >> 29;
+    return h;
+}
+
+static uint64_t merkle_hash_page(const uint8_t *page)
+{
+    uint64_t h = MERKLE_P1, w;
+    int k;
+    for (k = 0; k < MEM_PAGE_SIZE; k += 8) {
+        memcpy(&w, page + k, 8);
+        h ^= w * MERKLE_P2;
+        h = ((h << 31) | (h >> 33)) * MERKLE_P1;
+    }
+    return merkle_mix(h);
+}
+
+static uint64_t merkle_hash_node(uint64_t left, uint64_t right)
+{
+    return merkle_mix(left * MERKLE_P1 ^ ((right << 17) | (right >> 47)));
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_merkle_init                                  */
+/*                                                             */
+/* Purpose: Build the Merkle tree of a freshly zeroed region   */
+/*                                                             */
+/***************************************************************/
+static void mem_merkle_init(mem_region_t *region)
+{
+    region->merkle = malloc(2 * (region->size >> MEM_PAGE_SHIFT) * sizeof(uint64_t));
+    mem_merkle_reset(region);
+}
+
+/* Hash tree of an all-zero region */
+static void mem_merkle_reset(mem_region_t *region)
+{
+    uint32_t npages = region->size >> MEM_PAGE_SHIFT, k;
+    uint64_t zero_hash = merkle_hash_page(region->mem);
+
+    for (k = 0; k < npages; k++)
+        region->merkle[npages + k] = zero_hash;
+    for (k = npages - 1; k >= 1; k--)
+        region->merkle[k] = merkle_hash_node(region->merkle[2*k], region->merkle[2*k+1]);
+    region->merkle[0] = 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_merkle_update                                */
+/*                                                             */
+/* Purpose: Rehash the pages stored to since the last update   */
+/*          and the tree nodes above them. Cost is O(k log n)  */
+/*          for k stale pages out of n.                        */
+/*                                                             */
+/***************************************************************/
+void mem_merkle_update(sim_ctx_t *ctx)
+{
+    mem_map_t *mem = ctx->MEM;
+    int i;
+    uint32_t k, node, npages;
+
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        mem_region_t *region = &mem->REGIONS[i];
+        npages = region->size >> MEM_PAGE_SHIFT;
+        for (k = 0; k < region->nstale; k++) {
+            uint32_t page = region->stale_pages[k];
+            region->page_flags[page] &= ~PAGE_HASH_STALE;
+            node = npages + page;
+            region->merkle[node] =
+                merkle_hash_page(region->mem + ((uint64_t)page << MEM_PAGE_SHIFT));
+            for (node >>= 1; node >= 1; node >>= 1)
+                region->merkle[node] =
+                    merkle_hash_node(region->merkle[2*node], region->merkle[2*node+1]);
+        }
+        region->nstale = 0;
+    }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_merkle_root                                  */
+/*                                                             */
+/* Purpose: Up-to-date root hash of region i                   */
+/*                                                             */
+/***************************************************************/
+uint64_t mem_merkle_root(sim_ctx_t *ctx, int i)
+{
+    mem_merkle_update(ctx);
+    return ctx->MEM->REGIONS[i].merkle[1];
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_merkle_tree                                  */
+/*                                                             */
+/* Purpose: Up-to-date tree of region i, *nnodes entries,      */
+/*          laid out as a heap (children of k at 2k, 2k+1)     */
+/*                                                             */
+/***************************************************************/
+const uint64_t *mem_merkle_tree(sim_ctx_t *ctx, int i, uint32_t *nnodes)
+{
+    mem_merkle_update(ctx);
+    *nnodes = 2 * (ctx->MEM->REGIONS[i].size >> MEM_PAGE_SHIFT);
+    return ctx->MEM->REGIONS[i].merkle;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_merkle_diff                                  */
+/*                                                             */
+/* Purpose: Walk region i's tree against another tree of the   */
+/*          same shape, descending only into differing nodes,  */
+/*          and call fn for every differing page. Returns the  */
+/*          number of differing pages.                         */
+/*                                                             */
+/***************************************************************/
+static int merkle_diff_walk(mem_region_t *region, const uint64_t *other, uint32_t node,
+                            void (*fn)(uint64_t page_address, void *arg), void *arg)
+{
+    uint32_t npages = region->size >> MEM_PAGE_SHIFT;
+
+    if (region->merkle[node] == other[node])
+        return 0;
+    if (node >= npages) {
+        if (fn)
+            fn(region->start + ((uint64_t)(node - npages) << MEM_PAGE_SHIFT), arg);
+        return 1;
+    }
+    return merkle_diff_walk(region, other, 2*node, fn, arg) +
+           merkle_diff_walk(region, other, 2*node+1, fn, arg);
+}
+
+int mem_merkle_diff(sim_ctx_t *ctx, int i, const uint64_t *other,
+                    void (*fn)(uint64_t page_address, void *arg), void *arg)
+{
+    mem_merkle_update(ctx);
+    return merkle_diff_walk(&ctx->MEM->REGIONS[i], other, 1, fn, arg);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_watch_check                                  */
+/*                                                             */
+/* Purpose: Slow path for accesses to pages flagged as         */
+/*          watched: report and stop if a watch really covers  */
+/*          the 4 bytes touched.                               */
+/*                                                             */
+/***************************************************************/
+static void mem_watch_check(sim_ctx_t *ctx, uint64_t address, int type, uint32_t value)
+{
+    mem_map_t *mem = ctx->MEM;
+    int i;
+
+    if (!ctx->WATCH_ARMED)
+        return;
+
+    for (i = 0; i < MAX_WATCHPOINTS; i++) {
+        watchpoint_t *w = &mem->WATCHPOINTS[i];
+        if (!w->active || !(w->type & type))
+            continue;
+        if (address + 4 <= w->start || address >= w->start + w->len)
+            continue;
+
+        printf("Watchpoint %d: %s of 0x%x at 0x%" PRIx64 " (PC 0x%" PRIx64 ")\n",
+               i, type == WATCH_WRITE ? "write" : "read", value, address,
+               ctx->CURRENT_STATE.PC);
+        ctx->WATCH_HIT = TRUE;
+        return;
+    }
+}
+
+/* The same for len bytes written through a host pointer (atomics,
+   DMA), before the caller writes them */
+static void mem_watch_check_range(sim_ctx_t *ctx, uint64_t address, uint64_t len)
+{
+    mem_map_t *mem = ctx->MEM;
+    int i;
+
+    if (!ctx->WATCH_ARMED)
+        return;
+
+    for (i = 0; i < MAX_WATCHPOINTS; i++) {
+        watchpoint_t *w = &mem->WATCHPOINTS[i];
+        if (!w->active || !(w->type & WATCH_WRITE))
+            continue;
+        if (address + len <= w->start || address >= w->start + w->len)
+            continue;
+
+        printf("Watchpoint %d: write of %" PRIu64 " bytes at 0x%" PRIx64 " (PC 0x%" PRIx64 ")\n",
+               i, len, address, ctx->CURRENT_STATE.PC);
+        ctx->WATCH_HIT = TRUE;
+        return;
+    }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_watch_flag_pages                             */
+/*                                                             */
+/* Purpose: Rebuild the PAGE_WATCH_* bits from the active      */
+/*          watchpoints. A page is flagged when a word access  */
+/*          starting in it can overlap a watched byte, so the  */
+/*          fast path only has to look at the first page.      */
+/*                                                             */
+/***************************************************************/
+static void mem_watch_flag_pages(mem_map_t *mem)
+{
+    int i, k;
+    uint32_t page, npages;
+
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        npages = mem->REGIONS[i].size >> MEM_PAGE_SHIFT;
+        for (page = 0; page < npages; page++)
+            mem->REGIONS[i].page_flags[page] &= ~(PAGE_WATCH_R | PAGE_WATCH_W);
+    }
+
+    for (k = 0; k < MAX_WATCHPOINTS; k++) {
+        watchpoint_t *w = &mem->WATCHPOINTS[k];
+        uint8_t bits;
+        if (!w->active)
+            continue;
+        bits = ((w->type & WATCH_READ) ? PAGE_WATCH_R : 0) |
+               ((w->type & WATCH_WRITE) ? PAGE_WATCH_W : 0);
+
+        for (i = 0; i < MEM_NREGIONS; i++) {
+            uint64_t lo = w->start >= 3 ? w->start - 3 : 0;
+            uint64_t hi = w->start + w->len;
+            uint64_t rstart = mem->REGIONS[i].start;
+            uint64_t rend = rstart + mem->REGIONS[i].size;
+            if (hi <= rstart || lo >= rend)
+                continue;
+            if (lo < rstart) lo = rstart;
+            if (hi > rend) hi = rend;
+            for (page = (lo - rstart) >> MEM_PAGE_SHIFT;
+                 page <= (hi - 1 - rstart) >> MEM_PAGE_SHIFT; page++)
+                mem->REGIONS[i].page_flags[page] |= bits;
+        }
+    }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_watch_add                                    */
+/*                                                             */
+/* Purpose: Install a watchpoint over [start, start+len).      */
+/*          Returns its number, or -1 if the table is full.    */
+/*                                                             */
+/***************************************************************/
+int mem_watch_add(sim_ctx_t *ctx, uint64_t start, uint64_t len, int type)
+{
+    mem_map_t *mem = ctx->MEM;
+    int i;
+    for (i = 0; i < MAX_WATCHPOINTS; i++) {
+        if (!mem->WATCHPOINTS[i].active) {
+            mem->WATCHPOINTS[i].start = start;
+            mem->WATCHPOINTS[i].len = len ? len : 1;
+            mem->WATCHPOINTS[i].type = type;
+            mem->WATCHPOINTS[i].active = TRUE;
+            mem_watch_flag_pages(mem);
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_watch_remove                                 */
+/*                                                             */
+/* Purpose: Remove watchpoint n, or all of them if n < 0       */
+/*                                                             */
+/***************************************************************/
+void mem_watch_remove(sim_ctx_t *ctx, int n)
+{
+    mem_map_t *mem = ctx->MEM;
+    int i;
+    for (i = 0; i < MAX_WATCHPOINTS; i++)
+        if (n < 0 || i == n)
+            mem->WATCHPOINTS[i].active = FALSE;
+    mem_watch_flag_pages(mem);
+}
+
+/***************************************************************/
+/* Snapshots. All snapshots of a map sit on one list, newest   */
+/* first; the live ones form an undo chain. Writes keep the    */
+/* preimage of a page in the newest live snapshot the first    */
+/* time the page is written after it, so restoring snapshot S  */
+/* replays the preimages of every live snapshot from the       */
+/* newest down to S. Snapshots newer than S go stale then.     */
+/***************************************************************/
+
+typedef struct {
+    mem_region_t *region;
+    uint32_t page;
+    uint8_t *data;              /* the page as it was, pad bytes included */
+} mem_preimage_t;
+
+struct mem_snapshot_t {
+    CPU_State state;
+    uint64_t instruction_count;
+    int run_bit;
+    int live;
+    mem_preimage_t *pre;
+    uint32_t npre, cap;
+    struct mem_snapshot_t *older, *newer;
+};
+
+/* bytes of host backing covered by a page, the last one owning the pad */
+static uint64_t mem_page_bytes(mem_region_t *region, uint32_t page)
+{
+    if (page == (region->size >> MEM_PAGE_SHIFT) - 1)
+        return MEM_PAGE_SIZE + 3;
+    return MEM_PAGE_SIZE;
+}
+
+static mem_snapshot_t *mem_snapshot_newest_live(mem_map_t *mem)
+{
+    mem_snapshot_t *snap;
+
+    for (snap = mem->SNAPSHOTS; snap != NULL; snap = snap->older)
+        if (snap->live)
+            return snap;
+    return NULL;
+}
+
+static void mem_snapshot_push(mem_snapshot_t *snap, mem_region_t *region,
+                              uint32_t page, uint8_t *data)
+{
+    if (snap->npre == snap->cap) {
+        snap->cap = snap->cap ? 2 * snap->cap : 64;
+        snap->pre = realloc(snap->pre, snap->cap * sizeof(mem_preimage_t));
+    }
+    snap->pre[snap->npre].region = region;
+    snap->pre[snap->npre].page = page;
+    snap->pre[snap->npre].data = data;
+    snap->npre++;
+}
+
+static void mem_snapshot_clear(mem_snapshot_t *snap)
+{
+    uint32_t k;
+
+    for (k = 0; k < snap->npre; k++)
+        free(snap->pre[k].data);
+    free(snap->pre);
+    snap->pre = NULL;
+    snap->npre = snap->cap = 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_before_write                                 */
+/*                                                             */
+/* Purpose: Keep the preimage of the page holding a region     */
+/*          offset before its first write since the newest     */
+/*          snapshot                                           */
+/*                                                             */
+/***************************************************************/
+static void mem_before_write(mem_map_t *mem, mem_region_t *region, uint64_t offset)
+{
+    uint32_t page = offset >> MEM_PAGE_SHIFT;
+    mem_snapshot_t *snap;
+    uint64_t bytes;
+    uint8_t *data;
+
+    if (page >= (region->size >> MEM_PAGE_SHIFT))
+        page = (region->size >> MEM_PAGE_SHIFT) - 1;
+    if (__atomic_load_n(&region->snap_epoch[page], __ATOMIC_ACQUIRE) == mem->EPOCH)
+        return;
+
+    pthread_mutex_lock(&mem->SNAP_LOCK);
+    snap = mem_snapshot_newest_live(mem);
+    if (region->snap_epoch[page] != mem->EPOCH) {
+        if (snap != NULL) {
+            bytes = mem_page_bytes(region, page);
+            data = malloc(bytes);
+            memcpy(data, region->mem + ((uint64_t)page << MEM_PAGE_SHIFT), bytes);
+            mem_snapshot_push(snap, region, page, data);
+        }
+        __atomic_store_n(&region->snap_epoch[page], mem->EPOCH, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&mem->SNAP_LOCK);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_snapshot_take                                */
+/*                                                             */
+/* Purpose: Capture the CPU state and, lazily, the memory of a */
+/*          machine. Nothing is copied until pages are written.*/
+/*                                                             */
+/***************************************************************/
+mem_snapshot_t *mem_snapshot_take(sim_ctx_t *ctx)
+{
+    mem_map_t *mem = ctx->MEM;
+    mem_snapshot_t *snap = calloc(1, sizeof(mem_snapshot_t));
+
+    snap->state = ctx->CURRENT_STATE;
+    snap->instruction_count = ctx->INSTRUCTION_COUNT;
+    snap->run_bit = ctx->RUN_BIT;
+    snap->live = TRUE;
+
+    pthread_mutex_lock(&mem->SNAP_LOCK);
+    snap->older = mem->SNAPSHOTS;
+    if (mem->SNAPSHOTS != NULL)
+        mem->SNAPSHOTS->newer = snap;
+    mem->SNAPSHOTS = snap;
+    mem->EPOCH++;               /* every page's preimage is now unsaved */
+    pthread_mutex_unlock(&mem->SNAP_LOCK);
+    return snap;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_snapshot_restore                             */
+/*                                                             */
+/* Purpose: Roll a machine back to a live snapshot. Only pages */
+/*          written since it are copied back.                  */
+/*                                                             */
+/***************************************************************/
+void mem_snapshot_restore(sim_ctx_t *ctx, mem_snapshot_t *snap)
+{
+    mem_map_t *mem = ctx->MEM;
+    mem_snapshot_t *t;
+    int32_t k;
+
+    pthread_mutex_lock(&mem->SNAP_LOCK);
+    for (t = mem_snapshot_newest_live(mem); t != NULL; t = t->older) {
+        if (!t->live)
+            continue;
+        /* newest preimage first, so the oldest one of a page wins */
+        for (k = (int32_t)t->npre - 1; k >= 0; k--) {
+            mem_preimage_t *pre = &t->pre[k];
+
+            memcpy(pre->region->mem + ((uint64_t)pre->page << MEM_PAGE_SHIFT), pre->data,
+                   mem_page_bytes(pre->region, pre->page));
+            mem_mark_dirty(pre->region, (uint64_t)pre->page << MEM_PAGE_SHIFT);
+        }
+        mem_snapshot_clear(t);
+        if (t == snap)
+            break;
+        t->live = FALSE;
+    }
+    mem->EPOCH++;
+    pthread_mutex_unlock(&mem->SNAP_LOCK);
+
+    ctx->CURRENT_STATE = snap->state;
+    ctx->NEXT_STATE = snap->state;
+    ctx->INSTRUCTION_COUNT = snap->instruction_count;
+    ctx->RUN_BIT = snap->run_bit;
+    ctx->EXCL_VALID = FALSE;
+}
+
+int mem_snapshot_live(const mem_snapshot_t *snap)
+{
+    return snap->live;
+}
+
+uint64_t mem_snapshot_count(const mem_snapshot_t *snap)
+{
+    return snap->instruction_count;
+}
+
+/* Unlink and free a snapshot, handing its preimages to the next older
+   live one, which still needs them to roll back past this point */
+static void mem_snapshot_free(mem_map_t *mem, mem_snapshot_t *snap)
+{
+    mem_snapshot_t *older;
+    uint32_t k;
+
+    for (older = snap->older; older != NULL && !older->live; older = older->older)
+        ;
+    if (snap->live && older != NULL) {
+        for (k = 0; k < snap->npre; k++)
+            mem_snapshot_push(older, snap->pre[k].region, snap->pre[k].page, snap->pre[k].data);
+        snap->npre = 0;
+    }
+    mem_snapshot_clear(snap);
+
+    if (snap->newer != NULL)
+        snap->newer->older = snap->older;
+    else
+        mem->SNAPSHOTS = snap->older;
+    if (snap->older != NULL)
+        snap->older->newer = snap->newer;
+    free(snap);
+}
+
+void mem_snapshot_drop(sim_ctx_t *ctx, mem_snapshot_t *snap)
+{
+    pthread_mutex_lock(&ctx->MEM->SNAP_LOCK);
+    mem_snapshot_free(ctx->MEM, snap);
+    pthread_mutex_unlock(&ctx->MEM->SNAP_LOCK);
+}
+
+/* Host backing of a region: its pages, the 3 pad bytes rounded up */
+static uint64_t mem_region_bytes(mem_region_t *region)
+{
+    return region->size + MEM_PAGE_SIZE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_zero                                         */
+/*                                                             */
+/* Purpose: Return all RAM to zero by swapping in fresh        */
+/*          anonymous pages. Dirty state is cleared, the hash  */
+/*          trees reset and any snapshots go stale.            */
+/*                                                             */
+/***************************************************************/
+void mem_zero(sim_ctx_t *ctx)
+{
+    mem_map_t *mem = ctx->MEM;
+    mem_snapshot_t *snap;
+    uint32_t k;
+    int i;
+
+    pthread_mutex_lock(&mem->SNAP_LOCK);
+    for (snap = mem->SNAPSHOTS; snap != NULL; snap = snap->older) {
+        mem_snapshot_clear(snap);
+        snap->live = FALSE;
+    }
+    pthread_mutex_unlock(&mem->SNAP_LOCK);
+
+    mem_clear_dirty(ctx);
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        mem_region_t *region = &mem->REGIONS[i];
+
+        /* out of mappings: zero the old pages in place instead */
+        if (mmap(region->mem, mem_region_bytes(region), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+            memset(region->mem, 0, mem_region_bytes(region));
+        for (k = 0; k < region->nstale; k++)
+            region->page_flags[region->stale_pages[k]] &= ~PAGE_HASH_STALE;
+        region->nstale = 0;
+        mem_merkle_reset(region);
+    }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_map_file                                     */
+/*                                                             */
+/* Purpose: Back npages guest pages, starting at a page        */
+/*          boundary of a region, with a private copy-on-write */
+/*          mapping of a file. Pages are read on first touch.  */
+/*                                                             */
+/***************************************************************/
+int mem_map_file(sim_ctx_t *ctx, uint64_t address, uint32_t npages, int fd, uint64_t offset)
+{
+    mem_map_t *mem = ctx->MEM;
+    uint64_t len = (uint64_t)npages << MEM_PAGE_SHIFT, k;
+    int i;
+
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        mem_region_t *region = &mem->REGIONS[i];
+
+        if (address < region->start || address >= region->start + region->size)
+            continue;
+        if (((address - region->start) & (MEM_PAGE_SIZE - 1)) ||
+                len > region->start + region->size - address)
+            return -1;
+        if (mmap(region->mem + (address - region->start), len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED, fd, offset) == MAP_FAILED)
+            return -1;
+        for (k = 0; k < len; k += MEM_PAGE_SIZE)
+            mem_mark_dirty(region, address - region->start + k);
+        return 0;
+    }
+    return -1;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_map_create                                   */
+/*                                                             */
+/* Purpose: Allocate and zero a memory map, devices included  */
+/*                                                             */
+/***************************************************************/
+static const struct { uint64_t start, size; } MEM_LAYOUT[MEM_NREGIONS] = {
+    { MEM_TEXT_START, MEM_TEXT_SIZE },
+    { MEM_DATA_START, MEM_DATA_SIZE },
+    { MEM_STACK_START, MEM_STACK_SIZE },
+};
+
+mem_map_t *mem_map_create()
+{
+    mem_map_t *mem = calloc(1, sizeof(mem_map_t));
+    int i;
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        mem->REGIONS[i].start = MEM_LAYOUT[i].start;
+        mem->REGIONS[i].size = MEM_LAYOUT[i].size;
+        // Extra 3 bytes to prevent buffer overflow on unaligned access.
+        // Anonymous mappings so checkpoints can map file pages over them.
+        mem->REGIONS[i].mem = mmap(NULL, mem_region_bytes(&mem->REGIONS[i]),
+                                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        mem->REGIONS[i].page_flags = calloc(mem->REGIONS[i].size >> MEM_PAGE_SHIFT, 1);
+        mem->REGIONS[i].dirty_pages = malloc((mem->REGIONS[i].size >> MEM_PAGE_SHIFT) * sizeof(uint32_t));
+        mem->REGIONS[i].ndirty = 0;
+        mem->REGIONS[i].stale_pages = malloc((mem->REGIONS[i].size >> MEM_PAGE_SHIFT) * sizeof(uint32_t));
+        mem->REGIONS[i].nstale = 0;
+        mem->REGIONS[i].snap_epoch = calloc(mem->REGIONS[i].size >> MEM_PAGE_SHIFT, sizeof(uint32_t));
+        mem_merkle_init(&mem->REGIONS[i]);
+    }
+    pthread_mutex_init(&mem->SNAP_LOCK, NULL);
+    /* recursive: a DMA copy may itself reach a device */
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&mem->DEVICE_LOCK, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    console_init(mem);
+    dma_init(mem);
+    return mem;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: mem_map_destroy                                  */
+/*                                                             */
+/* Purpose: Free a memory map and the devices mapped in it     */
+/*                                                             */
+/***************************************************************/
+void mem_map_destroy(mem_map_t *mem)
+{
+    int i;
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        munmap(mem->REGIONS[i].mem, mem_region_bytes(&mem->REGIONS[i]));
+        free(mem->REGIONS[i].page_flags);
+        free(mem->REGIONS[i].dirty_pages);
+        free(mem->REGIONS[i].stale_pages);
+        free(mem->REGIONS[i].merkle);
+        free(mem->REGIONS[i].snap_epoch);
+    }
+    while (mem->SNAPSHOTS != NULL)
+        mem_snapshot_free(mem, mem->SNAPSHOTS);
+    if (!mem->DECODED_SHARED)
+        free(mem->DECODED);
+    for (i = 0; i < mem->NUM_DEVICES; i++)
+        device_destroy(mem->DEVICES[i]);
+    pthread_mutex_destroy(&mem->DEVICE_LOCK);
+    pthread_mutex_destroy(&mem->SNAP_LOCK);
+    free(mem);
+}
@@ -0,0 +1,96 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Instance pool: loaded simulators of one program, reset    */
+/*   and reused instead of being created and loaded again      */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "engine.h"
+#include "armsim.h"
+
+struct armsim_pool_t {
+  pthread_mutex_t lock;
+  armsim_image_t *image;  /* the program, loaded once */
+  armsim_t **free;        /* reset instances ready to hand out */
+  int nfree, cap;
+};
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_pool_create                              */
+/*                                                             */
+/* Purpose   : Load the program once into an image that new    */
+/*             instances share. Returns NULL and sets *err if  */
+/*             the program can't be loaded.                    */
+/*                                                             */
+/***************************************************************/
+armsim_pool_t *armsim_pool_create(const char *path, int *err) {
+  armsim_image_t *image = armsim_image_load(path, err);
+  armsim_pool_t *pool;
+
+  if (image == NULL)
+    return NULL;
+  pool = calloc(1, sizeof(armsim_pool_t));
+  pthread_mutex_init(&pool->lock, NULL);
+  pool->image = image;
+  pool->cap = 1;
+  pool->free = malloc(sizeof(armsim_t *));
+  return pool;
+}
+
+void armsim_pool_destroy(armsim_pool_t *pool) {
+  int i;
+
+  for (i = 0; i < pool->nfree; i++)
+    armsim_destroy(pool->free[i]);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->free);
+  armsim_image_destroy(pool->image);
+  free(pool);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_pool_get / armsim_pool_put               */
+/*                                                             */
+/* Purpose   : Borrow an instance in the freshly loaded state, */
+/*             making a new one only when none is free; give   */
+/*             one back                                        */
+/*                                                             */
+/***************************************************************/
+armsim_t *armsim_pool_get(armsim_pool_t *pool) {
+  armsim_t *sim = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->nfree > 0)
+    sim = pool->free[--pool->nfree];
+  pthread_mutex_unlock(&pool->lock);
+
+  if (sim == NULL) {
+    sim = armsim_image_instance(pool->image);
+    armsim_reset_point(sim);
+  }
+  return sim;
+}
+
+void armsim_pool_put(armsim_pool_t *pool, armsim_t *sim) {
+  /* a stale initial state (after a checkpoint load) means reloading */
+  if (armsim_reset(sim) != ARMSIM_OK) {
+    armsim_destroy(sim);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->nfree == pool->cap) {
+    pool->cap *= 2;
+    pool->free = realloc(pool->free, pool->cap * sizeof(armsim_t *));
+  }
+  pool->free[pool->nfree++] = sim;
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,489 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Recording and reverse execution                           */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "engine.h"
+#include "device.h"
+#include "armsim.h"
+
+/***************************************************************/
+/* While recording, every retired instruction appends one      */
+/* record to a byte ring holding just what it overwrote:       */
+/*                                                             */
+/*   len tag counts regs.. [flags] [pc] stores.. len           */
+/*                                                             */
+/* tag:    UNDO_HALTED | UNDO_FLAGS | UNDO_JUMP                */
+/* counts: registers changed << 4 | stores                     */
+/* reg:    index byte, varint zigzag(old - new)                */
+/* flags:  old N | old Z << 1                                  */
+/* pc:     varint zigzag(old - new), only for taken branches   */
+/* store:  varint address, varint (old word ^ new word)        */
+/*                                                             */
+/* Values are deltas against the state after the instruction,  */
+/* which is what is in the machine when the record is undone.  */
+/* The length at both ends lets the ring be walked backwards   */
+/* for undo and forwards for eviction. Every interval          */
+/* instructions a copy-on-write snapshot is also taken (see    */
+/* undo_checkpoint for how their number is bounded), so        */
+/* history evicted from the ring is reached by restoring the   */
+/* nearest snapshot and replaying forward. The ring size is a  */
+/* power of two, so positions wrap with a mask, and a record   */
+/* is encoded straight into it unless it would wrap.           */
+/***************************************************************/
+
+#define UNDO_HALTED 0x80        /* HLT (or a fault) cleared RUN_BIT */
+#define UNDO_FLAGS  0x40
+#define UNDO_JUMP   0x20
+
+#define UNDO_MAX_STORES      15
+#define UNDO_MAX_RECORD      255
+#define UNDO_MAX_ENCODE      (UNDO_MAX_RECORD + 16)   /* before the size check */
+#define UNDO_MIN_RING        512
+#define UNDO_MAX_CHECKPOINTS 8
+
+typedef struct {
+  uint64_t address;
+  uint32_t old;
+  const uint8_t *host;        /* the word's backing, read back at the end */
+} undo_store_t;
+
+struct undo_log_t {
+  uint8_t *ring;
+  uint64_t size;              /* the memory limit, a power of two */
+  uint64_t head, tail;        /* absolute byte positions */
+  uint64_t nrecords;
+
+  /* the instruction being retired */
+  int in_instruction;
+  CPU_State before;           /* PC, registers and flags only */
+  int run_bit;
+  undo_store_t stores[UNDO_MAX_STORES];
+  int nstores;
+
+  /* periodic full checkpoints, oldest first */
+  mem_snapshot_t *checkpoints[UNDO_MAX_CHECKPOINTS];
+  int ncheckpoints;
+  uint64_t interval, next_checkpoint;
+};
+
+static uint64_t undo_zigzag(int64_t v) {
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t undo_unzigzag(uint64_t v) {
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int undo_put_varint(uint8_t *out, uint64_t v) {
+  int n = 0;
+
+  while (v >= 0x80) {
+    out[n++] = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  out[n++] = v;
+  return n;
+}
+
+static uint64_t undo_get_varint(const uint8_t *in, int *pos) {
+  uint64_t v = 0;
+  int shift = 0;
+
+  do {
+    v |= (uint64_t)(in[*pos] & 0x7F) << shift;
+    shift += 7;
+  } while (in[(*pos)++] & 0x80);
+  return v;
+}
+
+/* The guest word at address, bypassing read watchpoints */
+static uint32_t undo_peek(sim_ctx_t *ctx, uint64_t address) {
+  uint8_t *p = mem_host_ptr(ctx, address, 4, FALSE);
+  uint32_t w = 0;
+
+  if (p != NULL)
+    memcpy(&w, p, 4);
+  return w;
+}
+
+static uint8_t undo_ring_get(struct undo_log_t *log, uint64_t pos) {
+  return log->ring[pos & (log->size - 1)];
+}
+
+/* A record in or out of the ring, in at most two pieces */
+static void undo_ring_copy_in(struct undo_log_t *log, uint64_t pos, const uint8_t *in, int len) {
+  uint64_t at = pos & (log->size - 1), first = log->size - at;
+
+  if (first >= (uint64_t)len) {
+    memcpy(log->ring + at, in, len);
+  } else {
+    memcpy(log->ring + at, in, first);
+    memcpy(log->ring, in + first, len - first);
+  }
+}
+
+static void undo_ring_copy_out(struct undo_log_t *log, uint64_t pos, uint8_t *out, int len) {
+  uint64_t at = pos & (log->size - 1), first = log->size - at;
+
+  if (first >= (uint64_t)len) {
+    memcpy(out, log->ring + at, len);
+  } else {
+    memcpy(out, log->ring + at, first);
+    memcpy(out + first, log->ring, len - first);
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : undo_checkpoint                                 */
+/*                                                             */
+/* Purpose   : Take a periodic snapshot. When there are too    */
+/*             many, every other one is dropped and the        */
+/*             interval doubled, so the start of the recording */
+/*             stays reachable in bounded memory.              */
+/*                                                             */
+/***************************************************************/
+static void undo_schedule(struct undo_log_t *log, uint64_t when) {
+  log->next_checkpoint = log->interval ? when : UINT64_MAX;
+}
+
+static void undo_checkpoint(sim_ctx_t *ctx) {
+  struct undo_log_t *log = ctx->UNDO;
+  int k;
+
+  if (log->ncheckpoints == UNDO_MAX_CHECKPOINTS) {
+    for (k = 1; k < UNDO_MAX_CHECKPOINTS; k += 2)
+      mem_snapshot_drop(ctx, log->checkpoints[k]);
+    for (k = 0; k < UNDO_MAX_CHECKPOINTS / 2; k++)
+      log->checkpoints[k] = log->checkpoints[2 * k];
+    log->ncheckpoints = UNDO_MAX_CHECKPOINTS / 2;
+    log->interval *= 2;
+  }
+  log->checkpoints[log->ncheckpoints++] = mem_snapshot_take(ctx);
+  undo_schedule(log, ctx->INSTRUCTION_COUNT + log->interval);
+}
+
+/* Forget the ring (the checkpoints stay valid) */
+static void undo_clear(struct undo_log_t *log) {
+  log->head = log->tail = 0;
+  log->nrecords = 0;
+}
+
+void undo_begin(sim_ctx_t *ctx) {
+  struct undo_log_t *log = ctx->UNDO;
+
+  if (ctx->INSTRUCTION_COUNT >= log->next_checkpoint)
+    undo_checkpoint(ctx);
+  /* field by field: a struct copy is a rep movs, which undo_end's
+     loads can't forward from */
+  memcpy(log->before.REGS, ctx->CURRENT_STATE.REGS, sizeof(log->before.REGS));
+  log->before.PC = ctx->CURRENT_STATE.PC;
+  log->before.FLAG_N = ctx->CURRENT_STATE.FLAG_N;
+  log->before.FLAG_Z = ctx->CURRENT_STATE.FLAG_Z;
+  log->run_bit = ctx->RUN_BIT;
+  log->nstores = 0;
+  log->in_instruction = TRUE;
+}
+
+/* Called by the store paths, with the word's backing in RAM,
+   before they overwrite it */
+void undo_note_store(sim_ctx_t *ctx, uint64_t address, const uint8_t *host) {
+  struct undo_log_t *log = ctx->UNDO;
+  undo_store_t *st;
+
+  if (!log->in_instruction || log->nstores == UNDO_MAX_STORES)
+    return;
+  st = &log->stores[log->nstores++];
+  st->address = address;
+  st->host = host;
+  memcpy(&st->old, host, 4);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : undo_end                                        */
+/*                                                             */
+/* Purpose   : Encode what the instruction just retired        */
+/*             overwrote and append it to the ring, evicting   */
+/*             the oldest records to stay within the limit     */
+/*                                                             */
+/***************************************************************/
+void undo_end(sim_ctx_t *ctx) {
+  struct undo_log_t *log = ctx->UNDO;
+  CPU_State *after = &ctx->NEXT_STATE;
+  const int64_t *old = log->before.REGS, *new = after->REGS;
+  uint8_t stage[UNDO_MAX_ENCODE], *rec;
+  uint64_t at;
+  int len = 3, nregs = 0, k;
+  uint32_t changed = 0, now;
+  uint8_t tag = 0;
+
+  log->in_instruction = FALSE;
+  /* room for the longest record, then encode in place unless the
+     ring wraps inside it */
+  while (log->head + UNDO_MAX_ENCODE - log->tail > log->size) {
+    log->tail += undo_ring_get(log, log->tail);
+    log->nrecords--;
+  }
+  at = log->head & (log->size - 1);
+  rec = log->size - at >= UNDO_MAX_ENCODE ? log->ring + at : stage;
+
+  /* a group of four registers at a time; usually one changed */
+  for (k = 0; k < ARM_REGS; k += 4)
+    if ((old[k] ^ new[k]) | (old[k + 1] ^ new[k + 1]) |
+        (old[k + 2] ^ new[k + 2]) | (old[k + 3] ^ new[k + 3]))
+      changed |= (uint32_t)(old[k] != new[k]) << k | (uint32_t)(old[k + 1] != new[k + 1]) << (k + 1) |
+                 (uint32_t)(old[k + 2] != new[k + 2]) << (k + 2) |
+                 (uint32_t)(old[k + 3] != new[k + 3]) << (k + 3);
+  for (; changed != 0; changed &= changed - 1) {
+    k = __builtin_ctz(changed);
+    rec[len++] = k;
+    len += undo_put_varint(rec + len, undo_zigzag(log->before.REGS[k] - after->REGS[k]));
+    nregs++;
+  }
+  if (log->before.FLAG_N != after->FLAG_N || log->before.FLAG_Z != after->FLAG_Z) {
+    tag |= UNDO_FLAGS;
+    rec[len++] = (log->before.FLAG_N & 1) | (log->before.FLAG_Z & 1) << 1;
+  }
+  if (after->PC != log->before.PC + 4) {
+    tag |= UNDO_JUMP;
+    len += undo_put_varint(rec + len, undo_zigzag(log->before.PC - after->PC));
+  }
+  for (k = 0; k < log->nstores; k++) {
+    memcpy(&now, log->stores[k].host, 4);
+    len += undo_put_varint(rec + len, log->stores[k].address);
+    len += undo_put_varint(rec + len, log->stores[k].old ^ now);
+  }
+  if (log->run_bit && !ctx->RUN_BIT)
+    tag |= UNDO_HALTED;
+  rec[1] = tag;
+  rec[2] = nregs << 4 | log->nstores;
+  rec[0] = rec[len] = len + 1;
+  len++;
+  if (len > UNDO_MAX_RECORD || nregs > 15) {
+    /* can't happen with this ISA; losing history beats a bad undo */
+    undo_clear(log);
+    return;
+  }
+
+  if (rec == stage)
+    undo_ring_copy_in(log, log->head, stage, len);
+  log->head += len;
+  log->nrecords++;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : undo_pop                                        */
+/*                                                             */
+/* Purpose   : Undo the newest record. Returns TRUE if one of  */
+/*             the restored words is under a write watchpoint. */
+/*                                                             */
+/***************************************************************/
+static int undo_pop(sim_ctx_t *ctx) {
+  struct undo_log_t *log = ctx->UNDO;
+  CPU_State *state = &ctx->CURRENT_STATE;
+  uint8_t rec[UNDO_MAX_RECORD];
+  undo_store_t stores[UNDO_MAX_STORES];
+  int len, pos = 3, nregs, nstores, k, w, watched = FALSE;
+  uint64_t address;
+
+  len = undo_ring_get(log, log->head - 1);
+  undo_ring_copy_out(log, log->head - len, rec, len);
+
+  nregs = rec[2] >> 4;
+  nstores = rec[2] & 0xF;
+  for (k = 0; k < nregs; k++) {
+    int n = rec[pos++];
+
+    state->REGS[n] += undo_unzigzag(undo_get_varint(rec, &pos));
+  }
+  if (rec[1] & UNDO_FLAGS) {
+    state->FLAG_N = rec[pos] & 1;
+    state->FLAG_Z = (rec[pos] >> 1) & 1;
+    pos++;
+  }
+  if (rec[1] & UNDO_JUMP)
+    state->PC += undo_unzigzag(undo_get_varint(rec, &pos));
+  else
+    state->PC -= 4;
+  for (k = 0; k < nstores; k++) {
+    stores[k].address = undo_get_varint(rec, &pos);
+    stores[k].old = undo_get_varint(rec, &pos);
+  }
+
+  /* last store first, in case two hit the same word */
+  ctx->UNDO = NULL;
+  for (k = nstores - 1; k >= 0; k--) {
+    address = stores[k].address;
+    mem_write_32(ctx, address, stores[k].old ^ undo_peek(ctx, address));
+    for (w = 0; w < MAX_WATCHPOINTS; w++) {
+      watchpoint_t *wp = &ctx->MEM->WATCHPOINTS[w];
+
+      if (wp->active && (wp->type & WATCH_WRITE) &&
+          address < wp->start + wp->len && wp->start < address + 4)
+        watched = TRUE;
+    }
+  }
+  ctx->UNDO = log;
+
+  if (rec[1] & UNDO_HALTED)
+    ctx->RUN_BIT = TRUE;
+  ctx->NEXT_STATE = *state;
+  ctx->INSTRUCTION_COUNT--;
+  log->head -= len;
+  log->nrecords--;
+  return watched;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : undo_rewind                                     */
+/*                                                             */
+/* Purpose   : Reach an instruction count older than the ring  */
+/*             holds: restore the newest checkpoint at or      */
+/*             before it and replay forward                    */
+/*                                                             */
+/***************************************************************/
+static int undo_rewind(sim_ctx_t *ctx, uint64_t target) {
+  struct undo_log_t *log = ctx->UNDO;
+  mem_snapshot_t *snap = NULL;
+  int k;
+
+  /* loading a user snapshot may have made some of ours stale */
+  for (k = log->ncheckpoints - 1; k >= 0; k--) {
+    if (!mem_snapshot_live(log->checkpoints[k]))
+      continue;
+    if (mem_snapshot_count(log->checkpoints[k]) <= target) {
+      snap = log->checkpoints[k];
+      break;
+    }
+  }
+  if (snap == NULL)
+    return FALSE;
+
+  device_flush_all(ctx);
+  mem_snapshot_restore(ctx, snap);
+  while (log->ncheckpoints > 0 && log->checkpoints[log->ncheckpoints - 1] != snap) {
+    mem_snapshot_drop(ctx, log->checkpoints[--log->ncheckpoints]);
+  }
+  undo_clear(log);
+  undo_schedule(log, ctx->INSTRUCTION_COUNT + log->interval);
+  while (ctx->INSTRUCTION_COUNT < target && ctx->RUN_BIT)
+    cycle(ctx);
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_record_start / armsim_record_stop        */
+/*                                                             */
+/* Purpose   : Turn recording on with a ring of limit bytes,   */
+/*             rounded down to a power of two (at least 512),  */
+/*             and a checkpoint every interval instructions    */
+/*             (0 = none), or off                              */
+/*                                                             */
+/***************************************************************/
+int armsim_record_start(armsim_t *sim, uint64_t limit, uint64_t interval) {
+  struct undo_log_t *log;
+
+  while (limit & (limit - 1))
+    limit &= limit - 1;
+  if (limit < UNDO_MIN_RING)
+    return ARMSIM_ERR_RANGE;
+  armsim_record_stop(sim);
+  log = calloc(1, sizeof(struct undo_log_t));
+  log->ring = malloc(limit);
+  log->size = limit;
+  log->interval = interval;
+  undo_schedule(log, sim->INSTRUCTION_COUNT);
+  sim->UNDO = log;
+  return ARMSIM_OK;
+}
+
+void armsim_record_stop(armsim_t *sim) {
+  struct undo_log_t *log = sim->UNDO;
+  int k;
+
+  if (log == NULL)
+    return;
+  for (k = 0; k < log->ncheckpoints; k++)
+    mem_snapshot_drop(sim, log->checkpoints[k]);
+  free(log->ring);
+  free(log);
+  sim->UNDO = NULL;
+}
+
+/* The machine was changed behind the recorder's back */
+void undo_reset(sim_ctx_t *ctx) {
+  struct undo_log_t *log = ctx->UNDO;
+  int k;
+
+  for (k = 0; k < log->ncheckpoints; k++)
+    mem_snapshot_drop(ctx, log->checkpoints[k]);
+  log->ncheckpoints = 0;
+  undo_clear(log);
+  undo_schedule(log, ctx->INSTRUCTION_COUNT);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_reverse_step                             */
+/*                                                             */
+/* Purpose   : Go back n instructions. Returns how many were   */
+/*             undone, fewer if history runs out.              */
+/*                                                             */
+/***************************************************************/
+uint64_t armsim_reverse_step(armsim_t *sim, uint64_t n) {
+  uint64_t start = sim->INSTRUCTION_COUNT, target;
+  uint64_t done = 0;
+
+  if (sim->UNDO == NULL)
+    return 0;
+  target = n > start ? 0 : start - n;
+  while (done < n && sim->UNDO->nrecords > 0) {
+    undo_pop(sim);
+    done++;
+  }
+  if (done < n && undo_rewind(sim, target))
+    done = start - sim->INSTRUCTION_COUNT;
+  return done;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_reverse_continue                         */
+/*                                                             */
+/* Purpose   : Go back until an instruction that stored under  */
+/*             a write watchpoint has been undone, or the ring */
+/*             runs out                                        */
+/*                                                             */
+/***************************************************************/
+int armsim_reverse_continue(armsim_t *sim) {
+  if (sim->UNDO == NULL)
+    return ARMSIM_HALTED;
+  while (sim->UNDO->nrecords > 0)
+    if (undo_pop(sim))
+      return ARMSIM_WATCHPOINT;
+  return ARMSIM_HALTED;
+}
+
+void armsim_get_record_stats(armsim_t *sim, armsim_record_stats_t *stats) {
+  struct undo_log_t *log = sim->UNDO;
+
+  memset(stats, 0, sizeof(*stats));
+  if (log == NULL)
+    return;
+  stats->recording = TRUE;
+  stats->records = log->nrecords;
+  stats->bytes = log->head - log->tail;
+  stats->limit = log->size;
+  stats->checkpoints = log->ncheckpoints;
+}
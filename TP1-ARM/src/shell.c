@@ -27,91 +27,110 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <unistd.h>
 #include "shell.h"
+#include "engine.h"
+#include "device.h"
+#include "armsim.h"
+#include "batch.h"
+#include "forkserver.h"
 
 /***************************************************************/
-/* Main memory.                                                */
+/* The simulator instance driven by this shell.                */
 /***************************************************************/
 
-#define MEM_DATA_START  0x10000000
-#define MEM_DATA_SIZE   0x00100000
-#define MEM_TEXT_START  0x00400000
-#define MEM_TEXT_SIZE   0x00100000
-#define MEM_STACK_START 0xfffffffc
-#define MEM_STACK_SIZE  0x00100000
+sim_ctx_t *SIM;
 
-typedef struct {
-    uint64_t start, size;
-    uint8_t *mem;
-} mem_region_t;
+/* With --cores N: the SMP machine SIM is core 0 of, else NULL */
+armsim_smp_t *SMP;
+uint64_t QUANTUM;             /* 0 = one host thread per core */
 
-/* memory will be dynamically allocated at initialization */
-mem_region_t MEM_REGIONS[] = {
-    { MEM_TEXT_START, MEM_TEXT_SIZE, NULL },
-    { MEM_DATA_START, MEM_DATA_SIZE, NULL },
-    { MEM_STACK_START, MEM_STACK_SIZE, NULL },
-};
+/* With --lanes K: the lockstep machine SIM is lane 0 of, else NULL */
+armsim_simt_t *SIMT;
 
-#define MEM_NREGIONS (sizeof(MEM_REGIONS)/sizeof(mem_region_t))
+/* --quiet: no banner, prompts or progress messages, only what
+   the commands print */
+int QUIET;
+#define NOTE(...) do { if (!QUIET) printf(__VA_ARGS__); } while (0)
 
-/***************************************************************/
-/* CPU State info.                                             */
-/***************************************************************/
+/* --emit-state=json|bin[:file]: ARMSIM_DUMP_* of the state record
+   written on exit, -1 for none, and where it goes */
+int EMIT_STATE = -1;
+FILE *EMIT_FILE;
+
+/* The trace being written by "trace on", and its file */
+armsim_trace_t *TRACE;
+char TRACE_PATH[256];
+
+/* How the last run stopped, ARMSIM_HALTED before any */
+int LAST_STOP = ARMSIM_HALTED;
+
+/* Exit status of a session: how the program stopped */
+#define EXIT_HALTED   0   /* ran to HLT */
+#define EXIT_ERROR    1   /* bad usage, a load error or a failed script command */
+#define EXIT_RUNNING  2   /* not finished when the session ended */
+#define EXIT_WATCH    3   /* stopped at a watchpoint */
+
+/* What run_command tells its caller */
+#define CMD_OK    0
+#define CMD_ERROR 1       /* unknown command or bad arguments */
+#define CMD_QUIT  2
 
-CPU_State CURRENT_STATE, NEXT_STATE;
-int RUN_BIT;	/* run bit */
-int INSTRUCTION_COUNT;
+/* Named snapshots taken with "snapshot save" */
+#define MAX_SNAPSHOTS 16
 
+struct {
+  char name[32];
+  armsim_snapshot_t *snap;
+} SNAPSHOTS[MAX_SNAPSHOTS];
 
 /***************************************************************/
 /*                                                             */
-/* Procedure: mem_read_32                                      */
+/* Procedure : sim_running / sim_run / sim_exit_status         */
 /*                                                             */
-/* Purpose: Read a 32-bit word from memory                     */
+/* Purpose   : Run state and run loop of the whole machine:    */
+/*             one core, all SMP cores or all SIMT lanes       */
 /*                                                             */
 /***************************************************************/
-uint32_t mem_read_32(uint64_t address)
-{
-    int i;
-    for (i = 0; i < MEM_NREGIONS; i++) {
-        if (address >= MEM_REGIONS[i].start &&
-                address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size)) {
-            uint32_t offset = address - MEM_REGIONS[i].start;
-
-            return
-                (MEM_REGIONS[i].mem[offset+3] << 24) |
-                (MEM_REGIONS[i].mem[offset+2] << 16) |
-                (MEM_REGIONS[i].mem[offset+1] <<  8) |
-                (MEM_REGIONS[i].mem[offset+0] <<  0);
-        }
-    }
+int sim_running(sim_ctx_t *ctx) {
+  int i;
 
-    return 0;
+  if (SIMT != NULL) {
+    for (i = 0; i < armsim_simt_nlanes(SIMT); i++)
+      if (armsim_simt_lane(SIMT, i)->RUN_BIT)
+        return TRUE;
+    return FALSE;
+  }
+  if (SMP == NULL)
+    return ctx->RUN_BIT;
+  for (i = 0; i < armsim_smp_ncores(SMP); i++)
+    if (armsim_smp_core(SMP, i)->RUN_BIT)
+      return TRUE;
+  return FALSE;
 }
 
-/***************************************************************/
-/*                                                             */
-/* Procedure: mem_write_32                                     */
-/*                                                             */
-/* Purpose: Write a 32-bit word to memory                      */
-/*                                                             */
-/***************************************************************/
-void mem_write_32(uint64_t address, uint32_t value)
-{
-    int i;
-    for (i = 0; i < MEM_NREGIONS; i++) {
-        if (address >= MEM_REGIONS[i].start &&
-                address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size)) {
-            uint32_t offset = address - MEM_REGIONS[i].start;
-
-            MEM_REGIONS[i].mem[offset+3] = (value >> 24) & 0xFF;
-            MEM_REGIONS[i].mem[offset+2] = (value >> 16) & 0xFF;
-            MEM_REGIONS[i].mem[offset+1] = (value >>  8) & 0xFF;
-            MEM_REGIONS[i].mem[offset+0] = (value >>  0) & 0xFF;
-            return;
-        }
-    }
+int sim_run(sim_ctx_t *ctx, uint64_t budget) {
+  if (SIMT != NULL) {
+    armsim_simt_stats_t stats;
+    int reason = armsim_simt_run(SIMT, budget);
+
+    armsim_simt_get_stats(SIMT, &stats);
+    NOTE("Lockstep: %" PRIu64 " steps, %" PRIu64 " of %d lanes diverged\n",
+         stats.lockstep_instructions, stats.diverged, armsim_simt_nlanes(SIMT));
+    return LAST_STOP = reason;
+  }
+  if (SMP == NULL)
+    return LAST_STOP = armsim_run(ctx, budget);
+  return LAST_STOP = armsim_smp_run(SMP, budget, QUANTUM);
+}
+
+/* The exit status for the machine's state now */
+int sim_exit_status(sim_ctx_t *ctx) {
+  if (!sim_running(ctx))
+    return EXIT_HALTED;
+  return LAST_STOP == ARMSIM_WATCHPOINT ? EXIT_WATCH : EXIT_RUNNING;
 }
+
 /***************************************************************/
 /*                                                             */
 /* Procedure : help                                            */
@@ -123,53 +142,122 @@ void help() {
   printf("----------------ARM ISIM Help-----------------------\n");
   printf("go               -  run program to completion         \n");
   printf("run n            -  execute program for n instructions\n");
-  printf("mdump low high   -  dump memory from low to high      \n");
-  printf("rdump            -  dump the register & bus values    \n");
+  printf("mdump low high [text|bin|json] [file] - dump memory  \n");
+  printf("disasm [addr [n]]-  disassemble n words, 10 at the PC\n");
+  printf("symbols          -  list the program's symbols        \n");
+  printf("                    (any addr may be a symbol[+n])     \n");
+  printf("rdump [text|bin|json] [file] - dump the registers    \n");
   printf("input reg_no reg_value - set GPR reg_no to reg_value  \n");
+  printf("sweep reg_no start step - lane i gets start + i*step  \n");
+  printf("snapshot save|load name - save/restore the whole state\n");
+  printf("snapshot         -  list snapshots                    \n");
+  printf("checkpoint save|load file - write/restore state on disk\n");
+  printf("reset            -  back to the freshly loaded program\n");
+  printf("record on [limit [interval]] | off - log for undo    \n");
+  printf("rstep [n]        -  execute n instructions backwards  \n");
+  printf("rcontinue        -  go back to the last watched store \n");
+  printf("trace on file | off - write every instruction to file\n");
+  printf("dirty            -  list pages written since last clear\n");
+  printf("dirty clear      -  forget the dirty pages            \n");
+  printf("watch addr [len] [r|w|rw] - stop when guest touches it\n");
+  printf("watch            -  list watchpoints                  \n");
+  printf("unwatch n|all    -  remove watchpoint(s)              \n");
+  printf("hash             -  print Merkle root of each region  \n");
+  printf("hash save file   -  write the Merkle trees to file    \n");
+  printf("hash diff file   -  list pages differing from file    \n");
   printf("?                -  display this help menu            \n");
   printf("quit             -  exit the program                  \n\n");
 }
 
 /***************************************************************/
 /*                                                             */
-/* Procedure : cycle                                           */
+/* Procedure : run n                                           */
 /*                                                             */
-/* Purpose   : Execute a cycle                                 */
+/* Purpose   : Simulate ARM for n cycles                       */
 /*                                                             */
 /***************************************************************/
-void cycle() {                                                
+void run(sim_ctx_t *ctx, int num_cycles) {
+  if (!sim_running(ctx)) {
+    printf("Can't simulate, Simulator is halted\n\n");
+    return;
+  }
+  /* sim_run takes 0 as "no limit"; "run 0" must not run forever */
+  if (num_cycles <= 0)
+    return;
 
-  process_instruction();
-  CURRENT_STATE = NEXT_STATE;
-  INSTRUCTION_COUNT++;
+  NOTE("Simulating for %d cycles...\n\n", num_cycles);
+  switch (sim_run(ctx, num_cycles)) {
+  case ARMSIM_HALTED:
+    NOTE("Simulator halted\n\n");
+    break;
+  case ARMSIM_WATCHPOINT:
+    NOTE("Simulator stopped at watchpoint\n\n");
+    break;
+  }
 }
 
 /***************************************************************/
 /*                                                             */
-/* Procedure : run n                                           */
+/* Procedure : parse_address                                   */
 /*                                                             */
-/* Purpose   : Simulate ARM for n cycles                       */
+/* Purpose   : Read an address argument: a number, a symbol or */
+/*             symbol+offset. Says what is wrong if it can't.  */
 /*                                                             */
 /***************************************************************/
-void run(int num_cycles) {                                      
-  int i;
-
-  if (RUN_BIT == FALSE) {
-    printf("Can't simulate, Simulator is halted\n\n");
-    return;
+static int parse_address(sim_ctx_t *ctx, const char *text, uint64_t *address) {
+  switch (armsim_parse_address(ctx, text, address)) {
+  case ARMSIM_OK:
+    return TRUE;
+  case ARMSIM_ERR_SYMBOL:
+    printf("Unknown symbol %s\n\n", text);
+    return FALSE;
+  default:
+    printf("Invalid address %s\n\n", text);
+    return FALSE;
   }
+}
 
-  printf("Simulating for %d cycles...\n\n", num_cycles);
-  for (i = 0; i < num_cycles; i++) {
-    if (RUN_BIT == FALSE) {
-	    printf("Simulator halted\n\n");
-	    break;
+/***************************************************************/
+/*                                                             */
+/* Procedure : dump_options                                    */
+/*                                                             */
+/* Purpose   : Read the optional "[text|bin|json] [path]" of   */
+/*             mdump and rdump into the streams to write: the  */
+/*             path, or else the screen and the dumpsim file   */
+/*                                                             */
+/***************************************************************/
+static int dump_options(char *args, FILE * dumpsim_file, int *format, FILE **out, int *nout) {
+  char *tok = strtok(args, " \t\n");
+
+  *format = ARMSIM_DUMP_TEXT;
+  if (tok != NULL && armsim_dump_format(tok) >= 0) {
+    *format = armsim_dump_format(tok);
+    tok = strtok(NULL, " \t\n");
+  }
+  if (tok != NULL) {
+    if ((out[0] = fopen(tok, *format == ARMSIM_DUMP_BINARY ? "wb" : "w")) == NULL) {
+      printf("Error: Can't open %s\n\n", tok);
+      return FALSE;
     }
-    cycle();
+    *nout = 1;
+    return TRUE;
+  }
+  if (*format == ARMSIM_DUMP_BINARY) {
+    printf("Error: Binary dumps need an output file\n\n");
+    return FALSE;
   }
+  out[0] = stdout;
+  out[1] = dumpsim_file;
+  *nout = 2;
+  return TRUE;
 }
 
-/***************************************************************/ 
+static void dump_close(FILE **out, int nout) {
+  if (nout == 1)
+    fclose(out[0]);
+}
+
+/***************************************************************/
 /*                                                             */
 /* Procedure : mdump                                           */
 /*                                                             */
@@ -177,21 +265,64 @@ void run(int num_cycles) {
 /*             output file.                                    */
 /*                                                             */
 /***************************************************************/
-void mdump(FILE * dumpsim_file, int start, int stop) {          
-  int address;
+int mdump(sim_ctx_t *ctx, FILE * dumpsim_file, uint64_t start, uint64_t stop, char *args) {
+  FILE *out[2];
+  int format, nout;
 
-  printf("\nMemory content [0x%08x..0x%08x] :\n", start, stop);
-  printf("-------------------------------------\n");
-  for (address = start; address <= stop; address += 4)
-    printf("  0x%08x (%d) : 0x%x\n", address, address, mem_read_32(address));
-  printf("\n");
+  if (!dump_options(args, dumpsim_file, &format, out, &nout))
+    return FALSE;
+  armsim_dump_memory(ctx, start, stop, format, out, nout);
+  dump_close(out, nout);
+  return TRUE;
+}
 
-  /* dump the memory contents into the dumpsim file */
-  fprintf(dumpsim_file, "\nMemory content [0x%08x..0x%08x] :\n", start, stop);
-  fprintf(dumpsim_file, "-------------------------------------\n");
-  for (address = start; address <= stop; address += 4)
-    fprintf(dumpsim_file, "  0x%08x (%d) : 0x%x\n", address, address, mem_read_32(address));
-  fprintf(dumpsim_file, "\n");
+/***************************************************************/
+/*                                                             */
+/* Procedure : disasm addr n                                   */
+/*                                                             */
+/* Purpose   : Disassemble n words from addr, to the screen    */
+/*             and the dumpsim file. Defaults to 10 words at   */
+/*             the PC.                                         */
+/*                                                             */
+/***************************************************************/
+int disasm(sim_ctx_t *ctx, FILE * dumpsim_file, char *args) {
+  uint64_t address = ctx->CURRENT_STATE.PC, count = 10;
+  char *tok, *text;
+  size_t len;
+
+  if ((tok = strtok(args, " \t")) != NULL) {
+    if (!parse_address(ctx, tok, &address))
+      return FALSE;
+    if ((tok = strtok(NULL, " \t")) != NULL)
+      count = strtoull(tok, NULL, 0);
+  }
+
+  len = armsim_disasm(ctx, address, count, NULL, 0);
+  text = malloc(len + 1);
+  armsim_disasm(ctx, address, count, text, len + 1);
+  printf("%s\n", text);
+  fprintf(dumpsim_file, "%s\n", text);
+  free(text);
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : symbols                                         */
+/*                                                             */
+/* Purpose   : List the program's symbols by address           */
+/*                                                             */
+/***************************************************************/
+void symbols(sim_ctx_t *ctx) {
+  uint64_t address;
+  const char *name;
+  int i, n = armsim_symbol_count(ctx);
+
+  for (i = 0; i < n; i++) {
+    name = armsim_symbol_get(ctx, i, &address);
+    printf("  0x%08" PRIx64 "  %s\n", address, name);
+  }
+  printf("%d symbols\n\n", n);
 }
 
 /***************************************************************/
@@ -199,35 +330,160 @@ void mdump(FILE * dumpsim_file, int start, int stop) {
 /* Procedure : rdump                                           */
 /*                                                             */
 /* Purpose   : Dump current register and bus values to the     */   
-/*             output file.                                    */
+/*             output file, core by core on an SMP machine     */
+/*             and lane by lane in SIMT mode.                  */
+/*                                                             */
+/***************************************************************/
+void rdump_core(sim_ctx_t *ctx, int format, FILE **out, int nout, const char *title, int n) {
+  int k;
+
+  for (k = 0; n >= 0 && format == ARMSIM_DUMP_TEXT && k < nout; k++)
+    fprintf(out[k], "\n%s %d", title, n);
+  armsim_dump_registers(ctx, format, out, nout);
+}
+
+int rdump(sim_ctx_t *ctx, FILE * dumpsim_file, char *args) {
+  FILE *out[2];
+  int i, format, nout;
+
+  if (!dump_options(args, dumpsim_file, &format, out, &nout))
+    return FALSE;
+  if (SIMT != NULL) {
+    for (i = 0; i < armsim_simt_nlanes(SIMT); i++)
+      rdump_core(armsim_simt_lane(SIMT, i), format, out, nout, "Lane", i);
+  } else if (SMP == NULL || armsim_smp_ncores(SMP) == 1) {
+    rdump_core(ctx, format, out, nout, NULL, -1);
+  } else {
+    for (i = 0; i < armsim_smp_ncores(SMP); i++)
+      rdump_core(armsim_smp_core(SMP, i), format, out, nout, "Core", i);
+  }
+  dump_close(out, nout);
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : ddump                                           */
+/*                                                             */
+/* Purpose   : Dump the ranges of dirty pages to the output    */
+/*             file, coalescing adjacent pages.                */
 /*                                                             */
 /***************************************************************/
-void rdump(FILE * dumpsim_file) {                               
-  int k; 
+void ddump(sim_ctx_t *ctx, FILE * dumpsim_file) {
+  int i, total = 0;
+  uint32_t page, npages, first;
+  uint64_t lo, hi;
+  mem_region_t *region;
 
-  printf("\nCurrent register/bus values :\n");
+  printf("\nDirty pages :\n");
   printf("-------------------------------------\n");
-  printf("Instruction Count : %u\n", INSTRUCTION_COUNT);
-  printf("PC                : 0x%" PRIx64 "\n", CURRENT_STATE.PC);
-  printf("Registers:\n");
-  for (k = 0; k < ARM_REGS; k++)
-    printf("X%d: 0x%" PRIx64 "\n", k, CURRENT_STATE.REGS[k]);
-  printf("FLAG_N: %d\n", CURRENT_STATE.FLAG_N);
-  printf("FLAG_Z: %d\n", CURRENT_STATE.FLAG_Z);
-  printf("\n");
-
-  /* dump the state information into the dumpsim file */
-  fprintf(dumpsim_file, "\nCurrent register/bus values :\n");
+  fprintf(dumpsim_file, "\nDirty pages :\n");
   fprintf(dumpsim_file, "-------------------------------------\n");
-  fprintf(dumpsim_file, "Instruction Count : %u\n", INSTRUCTION_COUNT);
-  fprintf(dumpsim_file, "PC                : 0x%" PRIx64 "\n", CURRENT_STATE.PC);
-  fprintf(dumpsim_file, "Registers:\n");
-  for (k = 0; k < ARM_REGS; k++)
-    fprintf(dumpsim_file, "X%d: 0x%" PRIx64 "\n", k, CURRENT_STATE.REGS[k]);
-  fprintf(dumpsim_file, "FLAG_N: %d\n", CURRENT_STATE.FLAG_N);
-  fprintf(dumpsim_file, "FLAG_Z: %d\n", CURRENT_STATE.FLAG_Z);
-  fprintf(dumpsim_file, "\n");
+  for (i = 0; i < MEM_NREGIONS; i++) {
+    region = &ctx->MEM->REGIONS[i];
+    npages = region->size >> MEM_PAGE_SHIFT;
+    for (page = 0; page < npages; page++) {
+      if (!(region->page_flags[page] & PAGE_DIRTY))
+        continue;
+      first = page;
+      while (page + 1 < npages && (region->page_flags[page + 1] & PAGE_DIRTY))
+        page++;
+      lo = region->start + ((uint64_t)first << MEM_PAGE_SHIFT);
+      hi = region->start + ((uint64_t)(page + 1) << MEM_PAGE_SHIFT) - 1;
+      printf("  0x%08" PRIx64 "..0x%08" PRIx64 " (%u pages)\n", lo, hi, page - first + 1);
+      fprintf(dumpsim_file, "  0x%08" PRIx64 "..0x%08" PRIx64 " (%u pages)\n", lo, hi, page - first + 1);
+    }
+    total += region->ndirty;
+  }
+  printf("Total: %d dirty pages of %d bytes\n\n", total, MEM_PAGE_SIZE);
+  fprintf(dumpsim_file, "Total: %d dirty pages of %d bytes\n\n", total, MEM_PAGE_SIZE);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : hash                                            */
+/*                                                             */
+/* Purpose   : Print the Merkle roots, or save/compare the     */
+/*             trees with a file written by "hash save".       */
+/*                                                             */
+/***************************************************************/
+#define HASH_FILE_MAGIC 0x3148534148435241ULL   /* "ARCHASH1" */
+
+static void hash_print_page(uint64_t page_address, void *arg) {
+  (void)arg;
+  printf("  0x%08" PRIx64 "..0x%08" PRIx64 "\n", page_address, page_address + MEM_PAGE_SIZE - 1);
+}
+
+int hash(sim_ctx_t *ctx, char *args) {
+  char op[8], filename[64];
+  FILE *f;
+  int i, n;
+  uint32_t nnodes;
+  uint64_t magic, *other;
+  const uint64_t *tree;
+
+  n = sscanf(args, "%7s %63s", op, filename);
+  if (n < 1) {
+    printf("\nMerkle roots :\n");
+    printf("-------------------------------------\n");
+    for (i = 0; i < MEM_NREGIONS; i++)
+      printf("  0x%08" PRIx64 " : %016" PRIx64 "\n", ctx->MEM->REGIONS[i].start, mem_merkle_root(ctx, i));
+    printf("\n");
+    return TRUE;
+  }
+  if (n < 2) {
+    printf("Error: hash %s needs a file name\n\n", op);
+    return FALSE;
+  }
+
+  if (strcmp(op, "save") == 0) {
+    if ((f = fopen(filename, "wb")) == NULL) {
+      printf("Error: Can't open hash file %s\n\n", filename);
+      return FALSE;
+    }
+    magic = HASH_FILE_MAGIC;
+    fwrite(&magic, sizeof(magic), 1, f);
+    for (i = 0; i < MEM_NREGIONS; i++) {
+      tree = mem_merkle_tree(ctx, i, &nnodes);
+      fwrite(&nnodes, sizeof(nnodes), 1, f);
+      fwrite(tree, sizeof(uint64_t), nnodes, f);
+    }
+    fclose(f);
+    printf("Merkle trees written to %s\n\n", filename);
+  } else if (strcmp(op, "diff") == 0) {
+    if ((f = fopen(filename, "rb")) == NULL) {
+      printf("Error: Can't open hash file %s\n\n", filename);
+      return FALSE;
+    }
+    if (fread(&magic, sizeof(magic), 1, f) != 1 || magic != HASH_FILE_MAGIC) {
+      printf("Error: %s is not a hash file\n\n", filename);
+      fclose(f);
+      return FALSE;
+    }
+    printf("\nPages differing from %s :\n", filename);
+    printf("-------------------------------------\n");
+    for (i = 0, n = 0; i < MEM_NREGIONS; i++) {
+      mem_merkle_tree(ctx, i, &nnodes);
+      other = malloc(nnodes * sizeof(uint64_t));
+      if (fread(&magic, sizeof(uint32_t), 1, f) != 1 || (uint32_t)magic != nnodes ||
+          fread(other, sizeof(uint64_t), nnodes, f) != nnodes) {
+        printf("Error: %s does not match this memory layout\n\n", filename);
+        free(other);
+        fclose(f);
+        return FALSE;
+      }
+      n += mem_merkle_diff(ctx, i, other, hash_print_page, NULL);
+      free(other);
+    }
+    fclose(f);
+    printf("Total: %d differing pages\n\n", n);
+  } else {
+    printf("Invalid hash command %s\n\n", op);
+    return FALSE;
+  }
+  return TRUE;
 }
+
 /***************************************************************/
 /*                                                             */
 /* Procedure : go                                              */
@@ -235,55 +491,440 @@ void rdump(FILE * dumpsim_file) {
 /* Purpose   : Simulate ARM until HALTed                       */
 /*                                                             */
 /***************************************************************/
-void go(FILE * dumpsim_file) {                                                     
-  if (RUN_BIT == FALSE) {
+void go(sim_ctx_t *ctx, FILE * dumpsim_file) {
+  (void)dumpsim_file;
+  if (!sim_running(ctx)) {
     printf("Can't simulate, Simulator is halted\n\n");
     return;
   }
 
-  printf("Simulating...\n\n");
-  while (RUN_BIT) {
-    cycle();
-    //printf("Going\n");
-    //rdump(dumpsim_file);
-    //mdump(dumpsim_file, MEM_DATA_START, MEM_DATA_START+0x100);
+  NOTE("Simulating...\n\n");
+  if (sim_run(ctx, 0) == ARMSIM_WATCHPOINT)
+    NOTE("Simulator stopped at watchpoint\n\n");
+  else
+    NOTE("Simulator halted\n\n");
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : watch                                           */
+/*                                                             */
+/* Purpose   : Parse "watch addr [len] [r|w|rw]" arguments,    */
+/*             or list the watchpoints when there are none.    */
+/*             FALSE if the watchpoint can't be set.           */
+/*                                                             */
+/***************************************************************/
+int watch(sim_ctx_t *ctx, char *args) {
+  char *mode = "w", *tok, *end;
+  uint64_t start, len = 4;
+  int i, type;
+  watchpoint_t *w;
+
+  if ((tok = strtok(args, " \t\r\n")) == NULL) {
+    for (i = 0; i < MAX_WATCHPOINTS; i++) {
+      w = &ctx->MEM->WATCHPOINTS[i];
+      if (w->active)
+        printf("  %d: 0x%08" PRIx64 "..0x%08" PRIx64 " %s%s\n", i,
+               w->start, w->start + w->len - 1,
+               (w->type & WATCH_READ) ? "r" : "",
+               (w->type & WATCH_WRITE) ? "w" : "");
+    }
+    printf("\n");
+    return TRUE;
+  }
+  if (!parse_address(ctx, tok, &start))
+    return FALSE;
+  while ((tok = strtok(NULL, " \t\r\n")) != NULL) {
+    if (tok[0] == 'r' || tok[0] == 'w')
+      mode = tok;
+    else {
+      len = strtoull(tok, &end, 0);
+      if (*end != '\0' || len == 0) {
+        printf("Usage: watch addr [len] [r|w|rw]\n\n");
+        return FALSE;
+      }
+    }
+  }
+
+  type = (strchr(mode, 'r') ? WATCH_READ : 0) | (strchr(mode, 'w') ? WATCH_WRITE : 0);
+  if (type == 0 || mode[strspn(mode, "rw")] != '\0') {
+    printf("Invalid watch mode %s\n\n", mode);
+    return FALSE;
+  }
+  if ((i = mem_watch_add(ctx, start, len, type)) < 0) {
+    printf("Too many watchpoints\n\n");
+    return FALSE;
   }
-  printf("Simulator halted\n\n");
+  NOTE("Watchpoint %d set\n\n", i);
+  return TRUE;
 }
 
 
 /***************************************************************/
 /*                                                             */
-/* Procedure : get_command                                     */
+/* Procedure : sweep                                           */
+/*                                                             */
+/* Purpose   : Set a register in every lane, lane i getting    */
+/*             start + i*step (input is a sweep with step 0).  */
+/*             FALSE if there is no such register.             */
+/*                                                             */
+/***************************************************************/
+int sweep(sim_ctx_t *ctx, int register_no, int64_t start, uint64_t step) {
+  int i;
+
+  if (register_no < 0 || register_no >= ARM_REGS) {
+    printf("No register X%d\n\n", register_no);
+    return FALSE;
+  }
+  if (SIMT == NULL)
+    return armsim_set_reg(ctx, register_no, start) == ARMSIM_OK;
+  for (i = 0; i < armsim_simt_nlanes(SIMT); i++)
+    armsim_set_reg(armsim_simt_lane(SIMT, i), register_no, start + i * step);
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : snapshot                                        */
+/*                                                             */
+/* Purpose   : Parse "snapshot save|load name", or list the    */
+/*             snapshots when there are no arguments.          */
+/*                                                             */
+/***************************************************************/
+int snapshot(sim_ctx_t *ctx, char *args) {
+  char *op = strtok(args, " \t"), *name = strtok(NULL, " \t");
+  int i, slot = -1;
+
+  if (SMP != NULL || SIMT != NULL) {
+    printf("Snapshots need a single-core machine\n\n");
+    return FALSE;
+  }
+  if (op == NULL) {
+    for (i = 0; i < MAX_SNAPSHOTS; i++)
+      if (SNAPSHOTS[i].snap != NULL)
+        printf("  %s%s\n", SNAPSHOTS[i].name,
+               mem_snapshot_live(SNAPSHOTS[i].snap) ? "" : " (stale)");
+    printf("\n");
+    return TRUE;
+  }
+  if (name == NULL || (strcmp(op, "save") != 0 && strcmp(op, "load") != 0)) {
+    printf("Usage: snapshot save|load name\n\n");
+    return FALSE;
+  }
+
+  for (i = 0; i < MAX_SNAPSHOTS; i++)
+    if (SNAPSHOTS[i].snap != NULL && strcmp(SNAPSHOTS[i].name, name) == 0)
+      slot = i;
+
+  if (strcmp(op, "load") == 0) {
+    if (slot < 0) {
+      printf("No snapshot named %s\n\n", name);
+      return FALSE;
+    }
+    if (armsim_snapshot_load(ctx, SNAPSHOTS[slot].snap) == ARMSIM_ERR_STALE) {
+      printf("Snapshot %s is stale: an older one was loaded after it\n\n", name);
+      return FALSE;
+    }
+    printf("Restored snapshot %s\n\n", name);
+    return TRUE;
+  }
+
+  if (slot >= 0) {
+    armsim_snapshot_free(ctx, SNAPSHOTS[slot].snap);
+  } else {
+    for (i = 0; i < MAX_SNAPSHOTS && slot < 0; i++)
+      if (SNAPSHOTS[i].snap == NULL)
+        slot = i;
+    if (slot < 0) {
+      printf("Too many snapshots (max %d)\n\n", MAX_SNAPSHOTS);
+      return FALSE;
+    }
+  }
+  snprintf(SNAPSHOTS[slot].name, sizeof(SNAPSHOTS[slot].name), "%s", name);
+  SNAPSHOTS[slot].snap = armsim_snapshot_save(ctx);
+  printf("Saved snapshot %s\n\n", name);
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : checkpoint                                      */
+/*                                                             */
+/* Purpose   : Parse "checkpoint save|load file"               */
+/*                                                             */
+/***************************************************************/
+int checkpoint(sim_ctx_t *ctx, char *args) {
+  char *op = strtok(args, " \t"), *path = strtok(NULL, " \t");
+
+  if (SMP != NULL || SIMT != NULL) {
+    printf("Checkpoints need a single-core machine\n\n");
+    return FALSE;
+  }
+  if (op == NULL || path == NULL) {
+    printf("Usage: checkpoint save|load file\n\n");
+    return FALSE;
+  }
+  if (strcmp(op, "save") == 0) {
+    if (armsim_checkpoint_save(ctx, path) != ARMSIM_OK) {
+      printf("Error: Can't write checkpoint %s\n\n", path);
+      return FALSE;
+    }
+    printf("Wrote checkpoint %s\n\n", path);
+  } else if (strcmp(op, "load") == 0) {
+    switch (armsim_checkpoint_load(ctx, path)) {
+    case ARMSIM_OK:
+      printf("Restored checkpoint %s\n\n", path);
+      break;
+    case ARMSIM_ERR_FORMAT:
+      printf("Error: %s is not a checkpoint\n\n", path);
+      return FALSE;
+    default:
+      printf("Error: Can't open checkpoint %s\n\n", path);
+      return FALSE;
+    }
+  } else {
+    printf("Usage: checkpoint save|load file\n\n");
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : reset                                           */
 /*                                                             */
-/* Purpose   : Read a command from standard input.             */  
+/* Purpose   : Return to the state right after loading         */
 /*                                                             */
 /***************************************************************/
-void get_command(FILE * dumpsim_file) {                         
+int reset(sim_ctx_t *ctx) {
+  if (SMP != NULL || SIMT != NULL) {
+    printf("Reset needs a single-core machine\n\n");
+    return FALSE;
+  }
+  if (armsim_reset(ctx) != ARMSIM_OK) {
+    printf("Can't reset: a checkpoint load replaced the loaded program\n\n");
+    return FALSE;
+  }
+  printf("Reset to the loaded program\n\n");
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : record                                          */
+/*                                                             */
+/* Purpose   : Parse "record on [limit [interval]]", "record   */
+/*             off" and "record"                               */
+/*                                                             */
+/***************************************************************/
+#define RECORD_LIMIT    (16 << 20)
+#define RECORD_INTERVAL 1000000
+
+int record(sim_ctx_t *ctx, char *args) {
+  char *op = strtok(args, " \t"), *limit = strtok(NULL, " \t");
+  char *interval = strtok(NULL, " \t");
+  armsim_record_stats_t stats;
+
+  if (SMP != NULL || SIMT != NULL) {
+    printf("Recording needs a single-core machine\n\n");
+    return FALSE;
+  }
+  if (op != NULL && strcmp(op, "on") == 0) {
+    if (armsim_record_start(ctx, limit ? strtoull(limit, NULL, 0) : RECORD_LIMIT,
+                            interval ? strtoull(interval, NULL, 0) : RECORD_INTERVAL) != ARMSIM_OK) {
+      printf("Error: record limit too small\n\n");
+      return FALSE;
+    }
+    printf("Recording\n\n");
+    return TRUE;
+  }
+  if (op != NULL && strcmp(op, "off") == 0) {
+    armsim_record_stop(ctx);
+    printf("Recording off\n\n");
+    return TRUE;
+  }
+  if (op != NULL) {
+    printf("Usage: record [on [limit [interval]]|off]\n\n");
+    return FALSE;
+  }
+
+  armsim_get_record_stats(ctx, &stats);
+  if (!stats.recording)
+    printf("Not recording\n\n");
+  else
+    printf("Recording: %" PRIu64 " instructions in %" PRIu64 " of %" PRIu64
+           " bytes, %d checkpoints\n\n",
+           stats.records, stats.bytes, stats.limit, stats.checkpoints);
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : rstep n / rcontinue                             */
+/*                                                             */
+/* Purpose   : Execute backwards, n instructions or up to the  */
+/*             last store under a write watchpoint             */
+/*                                                             */
+/***************************************************************/
+int rstep(sim_ctx_t *ctx, int num_cycles) {
+  uint64_t done;
+
+  if (ctx->UNDO == NULL) {
+    printf("Not recording, use \"record on\" first\n\n");
+    return FALSE;
+  }
+  done = armsim_reverse_step(ctx, num_cycles > 0 ? num_cycles : 1);
+  printf("Stepped back %" PRIu64 " instructions, now at %" PRIu64 "\n\n",
+         done, ctx->INSTRUCTION_COUNT);
+  return TRUE;
+}
+
+int rcontinue(sim_ctx_t *ctx) {
+  if (ctx->UNDO == NULL) {
+    printf("Not recording, use \"record on\" first\n\n");
+    return FALSE;
+  }
+  if (armsim_reverse_continue(ctx) == ARMSIM_WATCHPOINT)
+    printf("Watchpoint: undid a store at instruction %" PRIu64 ", PC 0x%" PRIx64 "\n\n",
+           ctx->INSTRUCTION_COUNT, ctx->CURRENT_STATE.PC);
+  else
+    printf("Reached the start of the recording, instruction %" PRIu64 "\n\n",
+           ctx->INSTRUCTION_COUNT);
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : trace                                           */
+/*                                                             */
+/* Purpose   : Parse "trace on file", "trace off" and "trace"  */
+/*                                                             */
+/***************************************************************/
+static int trace_stop(void) {
+  int err = armsim_trace_close(TRACE);
+
+  TRACE = NULL;
+  if (err != ARMSIM_OK)
+    printf("Error: Can't write trace file %s\n\n", TRACE_PATH);
+  return err == ARMSIM_OK;
+}
+
+int trace(sim_ctx_t *ctx, char *args) {
+  char *op = strtok(args, " \t"), *path = strtok(NULL, " \t");
+  int i;
+
+  if (SIMT != NULL) {
+    printf("Tracing doesn't follow lanes in lockstep, use --cores\n\n");
+    return FALSE;
+  }
+  if (op != NULL && strcmp(op, "on") == 0 && path != NULL) {
+    if (TRACE != NULL && !trace_stop())
+      return FALSE;
+    if ((TRACE = armsim_trace_open(path, NULL)) == NULL) {
+      printf("Error: Can't open trace file %s\n\n", path);
+      return FALSE;
+    }
+    snprintf(TRACE_PATH, sizeof(TRACE_PATH), "%s", path);
+    if (SMP != NULL)
+      for (i = 0; i < armsim_smp_ncores(SMP); i++)
+        armsim_trace_attach(TRACE, armsim_smp_core(SMP, i));
+    else
+      armsim_trace_attach(TRACE, ctx);
+    NOTE("Tracing to %s\n\n", path);
+    return TRUE;
+  }
+  if (op != NULL && strcmp(op, "off") == 0) {
+    if (TRACE == NULL)
+      return TRUE;
+    if (!trace_stop())
+      return FALSE;
+    NOTE("Trace written to %s\n\n", TRACE_PATH);
+    return TRUE;
+  }
+  if (op != NULL) {
+    printf("Usage: trace [on file|off]\n\n");
+    return FALSE;
+  }
+  if (TRACE == NULL)
+    printf("Not tracing\n\n");
+  else
+    printf("Tracing to %s\n\n", TRACE_PATH);
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : run_command                                     */
+/*                                                             */
+/* Purpose   : Execute one command line: the command word and  */
+/*             its arguments                                   */
+/*                                                             */
+/***************************************************************/
+int run_command(sim_ctx_t *ctx, FILE * dumpsim_file, char *line) {
   char buffer[20];
-  int start, stop, cycles;
+  char args[256];
+  char low[40], high[40], *end;
+  uint64_t address;
+  int cycles, skip = 0, watch_no;
   int register_no;
   int64_t register_value;
+  uint64_t step;
 
-  printf("ARM-SIM> ");
-
-  if (scanf("%s", buffer) == EOF)
-      exit(0);
-
-  printf("\n");
+  if (sscanf(line, "%19s %n", buffer, &skip) != 1)
+    return CMD_OK;
+  snprintf(args, sizeof(args), "%s", line + skip);
 
   switch(buffer[0]) {
   case 'G':
   case 'g':
-    go(dumpsim_file);
+    go(ctx, dumpsim_file);
     break;
 
   case 'M':
   case 'm':
-    if (scanf("%i %i", &start, &stop) != 2)
-        break;
+    if (sscanf(args, "%39s %39s %n", low, high, &skip) != 2)
+        return CMD_ERROR;
+    if (!parse_address(ctx, low, &address) || !parse_address(ctx, high, &step))
+        return CMD_ERROR;
+
+    return mdump(ctx, dumpsim_file, address, step, args + skip) ? CMD_OK : CMD_ERROR;
 
-    mdump(dumpsim_file, start, stop);
+  case 'D':
+  case 'd':
+    if (buffer[1] == 'i' && buffer[2] == 's')
+      return disasm(ctx, dumpsim_file, args) ? CMD_OK : CMD_ERROR;
+    if (strstr(args, "clear") != NULL)
+      mem_clear_dirty(ctx);
+    else
+      ddump(ctx, dumpsim_file);
+    break;
+
+  case 'W':
+  case 'w':
+    return watch(ctx, args) ? CMD_OK : CMD_ERROR;
+
+  case 'H':
+  case 'h':
+    return hash(ctx, args) ? CMD_OK : CMD_ERROR;
+
+  case 'C':
+  case 'c':
+    return checkpoint(ctx, args) ? CMD_OK : CMD_ERROR;
+
+  case 'U':
+  case 'u':
+    if (sscanf(args, "%39s", low) != 1) return CMD_ERROR;
+    if (strcmp(low, "all") == 0) {
+      mem_watch_remove(ctx, -1);
+      break;
+    }
+    watch_no = strtol(low, &end, 0);
+    if (*end != '\0' || watch_no < 0 || watch_no >= MAX_WATCHPOINTS ||
+        !ctx->MEM->WATCHPOINTS[watch_no].active) {
+      printf("No watchpoint %s\n\n", low);
+      return CMD_ERROR;
+    }
+    mem_watch_remove(ctx, watch_no);
     break;
 
   case '?':
@@ -292,83 +933,313 @@ void get_command(FILE * dumpsim_file) {
 
   case 'Q':
   case 'q':
-    printf("Bye.\n");
-    exit(0);
+    return CMD_QUIT;
 
   case 'R':
   case 'r':
     if (buffer[1] == 'd' || buffer[1] == 'D')
-	    rdump(dumpsim_file);
+	    return rdump(ctx, dumpsim_file, args) ? CMD_OK : CMD_ERROR;
+    else if ((buffer[1] == 'e' || buffer[1] == 'E') && (buffer[2] == 's' || buffer[2] == 'S'))
+	    return reset(ctx) ? CMD_OK : CMD_ERROR;
+    else if (buffer[1] == 'e' || buffer[1] == 'E')
+	    return record(ctx, args) ? CMD_OK : CMD_ERROR;
+    else if (buffer[1] == 's' || buffer[1] == 'S')
+	    return rstep(ctx, atoi(args)) ? CMD_OK : CMD_ERROR;
+    else if (buffer[1] == 'c' || buffer[1] == 'C')
+	    return rcontinue(ctx) ? CMD_OK : CMD_ERROR;
     else {
-	    if (scanf("%d", &cycles) != 1) break;
-	    run(cycles);
+	    if (sscanf(args, "%d", &cycles) != 1) return CMD_ERROR;
+	    run(ctx, cycles);
     }
     break;
 
+  case 'T':
+  case 't':
+    return trace(ctx, args) ? CMD_OK : CMD_ERROR;
+
   case 'I':
   case 'i':
-   if (scanf("%i %" PRIx64, &register_no, &register_value) != 2)
-      break;
-   CURRENT_STATE.REGS[register_no] = register_value;
-   NEXT_STATE.REGS[register_no] = register_value;
-   break;
+   if (sscanf(args, "%i %" PRIx64, &register_no, &register_value) != 2)
+      return CMD_ERROR;
+   return sweep(ctx, register_no, register_value, 0) ? CMD_OK : CMD_ERROR;
+
+  case 'S':
+  case 's':
+   if (buffer[1] == 'y' || buffer[1] == 'Y') {
+     symbols(ctx);
+     break;
+   }
+   if (buffer[1] == 'n' || buffer[1] == 'N')
+     return snapshot(ctx, args) ? CMD_OK : CMD_ERROR;
+   if (sscanf(args, "%i %" PRIx64 " %" PRIx64, &register_no, &register_value, &step) != 3)
+      return CMD_ERROR;
+   return sweep(ctx, register_no, register_value, step) ? CMD_OK : CMD_ERROR;
 
   default:
     printf("Invalid Command\n");
-    break;
+    return CMD_ERROR;
   }
+  return CMD_OK;
 }
 
 /***************************************************************/
 /*                                                             */
-/* Procedure : init_memory                                     */
+/* Procedure : run_line                                        */
 /*                                                             */
-/* Purpose   : Allocate and zero memory                        */
+/* Purpose   : Execute a line of commands separated by ';',    */
+/*             up to '#'. Stops at the first one that fails    */
+/*             or quits.                                       */
 /*                                                             */
 /***************************************************************/
-void init_memory() {                                           
-    int i;
-    for (i = 0; i < MEM_NREGIONS; i++) {
-        // Extra 3 bytes to prevent buffer overflow on unaligned access.
-        MEM_REGIONS[i].mem = malloc(MEM_REGIONS[i].size + 3);
-        memset(MEM_REGIONS[i].mem, 0, MEM_REGIONS[i].size);
+int run_line(sim_ctx_t *ctx, FILE * dumpsim_file, char *line) {
+  char *cmd, *next;
+  int status = CMD_OK;
+
+  if ((next = strchr(line, '#')) != NULL)
+    *next = '\0';
+  for (cmd = line; cmd != NULL && status == CMD_OK; cmd = next) {
+    if ((next = strchr(cmd, ';')) != NULL)
+      *next++ = '\0';
+    status = run_command(ctx, dumpsim_file, cmd);
+  }
+  return status;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : quit                                            */
+/*                                                             */
+/* Purpose   : End the session, the exit status telling how    */
+/*             the program stopped                             */
+/*                                                             */
+/***************************************************************/
+void quit(sim_ctx_t *ctx) {
+  FILE *out = EMIT_FILE;
+  int i;
+
+  device_flush_all(ctx);
+  if (TRACE != NULL)
+    trace_stop();
+  /* one record per core or lane */
+  if (EMIT_STATE >= 0 && SIMT != NULL)
+    for (i = 0; i < armsim_simt_nlanes(SIMT); i++)
+      armsim_dump_state(armsim_simt_lane(SIMT, i), NULL, EMIT_STATE, &out, 1);
+  else if (EMIT_STATE >= 0 && SMP != NULL)
+    for (i = 0; i < armsim_smp_ncores(SMP); i++)
+      armsim_dump_state(armsim_smp_core(SMP, i), NULL, EMIT_STATE, &out, 1);
+  else if (EMIT_STATE >= 0)
+    armsim_dump_state(ctx, NULL, EMIT_STATE, &out, 1);
+  if (EMIT_FILE != NULL && EMIT_FILE != stdout && fclose(EMIT_FILE) != 0)
+    printf("Error: Can't write the state record\n");
+  NOTE("Bye.\n");
+  exit(sim_exit_status(ctx));
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : get_command                                     */
+/*                                                             */
+/* Purpose   : Read a command line from standard input.        */
+/*                                                             */
+/***************************************************************/
+void get_command(sim_ctx_t *ctx, FILE * dumpsim_file) {
+  char line[1024];
+
+  NOTE("ARM-SIM> ");
+
+  if (fgets(line, sizeof(line), stdin) == NULL)
+      quit(ctx);
+
+  NOTE("\n");
+
+  if (run_line(ctx, dumpsim_file, line) == CMD_QUIT)
+    quit(ctx);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : run_script                                      */
+/*                                                             */
+/* Purpose   : Execute commands with no prompts, from -c text  */
+/*             or a -f file. A failed command ends the session */
+/*             with EXIT_ERROR.                                */
+/*                                                             */
+/***************************************************************/
+void run_script(sim_ctx_t *ctx, FILE * dumpsim_file, const char *text, FILE *file,
+                const char *name) {
+  char line[1024];
+  const char *p = text, *eol;
+  int n = 0, status;
+  size_t len;
+
+  for (;;) {
+    if (file != NULL) {
+      if (fgets(line, sizeof(line), file) == NULL)
+        return;
+    } else {
+      if (*p == '\0')
+        return;
+      eol = strchr(p, '\n');
+      len = eol ? (size_t)(eol - p) : strlen(p);
+      snprintf(line, sizeof(line), "%.*s", (int)(len < sizeof(line) ? len : sizeof(line) - 1), p);
+      p += eol ? len + 1 : len;
+    }
+    n++;
+    status = run_line(ctx, dumpsim_file, line);
+    if (status == CMD_QUIT)
+      quit(ctx);
+    if (status == CMD_ERROR) {
+      device_flush_all(ctx);
+      fflush(stdout);
+      fprintf(stderr, "Error: %s, line %d: command failed\n", name, n);
+      exit(EXIT_ERROR);
     }
+  }
 }
 
 /**************************************************************/
 /*                                                            */
-/* Procedure : load_program                                   */
+/* Procedure : load_check                                     */
 /*                                                            */
-/* Purpose   : Load program and service routines into mem.    */
+/* Purpose   : Report a failed program load and exit          */
 /*                                                            */
 /**************************************************************/
-void load_program(char *program_filename) {                   
-  FILE * prog;
-  int ii, word;
+static void load_check(armsim_t *sim, int err, const char *path) {
+  switch (err) {
+  case ARMSIM_OK:
+    return;
+  case ARMSIM_ERR_OPEN:
+    printf("Error: Can't open program file %s\n", path);
+    break;
+  case ARMSIM_ERR_FORMAT:
+    if (armsim_load_error_message(sim)[0] != '\0')
+      printf("Error: Malformed program file %s, line %d: %s\n", path,
+             armsim_load_error_line(sim), armsim_load_error_message(sim));
+    else if (armsim_load_error_line(sim) > 0)
+      printf("Error: Malformed program file %s, line %d\n", path, armsim_load_error_line(sim));
+    else
+      printf("Error: Malformed program file %s\n", path);
+    break;
+  default:
+    printf("Error: Program file %s doesn't fit in memory\n", path);
+  }
+  exit(EXIT_ERROR);
+}
 
-  /* Open program file. */
-  prog = fopen(program_filename, "r");
-  if (prog == NULL) {
-    printf("Error: Can't open program file %s\n", program_filename);
-    exit(-1);
+/**************************************************************/
+/*                                                            */
+/* Procedure : asm_main                                       */
+/*                                                            */
+/* Purpose   : sim --asm file.s: print the program as hex,    */
+/*             one word per line, like asm2hex                */
+/*                                                            */
+/**************************************************************/
+static int asm_main(int argc, char *argv[]) {
+  FILE *src;
+  char *text = NULL, msg[96];
+  size_t len = 0, cap = 0, n, nwords, k;
+  uint32_t *words;
+  int line;
+
+  if (argc != 2) {
+    fprintf(stderr, "Error: usage: sim --asm <file.s>\n");
+    return 1;
+  }
+  src = fopen(argv[1], "r");
+  if (src == NULL) {
+    fprintf(stderr, "Error: Can't open program file %s\n", argv[1]);
+    return 1;
   }
+  do {
+    if (len == cap)
+      text = realloc(text, cap = cap ? 2 * cap : 65536);
+    n = fread(text + len, 1, cap - len, src);
+    len += n;
+  } while (n > 0);
+  fclose(src);
+
+  if (armsim_assemble(text, len, &words, &nwords, &line, msg, sizeof(msg)) != ARMSIM_OK) {
+    fprintf(stderr, "Error: %s, line %d: %s\n", argv[1], line, msg);
+    free(text);
+    return 1;
+  }
+  for (k = 0; k < nwords; k++)
+    printf("%08x\n", words[k]);
+  free(words);
+  free(text);
+  return 0;
+}
 
-  /* Read in the program. */
+/**************************************************************/
+/*                                                            */
+/* Procedure : disasm_main                                    */
+/*                                                            */
+/* Purpose   : sim --disasm file: list the whole text segment */
+/*             of a program in any format the loader takes    */
+/*                                                            */
+/**************************************************************/
+static int disasm_main(int argc, char *argv[]) {
+  armsim_t *sim;
+  char *text;
+  size_t len;
 
-  ii = 0;
-  int bytes_read = EOF;
-  while ((bytes_read=fscanf(prog, "%x\n", &word)) > 0) {
-    mem_write_32(MEM_TEXT_START + ii, word);
-    ii += 4;
+  if (argc != 2) {
+    fprintf(stderr, "Error: usage: sim --disasm <program_file>\n");
+    return 1;
   }
-  if (bytes_read == 0) {
-    printf("Error: Malformed program file %s\n", program_filename);
-    exit(-1);
+  sim = armsim_create();
+  load_check(sim, armsim_load_file(sim, argv[1], NULL), argv[1]);
+
+  len = armsim_disasm(sim, sim->MEM->DECODED_START, sim->MEM->NDECODED, NULL, 0);
+  text = malloc(len + 1);
+  armsim_disasm(sim, sim->MEM->DECODED_START, sim->MEM->NDECODED, text, len + 1);
+  fwrite(text, 1, len, stdout);
+  free(text);
+  armsim_destroy(sim);
+  return 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : trace_decode_main                               */
+/*                                                             */
+/* Purpose   : sim --trace-decode file: print a trace as text  */
+/*                                                             */
+/***************************************************************/
+static int trace_decode_main(int argc, char *argv[]) {
+  FILE *in;
+  int err;
+
+  if (argc != 2) {
+    fprintf(stderr, "Error: usage: sim --trace-decode <trace_file>\n");
+    return 1;
+  }
+  if ((in = fopen(argv[1], "rb")) == NULL) {
+    fprintf(stderr, "Error: Can't open trace file %s\n", argv[1]);
+    return 1;
+  }
+  err = armsim_trace_decode(in, stdout);
+  fclose(in);
+  if (err != ARMSIM_OK) {
+    fprintf(stderr, "Error: Malformed trace file %s\n", argv[1]);
+    return 1;
   }
+  return 0;
+}
+
+/**************************************************************/
+/*                                                            */
+/* Procedure : load_program                                   */
+/*                                                            */
+/* Purpose   : Load program and service routines into mem.    */
+/*                                                            */
+/**************************************************************/
+void load_program(sim_ctx_t *ctx, char *program_filename) {
+  int words;
 
-  CURRENT_STATE.PC = MEM_TEXT_START;
+  load_check(ctx, armsim_load_file(ctx, program_filename, &words), program_filename);
 
-  printf("Read %d words from program into memory.\n\n", ii/4);
+  NOTE("Read %d words from program into memory.\n\n", words);
 }
 
 /************************************************************/
@@ -379,17 +1250,35 @@ void load_program(char *program_filename) {
 /*             and set up initial state of the machine.     */
 /*                                                          */
 /************************************************************/
-void initialize(char *program_filename, int num_prog_files) { 
+void initialize(sim_ctx_t *ctx, char *program_filenames[], int num_prog_files) { 
   int i;
 
-  init_memory();
-  for ( i = 0; i < num_prog_files; i++ ) {
-    load_program(program_filename);
-    while(*program_filename++ != '\0');
-  }
-  NEXT_STATE = CURRENT_STATE;
+  for ( i = 0; i < num_prog_files; i++ )
+    load_program(ctx, program_filenames[i]);
+  ctx->NEXT_STATE = ctx->CURRENT_STATE;
     
-  RUN_BIT = TRUE;
+  ctx->RUN_BIT = TRUE;
+  armsim_reset_point(ctx);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : usage                                           */
+/*                                                             */
+/***************************************************************/
+static void usage(const char *name) {
+  printf("Error: usage: %s [-q] [-c \"cmd; cmd\"] [-f script] [--emit-state=json|bin[:file]]"
+         " <program_file_1> <program_file_2> ...\n"
+         "       %s [-q] [-c ...] [-f ...] [--emit-state=...] --cores N [--quantum Q] <program_file>\n"
+         "       %s [-q] [-c ...] [-f ...] [--emit-state=...] --lanes K <program_file>\n"
+         "       %s --batch [-j threads] [-n budget] [-o outdir] [-s reg start step count]"
+         " [--emit-state=json|bin] <file.x|dir> ...\n"
+         "       %s --forkserver [-n budget] <program_file>\n"
+         "       %s --asm <file.s>\n"
+         "       %s --disasm <program_file>\n"
+         "       %s --trace-decode <trace_file>\n",
+         name, name, name, name, name, name, name, name);
+  exit(EXIT_ERROR);
 }
 
 /***************************************************************/
@@ -398,24 +1287,128 @@ void initialize(char *program_filename, int num_prog_files) {
 /*                                                             */
 /***************************************************************/
 int main(int argc, char *argv[]) {                              
-  FILE * dumpsim_file;
+  FILE * dumpsim_file, *file;
+  const char *script[16];
+  int is_file[16], nscripts = 0, i, n;
+  char *path;
 
   /* Error Checking */
-  if (argc < 2) {
-    printf("Error: usage: %s <program_file_1> <program_file_2> ...\n",
-           argv[0]);
-    exit(1);
+  if (argc < 2)
+    usage(argv[0]);
+
+  if (strcmp(argv[1], "--batch") == 0)
+    return batch_main(argc - 1, argv + 1);
+  if (strcmp(argv[1], "--forkserver") == 0)
+    return forkserver_main(argc - 1, argv + 1);
+  if (strcmp(argv[1], "--asm") == 0)
+    return asm_main(argc - 1, argv + 1);
+  if (strcmp(argv[1], "--disasm") == 0)
+    return disasm_main(argc - 1, argv + 1);
+  if (strcmp(argv[1], "--trace-decode") == 0)
+    return trace_decode_main(argc - 1, argv + 1);
+
+  /* -c, -f and --quiet can go anywhere; scripts run in order */
+  for (i = n = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "-f") == 0) && i + 1 < argc) {
+      if (nscripts == 16) {
+        printf("Error: too many scripts\n");
+        exit(EXIT_ERROR);
+      }
+      is_file[nscripts] = argv[i][1] == 'f';
+      script[nscripts++] = argv[++i];
+    } else if (strcmp(argv[i], "-q") == 0 || strcmp(argv[i], "--quiet") == 0) {
+      QUIET = TRUE;
+    } else if (strncmp(argv[i], "--emit-state=", 13) == 0) {
+      if ((path = strchr(argv[i] + 13, ':')) != NULL)
+        *path++ = '\0';
+      EMIT_STATE = armsim_dump_format(argv[i] + 13);
+      if (EMIT_STATE != ARMSIM_DUMP_JSON && EMIT_STATE != ARMSIM_DUMP_BINARY)
+        usage(argv[0]);
+      if (EMIT_FILE != NULL)
+        fclose(EMIT_FILE);
+      if (path != NULL && (EMIT_FILE = fopen(path, "wb")) == NULL) {
+        printf("Error: Can't open state file %s\n", path);
+        exit(EXIT_ERROR);
+      }
+    } else {
+      argv[n++] = argv[i];
+    }
+  }
+  argc = n;
+  if (argc < 2)
+    usage(argv[0]);
+
+  /* A binary record on stdout gets stdout to itself: the text
+     the commands print goes to stderr instead */
+  if (EMIT_STATE == ARMSIM_DUMP_BINARY && EMIT_FILE == NULL) {
+    EMIT_FILE = fdopen(dup(STDOUT_FILENO), "wb");
+    fflush(stdout);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    QUIET = TRUE;
   }
+  if (EMIT_STATE >= 0 && EMIT_FILE == NULL)
+    EMIT_FILE = stdout;
+
+  NOTE("ARM Simulator\n\n");
 
-  printf("ARM Simulator\n\n");
+  if (strcmp(argv[1], "--lanes") == 0) {
+    int nlanes, words;
 
-  initialize(argv[1], argc - 1);
+    nlanes = argc > 2 ? atoi(argv[2]) : 0;
+    if (nlanes < 1 || argc != 4) {
+      printf("Error: usage: --lanes K <program_file>\n");
+      exit(EXIT_ERROR);
+    }
+    SIMT = armsim_simt_create(nlanes);
+    SIM = armsim_simt_lane(SIMT, 0);
+    load_check(SIM, armsim_simt_load_file(SIMT, argv[3], &words), argv[3]);
+    NOTE("Read %d words from program into memory.\n\n", words);
+  } else if (strcmp(argv[1], "--cores") == 0) {
+    int i, ncores, words;
+
+    ncores = argc > 2 ? atoi(argv[2]) : 0;
+    argc -= 2;
+    argv += 2;
+    if (argc > 2 && strcmp(argv[1], "--quantum") == 0) {
+      QUANTUM = strtoull(argv[2], NULL, 0);
+      argc -= 2;
+      argv += 2;
+    }
+    if (ncores < 1 || argc != 2) {
+      printf("Error: usage: --cores N [--quantum Q] <program_file>\n");
+      exit(EXIT_ERROR);
+    }
+    SMP = armsim_smp_create(ncores);
+    for (i = 0; i < ncores; i++)
+      armsim_set_verbose(armsim_smp_core(SMP, i), ncores == 1 && !QUIET);
+    SIM = armsim_smp_core(SMP, 0);
+    load_check(SIM, armsim_smp_load_file(SMP, argv[1], &words), argv[1]);
+    NOTE("Read %d words from program into memory.\n\n", words);
+  } else {
+    SIM = armsim_create();
+    armsim_set_verbose(SIM, !QUIET);
+    initialize(SIM, argv + 1, argc - 1);
+  }
 
   if ( (dumpsim_file = fopen( "dumpsim", "w" )) == NULL ) {
     printf("Error: Can't open dumpsim file\n");
-    exit(-1);
+    exit(EXIT_ERROR);
+  }
+
+  if (nscripts > 0) {
+    for (i = 0; i < nscripts; i++) {
+      file = NULL;
+      if (is_file[i] && (file = fopen(script[i], "r")) == NULL) {
+        printf("Error: Can't open script %s\n", script[i]);
+        exit(EXIT_ERROR);
+      }
+      run_script(SIM, dumpsim_file, script[i], file, is_file[i] ? script[i] : "-c");
+      if (file != NULL)
+        fclose(file);
+    }
+    quit(SIM);
   }
 
   while (1)
-    get_command(dumpsim_file);
+    get_command(SIM, dumpsim_file);
 }
@@ -28,16 +28,13 @@ typedef struct CPU_State_Struct {
   int FLAG_Z;               /* flag Z */
 } CPU_State;
 
-/* Data Structure for Latch */
+/* The simulator's state, defined in engine.h */
+typedef struct sim_ctx_t sim_ctx_t;
 
-extern CPU_State CURRENT_STATE, NEXT_STATE;
-
-extern int RUN_BIT;	/* run bit */
-
-uint32_t mem_read_32(uint64_t address);
-void     mem_write_32(uint64_t address, uint32_t value);
+uint32_t mem_read_32(sim_ctx_t *ctx, uint64_t address);
+void     mem_write_32(sim_ctx_t *ctx, uint64_t address, uint32_t value);
 
 /* YOU IMPLEMENT THIS FUNCTION */
-void process_instruction();
+void process_instruction(sim_ctx_t *ctx);
 
 #endif
@@ -1,9 +1,11 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include "shell.h"
+#include "engine.h"
+#include "sim.h"
 
-#define OPCODE_TABLE_SIZE 50
 #define MASK_21 0x7FF
 #define MASK_26 0x3F
 #define MASK_24 0xFF
@@ -16,54 +18,44 @@
 #define MASK_26bits 0x3FFFFFFF
 #define MASK_2bits 0x3
 
-typedef struct instruction_t{
-    uint32_t opcode;
-    uint32_t rd;
-    uint32_t rn;
-    uint32_t rm;
-    uint32_t rt;
-    uint32_t shamt;
-    uint32_t alu_immediate;
-    uint32_t dt_address;
-    uint32_t br_address;
-    uint32_t cond_br_address;
-    uint32_t mov_immediate;
-    char type[20];  
-    char *name;
-} instruction;
-
-void process_instruction();
-instruction decode_instruction(uint32_t bytecode);
-void decode_instruction_opcode(instruction *instr, uint32_t bytecode);
+void process_instruction(sim_ctx_t *ctx);
+void decode_instruction_opcode(sim_ctx_t *ctx, instruction *instr, uint32_t bytecode);
 void decode_completely_instruction(instruction *instr, uint32_t bytecode);
 
-void implement_ADDS_immediate(instruction instruct);
-void implement_ADDS_extended_register(instruction instruct);
-void implement_SUBS_immediate(instruction instruct);
-void implement_SUBS_extended_register(instruction instruct);
-void implement_HLT(instruction instruct);
-void implement_ANDS_shifted_register(instruction instruct);
-void implement_EOR_shifted_register(instruction instruct);
-void implement_MOVZ(instruction instruct);
-void implement_STURB(instruction instruct);
-void implement_LSL_immediate(instruction instruct);
-void implement_STUR(instruction instruct);
-void implement_LDUR(instruction instruct);
-void implement_LDURB(instruction instruct);
-void implement_BCOND(instruction instruct);
-void implement_ORR_shifted_register(instruction instruct);
-void implement_STURH(instruction instruct);
-void implement_LDURH(instruction instruct);
-void implement_AND_inmediate(instruction instruct);
-void implement_SUB_inmediate(instruction instruct);
-void implement_CBZ(instruction instruct);
-void implement_CBNZ(instruction instruct);
-void implement_B(instruction instruct);
-void implement_BR(instruction instruct);
-void implement_MUL(instruction instruct);
-void implement_ADD_immediate(instruction instruct);
-void implement_LSR_immediate(instruction instruct);
-void implement_ADD_extended_register(instruction instruct);
+void implement_ADDS_immediate(sim_ctx_t *ctx, instruction instruct);
+void implement_ADDS_extended_register(sim_ctx_t *ctx, instruction instruct);
+void implement_SUBS_immediate(sim_ctx_t *ctx, instruction instruct);
+void implement_SUBS_extended_register(sim_ctx_t *ctx, instruction instruct);
+void implement_HLT(sim_ctx_t *ctx, instruction instruct);
+void implement_ANDS_shifted_register(sim_ctx_t *ctx, instruction instruct);
+void implement_EOR_shifted_register(sim_ctx_t *ctx, instruction instruct);
+void implement_MOVZ(sim_ctx_t *ctx, instruction instruct);
+void implement_STURB(sim_ctx_t *ctx, instruction instruct);
+void implement_LSL_immediate(sim_ctx_t *ctx, instruction instruct);
+void implement_STUR(sim_ctx_t *ctx, instruction instruct);
+void implement_LDUR(sim_ctx_t *ctx, instruction instruct);
+void implement_LDURB(sim_ctx_t *ctx, instruction instruct);
+void implement_BCOND(sim_ctx_t *ctx, instruction instruct);
+void implement_ORR_shifted_register(sim_ctx_t *ctx, instruction instruct);
+void implement_STURH(sim_ctx_t *ctx, instruction instruct);
+void implement_LDURH(sim_ctx_t *ctx, instruction instruct);
+void implement_AND_inmediate(sim_ctx_t *ctx, instruction instruct);
+void implement_SUB_inmediate(sim_ctx_t *ctx, instruction instruct);
+void implement_CBZ(sim_ctx_t *ctx, instruction instruct);
+void implement_CBNZ(sim_ctx_t *ctx, instruction instruct);
+void implement_B(sim_ctx_t *ctx, instruction instruct);
+void implement_BR(sim_ctx_t *ctx, instruction instruct);
+void implement_MUL(sim_ctx_t *ctx, instruction instruct);
+void implement_ADD_immediate(sim_ctx_t *ctx, instruction instruct);
+void implement_LSR_immediate(sim_ctx_t *ctx, instruction instruct);
+void implement_ADD_extended_register(sim_ctx_t *ctx, instruction instruct);
+void implement_LDXR(sim_ctx_t *ctx, instruction instruct);
+void implement_STXR(sim_ctx_t *ctx, instruction instruct);
+void implement_LDADD(sim_ctx_t *ctx, instruction instruct);
+void implement_SWP(sim_ctx_t *ctx, instruction instruct);
+void implement_CAS(sim_ctx_t *ctx, instruction instruct);
+void implement_BARRIER(sim_ctx_t *ctx, instruction instruct);
+void implement_NOP(sim_ctx_t *ctx, instruction instruct);
 
 
 const instruction opcode_table[OPCODE_TABLE_SIZE] = {
@@ -94,61 +86,209 @@ const instruction opcode_table[OPCODE_TABLE_SIZE] = {
     {0b10110101, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "CB", "CBNZ"},
     {11010001, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "I", "SUB(immediate)"},
     {1001001000, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "I", "AND(immediate)"},
+    // Atómicas (solo variantes X de 64 bits) y barreras, para SMP
+    {0b11001000010, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "A", "LDXR"},
+    {0b11001000000, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "A", "STXR"},
+    {0b11001000101, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "A", "CAS"},
+    {0b11001000111, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "A", "CAS"},
+    {0b11111000001, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "A", "LDADD"},
+    {0b11111000011, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "A", "LDADD"},
+    {0b11111000101, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "A", "LDADD"},
+    {0b11111000111, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "A", "LDADD"},
+    {0b11010101000, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "SYS", "BARRIER"},
 };
 
 
-void process_instruction(){
-    uint32_t bytecode = mem_read_32(CURRENT_STATE.PC);
-    instruction instruct = decode_instruction(bytecode);
-    printf("Instrucción: %s\n", instruct.name);
-
-    NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-
-    if (strcmp(instruct.name, "ADDS(immediate)") == 0) implement_ADDS_immediate(instruct);
-    if (strcmp(instruct.name, "ADDS(Extended Register)") == 0) implement_ADDS_extended_register(instruct);
-    if (strcmp(instruct.name, "SUBS(immediate)") == 0) implement_SUBS_immediate(instruct);
-    if (strcmp(instruct.name, "SUBS(Extended Register)") == 0) implement_SUBS_extended_register(instruct);
-    if (strcmp(instruct.name, "HLT") == 0) implement_HLT(instruct);
-    if (strcmp(instruct.name, "ANDS(Shifted Register)") == 0) implement_ANDS_shifted_register(instruct);
-    if (strcmp(instruct.name, "EOR(Shifter Register)") == 0 ) implement_EOR_shifted_register(instruct);
-    if (strcmp(instruct.name, "ORR(Shifted Register)") == 0) implement_ORR_shifted_register(instruct);
-    if (strcmp(instruct.name, "B") == 0) implement_B(instruct);
-    if (strcmp(instruct.name, "BCOND") == 0) implement_BCOND(instruct);
-    if (strcmp(instruct.name, "BR") == 0) implement_BR(instruct);
-    if (strcmp(instruct.name, "LSL(Immediate)") == 0) implement_LSL_immediate(instruct);
-    if (strcmp(instruct.name, "LSR(Immediate)") == 0) implement_LSR_immediate(instruct);
-    if (strcmp(instruct.name, "STUR") == 0) implement_STUR(instruct);
-    if (strcmp(instruct.name, "STURB") == 0) implement_STURB(instruct);
-    if (strcmp(instruct.name, "STURH") == 0) implement_STURH(instruct);
-    if (strcmp(instruct.name, "LDUR") == 0) implement_LDUR(instruct);
-    if (strcmp(instruct.name, "LDURB") == 0) implement_LDURB(instruct);
-    if (strcmp(instruct.name, "LDURH") == 0) implement_LDURH(instruct);
-    if (strcmp(instruct.name, "MOVZ") == 0) implement_MOVZ(instruct);
-    if (strcmp(instruct.name, "ADD(Extended Register)") == 0) implement_ADD_extended_register(instruct);
-    if (strcmp(instruct.name, "ADD(immediate)") == 0) implement_ADD_immediate(instruct);
-    if (strcmp(instruct.name, "MUL") == 0) implement_MUL(instruct);
-    if (strcmp(instruct.name, "CBZ") == 0 ) implement_CBZ(instruct);
-    if (strcmp(instruct.name, "CBNZ") == 0) implement_CBNZ(instruct);
-}
-
-instruction decode_instruction(uint32_t bytecode) {
-    instruction instr_def;
-
-    decode_instruction_opcode(&instr_def, bytecode);
+// Handler de cada instrucción, para el predecodificado
+static const struct {
+    const char *name;
+    instruction_handler handler;
+} handler_table[] = {
+    {"ADDS(immediate)", implement_ADDS_immediate},
+    {"ADDS(Extended Register)", implement_ADDS_extended_register},
+    {"SUBS(immediate)", implement_SUBS_immediate},
+    {"SUBS(Extended Register)", implement_SUBS_extended_register},
+    {"HLT", implement_HLT},
+    {"ANDS(Shifted Register)", implement_ANDS_shifted_register},
+    {"EOR(Shifter Register)", implement_EOR_shifted_register},
+    {"ORR(Shifted Register)", implement_ORR_shifted_register},
+    {"B", implement_B},
+    {"BCOND", implement_BCOND},
+    {"BR", implement_BR},
+    {"LSL(Immediate)", implement_LSL_immediate},
+    {"LSR(Immediate)", implement_LSR_immediate},
+    {"STUR", implement_STUR},
+    {"STURB", implement_STURB},
+    {"STURH", implement_STURH},
+    {"LDUR", implement_LDUR},
+    {"LDURB", implement_LDURB},
+    {"LDURH", implement_LDURH},
+    {"MOVZ", implement_MOVZ},
+    {"ADD(Extended Register)", implement_ADD_extended_register},
+    {"ADD(immediate)", implement_ADD_immediate},
+    {"MUL", implement_MUL},
+    {"CBZ", implement_CBZ},
+    {"CBNZ", implement_CBNZ},
+    {"LDXR", implement_LDXR},
+    {"STXR", implement_STXR},
+    {"LDADD", implement_LDADD},
+    {"SWP", implement_SWP},
+    {"CAS", implement_CAS},
+    {"BARRIER", implement_BARRIER},
+    {"NOP", implement_NOP},
+};
+
+// Arma la tabla de predecodificado para las nwords palabras desde start.
+// Las entradas arrancan vacías y cada una se decodifica la primera vez que
+// se ejecuta (ver predecode_note), así cargar no cuesta un decode por
+// palabra. El mapa de memoria guarda la tabla y la comparten todos los cores.
+void predecode(sim_ctx_t *ctx, uint64_t start, uint32_t nwords) {
+    mem_map_t *mem = ctx->MEM;
+
+    if (!mem->DECODED_SHARED)
+        free(mem->DECODED);
+    mem->DECODED = calloc(nwords ? nwords : 1, sizeof(decoded_t));
+    mem->DECODED_SHARED = FALSE;
+    mem->DECODED_LAZY = TRUE;
+    mem->DECODED_START = start;
+    mem->NDECODED = nwords;
+}
+
+static void predecode_entry(decoded_t *d, uint32_t bytecode, instruction instr) {
+    uint32_t k;
+
+    d->instr = instr;
+    d->handler = NULL;
+    for (k = 0; k < sizeof(handler_table) / sizeof(handler_table[0]); k++)
+        if (strcmp(instr.name, handler_table[k].name) == 0)
+            d->handler = handler_table[k].handler;
+    d->bytecode = bytecode;
+}
+
+// Decodifica ya todas las entradas que falten. Después la tabla no se
+// vuelve a escribir, así que se puede leer desde varios threads.
+void predecode_fill(sim_ctx_t *ctx) {
+    mem_map_t *mem = ctx->MEM;
+    int verbose = ctx->VERBOSE;
+    uint32_t i, bytecode;
+
+    if (mem->DECODED == NULL || !mem->DECODED_LAZY)
+        return;
+    ctx->VERBOSE = FALSE;
+    for (i = 0; i < mem->NDECODED; i++) {
+        if (mem->DECODED[i].handler != NULL)
+            continue;
+        bytecode = mem_read_32_nowatch(ctx, mem->DECODED_START + 4 * i);
+        predecode_entry(&mem->DECODED[i], bytecode, decode_instruction(ctx, bytecode));
+    }
+    ctx->VERBOSE = verbose;
+    mem->DECODED_LAZY = FALSE;
+}
+
+// Guarda en la tabla una palabra recién decodificada en pc
+static void predecode_note(sim_ctx_t *ctx, uint64_t pc, uint32_t bytecode, instruction instr) {
+    mem_map_t *mem = ctx->MEM;
+    uint64_t i = (pc - mem->DECODED_START) / 4;
+
+    if (mem->DECODED == NULL || !mem->DECODED_LAZY || pc < mem->DECODED_START ||
+        i >= mem->NDECODED || (pc & 3) != 0)
+        return;
+    predecode_entry(&mem->DECODED[i], bytecode, instr);
+}
+
+// La palabra predecodificada en pc, o NULL si no hay, si cambió desde
+// entonces, o si hay que mostrar la salida de debug del decodificador
+static const decoded_t *predecoded(sim_ctx_t *ctx, uint64_t pc, uint32_t bytecode) {
+    mem_map_t *mem = ctx->MEM;
+    uint64_t i = (pc - mem->DECODED_START) / 4;
+
+    if (mem->DECODED == NULL || ctx->VERBOSE || pc < mem->DECODED_START ||
+        i >= mem->NDECODED || (pc & 3) != 0)
+        return NULL;
+    if (mem->DECODED[i].bytecode != bytecode || mem->DECODED[i].handler == NULL)
+        return NULL;
+    return &mem->DECODED[i];
+}
+
+void process_instruction(sim_ctx_t *ctx){
+    uint32_t bytecode = mem_read_32_nowatch(ctx, ctx->CURRENT_STATE.PC);
+    const decoded_t *cached = predecoded(ctx, ctx->CURRENT_STATE.PC, bytecode);
+
+    if (cached != NULL) {
+        ctx->NEXT_STATE.PC = ctx->CURRENT_STATE.PC + 4;
+        cached->handler(ctx, cached->instr);
+        return;
+    }
+
+    instruction instruct = decode_instruction(ctx, bytecode);
+    SIM_DEBUG(ctx, "Instrucción: %s\n", instruct.name);
+    predecode_note(ctx, ctx->CURRENT_STATE.PC, bytecode, instruct);
+
+    ctx->NEXT_STATE.PC = ctx->CURRENT_STATE.PC + 4;
+    execute_instruction(ctx, instruct, bytecode);
+}
+
+// Ejecuta una instrucción ya decodificada (NEXT_STATE.PC ya apunta a la siguiente)
+void execute_instruction(sim_ctx_t *ctx, instruction instruct, uint32_t bytecode) {
+    if (strcmp(instruct.name, "ADDS(immediate)") == 0) implement_ADDS_immediate(ctx, instruct);
+    if (strcmp(instruct.name, "ADDS(Extended Register)") == 0) implement_ADDS_extended_register(ctx, instruct);
+    if (strcmp(instruct.name, "SUBS(immediate)") == 0) implement_SUBS_immediate(ctx, instruct);
+    if (strcmp(instruct.name, "SUBS(Extended Register)") == 0) implement_SUBS_extended_register(ctx, instruct);
+    if (strcmp(instruct.name, "HLT") == 0) implement_HLT(ctx, instruct);
+    if (strcmp(instruct.name, "ANDS(Shifted Register)") == 0) implement_ANDS_shifted_register(ctx, instruct);
+    if (strcmp(instruct.name, "EOR(Shifter Register)") == 0 ) implement_EOR_shifted_register(ctx, instruct);
+    if (strcmp(instruct.name, "ORR(Shifted Register)") == 0) implement_ORR_shifted_register(ctx, instruct);
+    if (strcmp(instruct.name, "B") == 0) implement_B(ctx, instruct);
+    if (strcmp(instruct.name, "BCOND") == 0) implement_BCOND(ctx, instruct);
+    if (strcmp(instruct.name, "BR") == 0) implement_BR(ctx, instruct);
+    if (strcmp(instruct.name, "LSL(Immediate)") == 0) implement_LSL_immediate(ctx, instruct);
+    if (strcmp(instruct.name, "LSR(Immediate)") == 0) implement_LSR_immediate(ctx, instruct);
+    if (strcmp(instruct.name, "STUR") == 0) implement_STUR(ctx, instruct);
+    if (strcmp(instruct.name, "STURB") == 0) implement_STURB(ctx, instruct);
+    if (strcmp(instruct.name, "STURH") == 0) implement_STURH(ctx, instruct);
+    if (strcmp(instruct.name, "LDUR") == 0) implement_LDUR(ctx, instruct);
+    if (strcmp(instruct.name, "LDURB") == 0) implement_LDURB(ctx, instruct);
+    if (strcmp(instruct.name, "LDURH") == 0) implement_LDURH(ctx, instruct);
+    if (strcmp(instruct.name, "MOVZ") == 0) implement_MOVZ(ctx, instruct);
+    if (strcmp(instruct.name, "ADD(Extended Register)") == 0) implement_ADD_extended_register(ctx, instruct);
+    if (strcmp(instruct.name, "ADD(immediate)") == 0) implement_ADD_immediate(ctx, instruct);
+    if (strcmp(instruct.name, "MUL") == 0) implement_MUL(ctx, instruct);
+    if (strcmp(instruct.name, "CBZ") == 0 ) implement_CBZ(ctx, instruct);
+    if (strcmp(instruct.name, "CBNZ") == 0) implement_CBNZ(ctx, instruct);
+    if (strcmp(instruct.name, "LDXR") == 0) implement_LDXR(ctx, instruct);
+    if (strcmp(instruct.name, "STXR") == 0) implement_STXR(ctx, instruct);
+    if (strcmp(instruct.name, "LDADD") == 0) implement_LDADD(ctx, instruct);
+    if (strcmp(instruct.name, "SWP") == 0) implement_SWP(ctx, instruct);
+    if (strcmp(instruct.name, "CAS") == 0) implement_CAS(ctx, instruct);
+    if (strcmp(instruct.name, "BARRIER") == 0) implement_BARRIER(ctx, instruct);
+    if (strcmp(instruct.name, "NOP") == 0) implement_NOP(ctx, instruct);
+
+    // Instrucción no reconocida: detener la simulación
+    if (strcmp(instruct.name, "UNKNOWN") == 0) {
+        SIM_DEBUG(ctx, "Instrucción desconocida 0x%08X en 0x%" PRIx64 "\n", bytecode, ctx->CURRENT_STATE.PC);
+        ctx->RUN_BIT = 0;
+    }
+}
+
+instruction decode_instruction(sim_ctx_t *ctx, uint32_t bytecode) {
+    instruction instr_def = {0};
+
+    instr_def.name = "UNKNOWN";
+    decode_instruction_opcode(ctx, &instr_def, bytecode);
     decode_completely_instruction(&instr_def, bytecode);
 
     return instr_def;
 }
 
 
-void decode_instruction_opcode(instruction *instr, uint32_t bytecode) {
+void decode_instruction_opcode(sim_ctx_t *ctx, instruction *instr, uint32_t bytecode) {
     
     // Instrucciones tipo R, D, IW (Opcode en bits [31:21], 11 bits)
     uint32_t opcode_21 = (bytecode >> 21) & MASK_21;  
-    printf("Opcode 21: 0x%X\n", opcode_21);
+    SIM_DEBUG(ctx, "Opcode 21: 0x%X\n", opcode_21);
     for (int i = 0; i < OPCODE_TABLE_SIZE; i++) {
-        if (opcode_table[i].opcode == opcode_21) {
-            printf("Entro al opcode 21\n");
+        if (opcode_table[i].name != NULL && opcode_table[i].opcode == opcode_21) {
+            SIM_DEBUG(ctx, "Entro al opcode 21\n");
             instr->opcode = opcode_table[i].opcode;
             instr->name = opcode_table[i].name;
             strcpy(instr->type, opcode_table[i].type);
@@ -158,10 +298,10 @@ void decode_instruction_opcode(instruction *instr, uint32_t bytecode) {
 
     // Instrucciones tipo B (Opcode en bits [31:26], 6 bits)
     uint32_t opcode_26 = (bytecode >> 26) & MASK_26;
-    printf("Opcode 26: 0x%X\n", opcode_26);
+    SIM_DEBUG(ctx, "Opcode 26: 0x%X\n", opcode_26);
     for (int i = 0; i < OPCODE_TABLE_SIZE; i++) {
-        if (opcode_table[i].opcode == opcode_26) {
-            printf("Entro al opcode 26\n");
+        if (opcode_table[i].name != NULL && opcode_table[i].opcode == opcode_26) {
+            SIM_DEBUG(ctx, "Entro al opcode 26\n");
             instr->opcode = opcode_table[i].opcode;
             instr->name = opcode_table[i].name;
             strcpy(instr->type, opcode_table[i].type);
@@ -171,10 +311,10 @@ void decode_instruction_opcode(instruction *instr, uint32_t bytecode) {
 
     // Instrucciones tipo CB (Opcode en bits [31:24], 8 bits)
     uint32_t opcode_24 = (bytecode >> 24) & MASK_24;
-    printf("Opcode 24: 0x%X\n", opcode_24);
+    SIM_DEBUG(ctx, "Opcode 24: 0x%X\n", opcode_24);
     for (int i = 0; i < OPCODE_TABLE_SIZE; i++) {
-        if (opcode_table[i].opcode == opcode_24) {
-            printf("Entro al opcode 24\n");
+        if (opcode_table[i].name != NULL && opcode_table[i].opcode == opcode_24) {
+            SIM_DEBUG(ctx, "Entro al opcode 24\n");
             instr->opcode = opcode_table[i].opcode;
             instr->name = opcode_table[i].name;
             strcpy(instr->type, opcode_table[i].type);
@@ -184,10 +324,10 @@ void decode_instruction_opcode(instruction *instr, uint32_t bytecode) {
 
     // Instrucciones tipo I (Immediate) - Opcode en bits [31:22], 10 bits
     uint32_t opcode_22 = (bytecode >> 22) & MASK_22;  
-    printf("Opcode 22: 0x%X\n", opcode_22);
+    SIM_DEBUG(ctx, "Opcode 22: 0x%X\n", opcode_22);
     for (int i = 0; i < OPCODE_TABLE_SIZE; i++) {
-        if (opcode_table[i].opcode == opcode_22) {
-            printf("Entro al opcode 22\n");
+        if (opcode_table[i].name != NULL && opcode_table[i].opcode == opcode_22) {
+            SIM_DEBUG(ctx, "Entro al opcode 22\n");
             instr->opcode = opcode_table[i].opcode;
             instr->name = opcode_table[i].name;
             strcpy(instr->type, opcode_table[i].type);
@@ -241,121 +381,144 @@ void decode_completely_instruction(instruction *instr, uint32_t bytecode) {
         instr->rn = (bytecode >> 5) & MASK_5bits;      // Bits [9:5] - Registro fuente
         instr->dt_address = (bytecode >> 12) & MASK_9bits;   // Bits [20:12] - Dirección de datos
         strcpy(instr->type, "D");
+    } else if (strcmp(instr->type, "A") == 0) {
+        instr->rt = bytecode & MASK_5bits;             // Bits [4:0] - Registro de datos (Xt)
+        instr->rn = (bytecode >> 5) & MASK_5bits;      // Bits [9:5] - Registro base (Xn)
+        instr->shamt = (bytecode >> 10) & 0x3F;        // Bits [15:10] - o0/o3, 11111 en exclusivas
+        instr->rm = (bytecode >> 16) & MASK_5bits;     // Bits [20:16] - Registro Xs / Ws de estado
+        // LDADD comparte bits [31:21] con LDR/STR (registro), que tienen
+        // bits [11:10] = 10; las atómicas tienen 00 y opc [14:12] = 000.
+        // SWP tiene además el bit 15 en 1
+        if (strcmp(instr->name, "LDADD") == 0 && (bytecode & 0x7C00) != 0)
+            instr->name = "UNKNOWN";
+        else if (strcmp(instr->name, "LDADD") == 0 && (bytecode & (1 << 15)))
+            instr->name = "SWP";
+    } else if (strcmp(instr->type, "SYS") == 0) {
+        instr->shamt = (bytecode >> 12) & 0xF;         // Bits [15:12] - CRn (3 en barreras)
+        instr->alu_immediate = (bytecode >> 5) & 0x7;  // Bits [7:5] - op2 (4 DSB, 5 DMB, 6 ISB)
+        // [31:21] abarca todo el espacio de sistema: solo DMB/DSB/ISB
+        // son barreras, NOP es el único hint, y el resto no se implementa
+        if (bytecode == 0xD503201F)
+            instr->name = "NOP";
+        else if ((bytecode & 0xFFFFF01F) != 0xD503301F || instr->alu_immediate < 4 ||
+                 instr->alu_immediate > 6)
+            instr->name = "UNKNOWN";
     }
 }
 
 // INSTRUCCIONES -------------------------------------------------------------------------------------------
-void implement_ADDS_immediate(instruction instruct) {
-    printf("Implementing ADDS(immediate)\n");
+void implement_ADDS_immediate(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing ADDS(immediate)\n");
 
-    uint64_t op1 = CURRENT_STATE.REGS[instruct.rn];
+    uint64_t op1 = ctx->CURRENT_STATE.REGS[instruct.rn];
     uint64_t op2 = instruct.alu_immediate;
 
     uint64_t result = op1 + op2;
-    NEXT_STATE.REGS[instruct.rd] = result;
+    ctx->NEXT_STATE.REGS[instruct.rd] = result;
    
-    NEXT_STATE.FLAG_N = (result >> 63) & 1;
-    NEXT_STATE.FLAG_Z = (result == 0) ? 1 : 0;
+    ctx->NEXT_STATE.FLAG_N = (result >> 63) & 1;
+    ctx->NEXT_STATE.FLAG_Z = (result == 0) ? 1 : 0;
 }
 
-void implement_ADDS_extended_register(instruction instruct) {
-    printf("Implementing ADDS(Extended Register)\n");
-    uint64_t op1 = CURRENT_STATE.REGS[instruct.rn]; 
-    uint64_t op2 = CURRENT_STATE.REGS[instruct.rm]; 
+void implement_ADDS_extended_register(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing ADDS(Extended Register)\n");
+    uint64_t op1 = ctx->CURRENT_STATE.REGS[instruct.rn]; 
+    uint64_t op2 = ctx->CURRENT_STATE.REGS[instruct.rm]; 
 
     uint64_t result = op1 + op2;
     
-    NEXT_STATE.REGS[instruct.rd] = result; 
+    ctx->NEXT_STATE.REGS[instruct.rd] = result; 
 
-    NEXT_STATE.FLAG_N = (result >> 63) & 1;
-    NEXT_STATE.FLAG_Z = (result == 0) ? 1 : 0;
+    ctx->NEXT_STATE.FLAG_N = (result >> 63) & 1;
+    ctx->NEXT_STATE.FLAG_Z = (result == 0) ? 1 : 0;
     
 }
 
-void implement_SUBS_immediate(instruction instruct) {
-    printf("Implementing SUBS(immediate)\n");
+void implement_SUBS_immediate(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing SUBS(immediate)\n");
 
-    uint64_t op1 = CURRENT_STATE.REGS[instruct.rn];
+    uint64_t op1 = ctx->CURRENT_STATE.REGS[instruct.rn];
     uint64_t op2 = instruct.alu_immediate;
 
     uint64_t result = op1 - op2;
     
-    NEXT_STATE.FLAG_N = (result >> 63) & 1; 
-    NEXT_STATE.FLAG_Z = (result == 0) ? 1 : 0; 
+    ctx->NEXT_STATE.FLAG_N = (result >> 63) & 1; 
+    ctx->NEXT_STATE.FLAG_Z = (result == 0) ? 1 : 0; 
     
     if (instruct.rd != 31) {
-        NEXT_STATE.REGS[instruct.rd] = result; 
+        ctx->NEXT_STATE.REGS[instruct.rd] = result; 
        
     }
 }
 
-void implement_SUBS_extended_register(instruction instruct) {
-    printf("Implementing SUBS(Extended Register)\n");
+void implement_SUBS_extended_register(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing SUBS(Extended Register)\n");
 
-    uint64_t op1 = CURRENT_STATE.REGS[instruct.rn]; 
-    uint64_t op2 = CURRENT_STATE.REGS[instruct.rm];
+    uint64_t op1 = ctx->CURRENT_STATE.REGS[instruct.rn]; 
+    uint64_t op2 = ctx->CURRENT_STATE.REGS[instruct.rm];
 
     uint64_t result = op1 - op2;
 
-    NEXT_STATE.FLAG_N = (result >> 63) & 1;
-    NEXT_STATE.FLAG_Z = (result == 0) ? 1 : 0; 
+    ctx->NEXT_STATE.FLAG_N = (result >> 63) & 1;
+    ctx->NEXT_STATE.FLAG_Z = (result == 0) ? 1 : 0; 
 
     if (instruct.rd != 31) {
-        NEXT_STATE.REGS[instruct.rd] = result; 
+        ctx->NEXT_STATE.REGS[instruct.rd] = result; 
         
     }
 }
 
-void implement_HLT(instruction instruct) {
-    printf("Implementing HLT\n");
-    RUN_BIT = 0;
+void implement_HLT(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing HLT\n");
+    (void)instruct;
+    ctx->RUN_BIT = 0;
 }
 
-void implement_ANDS_shifted_register(instruction instruct) {
-    printf("Implementing ANDS(Shifted Register)\n");
+void implement_ANDS_shifted_register(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing ANDS(Shifted Register)\n");
 
-    uint64_t op1 = CURRENT_STATE.REGS[instruct.rn];  
-    uint64_t op2 = CURRENT_STATE.REGS[instruct.rm]; 
+    uint64_t op1 = ctx->CURRENT_STATE.REGS[instruct.rn];  
+    uint64_t op2 = ctx->CURRENT_STATE.REGS[instruct.rm]; 
 
     uint64_t result = op1 & op2;
    
-    NEXT_STATE.REGS[instruct.rd] = result;
+    ctx->NEXT_STATE.REGS[instruct.rd] = result;
 
-    NEXT_STATE.FLAG_N = (result >> 63) & 1; 
-    NEXT_STATE.FLAG_Z = (result == 0) ? 1 : 0; 
+    ctx->NEXT_STATE.FLAG_N = (result >> 63) & 1; 
+    ctx->NEXT_STATE.FLAG_Z = (result == 0) ? 1 : 0; 
     
 }
 
-void implement_MOVZ(instruction instruct) {
-    printf("Implementing MOVZ\n");
+void implement_MOVZ(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing MOVZ\n");
 
     uint64_t imm = instruct.mov_immediate; 
 
     uint64_t result = imm;
     
-    NEXT_STATE.REGS[instruct.rd] = result; 
+    ctx->NEXT_STATE.REGS[instruct.rd] = result; 
 
-    NEXT_STATE.FLAG_N = (result >> 63) & 1; 
-    NEXT_STATE.FLAG_Z = (result == 0) ? 1 : 0; 
+    ctx->NEXT_STATE.FLAG_N = (result >> 63) & 1; 
+    ctx->NEXT_STATE.FLAG_Z = (result == 0) ? 1 : 0; 
     
 }
 
-void implement_LSL_immediate(instruction instruct) {
-    printf("Implementing LSL(Immediate)\n");
+void implement_LSL_immediate(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing LSL(Immediate)\n");
 
-    uint64_t op1 = CURRENT_STATE.REGS[instruct.rn];
+    uint64_t op1 = ctx->CURRENT_STATE.REGS[instruct.rn];
     uint64_t shift_amount = 64 - instruct.rm; 
 
     uint64_t result = op1 << shift_amount;
 
-    NEXT_STATE.REGS[instruct.rd] = result;
+    ctx->NEXT_STATE.REGS[instruct.rd] = result;
 
-    NEXT_STATE.FLAG_N = (result >> 63) & 1;  
-    NEXT_STATE.FLAG_Z = (result == 0) ? 1 : 0; 
+    ctx->NEXT_STATE.FLAG_N = (result >> 63) & 1;  
+    ctx->NEXT_STATE.FLAG_Z = (result == 0) ? 1 : 0; 
 }
 
-void implement_STUR(instruction instruct) {
-    printf("Implementing STUR\n");
+void implement_STUR(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing STUR\n");
     uint64_t signed_offset;
     if (instruct.dt_address & (1 << 8)) {  
         signed_offset = (uint64_t)(instruct.dt_address | 0xFFFFFFFFFFFFFF00);
@@ -363,15 +526,15 @@ void implement_STUR(instruction instruct) {
         signed_offset = (uint64_t)(instruct.dt_address & 0x1FF); 
     }
 
-    uint64_t address = CURRENT_STATE.REGS[instruct.rn] + signed_offset;
-    uint32_t value = CURRENT_STATE.REGS[instruct.rd] & 0xFFFFFFFF;
+    uint64_t address = ctx->CURRENT_STATE.REGS[instruct.rn] + signed_offset;
+    uint32_t value = ctx->CURRENT_STATE.REGS[instruct.rd] & 0xFFFFFFFF;
 
-    mem_write_32(address, value);
+    mem_write_32(ctx, address, value);
    
 }
 
-void implement_STURB(instruction instruct) {
-    printf("Implementing STURB\n");
+void implement_STURB(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing STURB\n");
 
      uint64_t signed_offset;
     if (instruct.dt_address & (1 << 8)) { 
@@ -380,20 +543,20 @@ void implement_STURB(instruction instruct) {
         signed_offset = (uint64_t)(instruct.dt_address & 0x1FF);
     }
 
-    uint64_t address = CURRENT_STATE.REGS[instruct.rn] + signed_offset;
+    uint64_t address = ctx->CURRENT_STATE.REGS[instruct.rn] + signed_offset;
 
-    uint8_t value = CURRENT_STATE.REGS[instruct.rd] & 0xFF;
+    uint8_t value = ctx->CURRENT_STATE.REGS[instruct.rd] & 0xFF;
 
     uint32_t aligned_address = address & ~0x3;
-    uint32_t aligned_value = mem_read_32(aligned_address); 
+    uint32_t aligned_value = mem_read_32_nowatch(ctx, aligned_address); 
     uint32_t byte_shift = (address & MASK_2bits) * 8;  
     aligned_value = (aligned_value & ~(0xFF << byte_shift)) | (value << byte_shift); 
-    mem_write_32(aligned_address, aligned_value); 
+    mem_write_32(ctx, aligned_address, aligned_value); 
 
 }
 
-void implement_LDUR(instruction instruct) {
-    printf("Implementing LDUR\n");
+void implement_LDUR(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing LDUR\n");
     uint64_t signed_offset;
     if (instruct.dt_address & (1 << 8)) {
         signed_offset = (uint64_t)(instruct.dt_address | 0xFFFFFFFFFFFFFF00);
@@ -401,21 +564,19 @@ void implement_LDUR(instruction instruct) {
         signed_offset = (uint64_t)(instruct.dt_address & 0x1FF); 
     }
 
-    uint64_t address = CURRENT_STATE.REGS[instruct.rn] + signed_offset;
+    uint64_t address = ctx->CURRENT_STATE.REGS[instruct.rn] + signed_offset;
 
-    uint32_t value = mem_read_32(address);
-    
     uint32_t aligned_address = address & ~0x3; 
-    uint32_t aligned_value = mem_read_32(aligned_address);
-    uint32_t aligned_high = mem_read_32(aligned_address + 4);
+    uint32_t aligned_value = mem_read_32(ctx, aligned_address);
+    uint32_t aligned_high = mem_read_32(ctx, aligned_address + 4);
 
     uint64_t concatenado = (uint64_t)aligned_high << 32 | aligned_value;
-    NEXT_STATE.REGS[instruct.rd] = concatenado;
+    ctx->NEXT_STATE.REGS[instruct.rd] = concatenado;
    
 }
 
-void implement_LDURB(instruction instruct) {
-    printf("Implementing LDURB\n");
+void implement_LDURB(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing LDURB\n");
 
     uint64_t signed_offset;
     if (instruct.dt_address & (1 << 8)) { 
@@ -424,57 +585,57 @@ void implement_LDURB(instruction instruct) {
         signed_offset = (uint64_t)(instruct.dt_address & 0x1FF);
     }
 
-    uint64_t address = CURRENT_STATE.REGS[instruct.rn] + signed_offset;
+    uint64_t address = ctx->CURRENT_STATE.REGS[instruct.rn] + signed_offset;
 
     uint32_t aligned_address = address & ~0x3; 
-    uint32_t aligned_value = mem_read_32(aligned_address);
+    uint32_t aligned_value = mem_read_32(ctx, aligned_address);
     uint32_t byte_shift = (address & MASK_2bits) * 8;
     uint8_t value = (aligned_value >> byte_shift) & 0xFF;
 
-    NEXT_STATE.REGS[instruct.rd] = value;
+    ctx->NEXT_STATE.REGS[instruct.rd] = value;
 }
 
-void implement_EOR_shifted_register(instruction instruct) {
-    printf("Implementing EOR(Shifter Register)\n");
+void implement_EOR_shifted_register(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing EOR(Shifter Register)\n");
 
-    uint64_t op1 = CURRENT_STATE.REGS[instruct.rn];
-    uint64_t op2 = CURRENT_STATE.REGS[instruct.rm];
+    uint64_t op1 = ctx->CURRENT_STATE.REGS[instruct.rn];
+    uint64_t op2 = ctx->CURRENT_STATE.REGS[instruct.rm];
 
     uint64_t result = op1 ^ op2;
    
-    NEXT_STATE.REGS[instruct.rd] = result; 
+    ctx->NEXT_STATE.REGS[instruct.rd] = result; 
     
 }
 
-void implement_BCOND(instruction instruct) {
-    printf("Implementing BCOND\n");
+void implement_BCOND(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing BCOND\n");
 
     int cond = instruct.rt;
     int branch = 0;
     switch (cond) {
         case 0b0000:
-            printf("BEQ\n");
-            branch = CURRENT_STATE.FLAG_Z;
+            SIM_DEBUG(ctx, "BEQ\n");
+            branch = ctx->CURRENT_STATE.FLAG_Z;
             break;
         case 0b0001:
-            printf("BNE\n");
-            branch = !CURRENT_STATE.FLAG_Z;
+            SIM_DEBUG(ctx, "BNE\n");
+            branch = !ctx->CURRENT_STATE.FLAG_Z;
             break;
         case 0b1100:
-            printf("BGT\n");
-            branch = !CURRENT_STATE.FLAG_Z && !CURRENT_STATE.FLAG_N;
+            SIM_DEBUG(ctx, "BGT\n");
+            branch = !ctx->CURRENT_STATE.FLAG_Z && !ctx->CURRENT_STATE.FLAG_N;
             break;
         case 0b1011:
-            printf("BLT\n");
-            branch = CURRENT_STATE.FLAG_N;
+            SIM_DEBUG(ctx, "BLT\n");
+            branch = ctx->CURRENT_STATE.FLAG_N;
             break;
         case 0b1010:
-            printf("BGE\n");
-            branch = !CURRENT_STATE.FLAG_N;
+            SIM_DEBUG(ctx, "BGE\n");
+            branch = !ctx->CURRENT_STATE.FLAG_N;
             break;
         case 0b1101:
-            printf("BLE\n");
-            branch = CURRENT_STATE.FLAG_Z || CURRENT_STATE.FLAG_N;
+            SIM_DEBUG(ctx, "BLE\n");
+            branch = ctx->CURRENT_STATE.FLAG_Z || ctx->CURRENT_STATE.FLAG_N;
             break;
     }
 
@@ -487,23 +648,23 @@ void implement_BCOND(instruction instruct) {
             signed_offset = (int64_t)(instruct.cond_br_address & 0x3FFFF); 
         }
 
-        NEXT_STATE.PC = CURRENT_STATE.PC + (signed_offset << 2);
+        ctx->NEXT_STATE.PC = ctx->CURRENT_STATE.PC + (signed_offset << 2);
        
     }
 }
 
-void implement_ORR_shifted_register(instruction instruct) {
-    printf("Implementing ORR(Shifter Register)\n");
+void implement_ORR_shifted_register(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing ORR(Shifter Register)\n");
 
-    uint64_t op1 = CURRENT_STATE.REGS[instruct.rn];
-    uint64_t op2 = CURRENT_STATE.REGS[instruct.shamt];
+    uint64_t op1 = ctx->CURRENT_STATE.REGS[instruct.rn];
+    uint64_t op2 = ctx->CURRENT_STATE.REGS[instruct.shamt];
 
     uint64_t result = op1 | op2;
-    NEXT_STATE.REGS[instruct.rd] = result;
+    ctx->NEXT_STATE.REGS[instruct.rd] = result;
 }
 
-void implement_STURH(instruction instruct) {
-    printf("Implementing STURH\n");
+void implement_STURH(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing STURH\n");
 
     uint64_t signed_offset;
     if (instruct.dt_address & (1 << 8)) { 
@@ -512,21 +673,21 @@ void implement_STURH(instruction instruct) {
         signed_offset = (uint64_t)(instruct.dt_address & 0x1FF); 
     }
 
-    uint64_t address = CURRENT_STATE.REGS[instruct.rn] + signed_offset; 
-    uint16_t value = CURRENT_STATE.REGS[instruct.rd] & 0xFFFF; 
+    uint64_t address = ctx->CURRENT_STATE.REGS[instruct.rn] + signed_offset; 
+    uint16_t value = ctx->CURRENT_STATE.REGS[instruct.rd] & 0xFFFF; 
 
     uint32_t aligned_address = address & ~0x3; 
-    uint32_t aligned_value = mem_read_32(aligned_address); 
+    uint32_t aligned_value = mem_read_32_nowatch(ctx, aligned_address); 
     uint32_t halfword_shift = (address & 0x2) * 8; 
 
     
     aligned_value = (aligned_value & ~(0xFFFF << halfword_shift)) | (value << halfword_shift);
-    mem_write_32(aligned_address, aligned_value); 
+    mem_write_32(ctx, aligned_address, aligned_value); 
 
 }
 
-void implement_LDURH(instruction instruct) {
-    printf("Implementing LDURH\n");
+void implement_LDURH(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing LDURH\n");
 
     uint64_t signed_offset;
     if (instruct.dt_address & (1 << 8)) { 
@@ -535,25 +696,25 @@ void implement_LDURH(instruction instruct) {
         signed_offset = (uint64_t)(instruct.dt_address & 0x1FF); 
     }
 
-    uint64_t address = CURRENT_STATE.REGS[instruct.rn] + signed_offset;
+    uint64_t address = ctx->CURRENT_STATE.REGS[instruct.rn] + signed_offset;
 
     
     uint32_t aligned_address = address & ~0x3;  
-    uint32_t aligned_value = mem_read_32(aligned_address); 
+    uint32_t aligned_value = mem_read_32(ctx, aligned_address); 
     uint32_t halfword_shift = (address & 0x2) * 8; 
 
    
     uint16_t loaded_value = (aligned_value >> halfword_shift) & 0xFFFF;
-    CURRENT_STATE.REGS[instruct.rd] = loaded_value;  
+    ctx->CURRENT_STATE.REGS[instruct.rd] = loaded_value;  
 }
 
 
-void implement_CBZ(instruction instruct) {
-    printf("Implementing CBZ\n");
+void implement_CBZ(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing CBZ\n");
 
     
     int zero = 0;
-    if (CURRENT_STATE.REGS[instruct.rt] == 0) {
+    if (ctx->CURRENT_STATE.REGS[instruct.rt] == 0) {
         zero = 1; 
     } else {
         zero = 0; 
@@ -569,7 +730,7 @@ void implement_CBZ(instruction instruct) {
             signed_offset = (uint64_t)(instruct.cond_br_address & 0x3FFFF);
         }
 
-        uint64_t address = CURRENT_STATE.PC + (signed_offset << 2);
+        uint64_t address = ctx->CURRENT_STATE.PC + (signed_offset << 2);
        
 
         
@@ -579,20 +740,20 @@ void implement_CBZ(instruction instruct) {
         }
 
         
-        NEXT_STATE.PC = address;
+        ctx->NEXT_STATE.PC = address;
 
         
     } else {
         
-        NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+        ctx->NEXT_STATE.PC = ctx->CURRENT_STATE.PC + 4;
     }
 }
-void implement_CBNZ(instruction instruct) {
-    printf("Implementing CBNZ\n");
+void implement_CBNZ(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing CBNZ\n");
 
     
     int zero = 0; 
-    if (CURRENT_STATE.REGS[instruct.rt] == 0) {
+    if (ctx->CURRENT_STATE.REGS[instruct.rt] == 0) {
         zero = 1; 
     } else {
         zero = 0; 
@@ -607,7 +768,7 @@ void implement_CBNZ(instruction instruct) {
             signed_offset = (uint64_t)(instruct.cond_br_address & 0x3FFFF); 
         }
         
-        uint64_t address = CURRENT_STATE.PC + (signed_offset << 2);
+        uint64_t address = ctx->CURRENT_STATE.PC + (signed_offset << 2);
 
         
         if (address % 4 != 0) {
@@ -615,17 +776,17 @@ void implement_CBNZ(instruction instruct) {
         }
 
        
-        NEXT_STATE.PC = address;
+        ctx->NEXT_STATE.PC = address;
 
         
     } else {
         
-        NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+        ctx->NEXT_STATE.PC = ctx->CURRENT_STATE.PC + 4;
     }
 }
 
-void implement_B(instruction instruct) {
-    printf("Implementing B\n");
+void implement_B(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing B\n");
 
     int64_t signed_offset;
     if (instruct.br_address & (1 << 18)) {
@@ -634,76 +795,173 @@ void implement_B(instruction instruct) {
         signed_offset = (int64_t)(instruct.br_address & 0x3FFFF); 
     }
 
-    uint64_t address = CURRENT_STATE.PC + (signed_offset << 2);
+    uint64_t address = ctx->CURRENT_STATE.PC + (signed_offset << 2);
 
-    NEXT_STATE.PC = address;
+    ctx->NEXT_STATE.PC = address;
 }
 
-void implement_BR(instruction instruct) {
-    printf("Implementing BR\n");
+void implement_BR(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing BR\n");
 
-    uint64_t address = CURRENT_STATE.REGS[instruct.rn];
+    uint64_t address = ctx->CURRENT_STATE.REGS[instruct.rn];
 
     if (address > 0x1000000000000) { 
-        printf("Warning: Jump address 0x%" PRIx64 " is out of bounds! Address too high.\n", address);
+        SIM_DEBUG(ctx, "Warning: Jump address 0x%" PRIx64 " is out of bounds! Address too high.\n", address);
     }
 
     if (address % 4 != 0) {
-        printf("Error: Dirección no alineada 0x%" PRIx64 "\n", address);
+        SIM_DEBUG(ctx, "Error: Dirección no alineada 0x%" PRIx64 "\n", address);
         return;
     }
 
-    NEXT_STATE.PC = address;
+    ctx->NEXT_STATE.PC = address;
 
-    printf("Branching to 0x%" PRIx64 "\n", NEXT_STATE.PC);
+    SIM_DEBUG(ctx, "Branching to 0x%" PRIx64 "\n", ctx->NEXT_STATE.PC);
 }
 
-void implement_MUL(instruction instruct) {
-    printf("Implementing MUL\n");
+void implement_MUL(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing MUL\n");
 
-    uint64_t op1 = CURRENT_STATE.REGS[instruct.rn]; 
-    uint64_t op2 = CURRENT_STATE.REGS[instruct.rm]; 
+    uint64_t op1 = ctx->CURRENT_STATE.REGS[instruct.rn]; 
+    uint64_t op2 = ctx->CURRENT_STATE.REGS[instruct.rm]; 
 
     uint64_t result = op1 * op2;
   
-    NEXT_STATE.REGS[instruct.rd] = result;
+    ctx->NEXT_STATE.REGS[instruct.rd] = result;
 
 }
 
-void implement_ADD_immediate(instruction instruct) {
-    printf("Implementing ADD(immediate)\n");
+void implement_ADD_immediate(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing ADD(immediate)\n");
 
-    uint64_t op1 = CURRENT_STATE.REGS[instruct.rn]; 
+    uint64_t op1 = ctx->CURRENT_STATE.REGS[instruct.rn]; 
     uint64_t op2 = instruct.alu_immediate; 
 
     uint64_t result = op1 + op2;
-    NEXT_STATE.REGS[instruct.rd] = result; 
+    ctx->NEXT_STATE.REGS[instruct.rd] = result; 
 
 }
 
-void implement_LSR_immediate(instruction instruct) {
-    printf("Implementing LSR(Immediate)\n");
+void implement_LSR_immediate(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing LSR(Immediate)\n");
 
-    uint64_t op1 = CURRENT_STATE.REGS[instruct.rn]; 
+    uint64_t op1 = ctx->CURRENT_STATE.REGS[instruct.rn]; 
     uint64_t shift_amount = instruct.rm;
 
     uint64_t result = op1 >> shift_amount;
 
-    NEXT_STATE.REGS[instruct.rd] = result;
+    ctx->NEXT_STATE.REGS[instruct.rd] = result;
 }
 
-void implement_ADD_extended_register(instruction instruct) {
-    printf("Implementing ADD(Extended Register)\n");
+void implement_ADD_extended_register(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing ADD(Extended Register)\n");
 
-    uint64_t op1 = CURRENT_STATE.REGS[instruct.rn];
-    uint64_t op2 = CURRENT_STATE.REGS[instruct.rm];
+    // el decode de tipo R deja en rm los bits [21:16]; el bit 21 marca la forma extendida
+    uint64_t op1 = ctx->CURRENT_STATE.REGS[instruct.rn];
+    uint64_t op2 = ctx->CURRENT_STATE.REGS[instruct.rm & MASK_5bits];
 
     uint64_t result = op1 + op2;
    
 
     if (instruct.rd != 31) {
-        NEXT_STATE.REGS[instruct.rd] = result; 
+        ctx->NEXT_STATE.REGS[instruct.rd] = result; 
        
     }
 }
 
+/* Las atómicas operan directamente sobre la memoria del host para que
+   los núcleos SMP que comparten el mapa de memoria se vean entre sí. */
+static uint64_t *atomic_host_ptr(sim_ctx_t *ctx, uint64_t address, int for_write) {
+    uint64_t *p = NULL;
+
+    if ((address & 7) == 0)
+        p = (uint64_t *)mem_host_ptr(ctx, address, 8, for_write);
+    if (p == NULL) {
+        SIM_DEBUG(ctx, "Acceso atómico inválido en 0x%" PRIx64 "\n", address);
+        ctx->RUN_BIT = 0;
+    }
+    return p;
+}
+
+void implement_LDXR(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing LDXR\n");
+
+    uint64_t address = ctx->CURRENT_STATE.REGS[instruct.rn];
+    uint64_t *p = atomic_host_ptr(ctx, address, FALSE);
+    if (p == NULL)
+        return;
+
+    uint64_t value = __atomic_load_n(p, __ATOMIC_ACQUIRE);
+    ctx->EXCL_VALID = TRUE;
+    ctx->EXCL_ADDR = address;
+    ctx->EXCL_VALUE = value;
+    ctx->NEXT_STATE.REGS[instruct.rt] = value;
+}
+
+void implement_STXR(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing STXR\n");
+
+    uint64_t address = ctx->CURRENT_STATE.REGS[instruct.rn];
+    uint64_t *p = atomic_host_ptr(ctx, address, TRUE);
+    if (p == NULL)
+        return;
+
+    // El monitor exclusivo se emula comparando con el valor leído por LDXR
+    int ok = FALSE;
+    if (ctx->EXCL_VALID && ctx->EXCL_ADDR == address) {
+        uint64_t expected = ctx->EXCL_VALUE;
+        ok = __atomic_compare_exchange_n(p, &expected, ctx->CURRENT_STATE.REGS[instruct.rt],
+                                         FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+    ctx->EXCL_VALID = FALSE;
+    ctx->NEXT_STATE.REGS[instruct.rm] = ok ? 0 : 1;
+}
+
+void implement_LDADD(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing LDADD\n");
+
+    uint64_t *p = atomic_host_ptr(ctx, ctx->CURRENT_STATE.REGS[instruct.rn], TRUE);
+    if (p == NULL)
+        return;
+
+    uint64_t old = __atomic_fetch_add(p, ctx->CURRENT_STATE.REGS[instruct.rm], __ATOMIC_SEQ_CST);
+    ctx->NEXT_STATE.REGS[instruct.rt] = old;
+}
+
+void implement_SWP(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing SWP\n");
+
+    uint64_t *p = atomic_host_ptr(ctx, ctx->CURRENT_STATE.REGS[instruct.rn], TRUE);
+    if (p == NULL)
+        return;
+
+    uint64_t old = __atomic_exchange_n(p, ctx->CURRENT_STATE.REGS[instruct.rm], __ATOMIC_SEQ_CST);
+    ctx->NEXT_STATE.REGS[instruct.rt] = old;
+}
+
+void implement_CAS(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing CAS\n");
+
+    uint64_t *p = atomic_host_ptr(ctx, ctx->CURRENT_STATE.REGS[instruct.rn], TRUE);
+    if (p == NULL)
+        return;
+
+    // Xs recibe siempre el valor anterior de memoria
+    uint64_t expected = ctx->CURRENT_STATE.REGS[instruct.rm];
+    __atomic_compare_exchange_n(p, &expected, ctx->CURRENT_STATE.REGS[instruct.rt],
+                                FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    ctx->NEXT_STATE.REGS[instruct.rm] = expected;
+}
+
+void implement_BARRIER(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing BARRIER\n");
+
+    // DMB/DSB (op2 = 5/4) ordenan la memoria; ISB no tiene nada que vaciar
+    if (instruct.alu_immediate == 4 || instruct.alu_immediate == 5)
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void implement_NOP(sim_ctx_t *ctx, instruction instruct) {
+    SIM_DEBUG(ctx, "Implementing NOP\n");
+    (void)instruct;
+}
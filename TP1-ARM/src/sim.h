@@ -0,0 +1,52 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Decoder interface shared by sim.c and the engines that    */
+/*   reuse its decode and handlers                             */
+/*                                                             */
+/***************************************************************/
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include "engine.h"
+
+#define OPCODE_TABLE_SIZE 50
+
+typedef struct instruction_t{
+    uint32_t opcode;
+    uint32_t rd;
+    uint32_t rn;
+    uint32_t rm;
+    uint32_t rt;
+    uint32_t shamt;
+    uint32_t alu_immediate;
+    uint32_t dt_address;
+    uint32_t br_address;
+    uint32_t cond_br_address;
+    uint32_t mov_immediate;
+    char type[20];  
+    char *name;
+} instruction;
+
+extern const instruction opcode_table[OPCODE_TABLE_SIZE];
+
+/* ctx only decides whether the decoder is chatty, and may be NULL */
+instruction decode_instruction(sim_ctx_t *ctx, uint32_t bytecode);
+void        execute_instruction(sim_ctx_t *ctx, instruction instruct, uint32_t bytecode);
+
+/* A predecoded text word: its fields plus the handler that runs it,
+   so the fetch loop skips decode and the dispatch by name */
+typedef void (*instruction_handler)(sim_ctx_t *ctx, instruction instruct);
+
+typedef struct decoded_t {
+    uint32_t bytecode;          /* checked at fetch: a rewritten word misses */
+    instruction instr;
+    instruction_handler handler;  /* NULL for unknown words */
+} decoded_t;
+
+void predecode(sim_ctx_t *ctx, uint64_t start, uint32_t nwords);
+void predecode_fill(sim_ctx_t *ctx);
+
+#endif
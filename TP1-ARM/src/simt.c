@@ -0,0 +1,548 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   SIMT: one program over many lanes in lockstep             */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "engine.h"
+#include "sim.h"
+#include "device.h"
+#include "armsim.h"
+
+/* On x86-64 the ALU loops are built a second time for AVX2 and
+   picked at create time when the CPU has it */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SIMT_AVX2
+#endif
+#define SIMT_INLINE static inline __attribute__((always_inline))
+
+/***************************************************************/
+/* Lanes are ordinary simulators, each with its own memory.    */
+/* While they share a PC they form the lockstep group: the     */
+/* instruction is fetched once and taken from the predecoded   */
+/* text, ALU instructions and branches run over a              */
+/* structure-of-arrays register file in loops the compiler     */
+/* vectorizes, and everything else runs through the scalar     */
+/* handlers lane by lane. A lane whose PC leaves the group's   */
+/* is split off and finishes on its own. The text segment is   */
+/* assumed identical across lanes.                             */
+/***************************************************************/
+
+struct armsim_simt_t {
+  int nlanes;
+  sim_ctx_t **lanes;
+
+  /* the lockstep group: slot j holds lane group[j] */
+  int ngroup;
+  int *group;
+  uint64_t pc;
+  int64_t *regs[ARM_REGS];
+  int *flag_n, *flag_z;
+  uint64_t *next_pc;          /* per slot, after a branch */
+
+  /* SIMT_* class of each predecoded text word, built per run */
+  unsigned char *ops;
+  uint32_t nops;
+
+  void (*alu)(struct armsim_simt_t *simt, int op, const instruction *in);
+  int watch_hit;              /* a lockstep access hit a watchpoint */
+  armsim_simt_stats_t stats;
+};
+
+/* Instructions with a lockstep implementation: ALU ops, then branches */
+enum {
+  SIMT_SCALAR, SIMT_ADDS_IMM, SIMT_ADDS_REG, SIMT_SUBS_IMM, SIMT_SUBS_REG,
+  SIMT_ANDS, SIMT_EOR, SIMT_ORR, SIMT_MOVZ, SIMT_LSL, SIMT_LSR,
+  SIMT_ADD_IMM, SIMT_ADD_REG, SIMT_MUL,
+  SIMT_B, SIMT_BCOND, SIMT_CBZ, SIMT_CBNZ
+};
+
+static const struct {
+  const char *name;
+  int op;
+} simt_ops[] = {
+  {"ADDS(immediate)", SIMT_ADDS_IMM},
+  {"ADDS(Extended Register)", SIMT_ADDS_REG},
+  {"SUBS(immediate)", SIMT_SUBS_IMM},
+  {"SUBS(Extended Register)", SIMT_SUBS_REG},
+  {"ANDS(Shifted Register)", SIMT_ANDS},
+  {"EOR(Shifter Register)", SIMT_EOR},
+  {"ORR(Shifted Register)", SIMT_ORR},
+  {"MOVZ", SIMT_MOVZ},
+  {"LSL(Immediate)", SIMT_LSL},
+  {"LSR(Immediate)", SIMT_LSR},
+  {"ADD(immediate)", SIMT_ADD_IMM},
+  {"ADD(Extended Register)", SIMT_ADD_REG},
+  {"MUL", SIMT_MUL},
+  {"B", SIMT_B},
+  {"BCOND", SIMT_BCOND},
+  {"CBZ", SIMT_CBZ},
+  {"CBNZ", SIMT_CBNZ},
+};
+
+static void simt_execute_alu(armsim_simt_t *simt, int op, const instruction *in);
+#ifdef SIMT_AVX2
+static void simt_execute_alu_avx2(armsim_simt_t *simt, int op, const instruction *in);
+#endif
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_simt_create                              */
+/*                                                             */
+/* Purpose   : Allocate nlanes independent lanes               */
+/*                                                             */
+/***************************************************************/
+armsim_simt_t *armsim_simt_create(int nlanes) {
+  armsim_simt_t *simt;
+  int i;
+
+  if (nlanes < 1)
+    return NULL;
+  simt = calloc(1, sizeof(armsim_simt_t));
+  simt->nlanes = nlanes;
+  simt->lanes = calloc(nlanes, sizeof(sim_ctx_t *));
+  for (i = 0; i < nlanes; i++)
+    simt->lanes[i] = sim_ctx_create();
+  simt->group = calloc(nlanes, sizeof(int));
+  for (i = 0; i < ARM_REGS; i++)
+    simt->regs[i] = calloc(nlanes, sizeof(int64_t));
+  simt->flag_n = calloc(nlanes, sizeof(int));
+  simt->flag_z = calloc(nlanes, sizeof(int));
+  simt->next_pc = calloc(nlanes, sizeof(uint64_t));
+  simt->alu = simt_execute_alu;
+#ifdef SIMT_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    simt->alu = simt_execute_alu_avx2;
+#endif
+  return simt;
+}
+
+void armsim_simt_destroy(armsim_simt_t *simt) {
+  int i;
+
+  for (i = 0; i < simt->nlanes; i++)
+    sim_ctx_destroy(simt->lanes[i]);
+  for (i = 0; i < ARM_REGS; i++)
+    free(simt->regs[i]);
+  free(simt->flag_n);
+  free(simt->flag_z);
+  free(simt->next_pc);
+  free(simt->ops);
+  free(simt->group);
+  free(simt->lanes);
+  free(simt);
+}
+
+int armsim_simt_nlanes(armsim_simt_t *simt) {
+  return simt->nlanes;
+}
+
+armsim_t *armsim_simt_lane(armsim_simt_t *simt, int n) {
+  if (n < 0 || n >= simt->nlanes)
+    return NULL;
+  return simt->lanes[n];
+}
+
+void armsim_simt_get_stats(armsim_simt_t *simt, armsim_simt_stats_t *stats) {
+  *stats = simt->stats;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_simt_load_file                           */
+/*                                                             */
+/* Purpose   : Load the same program into every lane           */
+/*                                                             */
+/***************************************************************/
+int armsim_simt_load_file(armsim_simt_t *simt, const char *path, int *nwords) {
+  int i, err;
+
+  for (i = 0; i < simt->nlanes; i++) {
+    err = armsim_load_file(simt->lanes[i], path, nwords);
+    if (err != ARMSIM_OK)
+      return err;
+  }
+  return ARMSIM_OK;
+}
+
+/* Copy a lane's registers into / out of group slot j */
+static void simt_gather(armsim_simt_t *simt, int j) {
+  CPU_State *state = &simt->lanes[simt->group[j]]->CURRENT_STATE;
+  int k;
+
+  for (k = 0; k < ARM_REGS; k++)
+    simt->regs[k][j] = state->REGS[k];
+  simt->flag_n[j] = state->FLAG_N;
+  simt->flag_z[j] = state->FLAG_Z;
+}
+
+static void simt_scatter(armsim_simt_t *simt, int j, uint64_t pc) {
+  sim_ctx_t *lane = simt->lanes[simt->group[j]];
+  int k;
+
+  for (k = 0; k < ARM_REGS; k++)
+    lane->CURRENT_STATE.REGS[k] = simt->regs[k][j];
+  lane->CURRENT_STATE.FLAG_N = simt->flag_n[j];
+  lane->CURRENT_STATE.FLAG_Z = simt->flag_z[j];
+  lane->CURRENT_STATE.PC = pc;
+  lane->NEXT_STATE = lane->CURRENT_STATE;
+}
+
+/* Drop slot j from the group by moving the last slot into it */
+static void simt_split(armsim_simt_t *simt, int j) {
+  int last = --simt->ngroup, k;
+
+  if (j == last)
+    return;
+  simt->group[j] = simt->group[last];
+  for (k = 0; k < ARM_REGS; k++)
+    simt->regs[k][j] = simt->regs[k][last];
+  simt->flag_n[j] = simt->flag_n[last];
+  simt->flag_z[j] = simt->flag_z[last];
+  simt->next_pc[j] = simt->next_pc[last];
+}
+
+static int simt_classify(const char *name) {
+  size_t i;
+
+  for (i = 0; i < sizeof(simt_ops) / sizeof(simt_ops[0]); i++)
+    if (strcmp(name, simt_ops[i].name) == 0)
+      return simt_ops[i].op;
+  return SIMT_SCALAR;
+}
+
+/* Classify every predecoded text word of the first lane once, so
+   a step finds its class by PC */
+static void simt_classify_text(armsim_simt_t *simt) {
+  mem_map_t *mem = simt->lanes[0]->MEM;
+  uint32_t i;
+
+  predecode_fill(simt->lanes[0]);
+  free(simt->ops);
+  simt->nops = mem->DECODED != NULL ? mem->NDECODED : 0;
+  simt->ops = calloc(simt->nops ? simt->nops : 1, 1);
+  for (i = 0; i < simt->nops; i++)
+    if (mem->DECODED[i].handler != NULL)
+      simt->ops[i] = simt_classify(mem->DECODED[i].instr.name);
+}
+
+SIMT_INLINE void simt_set_flags(armsim_simt_t *simt, const int64_t *result, int n) {
+  int j;
+
+  for (j = 0; j < n; j++) {
+    simt->flag_n[j] = ((uint64_t)result[j] >> 63) & 1;
+    simt->flag_z[j] = result[j] == 0;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : simt_execute_alu                                */
+/*                                                             */
+/* Purpose   : Run one ALU instruction across the whole group. */
+/*             Each case mirrors its scalar handler in sim.c,  */
+/*             quirks included, so lanes give the same result  */
+/*             in or out of lockstep.                          */
+/*                                                             */
+/***************************************************************/
+SIMT_INLINE void simt_alu(armsim_simt_t *simt, int op, const instruction *in) {
+  int n = simt->ngroup, j;
+  int64_t *d = simt->regs[in->rd];
+  const int64_t *a = simt->regs[in->rn];
+  /* LSL/LSR keep a 6-bit shift in rm and never read b */
+  const int64_t *b = simt->regs[in->rm & (ARM_REGS - 1)];
+  uint64_t imm = in->alu_immediate;
+
+  switch (op) {
+  case SIMT_ADDS_IMM:
+    for (j = 0; j < n; j++)
+      d[j] = (uint64_t)a[j] + imm;
+    simt_set_flags(simt, d, n);
+    break;
+  case SIMT_ADDS_REG:
+    for (j = 0; j < n; j++)
+      d[j] = (uint64_t)a[j] + (uint64_t)b[j];
+    simt_set_flags(simt, d, n);
+    break;
+  case SIMT_SUBS_IMM:
+  case SIMT_SUBS_REG:
+    /* SUBS to XZR (CMP) only sets the flags */
+    for (j = 0; j < n; j++) {
+      uint64_t r = (uint64_t)a[j] - (op == SIMT_SUBS_IMM ? imm : (uint64_t)b[j]);
+      simt->flag_n[j] = (r >> 63) & 1;
+      simt->flag_z[j] = r == 0;
+      if (in->rd != 31)
+        d[j] = r;
+    }
+    break;
+  case SIMT_ANDS:
+    for (j = 0; j < n; j++)
+      d[j] = a[j] & b[j];
+    simt_set_flags(simt, d, n);
+    break;
+  case SIMT_EOR:
+    for (j = 0; j < n; j++)
+      d[j] = a[j] ^ b[j];
+    break;
+  case SIMT_ORR:
+    /* the scalar handler takes its second operand from shamt */
+    b = simt->regs[in->shamt];
+    for (j = 0; j < n; j++)
+      d[j] = a[j] | b[j];
+    break;
+  case SIMT_MOVZ:
+    for (j = 0; j < n; j++)
+      d[j] = in->mov_immediate;
+    simt_set_flags(simt, d, n);
+    break;
+  case SIMT_LSL:
+    /* 64 - immr, taken modulo 64 like the host shift does */
+    for (j = 0; j < n; j++)
+      d[j] = (uint64_t)a[j] << ((64 - in->rm) & 63);
+    simt_set_flags(simt, d, n);
+    break;
+  case SIMT_LSR:
+    for (j = 0; j < n; j++)
+      d[j] = (uint64_t)a[j] >> (in->rm & 63);
+    break;
+  case SIMT_ADD_IMM:
+    for (j = 0; j < n; j++)
+      d[j] = (uint64_t)a[j] + imm;
+    break;
+  case SIMT_ADD_REG:
+    if (in->rd != 31)
+      for (j = 0; j < n; j++)
+        d[j] = (uint64_t)a[j] + (uint64_t)b[j];
+    break;
+  case SIMT_MUL:
+    for (j = 0; j < n; j++)
+      d[j] = (uint64_t)a[j] * (uint64_t)b[j];
+    break;
+  }
+}
+
+static void simt_execute_alu(armsim_simt_t *simt, int op, const instruction *in) {
+  simt_alu(simt, op, in);
+}
+
+#ifdef SIMT_AVX2
+__attribute__((target("avx2")))
+static void simt_execute_alu_avx2(armsim_simt_t *simt, int op, const instruction *in) {
+  simt_alu(simt, op, in);
+}
+#endif
+
+/* Sign-extended 19-bit branch offset, in bytes */
+static int64_t simt_offset19(uint32_t field) {
+  if (field & (1 << 18))
+    return (int64_t)(field | 0xFFFFFFFFFFFC0000) << 2;
+  return (int64_t)(field & 0x3FFFF) << 2;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : simt_execute_branch                             */
+/*                                                             */
+/* Purpose   : Work out every slot's next PC for a branch,     */
+/*             following the scalar handlers in sim.c          */
+/*                                                             */
+/***************************************************************/
+static void simt_execute_branch(armsim_simt_t *simt, int op, const instruction *in) {
+  int n = simt->ngroup, j, taken;
+  uint64_t fall = simt->pc + 4, target;
+  const int64_t *t = simt->regs[in->rt];
+
+  switch (op) {
+  case SIMT_B:
+    target = simt->pc + simt_offset19(in->br_address);
+    for (j = 0; j < n; j++)
+      simt->next_pc[j] = target;
+    break;
+  case SIMT_BCOND:
+    target = simt->pc + simt_offset19(in->cond_br_address);
+    for (j = 0; j < n; j++) {
+      int z = simt->flag_z[j], neg = simt->flag_n[j];
+
+      switch (in->rt) {
+      case 0x0: taken = z; break;             /* EQ */
+      case 0x1: taken = !z; break;            /* NE */
+      case 0xC: taken = !z && !neg; break;    /* GT */
+      case 0xB: taken = neg; break;           /* LT */
+      case 0xA: taken = !neg; break;          /* GE */
+      case 0xD: taken = z || neg; break;      /* LE */
+      default:  taken = 0; break;
+      }
+      simt->next_pc[j] = taken ? target : fall;
+    }
+    break;
+  case SIMT_CBZ:
+    target = simt->pc + simt_offset19(in->cond_br_address);
+    for (j = 0; j < n; j++)
+      simt->next_pc[j] = t[j] == 0 ? target : fall;
+    break;
+  case SIMT_CBNZ:
+    /* the scalar handler sign-extends from br_address, which CB leaves 0 */
+    target = simt->pc + ((int64_t)(in->cond_br_address & 0x3FFFF) << 2);
+    for (j = 0; j < n; j++)
+      simt->next_pc[j] = t[j] != 0 ? target : fall;
+    break;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : simt_step                                       */
+/*                                                             */
+/* Purpose   : Retire one instruction on every lane in the     */
+/*             group, then split off lanes that halted or      */
+/*             branched away from the first lane               */
+/*                                                             */
+/***************************************************************/
+static void simt_step(armsim_simt_t *simt) {
+  sim_ctx_t *lead = simt->lanes[simt->group[0]];
+  uint32_t bytecode = mem_read_32_nowatch(lead, simt->pc);
+  mem_map_t *text = simt->lanes[0]->MEM;
+  const decoded_t *d = NULL;
+  instruction in;
+  uint64_t i = (simt->pc - text->DECODED_START) / 4;
+  int op, j;
+
+  /* the text is the same in every lane, so the first lane's table
+     serves the group; a rewritten or unknown word takes the slow
+     decode */
+  if (text->DECODED != NULL && (simt->pc & 3) == 0 && simt->pc >= text->DECODED_START &&
+      i < simt->nops) {
+    d = &text->DECODED[i];
+    if (d->bytecode != bytecode || d->handler == NULL)
+      d = NULL;
+  }
+  if (d != NULL) {
+    in = d->instr;
+    op = simt->ops[i];
+  } else {
+    in = decode_instruction(lead, bytecode);
+    op = simt_classify(in.name);
+  }
+
+  if (op >= SIMT_B) {
+    simt_execute_branch(simt, op, &in);
+  } else if (op != SIMT_SCALAR) {
+    simt->alu(simt, op, &in);
+  } else {
+    for (j = 0; j < simt->ngroup; j++) {
+      sim_ctx_t *lane = simt->lanes[simt->group[j]];
+
+      simt_scatter(simt, j, simt->pc);
+      lane->NEXT_STATE.PC = simt->pc + 4;
+      /* only loads and stores can hit a watchpoint */
+      lane->WATCH_ARMED = TRUE;
+      if (d != NULL)
+        d->handler(lane, in);
+      else
+        execute_instruction(lane, in, bytecode);
+      lane->WATCH_ARMED = FALSE;
+      if (lane->WATCH_HIT)
+        simt->watch_hit = TRUE;
+      lane->CURRENT_STATE = lane->NEXT_STATE;
+      simt_gather(simt, j);
+      simt->next_pc[j] = lane->CURRENT_STATE.PC;
+    }
+  }
+
+  for (j = 0; j < simt->ngroup; j++) {
+    sim_ctx_t *lane = simt->lanes[simt->group[j]];
+
+    lane->INSTRUCTION_COUNT++;
+    if (lane->INSTRUCTION_COUNT >= lane->DEVICE_NEXT_EVENT)
+      device_tick_all(lane);
+  }
+  simt->stats.lockstep_instructions++;
+  if (op != SIMT_SCALAR && op < SIMT_B) {
+    simt->pc += 4;
+    return;
+  }
+
+  /* the group follows the first lane still running */
+  while (simt->ngroup > 0 && !simt->lanes[simt->group[0]]->RUN_BIT)
+    simt_split(simt, 0);
+  if (simt->ngroup == 0)
+    return;
+  simt->pc = simt->next_pc[0];
+  for (j = simt->ngroup - 1; j > 0; j--) {
+    sim_ctx_t *lane = simt->lanes[simt->group[j]];
+
+    if (!lane->RUN_BIT || simt->next_pc[j] != simt->pc) {
+      if (lane->RUN_BIT) {
+        simt->stats.diverged++;
+        simt_scatter(simt, j, simt->next_pc[j]);
+      }
+      simt_split(simt, j);
+    }
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_simt_run                                 */
+/*                                                             */
+/* Purpose   : Run every lane until it halts or retires budget */
+/*             instructions (0 = no limit): in lockstep while  */
+/*             the lanes agree, then the stragglers one by one */
+/*             Everything stops once a lane hits a watchpoint. */
+/*                                                             */
+/***************************************************************/
+int armsim_simt_run(armsim_simt_t *simt, uint64_t budget) {
+  uint64_t *start = calloc(simt->nlanes, sizeof(uint64_t));
+  uint64_t steps = 0, done;
+  int i, j, reason = ARMSIM_HALTED;
+
+  simt_classify_text(simt);
+  simt->watch_hit = FALSE;
+
+  /* the group starts as every running lane at the first one's PC */
+  simt->ngroup = 0;
+  for (i = 0; i < simt->nlanes; i++) {
+    sim_ctx_t *lane = simt->lanes[i];
+
+    start[i] = lane->INSTRUCTION_COUNT;
+    lane->WATCH_HIT = FALSE;
+    if (!lane->RUN_BIT)
+      continue;
+    if (simt->ngroup == 0)
+      simt->pc = lane->CURRENT_STATE.PC;
+    if (lane->CURRENT_STATE.PC == simt->pc) {
+      simt->group[simt->ngroup] = i;
+      simt_gather(simt, simt->ngroup++);
+    }
+  }
+
+  while (simt->ngroup > 0 && !simt->watch_hit && (budget == 0 || steps < budget)) {
+    simt_step(simt);
+    steps++;
+  }
+  for (j = 0; j < simt->ngroup; j++)
+    simt_scatter(simt, j, simt->pc);
+  simt->ngroup = 0;
+  if (simt->watch_hit)
+    reason = ARMSIM_WATCHPOINT;
+
+  for (i = 0; i < simt->nlanes; i++) {
+    sim_ctx_t *lane = simt->lanes[i];
+
+    done = lane->INSTRUCTION_COUNT - start[i];
+    if (reason != ARMSIM_WATCHPOINT && lane->RUN_BIT && (budget == 0 || done < budget)) {
+      if (armsim_run(lane, budget ? budget - done : 0) == ARMSIM_WATCHPOINT)
+        reason = ARMSIM_WATCHPOINT;
+    } else
+      device_flush_all(lane);
+    if (lane->RUN_BIT && reason != ARMSIM_WATCHPOINT)
+      reason = ARMSIM_BUDGET;
+  }
+  free(start);
+  return reason;
+}
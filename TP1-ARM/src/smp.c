@@ -0,0 +1,172 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   SMP: several cores over one shared memory map             */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "engine.h"
+#include "sim.h"
+#include "device.h"
+#include "armsim.h"
+
+struct armsim_smp_t {
+  int ncores;
+  sim_ctx_t **cores;          /* core 0 owns the memory map */
+  int stop;                   /* a core hit a watchpoint in a threaded run */
+};
+
+/* One core's share of a threaded run */
+typedef struct {
+  sim_ctx_t *core;
+  uint64_t budget;
+  int reason;
+} smp_thread_t;
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_smp_create                               */
+/*                                                             */
+/* Purpose   : Allocate ncores cores on one memory map         */
+/*                                                             */
+/***************************************************************/
+armsim_smp_t *armsim_smp_create(int ncores) {
+  armsim_smp_t *smp;
+  int i;
+
+  if (ncores < 1)
+    return NULL;
+  smp = calloc(1, sizeof(armsim_smp_t));
+  smp->ncores = ncores;
+  smp->cores = calloc(ncores, sizeof(sim_ctx_t *));
+  smp->cores[0] = sim_ctx_create();
+  smp->cores[0]->MEM->SHARED = ncores > 1;
+  for (i = 1; i < ncores; i++) {
+    smp->cores[i] = sim_ctx_create_shared(smp->cores[0]->MEM);
+    smp->cores[i]->CORE_ID = i;
+  }
+  return smp;
+}
+
+void armsim_smp_destroy(armsim_smp_t *smp) {
+  int i;
+
+  /* core 0 owns the map, so it goes last */
+  for (i = smp->ncores - 1; i >= 0; i--)
+    sim_ctx_destroy(smp->cores[i]);
+  free(smp->cores);
+  free(smp);
+}
+
+int armsim_smp_ncores(armsim_smp_t *smp) {
+  return smp->ncores;
+}
+
+armsim_t *armsim_smp_core(armsim_smp_t *smp, int n) {
+  if (n < 0 || n >= smp->ncores)
+    return NULL;
+  return smp->cores[n];
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_smp_load_file                            */
+/*                                                             */
+/* Purpose   : Load a program into the shared text segment and */
+/*             start every core on it, X0 = core number        */
+/*                                                             */
+/***************************************************************/
+int armsim_smp_load_file(armsim_smp_t *smp, const char *path, int *nwords) {
+  int i, err;
+
+  err = armsim_load_file(smp->cores[0], path, nwords);
+  if (err != ARMSIM_OK)
+    return err;
+  /* the cores share the table and run on their own threads */
+  predecode_fill(smp->cores[0]);
+  for (i = 0; i < smp->ncores; i++) {
+    armsim_set_pc(smp->cores[i], MEM_TEXT_START);
+    armsim_set_reg(smp->cores[i], 0, i);
+    smp->cores[i]->RUN_BIT = TRUE;
+  }
+  return ARMSIM_OK;
+}
+
+static void *smp_thread(void *arg) {
+  smp_thread_t *t = arg;
+
+  t->reason = armsim_run(t->core, t->budget);
+  return NULL;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_smp_run                                  */
+/*                                                             */
+/* Purpose   : Run the cores, interleaved or threaded          */
+/*                                                             */
+/***************************************************************/
+int armsim_smp_run(armsim_smp_t *smp, uint64_t budget, uint64_t quantum) {
+  int i, running, reason = ARMSIM_HALTED;
+
+  if (quantum == 0) {
+    smp_thread_t *t = calloc(smp->ncores, sizeof(smp_thread_t));
+    pthread_t *tid = calloc(smp->ncores, sizeof(pthread_t));
+
+    /* the first core to hit a watchpoint stops the others */
+    smp->stop = FALSE;
+    for (i = 0; i < smp->ncores; i++) {
+      smp->cores[i]->STOP = &smp->stop;
+      t[i].core = smp->cores[i];
+      t[i].budget = budget;
+      pthread_create(&tid[i], NULL, smp_thread, &t[i]);
+    }
+    for (i = 0; i < smp->ncores; i++) {
+      pthread_join(tid[i], NULL);
+      smp->cores[i]->STOP = NULL;
+      if (t[i].reason > reason)
+        reason = t[i].reason;
+    }
+    free(tid);
+    free(t);
+    return reason;
+  }
+
+  /* budget counts per core, like the threaded case */
+  uint64_t *left = calloc(smp->ncores, sizeof(uint64_t));
+  for (i = 0; i < smp->ncores; i++)
+    left[i] = budget;
+
+  do {
+    running = 0;
+    for (i = 0; i < smp->ncores; i++) {
+      uint64_t slice = quantum, before;
+
+      if (!smp->cores[i]->RUN_BIT || (budget && left[i] == 0))
+        continue;
+      if (budget && left[i] < slice)
+        slice = left[i];
+      before = smp->cores[i]->INSTRUCTION_COUNT;
+      if (armsim_run(smp->cores[i], slice) == ARMSIM_WATCHPOINT) {
+        reason = ARMSIM_WATCHPOINT;
+        running = 0;
+        break;
+      }
+      if (budget)
+        left[i] -= smp->cores[i]->INSTRUCTION_COUNT - before;
+      if (smp->cores[i]->RUN_BIT)
+        running++;
+    }
+  } while (running);
+
+  if (reason != ARMSIM_WATCHPOINT)
+    for (i = 0; i < smp->ncores; i++)
+      if (smp->cores[i]->RUN_BIT)
+        reason = ARMSIM_BUDGET;
+  free(left);
+  return reason;
+}
@@ -0,0 +1,278 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Symbol tables: the labels of an assembled program or the  */
+/*   symbols of an ELF file, looked up by name or by address   */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include "engine.h"
+#include "armsim.h"
+
+/***************************************************************/
+/* The loaders add symbols in any order and symtab_finish      */
+/* sorts them twice: by address for the nearest-symbol search  */
+/* and by name for lookups, both binary searches. After that a */
+/* table is never written again, so instances made from one    */
+/* image share it by reference.                                */
+/***************************************************************/
+
+typedef struct {
+  uint64_t address;
+  const char *name;       /* into the table's name pool */
+} symtab_entry_t;
+
+struct symtab_t {
+  atomic_int refs;
+  symtab_entry_t *entries;      /* by address, then name */
+  symtab_entry_t **by_name;     /* by name, then address */
+  uint32_t n, cap;
+  char *names;                  /* every name, '\0' terminated */
+  size_t names_len, names_cap;
+};
+
+symtab_t *symtab_create(void) {
+  symtab_t *tab = calloc(1, sizeof(symtab_t));
+
+  atomic_init(&tab->refs, 1);
+  return tab;
+}
+
+/* Add name (len bytes, not terminated) at address; before finish only */
+void symtab_add(symtab_t *tab, const char *name, size_t len, uint64_t address) {
+  if (tab->n == tab->cap) {
+    tab->cap = tab->cap ? 2 * tab->cap : 64;
+    tab->entries = realloc(tab->entries, tab->cap * sizeof(symtab_entry_t));
+  }
+  while (tab->names_len + len + 1 > tab->names_cap) {
+    tab->names_cap = tab->names_cap ? 2 * tab->names_cap : 1024;
+    tab->names = realloc(tab->names, tab->names_cap);
+  }
+  memcpy(tab->names + tab->names_len, name, len);
+  tab->names[tab->names_len + len] = '\0';
+  /* an offset until the pool stops moving */
+  tab->entries[tab->n].name = (const char *)(uintptr_t)tab->names_len;
+  tab->entries[tab->n].address = address;
+  tab->names_len += len + 1;
+  tab->n++;
+}
+
+static int symtab_by_address(const void *a, const void *b) {
+  const symtab_entry_t *x = a, *y = b;
+
+  if (x->address != y->address)
+    return x->address < y->address ? -1 : 1;
+  return strcmp(x->name, y->name);
+}
+
+static int symtab_by_name(const void *a, const void *b) {
+  const symtab_entry_t *x = *(symtab_entry_t * const *)a, *y = *(symtab_entry_t * const *)b;
+  int c = strcmp(x->name, y->name);
+
+  if (c != 0)
+    return c;
+  return x->address < y->address ? -1 : x->address > y->address;
+}
+
+/* Sort the table; it is read-only from here on */
+void symtab_finish(symtab_t *tab) {
+  uint32_t k;
+
+  for (k = 0; k < tab->n; k++)
+    tab->entries[k].name = tab->names + (uintptr_t)tab->entries[k].name;
+  if (tab->n > 0)
+    qsort(tab->entries, tab->n, sizeof(symtab_entry_t), symtab_by_address);
+  tab->by_name = malloc((tab->n ? tab->n : 1) * sizeof(symtab_entry_t *));
+  for (k = 0; k < tab->n; k++)
+    tab->by_name[k] = &tab->entries[k];
+  qsort(tab->by_name, tab->n, sizeof(symtab_entry_t *), symtab_by_name);
+}
+
+symtab_t *symtab_ref(symtab_t *tab) {
+  if (tab != NULL)
+    atomic_fetch_add(&tab->refs, 1);
+  return tab;
+}
+
+void symtab_release(symtab_t *tab) {
+  if (tab == NULL || atomic_fetch_sub(&tab->refs, 1) != 1)
+    return;
+  free(tab->entries);
+  free(tab->by_name);
+  free(tab->names);
+  free(tab);
+}
+
+/* Index of the last symbol at or below address, -1 if there is none */
+static int64_t symtab_below(const symtab_t *tab, uint64_t address) {
+  uint32_t lo = 0, hi = tab->n, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (tab->entries[mid].address <= address)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0)
+    return -1;
+  /* of several names at one address, the first */
+  for (lo--; lo > 0 && tab->entries[lo - 1].address == tab->entries[lo].address; lo--)
+    ;
+  return lo;
+}
+
+static const symtab_entry_t *symtab_lookup(const symtab_t *tab, const char *name, size_t len) {
+  uint32_t lo = 0, hi = tab->n, mid;
+  int c;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    c = strncmp(tab->by_name[mid]->name, name, len);
+    if (c == 0 && tab->by_name[mid]->name[len] != '\0')
+      c = 1;
+    if (c < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < tab->n && strncmp(tab->by_name[lo]->name, name, len) == 0 &&
+      tab->by_name[lo]->name[len] == '\0')
+    return tab->by_name[lo];
+  return NULL;
+}
+
+/* Memory region holding address, so a symbol never names an
+   address in another region; -1 outside RAM */
+static int symtab_region(armsim_t *sim, uint64_t address) {
+  int i;
+
+  for (i = 0; i < MEM_NREGIONS; i++)
+    if (address - sim->MEM->REGIONS[i].start < sim->MEM->REGIONS[i].size)
+      return i;
+  return -1;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_symbol_lookup                            */
+/*                                                             */
+/* Purpose   : Address of a symbol by name                     */
+/*                                                             */
+/***************************************************************/
+int armsim_symbol_lookup(armsim_t *sim, const char *name, uint64_t *address) {
+  const symtab_entry_t *e;
+
+  if (sim->SYMBOLS == NULL || (e = symtab_lookup(sim->SYMBOLS, name, strlen(name))) == NULL)
+    return ARMSIM_ERR_SYMBOL;
+  *address = e->address;
+  return ARMSIM_OK;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_symbol_at                                */
+/*                                                             */
+/* Purpose   : The symbol an address belongs to: the nearest   */
+/*             one at or below it in the same memory region.   */
+/*             NULL if there is none.                          */
+/*                                                             */
+/***************************************************************/
+const char *armsim_symbol_at(armsim_t *sim, uint64_t address, uint64_t *offset) {
+  const symtab_entry_t *e;
+  int64_t k;
+
+  if (sim->SYMBOLS == NULL || (k = symtab_below(sim->SYMBOLS, address)) < 0)
+    return NULL;
+  e = &sim->SYMBOLS->entries[k];
+  if (symtab_region(sim, e->address) != symtab_region(sim, address))
+    return NULL;
+  if (offset)
+    *offset = address - e->address;
+  return e->name;
+}
+
+int armsim_symbol_count(armsim_t *sim) {
+  return sim->SYMBOLS != NULL ? (int)sim->SYMBOLS->n : 0;
+}
+
+/* The i-th symbol in address order */
+const char *armsim_symbol_get(armsim_t *sim, int i, uint64_t *address) {
+  if (sim->SYMBOLS == NULL || i < 0 || (uint32_t)i >= sim->SYMBOLS->n)
+    return NULL;
+  if (address)
+    *address = sim->SYMBOLS->entries[i].address;
+  return sim->SYMBOLS->entries[i].name;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_symbolize                                */
+/*                                                             */
+/* Purpose   : "name" or "name+0x10" for an address, "" if no  */
+/*             symbol covers it. snprintf-style.               */
+/*                                                             */
+/***************************************************************/
+int armsim_symbolize(armsim_t *sim, uint64_t address, char *buf, size_t size) {
+  uint64_t offset;
+  const char *name = armsim_symbol_at(sim, address, &offset);
+
+  if (name == NULL)
+    return snprintf(buf, size, "%s", "");
+  if (offset == 0)
+    return snprintf(buf, size, "%s", name);
+  return snprintf(buf, size, "%s+0x%" PRIx64, name, offset);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_parse_address                            */
+/*                                                             */
+/* Purpose   : Read an address typed by the user: a number in  */
+/*             any C base, a symbol, or a symbol plus or minus */
+/*             a number ("loop+8")                             */
+/*                                                             */
+/***************************************************************/
+int armsim_parse_address(armsim_t *sim, const char *text, uint64_t *address) {
+  const symtab_entry_t *e;
+  const char *p = text, *start;
+  char *end;
+  uint64_t value, offset;
+  int negative;
+
+  while (isspace((unsigned char)*p))
+    p++;
+  if (isdigit((unsigned char)*p)) {
+    value = strtoull(p, &end, 0);
+  } else {
+    start = p;
+    while (isalnum((unsigned char)*p) || *p == '_' || *p == '.' || *p == '$')
+      p++;
+    if (p == start)
+      return ARMSIM_ERR_FORMAT;
+    if (sim->SYMBOLS == NULL || (e = symtab_lookup(sim->SYMBOLS, start, p - start)) == NULL)
+      return ARMSIM_ERR_SYMBOL;
+    value = e->address;
+    end = (char *)p;
+    if (*p == '+' || *p == '-') {
+      negative = *p == '-';
+      if (!isdigit((unsigned char)p[1]))
+        return ARMSIM_ERR_FORMAT;
+      offset = strtoull(p + 1, &end, 0);
+      value = negative ? value - offset : value + offset;
+    }
+  }
+  while (isspace((unsigned char)*end))
+    end++;
+  if (*end != '\0')
+    return ARMSIM_ERR_FORMAT;
+  *address = value;
+  return ARMSIM_OK;
+}
@@ -0,0 +1,687 @@
+/***************************************************************/
+/*                                                             */
+/*   ARM Instruction Level Simulator                           */
+/*                                                             */
+/*   Execution traces: every retired instruction, streamed to  */
+/*   a file by a background writer thread                      */
+/*                                                             */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "engine.h"
+#include "armsim.h"
+#ifdef ARMSIM_TRACE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef ARMSIM_TRACE_LZ4
+#include <lz4.h>
+#endif
+
+/***************************************************************/
+/* Each traced core owns a byte ring that only its simulating  */
+/* thread writes (head) and only the writer thread reads       */
+/* (tail), so neither side takes a lock. A record is published */
+/* by moving head past it once it is whole; when the ring is   */
+/* full the core waits for the writer rather than drop it.     */
+/*                                                             */
+/*   tag [pc] [word] [regs] [flags] [accesses]                 */
+/*                                                             */
+/* tag:      TRACE_* bits saying which fields follow           */
+/* pc:       varint zigzag(pc - (last pc + 4)), if TRACE_JUMP  */
+/* word:     4 bytes, if it differs from the last word traced  */
+/*           in its slot of a direct-mapped table by PC        */
+/* regs:     count, then per register changed: index byte,     */
+/*           varint zigzag(new - old)                          */
+/* flags:    N | Z << 1                                        */
+/* accesses: count, then per access: varint                    */
+/*           zigzag(address - last address) << 1 | is_store,   */
+/*           varint value                                      */
+/*                                                             */
+/* Everything is a delta against what a reader of the stream   */
+/* already knows, starting from a TRACE_SYNC record with the   */
+/* whole state, and another one whenever the instruction count */
+/* moves behind the tracer's back (reset, reverse steps,       */
+/* snapshot loads). Registers set from the host between        */
+/* instructions show up in the next record. The writer moves   */
+/* whatever each ring holds to the file as one chunk,          */
+/* optionally compressed:                                      */
+/*                                                             */
+/*   "ARMTRC1\n", then chunks of                               */
+/*   u16 core, u16 codec, u32 length, u32 stored length, data  */
+/***************************************************************/
+
+#define TRACE_JUMP  0x01
+#define TRACE_WORD  0x02
+#define TRACE_REGS  0x04
+#define TRACE_FLAGS 0x08
+#define TRACE_MEM   0x10
+#define TRACE_HALT  0x20
+#define TRACE_SYNC  0x40        /* pc, X0..X31, flags, count: all absolute */
+
+#define TRACE_MAGIC      "ARMTRC1\n"
+#define TRACE_RING       (1 << 20)
+#define TRACE_MAX_RECORD 512
+#define TRACE_MAX_ACCESS 15
+#define TRACE_WORDS      4096   /* slots of the encoding table */
+#define TRACE_MAX_CORES  64
+
+#define TRACE_CODEC_NONE 0
+#define TRACE_CODEC_ZSTD 1
+#define TRACE_CODEC_LZ4  2
+
+typedef struct {
+  uint16_t core, codec;
+  uint32_t length, stored;
+} trace_chunk_t;
+
+typedef struct {
+  uint64_t address;
+  uint32_t value;
+  int kind;                     /* TRACE_LOAD, TRACE_STORE or TRACE_STORE_LATER */
+} trace_access_t;
+
+struct trace_ring_t {
+  uint8_t *buf;
+  _Atomic uint64_t head;        /* written by the simulating thread */
+  _Atomic uint64_t tail;        /* written by the writer thread */
+  atomic_int detached;          /* the core is done; free once drained */
+  sim_ctx_t *ctx;
+  int core;
+
+  /* what a reader knows so far */
+  CPU_State shadow;
+  uint64_t count, last_address;
+  uint32_t words[TRACE_WORDS];
+
+  /* the instruction being retired */
+  int in_instruction, fetched, run_bit;
+  uint32_t bytecode;
+  trace_access_t access[TRACE_MAX_ACCESS];
+  int naccess;
+};
+
+typedef struct trace_ring_t trace_ring_t;
+
+struct armsim_trace_t {
+  FILE *file;
+  pthread_t thread;
+  pthread_mutex_t lock;         /* the ring list, for attach and detach */
+  trace_ring_t *rings[TRACE_MAX_CORES];
+  int nrings;
+  atomic_int stop;
+  int err;
+  uint8_t *chunk, *packed;
+};
+
+static uint64_t trace_zigzag(int64_t v) {
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t trace_unzigzag(uint64_t v) {
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int trace_put_varint(uint8_t *out, uint64_t v) {
+  int n = 0;
+
+  while (v >= 0x80) {
+    out[n++] = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  out[n++] = v;
+  return n;
+}
+
+/* FALSE at the end of the data */
+static int trace_get_varint(const uint8_t *in, size_t len, size_t *pos, uint64_t *v) {
+  int shift = 0;
+
+  *v = 0;
+  do {
+    if (*pos >= len || shift > 63)
+      return FALSE;
+    *v |= (uint64_t)(in[*pos] & 0x7F) << shift;
+    shift += 7;
+  } while (in[(*pos)++] & 0x80);
+  return TRUE;
+}
+
+static uint32_t trace_slot(uint64_t pc) {
+  return (pc >> 2) & (TRACE_WORDS - 1);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : trace_push                                      */
+/*                                                             */
+/* Purpose   : Publish one record in the core's ring, waiting  */
+/*             for the writer while it is full                 */
+/*                                                             */
+/***************************************************************/
+static void trace_push(trace_ring_t *ring, const uint8_t *rec, int len) {
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint64_t at = head & (TRACE_RING - 1), first = TRACE_RING - at;
+
+  while (head + len - atomic_load_explicit(&ring->tail, memory_order_acquire) > TRACE_RING)
+    sched_yield();
+  if (first >= (uint64_t)len) {
+    memcpy(ring->buf + at, rec, len);
+  } else {
+    memcpy(ring->buf + at, rec, first);
+    memcpy(ring->buf, rec + first, len - first);
+  }
+  atomic_store_explicit(&ring->head, head + len, memory_order_release);
+}
+
+/* A record with the whole state; deltas start over after it */
+static void trace_sync(sim_ctx_t *ctx, trace_ring_t *ring) {
+  uint8_t rec[TRACE_MAX_RECORD];
+  int len = 0, k;
+
+  ring->shadow = ctx->CURRENT_STATE;
+  ring->count = ctx->INSTRUCTION_COUNT;
+  ring->last_address = 0;
+  memset(ring->words, 0, sizeof(ring->words));
+  rec[len++] = TRACE_SYNC;
+  len += trace_put_varint(rec + len, ring->shadow.PC);
+  for (k = 0; k < ARM_REGS; k++)
+    len += trace_put_varint(rec + len, ring->shadow.REGS[k]);
+  rec[len++] = (ring->shadow.FLAG_N & 1) | (ring->shadow.FLAG_Z & 1) << 1;
+  len += trace_put_varint(rec + len, ctx->INSTRUCTION_COUNT);
+  /* the next instruction is at the PC itself, not 4 past it */
+  ring->shadow.PC -= 4;
+  trace_push(ring, rec, len);
+}
+
+void trace_begin(sim_ctx_t *ctx) {
+  trace_ring_t *ring = ctx->TRACE;
+
+  /* moved by a reset, reverse step or snapshot load */
+  if (ctx->INSTRUCTION_COUNT != ring->count)
+    trace_sync(ctx, ring);
+  ring->run_bit = ctx->RUN_BIT;
+  ring->naccess = 0;
+  ring->fetched = FALSE;
+  ring->in_instruction = TRUE;
+}
+
+/* Called by the memory paths for every word an instruction touches.
+   The first read of an instruction is its fetch. */
+void trace_note_access(sim_ctx_t *ctx, uint64_t address, uint32_t value, int kind) {
+  trace_ring_t *ring = ctx->TRACE;
+
+  if (!ring->in_instruction)
+    return;
+  if (!ring->fetched && kind == TRACE_LOAD) {
+    ring->fetched = TRUE;
+    ring->bytecode = value;
+    return;
+  }
+  if (ring->naccess == TRACE_MAX_ACCESS)
+    return;
+  ring->access[ring->naccess].address = address;
+  ring->access[ring->naccess].value = value;
+  ring->access[ring->naccess].kind = kind;
+  ring->naccess++;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : trace_end                                       */
+/*                                                             */
+/* Purpose   : Encode the instruction just retired against     */
+/*             the reader's state and publish it               */
+/*                                                             */
+/***************************************************************/
+void trace_end(sim_ctx_t *ctx) {
+  trace_ring_t *ring = ctx->TRACE;
+  CPU_State *before = &ctx->CURRENT_STATE, *after = &ctx->NEXT_STATE;
+  uint8_t rec[TRACE_MAX_RECORD];
+  uint8_t *p;
+  uint32_t slot = trace_slot(before->PC), value;
+  int len = 1, nregs = 0, count, k;
+  uint8_t tag = 0;
+
+  ring->in_instruction = FALSE;
+  ring->count++;
+  if (before->PC != ring->shadow.PC + 4) {
+    tag |= TRACE_JUMP;
+    len += trace_put_varint(rec + len, trace_zigzag(before->PC - (ring->shadow.PC + 4)));
+  }
+  ring->shadow.PC = before->PC;
+  if (ring->words[slot] != ring->bytecode) {
+    tag |= TRACE_WORD;
+    memcpy(rec + len, &ring->bytecode, 4);
+    len += 4;
+    ring->words[slot] = ring->bytecode;
+  }
+
+  count = len++;
+  for (k = 0; k < ARM_REGS; k++) {
+    if (after->REGS[k] == ring->shadow.REGS[k])
+      continue;
+    rec[len++] = k;
+    len += trace_put_varint(rec + len, trace_zigzag(after->REGS[k] - ring->shadow.REGS[k]));
+    ring->shadow.REGS[k] = after->REGS[k];
+    nregs++;
+  }
+  if (nregs > 0) {
+    tag |= TRACE_REGS;
+    rec[count] = nregs;
+  } else {
+    len--;
+  }
+
+  if (after->FLAG_N != ring->shadow.FLAG_N || after->FLAG_Z != ring->shadow.FLAG_Z) {
+    tag |= TRACE_FLAGS;
+    rec[len++] = (after->FLAG_N & 1) | (after->FLAG_Z & 1) << 1;
+    ring->shadow.FLAG_N = after->FLAG_N;
+    ring->shadow.FLAG_Z = after->FLAG_Z;
+  }
+
+  if (ring->naccess > 0) {
+    tag |= TRACE_MEM;
+    rec[len++] = ring->naccess;
+    for (k = 0; k < ring->naccess; k++) {
+      trace_access_t *a = &ring->access[k];
+
+      value = a->value;
+      /* atomics: other cores may be at the same word right now */
+      if (a->kind == TRACE_STORE_LATER && (a->address & 3) == 0 &&
+          (p = mem_host_ptr(ctx, a->address, 4, FALSE)) != NULL)
+        value = __atomic_load_n((uint32_t *)p, __ATOMIC_RELAXED);
+      len += trace_put_varint(rec + len, trace_zigzag(a->address - ring->last_address) << 1 |
+                              (a->kind != TRACE_LOAD));
+      len += trace_put_varint(rec + len, value);
+      ring->last_address = a->address;
+    }
+  }
+
+  if (ring->run_bit && !ctx->RUN_BIT)
+    tag |= TRACE_HALT;
+  rec[0] = tag;
+  trace_push(ring, rec, len);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : trace_flush_ring                                */
+/*                                                             */
+/* Purpose   : Writer side: move everything published in a     */
+/*             ring to the file as one chunk. Returns the      */
+/*             number of bytes moved.                          */
+/*                                                             */
+/***************************************************************/
+static uint64_t trace_flush_ring(armsim_trace_t *trace, trace_ring_t *ring) {
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  uint64_t n = head - tail, at = tail & (TRACE_RING - 1);
+  trace_chunk_t chunk;
+  const uint8_t *data = trace->chunk;
+
+  if (n == 0)
+    return 0;
+  if (at + n <= TRACE_RING) {
+    memcpy(trace->chunk, ring->buf + at, n);
+  } else {
+    memcpy(trace->chunk, ring->buf + at, TRACE_RING - at);
+    memcpy(trace->chunk + (TRACE_RING - at), ring->buf, n - (TRACE_RING - at));
+  }
+  atomic_store_explicit(&ring->tail, head, memory_order_release);
+
+  chunk.core = ring->core;
+  chunk.codec = TRACE_CODEC_NONE;
+  chunk.length = chunk.stored = n;
+#if defined(ARMSIM_TRACE_ZSTD)
+  {
+    size_t packed = ZSTD_compress(trace->packed, ZSTD_compressBound(TRACE_RING),
+                                  trace->chunk, n, 1);
+
+    if (!ZSTD_isError(packed) && packed < n) {
+      chunk.codec = TRACE_CODEC_ZSTD;
+      chunk.stored = packed;
+      data = trace->packed;
+    }
+  }
+#elif defined(ARMSIM_TRACE_LZ4)
+  {
+    int packed = LZ4_compress_default((const char *)trace->chunk, (char *)trace->packed,
+                                      n, LZ4_compressBound(TRACE_RING));
+
+    if (packed > 0 && (uint64_t)packed < n) {
+      chunk.codec = TRACE_CODEC_LZ4;
+      chunk.stored = packed;
+      data = trace->packed;
+    }
+  }
+#endif
+  if (fwrite(&chunk, sizeof(chunk), 1, trace->file) != 1 ||
+      fwrite(data, 1, chunk.stored, trace->file) != chunk.stored)
+    trace->err = ARMSIM_ERR_OPEN;
+  return n;
+}
+
+static void *trace_writer(void *arg) {
+  armsim_trace_t *trace = arg;
+  struct timespec nap = { 0, 200000 };
+  uint64_t moved;
+  int i, stop;
+
+  for (;;) {
+    stop = atomic_load(&trace->stop);
+    moved = 0;
+    pthread_mutex_lock(&trace->lock);
+    for (i = 0; i < trace->nrings; i++) {
+      trace_ring_t *ring = trace->rings[i];
+      int detached = atomic_load(&ring->detached);
+
+      moved += trace_flush_ring(trace, ring);
+      /* head no longer moves once detached, so this saw it all */
+      if (detached) {
+        free(ring->buf);
+        free(ring);
+        /* keep the order, so a core attached again comes after */
+        memmove(&trace->rings[i], &trace->rings[i + 1],
+                (trace->nrings - i - 1) * sizeof(trace_ring_t *));
+        trace->nrings--;
+        i--;
+      }
+    }
+    pthread_mutex_unlock(&trace->lock);
+    if (stop && moved == 0)
+      return NULL;
+    if (moved == 0)
+      nanosleep(&nap, NULL);
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_trace_open / armsim_trace_close          */
+/*                                                             */
+/* Purpose   : Start a trace file and its writer thread; stop  */
+/*             tracing every attached core, drain the rings    */
+/*             and close the file                              */
+/*                                                             */
+/***************************************************************/
+armsim_trace_t *armsim_trace_open(const char *path, int *err) {
+  armsim_trace_t *trace;
+  FILE *file = fopen(path, "wb");
+
+  if (file == NULL || fwrite(TRACE_MAGIC, 1, 8, file) != 8) {
+    if (file != NULL)
+      fclose(file);
+    if (err)
+      *err = ARMSIM_ERR_OPEN;
+    return NULL;
+  }
+  trace = calloc(1, sizeof(armsim_trace_t));
+  trace->file = file;
+  trace->chunk = malloc(TRACE_RING);
+#if defined(ARMSIM_TRACE_ZSTD)
+  trace->packed = malloc(ZSTD_compressBound(TRACE_RING));
+#elif defined(ARMSIM_TRACE_LZ4)
+  trace->packed = malloc(LZ4_compressBound(TRACE_RING));
+#endif
+  pthread_mutex_init(&trace->lock, NULL);
+  atomic_init(&trace->stop, FALSE);
+  trace->err = ARMSIM_OK;
+  pthread_create(&trace->thread, NULL, trace_writer, trace);
+  if (err)
+    *err = ARMSIM_OK;
+  return trace;
+}
+
+int armsim_trace_close(armsim_trace_t *trace) {
+  int i, err;
+
+  pthread_mutex_lock(&trace->lock);
+  for (i = 0; i < trace->nrings; i++)
+    if (!atomic_load(&trace->rings[i]->detached)) {
+      trace->rings[i]->ctx->TRACE = NULL;
+      atomic_store(&trace->rings[i]->detached, TRUE);
+    }
+  pthread_mutex_unlock(&trace->lock);
+  atomic_store(&trace->stop, TRUE);
+  pthread_join(trace->thread, NULL);
+
+  err = trace->err;
+  if (fclose(trace->file) != 0)
+    err = ARMSIM_ERR_OPEN;
+  pthread_mutex_destroy(&trace->lock);
+  free(trace->chunk);
+  free(trace->packed);
+  free(trace);
+  return err;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_trace_attach / armsim_trace_detach       */
+/*                                                             */
+/* Purpose   : Start or stop tracing one core into a trace     */
+/*                                                             */
+/***************************************************************/
+int armsim_trace_attach(armsim_trace_t *trace, armsim_t *sim) {
+  trace_ring_t *ring;
+
+  if (sim->TRACE != NULL)
+    armsim_trace_detach(sim);
+  pthread_mutex_lock(&trace->lock);
+  if (trace->nrings == TRACE_MAX_CORES) {
+    pthread_mutex_unlock(&trace->lock);
+    return ARMSIM_ERR_RANGE;
+  }
+  ring = calloc(1, sizeof(trace_ring_t));
+  ring->buf = malloc(TRACE_RING);
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->detached, FALSE);
+  ring->ctx = sim;
+  ring->core = sim->CORE_ID;
+  trace->rings[trace->nrings++] = ring;
+  pthread_mutex_unlock(&trace->lock);
+
+  sim->TRACE = ring;
+  trace_sync(sim, ring);
+  return ARMSIM_OK;
+}
+
+void armsim_trace_detach(armsim_t *sim) {
+  trace_ring_t *ring = sim->TRACE;
+
+  if (ring == NULL)
+    return;
+  sim->TRACE = NULL;
+  atomic_store(&ring->detached, TRUE);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : armsim_trace_decode                             */
+/*                                                             */
+/* Purpose   : Print a trace file as text, one line per        */
+/*             instruction                                     */
+/*                                                             */
+/***************************************************************/
+typedef struct {
+  int seen;
+  CPU_State state;
+  uint64_t count, last_address;
+  uint32_t words[TRACE_WORDS];
+} trace_reader_t;
+
+/* Blanks up to the operand column before the first field */
+static void trace_field(FILE *out, int *pad) {
+  if (*pad > 0)
+    fprintf(out, "%*s", *pad, "");
+  *pad = 0;
+}
+
+/* Print the records in data; FALSE if they are malformed */
+static int trace_decode_chunk(trace_reader_t *r, int core, const uint8_t *data, size_t len,
+                              FILE *out) {
+  char text[128], line[160];
+  size_t pos = 0;
+  uint64_t v, address;
+  uint32_t word;
+  int tag, n, k, reg, pad, store;
+
+  while (pos < len) {
+    tag = data[pos++];
+    if (tag & TRACE_SYNC) {
+      if (!trace_get_varint(data, len, &pos, &r->state.PC))
+        return FALSE;
+      for (k = 0; k < ARM_REGS; k++) {
+        if (!trace_get_varint(data, len, &pos, &v))
+          return FALSE;
+        r->state.REGS[k] = v;
+      }
+      if (pos >= len)
+        return FALSE;
+      r->state.FLAG_N = data[pos] & 1;
+      r->state.FLAG_Z = (data[pos++] >> 1) & 1;
+      if (!trace_get_varint(data, len, &pos, &r->count))
+        return FALSE;
+      /* the writer's tables start over too */
+      memset(r->words, 0, sizeof(r->words));
+      r->last_address = 0;
+      r->seen = TRUE;
+      fprintf(out, "c%d: at %" PRIu64 " instructions, PC 0x%" PRIx64 "\n",
+              core, r->count, r->state.PC);
+      r->state.PC -= 4;
+      continue;
+    }
+    if (!r->seen)
+      return FALSE;
+
+    r->state.PC += 4;
+    if (tag & TRACE_JUMP) {
+      if (!trace_get_varint(data, len, &pos, &v))
+        return FALSE;
+      r->state.PC += trace_unzigzag(v);
+    }
+    if (tag & TRACE_WORD) {
+      if (pos + 4 > len)
+        return FALSE;
+      memcpy(&r->words[trace_slot(r->state.PC)], data + pos, 4);
+      pos += 4;
+    }
+    word = r->words[trace_slot(r->state.PC)];
+    armsim_disasm_word(word, r->state.PC, text, sizeof(text));
+    /* tabs out to columns of 8, so the fields after line up */
+    for (k = n = 0; text[k] != '\0' && n < (int)sizeof(line) - 9; k++)
+      if (text[k] == '\t')
+        do
+          line[n++] = ' ';
+        while (n % 8 != 0);
+      else
+        line[n++] = text[k];
+    line[n] = '\0';
+    fprintf(out, "c%d %8" PRIu64 "  0x%08" PRIx64 ":  %08x  %s",
+            core, r->count, r->state.PC, word, line);
+    pad = 32 - n;
+
+    if (tag & TRACE_REGS) {
+      if (pos >= len)
+        return FALSE;
+      n = data[pos++];
+      for (k = 0; k < n; k++) {
+        if (pos >= len || (reg = data[pos++]) >= ARM_REGS || !trace_get_varint(data, len, &pos, &v))
+          return FALSE;
+        r->state.REGS[reg] += trace_unzigzag(v);
+        trace_field(out, &pad);
+        fprintf(out, " x%d=0x%" PRIx64, reg, r->state.REGS[reg]);
+      }
+    }
+    if (tag & TRACE_FLAGS) {
+      if (pos >= len)
+        return FALSE;
+      r->state.FLAG_N = data[pos] & 1;
+      r->state.FLAG_Z = (data[pos++] >> 1) & 1;
+      trace_field(out, &pad);
+      fprintf(out, " N=%d Z=%d", r->state.FLAG_N, r->state.FLAG_Z);
+    }
+    if (tag & TRACE_MEM) {
+      if (pos >= len)
+        return FALSE;
+      n = data[pos++];
+      for (k = 0; k < n; k++) {
+        if (!trace_get_varint(data, len, &pos, &v))
+          return FALSE;
+        store = v & 1;
+        address = r->last_address + trace_unzigzag(v >> 1);
+        r->last_address = address;
+        if (!trace_get_varint(data, len, &pos, &v))
+          return FALSE;
+        trace_field(out, &pad);
+        fprintf(out, " %s[0x%" PRIx64 "]=0x%" PRIx64, store ? "st" : "ld", address, v);
+      }
+    }
+    if (tag & TRACE_HALT) {
+      trace_field(out, &pad);
+      fprintf(out, " halted");
+    }
+    fprintf(out, "\n");
+    r->count++;
+  }
+  return TRUE;
+}
+
+int armsim_trace_decode(FILE *in, FILE *out) {
+  trace_reader_t *readers;
+  char magic[8];
+  trace_chunk_t chunk;
+  uint8_t *stored = NULL, *data = NULL;
+  int err = ARMSIM_OK;
+
+  if (fread(magic, 1, 8, in) != 8 || memcmp(magic, TRACE_MAGIC, 8) != 0)
+    return ARMSIM_ERR_FORMAT;
+  readers = calloc(TRACE_MAX_CORES, sizeof(trace_reader_t));
+  stored = malloc(TRACE_RING + 1024);
+  data = malloc(TRACE_RING);
+  while (fread(&chunk, sizeof(chunk), 1, in) == 1) {
+    if (chunk.core >= TRACE_MAX_CORES || chunk.length > TRACE_RING ||
+        chunk.stored > TRACE_RING + 1024 || fread(stored, 1, chunk.stored, in) != chunk.stored) {
+      err = ARMSIM_ERR_FORMAT;
+      break;
+    }
+    if (chunk.codec == TRACE_CODEC_NONE && chunk.stored == chunk.length) {
+      memcpy(data, stored, chunk.length);
+#ifdef ARMSIM_TRACE_ZSTD
+    } else if (chunk.codec == TRACE_CODEC_ZSTD) {
+      if (ZSTD_decompress(data, TRACE_RING, stored, chunk.stored) != chunk.length) {
+        err = ARMSIM_ERR_FORMAT;
+        break;
+      }
+#endif
+#ifdef ARMSIM_TRACE_LZ4
+    } else if (chunk.codec == TRACE_CODEC_LZ4) {
+      if (LZ4_decompress_safe((const char *)stored, (char *)data, chunk.stored, TRACE_RING) !=
+          (int)chunk.length) {
+        err = ARMSIM_ERR_FORMAT;
+        break;
+      }
+#endif
+    } else {
+      /* compressed by a build with a codec this one lacks */
+      err = ARMSIM_ERR_FORMAT;
+      break;
+    }
+    if (!trace_decode_chunk(&readers[chunk.core], chunk.core, data, chunk.length, out)) {
+      err = ARMSIM_ERR_FORMAT;
+      break;
+    }
+  }
+  free(readers);
+  free(stored);
+  free(data);
+  return err;
+}